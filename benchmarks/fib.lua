@@ -0,0 +1,10 @@
+-- Function calls: recursive fibonacci
+local function fib(n)
+	if n < 2 then
+		return n
+	end
+	return fib(n - 1) + fib(n - 2)
+end
+
+local result = fib(32)
+assert(result == 2178309)
@@ -0,0 +1,24 @@
+-- Short-lived tables churned next to a large and stable heap (configuration and lookup data)
+local lookup = {}
+for i = 1, 200000 do
+	lookup[i] = { id = i, name = "key" .. i, tags = { i % 7, i % 13 } }
+end
+
+local clock = os.clock
+local maxPause = 0
+local total = 0
+for batch = 1, 8000 do
+	local start = clock()
+	for i = 1, 500 do
+		local entry = lookup[(batch * 500 + i) % #lookup + 1]
+		local event = { source = entry, values = { i, batch, entry.id } }
+		total = total + #event.values + event.source.tags[1]
+	end
+	local elapsed = clock() - start
+	if elapsed > maxPause then
+		maxPause = elapsed
+	end
+end
+
+assert(total > 0)
+print(string.format("slowest batch: %.2f ms", maxPause * 1000))
@@ -0,0 +1,68 @@
+-- String keyed hash parts: building, hit and miss lookups in a large dictionary, small records read with computed keys, and traversals
+local clock = os.clock
+
+-- Dictionary building
+local start = clock()
+local words = {}
+for i = 1, 100000 do
+	words[i] = "word" .. (i * 7919) % 1000003
+end
+local dictionary = {}
+for i = 1, #words do
+	dictionary[words[i]] = i
+end
+local building = clock() - start
+
+-- Lookups: present keys, and missing keys (different strings, so the key comparisons cannot short-circuit)
+start = clock()
+local missing = {}
+for i = 1, 1000 do
+	missing[i] = "absent" .. i
+end
+local found = 0
+for _ = 1, 10 do
+	for i = 1, #words do
+		if dictionary[words[i]] then
+			found = found + 1
+		end
+		if dictionary[missing[i % 1000 + 1]] then
+			found = found - 1
+		end
+	end
+end
+local lookups = clock() - start
+
+-- Small records: fields accessed through computed keys (no inline caches)
+start = clock()
+local fields = { "id", "name", "kind", "owner", "created", "updated", "size", "flags" }
+local records = {}
+for i = 1, 20000 do
+	local record = {}
+	for j = 1, #fields do
+		record[fields[j]] = i + j
+	end
+	records[i] = record
+end
+local sum = 0
+for _ = 1, 10 do
+	for i = 1, #records do
+		local record = records[i]
+		for j = 1, #fields do
+			sum = sum + record[fields[j]]
+		end
+	end
+end
+local fieldAccesses = clock() - start
+
+-- Traversals
+start = clock()
+local count = 0
+for _ = 1, 20 do
+	for _, value in pairs(dictionary) do
+		count = count + value
+	end
+end
+local traversals = clock() - start
+
+assert(found == 10 * #words and sum > 0 and count > 0)
+print(string.format("building: %.0f ms, lookups: %.0f ms, fields: %.0f ms, traversals: %.0f ms", building * 1000, lookups * 1000, fieldAccesses * 1000, traversals * 1000))
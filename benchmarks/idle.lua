@@ -0,0 +1,31 @@
+-- Event loop style requests (one every 2 milliseconds) allocating short-lived tables next to a large and stable heap, the loop being idle in between
+local lookup = {}
+for i = 1, 200000 do
+	lookup[i] = { id = i, name = "key" .. i, tags = { i % 7, i % 13 } }
+end
+
+local clock = os.clock
+local requests = 1000
+local latencies = {}
+local total = 0
+local timer
+timer = lrbi.timer(2, function()
+	local handled = #latencies
+	local start = clock()
+	for i = 1, 400 do
+		local entry = lookup[(handled * 400 + i) % #lookup + 1]
+		local response = { source = entry, values = { i, handled, entry.id }, name = entry.name }
+		total = total + #response.values + #response.name
+	end
+	latencies[handled + 1] = clock() - start
+	if handled + 1 == requests then
+		lrbi.cancel(timer)
+		assert(total > 0)
+		local sum = 0
+		for _, latency in ipairs(latencies) do
+			sum = sum + latency
+		end
+		table.sort(latencies)
+		print(string.format("requests: %d, mean: %.3f ms, 99th percentile: %.3f ms, slowest: %.2f ms", requests, sum * 1000 / requests, latencies[math.ceil(requests * 0.99)] * 1000, latencies[requests] * 1000))
+	end
+end, 2)
@@ -0,0 +1,27 @@
+-- Float and integer arithmetic: mandelbrot set
+local size = 400
+local iterations = 50
+local count = 0
+
+for y = 0, size - 1 do
+	local ci = 2.0 * y / size - 1.0
+	for x = 0, size - 1 do
+		local cr = 2.0 * x / size - 1.5
+		local zr, zi = 0.0, 0.0
+		local inside = true
+		for _ = 1, iterations do
+			local zr2, zi2 = zr * zr, zi * zi
+			if zr2 + zi2 > 4.0 then
+				inside = false
+				break
+			end
+			zi = 2.0 * zr * zi + ci
+			zr = zr2 - zi2 + cr
+		end
+		if inside then
+			count = count + 1
+		end
+	end
+end
+
+assert(count > 0)
@@ -0,0 +1,30 @@
+-- Global accesses and method calls on objects (field lookups by string constant)
+Point = {}
+Point.__index = Point
+
+function Point.new(x, y)
+	return setmetatable({ x = x, y = y }, Point)
+end
+
+function Point:add(other)
+	return Point.new(self.x + other.x, self.y + other.y)
+end
+
+function Point:length2()
+	return self.x * self.x + self.y * self.y
+end
+
+scale = 3
+local sum = 0
+local p = Point.new(0, 0)
+local step = Point.new(1, 2)
+for i = 1, 2000000 do
+	p.x = p.x + step.x * scale
+	p.y = p.y - step.y
+	sum = sum + math.floor(p:length2() % 7)
+	if i % 1000 == 0 then
+		p = p:add(step)
+	end
+end
+
+assert(sum > 0)
@@ -0,0 +1,23 @@
+-- Text records parsing and aggregation (typical filter script)
+local lines = {}
+for i = 1, 100000 do
+	lines[i] = "user" .. (i % 1000) .. ";" .. (i % 97) .. ";" .. (i * 3)
+end
+
+local totals = {}
+for _ = 1, 3 do
+	for i = 1, #lines do
+		local line = lines[i]
+		local first = line:find(";", 1, true)
+		local second = line:find(";", first + 1, true)
+		local user = line:sub(1, first - 1)
+		local amount = tonumber(line:sub(second + 1))
+		totals[user] = (totals[user] or 0) + amount
+	end
+end
+
+local count = 0
+for _ in pairs(totals) do
+	count = count + 1
+end
+assert(count == 1000)
@@ -0,0 +1,29 @@
+#!/bin/bash
+# Runs the benchmark scripts with the specified LuaRunner executable, and prints the best time of several runs
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 <LuaRunner executable> [Runs count (default 5)] [LuaRunner options (eg. --jit)]"
+	exit 1
+fi
+
+luaRunner="$1"
+runs="${2:-5}"
+shift $(( $# < 2 ? $# : 2 ))
+options=("$@")
+
+# Get absolute folder for this script
+selfFolderPath="`cd "${BASH_SOURCE[0]%/*}"; pwd -P`/" # Command to get the absolute path
+
+for script in "${selfFolderPath}"*.lua; do
+	best=""
+	for ((run = 0; run < runs; ++run)); do
+		start=$(date +%s%N)
+		"${luaRunner}" "${options[@]}" "${script}" > /dev/null || { echo "ERROR: ${script} failed"; exit 1; }
+		end=$(date +%s%N)
+		elapsed=$(( (end - start) / 1000000 ))
+		if [ -z "${best}" ] || [ ${elapsed} -lt ${best} ]; then
+			best=${elapsed}
+		fi
+	done
+	printf "%-12s %6d ms\n" "$(basename "${script}" .lua)" ${best}
+done
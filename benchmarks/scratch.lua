@@ -0,0 +1,40 @@
+-- Scratch tables rebuilt by a hot loop: new empty tables, presized tables (lrbi.table_new) and a reused table (lrbi.table_clear)
+local clock = os.clock
+local iterations = 200000
+local itemsCount = 32
+
+local function fill(scratch, base)
+	for i = 1, itemsCount do
+		scratch[i] = base + i
+	end
+	scratch.first = scratch[1]
+	scratch.last = scratch[itemsCount]
+	scratch.count = itemsCount
+	return scratch.last - scratch.first + scratch.count
+end
+
+local start = clock()
+local total = 0
+for i = 1, iterations do
+	total = total + fill({}, i)
+end
+local empty = clock() - start
+
+start = clock()
+local presizedTotal = 0
+for i = 1, iterations do
+	presizedTotal = presizedTotal + fill(lrbi.table_new(itemsCount, 3), i)
+end
+local presized = clock() - start
+
+start = clock()
+local reusedTotal = 0
+local scratch = {}
+for i = 1, iterations do
+	lrbi.table_clear(scratch)
+	reusedTotal = reusedTotal + fill(scratch, i)
+end
+local reused = clock() - start
+
+assert(total == presizedTotal and total == reusedTotal)
+print(string.format("empty: %.0f ms, presized: %.0f ms, reused: %.0f ms", empty * 1000, presized * 1000, reused * 1000))
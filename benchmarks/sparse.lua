@@ -0,0 +1,38 @@
+-- Integer keyed tables with gaps (identifiers): memory footprint and access time
+local clock = os.clock
+
+collectgarbage()
+collectgarbage("stop")
+local before = collectgarbage("count")
+local start = clock()
+local tables = {}
+for t = 1, 20 do
+	local byId = {}
+	local id = 0
+	for i = 1, 5000 * t do -- various sizes, as parts are rounded to powers of 2
+		id = id + 1 + (i * 7919) % 4 -- gaps of 0 to 3 identifiers (40% dense)
+		byId[id] = i
+	end
+	tables[t] = byId
+end
+local building = clock() - start
+local memory = collectgarbage("count") - before
+collectgarbage("restart")
+
+start = clock()
+local sum = 0
+for _ = 1, 10 do
+	for t = 1, #tables do
+		local byId = tables[t]
+		for id = 1, 12500 * t do
+			local value = byId[id]
+			if value then
+				sum = sum + value
+			end
+		end
+	end
+end
+local accesses = clock() - start
+
+assert(sum > 0)
+print(string.format("memory: %.0f KB, building: %.0f ms, accesses: %.0f ms", memory, building * 1000, accesses * 1000))
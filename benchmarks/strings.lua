@@ -0,0 +1,32 @@
+-- String interning (new strings built from pieces) and table lookups with prefixed and long string keys
+local clock = os.clock
+
+-- Interning: every concatenation and sub creates (and hashes) a string
+local start = clock()
+local count = 0
+for i = 1, 1500000 do
+	local key = "session:" .. i
+	local field = key:sub(1, 12)
+	count = count + #key + #field
+end
+local interning = clock() - start
+
+-- Lookups: short keys sharing a long prefix, and long keys (hashed on their first use as keys)
+start = clock()
+local short = {}
+local long = {}
+local prefix = string.rep("/api/v1/customers/accounts/", 2)
+for i = 1, 50000 do
+	short["user:profile:" .. i] = i
+	long[prefix .. i .. "/details"] = i
+end
+local total = 0
+for round = 1, 20 do
+	for i = 1, 50000, 7 do
+		total = total + short["user:profile:" .. i] + long[prefix .. i .. "/details"]
+	end
+end
+local lookups = clock() - start
+
+assert(count > 0 and total > 0)
+print(string.format("interning: %.0f ms, lookups: %.0f ms", interning * 1000, lookups * 1000))
@@ -0,0 +1,20 @@
+-- Table construction, field accesses and global function calls
+local records = {}
+for i = 1, 200000 do
+	records[i] = { id = i, value = (i * 7919) % 1000, name = "item" }
+end
+
+local total = 0
+for _ = 1, 10 do
+	for i = 1, #records do
+		local record = records[i]
+		if record.value > 500 then
+			total = total + record.value
+		else
+			record.value = record.value + 1
+		end
+	end
+end
+
+table.sort(records, function(a, b) return a.value < b.value end)
+assert(total > 0 and records[1].value <= records[#records].value)
@@ -0,0 +1,37 @@
+-- Table traversals (pairs and next) over short string, long string, float and integer keys
+local clock = os.clock
+
+local function makeTable(makeKey)
+	local t = {}
+	for i = 1, 20000 do
+		t[makeKey(i)] = i
+	end
+	return t
+end
+
+local tables = {
+	{ "short", makeTable(function(i) return "key" .. i end) },
+	{ "long", makeTable(function(i) return string.rep("segment/", 8) .. i end) },
+	{ "float", makeTable(function(i) return i + 0.5 end) },
+	{ "sparse", makeTable(function(i) return i * 1000 end) },
+}
+
+local results = {}
+for _, entry in ipairs(tables) do
+	local name, t = entry[1], entry[2]
+	local start = clock()
+	local sum = 0
+	for _ = 1, 50 do
+		for _, value in pairs(t) do
+			sum = sum + value
+		end
+		local key, value = next(t)
+		while key ~= nil do
+			sum = sum + value
+			key, value = next(t, key)
+		end
+	end
+	assert(sum == 100 * 20000 * 20001 / 2)
+	results[#results + 1] = string.format("%s: %.0f ms", name, (clock() - start) * 1000)
+end
+print(table.concat(results, ", "))
@@ -0,0 +1,57 @@
+-- Memory footprint of values in tables (number arrays, records, a matrix) and the time to fill and read them
+local clock = os.clock
+
+collectgarbage()
+collectgarbage("stop")
+local before = collectgarbage("count")
+local start = clock()
+local arrays = {}
+for a = 1, 100 do
+	local values = {}
+	for i = 1, 10000 do
+		values[i] = (i % 2 == 0) and i * a or i * 0.5
+	end
+	arrays[a] = values
+end
+local records = {}
+for i = 1, 100000 do
+	records[i] = { id = i, x = i * 0.25, y = -i, visible = i % 3 == 0 }
+end
+local matrix = {}
+for row = 1, 500 do
+	local cells = {}
+	for column = 1, 500 do
+		cells[column] = row * column
+	end
+	matrix[row] = cells
+end
+local filling = clock() - start
+local memory = collectgarbage("count") - before
+collectgarbage("restart")
+
+start = clock()
+local sum = 0
+for _ = 1, 5 do
+	for a = 1, #arrays do
+		local values = arrays[a]
+		for i = 1, #values do
+			sum = sum + values[i]
+		end
+	end
+	for i = 1, #records do
+		local record = records[i]
+		if record.visible then
+			sum = sum + record.x + record.y
+		end
+	end
+	for row = 1, #matrix do
+		local cells = matrix[row]
+		for column = 1, #cells do
+			sum = sum + cells[column]
+		end
+	end
+end
+local reading = clock() - start
+
+assert(sum > 0)
+print(string.format("memory: %.0f KB, filling: %.0f ms, reading: %.0f ms", memory, filling * 1000, reading * 1000))
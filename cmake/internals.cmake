@@ -210,6 +210,44 @@ function(lr_copy_runtime TARGET_NAME MODULE_NAME)
 	)
 endfunction(lr_copy_runtime)
 
+###############################################################################
+# Define a plugin target running SCRIPT_FILE (relative to the current source
+# folder, as it appears in error messages) as natively compiled code, once
+# loaded the script is available through require(MODULE_NAME).
+# The C source of the plugin is generated by luaRunner-aot (see tools/aot).
+function(lr_add_aot_plugin TARGET_NAME SCRIPT_FILE MODULE_NAME)
+	get_filename_component(scriptPath "${SCRIPT_FILE}" ABSOLUTE)
+	set(generatedFile "${CMAKE_CURRENT_BINARY_DIR}/${TARGET_NAME}_aot.c")
+	add_custom_command(
+		OUTPUT "${generatedFile}"
+		COMMAND luaRunner-aot -n "${MODULE_NAME}" "${SCRIPT_FILE}" "${generatedFile}"
+		DEPENDS luaRunner-aot "${scriptPath}"
+		WORKING_DIRECTORY "${CMAKE_CURRENT_SOURCE_DIR}"
+		COMMENT "Compiling ${SCRIPT_FILE} to C"
+		VERBATIM
+	)
+	source_group("Source Files" FILES "${scriptPath}")
+	source_group("Generated Files" FILES "${generatedFile}")
+
+	add_library(${TARGET_NAME} SHARED "${generatedFile}" "${scriptPath}")
+	target_link_libraries(${TARGET_NAME} liblua_internals)
+	# Compiled functions stay attached to the prototypes after the plugin is unloaded (until lua_close)
+	if(CMAKE_SYSTEM_NAME STREQUAL "Linux")
+		set_target_properties(${TARGET_NAME} PROPERTIES LINK_FLAGS "-Wl,-z,nodelete")
+	endif()
+	# Use cmake folders
+	set_target_properties(${TARGET_NAME} PROPERTIES FOLDER "Plugins")
+
+	# Copy shared library to output folder as post-build (for easy test/debug)
+	add_custom_command(
+		TARGET ${TARGET_NAME}
+		POST_BUILD
+		COMMAND ${CMAKE_COMMAND} -E copy_if_different $<TARGET_FILE:${TARGET_NAME}> "${LuaRunner_BINARY_DIR}"
+		COMMENT "Copying ${TARGET_NAME} plugin to LuaRunner output folder for easy debug"
+		VERBATIM
+	)
+endfunction(lr_add_aot_plugin)
+
 ###############################################################################
 # Global variables (must stay at the end of the file)
 set(LUARUNNER_ROOT_FOLDER "${PROJECT_SOURCE_DIR}") # Folder containing the main CMakeLists.txt for the repository including this file
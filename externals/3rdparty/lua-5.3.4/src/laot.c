@@ -0,0 +1,76 @@
+/*
+** Ahead-of-time compiled functions
+** See Copyright Notice in lua.h
+**
+** Compiled code lives in shared objects built from the C source
+** generated by luaRunner-aot. Such a module embeds the bytecode of its
+** chunk along with one C function per prototype: the chunk is loaded
+** normally (so constants, debug information and error messages are the
+** ones of the script), then the functions are attached to the loaded
+** prototypes. The interpreter runs them when entering a frame (see
+** 'luaA_enter'), they hand control back for the few instructions they
+** do not handle.
+*/
+
+#define laot_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "laot.h"
+
+
+#if defined(LUA_USE_AOT)
+
+static int checkprotos (Proto *p, const int *sizes, int n, int *i) {
+  int j;
+  if (*i >= n || p->sizecode != sizes[*i])
+    return 0;
+  (*i)++;
+  for (j = 0; j < p->sizep; j++) {
+    if (!checkprotos(p->p[j], sizes, n, i))
+      return 0;
+  }
+  return 1;
+}
+
+
+static void attachprotos (Proto *p, const luaA_Function *f, int *i) {
+  int j;
+  p->aot = f[(*i)++];
+  p->jitcount = -1;  /* never JIT compiled */
+  for (j = 0; j < p->sizep; j++)
+    attachprotos(p->p[j], f, i);
+}
+
+
+LUA_API int luaA_attach (lua_State *L, int idx, const luaA_Function *f,
+                         const int *sizes, int n) {
+  Proto *p;
+  int i = 0;
+  if (lua_type(L, idx) != LUA_TFUNCTION || lua_iscfunction(L, idx))
+    return 0;
+  lua_lock(L);
+  p = cast(LClosure *, lua_topointer(L, idx))->p;
+  if (!checkprotos(p, sizes, n, &i) || i != n) {
+    lua_unlock(L);
+    return 0;
+  }
+  i = 0;
+  attachprotos(p, f, &i);
+  lua_unlock(L);
+  return 1;
+}
+
+#else
+
+LUA_API int luaA_attach (lua_State *L, int idx, const luaA_Function *f,
+                         const int *sizes, int n) {
+  UNUSED(L); UNUSED(idx); UNUSED(f); UNUSED(sizes); UNUSED(n);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+** Ahead-of-time compiled functions
+** See Copyright Notice in lua.h
+*/
+
+#ifndef laot_h
+#define laot_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** native code of a prototype, generated as C source by luaRunner-aot
+** (see laotgen.h): runs the function of 'ci' from its current
+** instruction, with exactly the effects the interpreter would have.
+** Returns 1 when it called a lua function (whose frame is now 'L->ci'),
+** 0 when the interpreter must go on from 'savedpc' (tail calls, returns,
+** or hooks turned on while it was running)
+*/
+typedef int (*luaA_Function) (lua_State *L, CallInfo *ci);
+
+
+#if defined(LUA_USE_AOT)
+
+/* run the compiled code of the function of 'ci', if any */
+#define luaA_enter(L,ci,p) \
+  ((p)->aot != NULL && !(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+   (p)->aot(L, ci))
+
+#else
+
+#define luaA_enter(L,ci,p)	0
+
+#endif
+
+
+/*
+** attaches the 'n' functions of 'f' to the prototypes of the lua
+** function at index 'idx' (in depth-first order, the function itself
+** first); 'sizes' are the expected code sizes of the prototypes.
+** Returns 0, attaching nothing, if the prototypes do not match or if
+** compiled code is not supported by this build.
+*/
+LUA_API int luaA_attach (lua_State *L, int idx, const luaA_Function *f,
+                         const int *sizes, int n);
+
+#endif
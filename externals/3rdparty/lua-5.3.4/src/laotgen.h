@@ -0,0 +1,303 @@
+/*
+** Building blocks of the C code generated by luaRunner-aot
+** See Copyright Notice in lua.h
+**
+** A compiled function has one label per instruction ('aot_L<pc>') and
+** the code of each instruction is the code of its handler in
+** 'luaV_execute', with its operands resolved at compile time. Like the
+** interpreter, it keeps 'savedpc' pointing after the running
+** instruction whenever something may raise an error, call a function or
+** a metamethod, or run the collector, so errors, hooks, yields and
+** 'luaV_finishOp' see the same state. Lines and count hooks are not
+** run by compiled code: when they are on, it returns to the interpreter
+** before the next instruction.
+*/
+
+#ifndef laotgen_h
+#define laotgen_h
+
+#include <math.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "laot.h"
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+#if defined(__GNUC__)
+#define aot_inline	__inline__
+#else
+#define aot_inline	/* empty */
+#endif
+
+
+/* locals of a compiled function */
+#define aot_prologue \
+  LClosure *cl = clLvalue(ci->func); \
+  TValue *k = cl->p->k; \
+  const Instruction *code = cl->p->code; \
+  StkId base = ci->u.l.base; \
+  UNUSED(k); UNUSED(base)
+
+/* case of the switch resuming a compiled function at instruction 'pc' */
+#define aot_entry(pc)	case pc: goto aot_L##pc;
+
+/* return to the interpreter, which goes on with instruction 'pc' */
+#define aot_exit(pc)	{ ci->u.l.savedpc = code + (pc); return 0; }
+
+/* start of an instruction, when it is not run in place of a fetch */
+#define aot_fetch(pc) \
+  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) aot_exit(pc)
+
+#define aot_savepc(pc)	(ci->u.l.savedpc = code + (pc) + 1)
+
+#define aot_Protect(x)	{ {x;}; base = ci->u.l.base; }
+
+#define aot_checkGC(c)  \
+	{ luaC_condGC(L, L->top = (c), aot_Protect(L->top = ci->top)); \
+          luai_threadyield(L); }
+
+/* close the upvalues of a jump instruction */
+#define aot_close(a)	luaF_close(L, ci->u.l.base + (a) - 1)
+
+/* initializers of the number constants written as C literals */
+#if defined(LUA_USE_NANBOXING)
+#define aot_intk(x)	{{.u = nbword(NB_INT) | (l_castS2U(x) & NB_PAYLOAD)}}
+#define aot_fltk(x)	{{.n = (x)}}
+#else
+#define aot_intk(x)	{{.i = (x)}, LUA_TNUMINT}
+#define aot_fltk(x)	{{.n = (x)}, LUA_TNUMFLT}
+#endif
+
+
+/*
+** raw accesses, by key kind: any key, short string constant, integer
+** constant
+*/
+static aot_inline const TValue *aot_get (Table *h, const TValue *key) {
+  return ttisinteger(key) ? luaH_getint(h, ivalue(key)) : luaH_get(h, key);
+}
+
+#define aot_getstr(h,key)	luaH_getshortstr(h, tsvalue(key))
+#define aot_getint(h,key)	luaH_getint(h, ivalue(key))
+
+
+#define aot_gettable(pc,t,key,ra,get) { const TValue *slot_; \
+  if (luaV_fastget(L,t,key,slot_,get)) { setobj2s(L, ra, slot_); } \
+  else { aot_savepc(pc); aot_Protect(luaV_finishget(L,t,key,ra,slot_)); } }
+
+#define aot_settable(pc,t,key,v,get) { const TValue *slot_; \
+  if (!luaV_fastset(L,t,key,slot_,get,v)) { \
+    aot_savepc(pc); aot_Protect(luaV_finishset(L,t,key,v,slot_)); } }
+
+
+/* arithmetic with integer and float versions */
+#define aot_arith(pc,ra,rb,rc,iop,fop,tm) { \
+  const TValue *rb_ = (rb); const TValue *rc_ = (rc); \
+  lua_Number nb_; lua_Number nc_; \
+  if (ttisinteger(rb_) && ttisinteger(rc_)) { \
+    setivalue(L, ra, intop(iop, ivalue(rb_), ivalue(rc_))); \
+  } \
+  else if (tonumber(rb_, &nb_) && tonumber(rc_, &nc_)) { \
+    setfltvalue(ra, fop(L, nb_, nc_)); \
+  } \
+  else { aot_savepc(pc); aot_Protect(luaT_trybinTM(L, rb_, rc_, ra, tm)); } }
+
+/* arithmetic with a float version only */
+#define aot_farith(pc,ra,rb,rc,fop,tm) { \
+  const TValue *rb_ = (rb); const TValue *rc_ = (rc); \
+  lua_Number nb_; lua_Number nc_; \
+  if (tonumber(rb_, &nb_) && tonumber(rc_, &nc_)) { \
+    setfltvalue(ra, fop(L, nb_, nc_)); \
+  } \
+  else { aot_savepc(pc); aot_Protect(luaT_trybinTM(L, rb_, rc_, ra, tm)); } }
+
+/* bitwise operations ('op' is an expression of 'ib_' and 'ic_') */
+#define aot_bitwise(pc,ra,rb,rc,op,tm) { \
+  const TValue *rb_ = (rb); const TValue *rc_ = (rc); \
+  lua_Integer ib_; lua_Integer ic_; \
+  if (tointeger(rb_, &ib_) && tointeger(rc_, &ic_)) { \
+    setivalue(L, ra, op); \
+  } \
+  else { aot_savepc(pc); aot_Protect(luaT_trybinTM(L, rb_, rc_, ra, tm)); } }
+
+#define aot_mod(L,a,b)	luaV_mod(L, a, b)
+#define aot_div(L,a,b)	luaV_div(L, a, b)
+
+/* integer division and modulo, whose integer versions may raise errors */
+#define aot_arithdiv(pc,ra,rb,rc,iop,fop,tm) { \
+  const TValue *rb_ = (rb); const TValue *rc_ = (rc); \
+  lua_Number nb_; lua_Number nc_; \
+  if (ttisinteger(rb_) && ttisinteger(rc_)) { \
+    aot_savepc(pc); \
+    setivalue(L, ra, iop(L, ivalue(rb_), ivalue(rc_))); \
+  } \
+  else if (tonumber(rb_, &nb_) && tonumber(rc_, &nc_)) { \
+    setfltvalue(ra, fop(L, nb_, nc_)); \
+  } \
+  else { aot_savepc(pc); aot_Protect(luaT_trybinTM(L, rb_, rc_, ra, tm)); } }
+
+static aot_inline lua_Number aot_nummod (lua_State *L, lua_Number a,
+                                       lua_Number b) {
+  lua_Number m;
+  UNUSED(L);  /* 'luai_nummod' may not use it */
+  luai_nummod(L, a, b, m);
+  return m;
+}
+
+
+#define aot_unm(pc,ra,rb) { \
+  const TValue *rb_ = (rb); \
+  lua_Number nb_; \
+  if (ttisinteger(rb_)) { \
+    setivalue(L, ra, intop(-, 0, ivalue(rb_))); \
+  } \
+  else if (tonumber(rb_, &nb_)) { \
+    setfltvalue(ra, luai_numunm(L, nb_)); \
+  } \
+  else { aot_savepc(pc); aot_Protect(luaT_trybinTM(L, rb_, rb_, ra, TM_UNM)); } }
+
+#define aot_bnot(pc,ra,rb) { \
+  const TValue *rb_ = (rb); \
+  lua_Integer ib_; \
+  if (tointeger(rb_, &ib_)) { \
+    setivalue(L, ra, intop(^, ~l_castS2U(0), ib_)); \
+  } \
+  else { aot_savepc(pc); aot_Protect(luaT_trybinTM(L, rb_, rb_, ra, TM_BNOT)); } }
+
+
+/*
+** comparisons: when the result is 'a', run the jump instruction that
+** follows (argument 'ja', target label 'jlbl'), else go to 'skiplbl'
+*/
+#define aot_cmp(res,a,ja,jlbl,skiplbl) { \
+  if ((res) != (a)) goto skiplbl; \
+  if ((ja) != 0) aot_close(ja); \
+  goto jlbl; }
+
+#define aot_eq(pc,rb,rc,res) { \
+  const TValue *rb_ = (rb); const TValue *rc_ = (rc); \
+  if (ttisinteger(rb_) && ttisinteger(rc_)) \
+    res = (ivalue(rb_) == ivalue(rc_)); \
+  else { aot_savepc(pc); aot_Protect(res = luaV_equalobj(L, rb_, rc_)); } }
+
+#define aot_lt(pc,rb,rc,res) { \
+  const TValue *rb_ = (rb); const TValue *rc_ = (rc); \
+  if (ttisinteger(rb_) && ttisinteger(rc_)) \
+    res = (ivalue(rb_) < ivalue(rc_)); \
+  else { aot_savepc(pc); aot_Protect(res = luaV_lessthan(L, rb_, rc_)); } }
+
+#define aot_le(pc,rb,rc,res) { \
+  const TValue *rb_ = (rb); const TValue *rc_ = (rc); \
+  if (ttisinteger(rb_) && ttisinteger(rc_)) \
+    res = (ivalue(rb_) <= ivalue(rc_)); \
+  else { aot_savepc(pc); aot_Protect(res = luaV_lessequal(L, rb_, rc_)); } }
+
+
+/* numeric 'for' loop step, jumping to 'lbl' while the loop goes on */
+#define aot_forloop(ra,lbl) { \
+  if (ttisinteger(ra)) { \
+    lua_Integer step_ = ivalue(ra + 2); \
+    lua_Integer idx_ = intop(+, ivalue(ra), step_); \
+    lua_Integer limit_ = ivalue(ra + 1); \
+    if ((0 < step_) ? (idx_ <= limit_) : (limit_ <= idx_)) { \
+      chgivalue(L, ra, idx_); \
+      setivalue(L, ra + 3, idx_); \
+      goto lbl; \
+    } \
+  } \
+  else { \
+    lua_Number step_ = fltvalue(ra + 2); \
+    lua_Number idx_ = luai_numadd(L, fltvalue(ra), step_); \
+    lua_Number limit_ = fltvalue(ra + 1); \
+    if (luai_numlt(0, step_) ? luai_numle(idx_, limit_) \
+                             : luai_numle(limit_, idx_)) { \
+      chgfltvalue(ra, idx_); \
+      setfltvalue(ra + 3, idx_); \
+      goto lbl; \
+    } \
+  } }
+
+
+/* call of 'ra' with 'b' and 'c' as in OP_CALL */
+#define aot_call(pc,ra,b,c) { \
+  int nresults_ = (c) - 1; \
+  if ((b) != 0) L->top = (ra) + (b); \
+  aot_savepc(pc); \
+  if (luaD_precall(L, ra, nresults_)) { \
+    if (nresults_ >= 0) L->top = ci->top; \
+    base = ci->u.l.base; \
+  } \
+  else return 1; }
+
+
+#define aot_concat(pc,a,b,c) { \
+  StkId ra_; StkId rb_; \
+  L->top = base + (c) + 1; \
+  aot_savepc(pc); \
+  aot_Protect(luaV_concat(L, (c) - (b) + 1)); \
+  ra_ = base + (a); \
+  rb_ = base + (b); \
+  setobjs2s(L, ra_, rb_); \
+  aot_checkGC((ra_ >= rb_ ? ra_ + 1 : rb_)); \
+  L->top = ci->top; }
+
+
+#define aot_setlist(pc,ra,b,c) { \
+  int n_ = (b); \
+  unsigned int last_; \
+  Table *h_; \
+  if (n_ == 0) n_ = cast_int(L->top - (ra)) - 1; \
+  h_ = hvalue(ra); \
+  last_ = (((c) - 1) * LFIELDS_PER_FLUSH) + n_; \
+  aot_savepc(pc); \
+  if (last_ > h_->sizearray) \
+    luaH_resizearray(L, h_, last_); \
+  for (; n_ > 0; n_--) { \
+    TValue *val_ = (ra) + n_; \
+    luaH_setint(L, h_, last_--, val_); \
+    luaC_barrierback(L, h_, val_); \
+  } \
+  L->top = ci->top; }
+
+
+#define aot_vararg(pc,a,b) { \
+  int b_ = (b) - 1; \
+  int j_; \
+  StkId ra_ = base + (a); \
+  int n_ = cast_int(base - ci->func) - cl->p->numparams - 1; \
+  if (n_ < 0) n_ = 0; \
+  if (b_ < 0) { \
+    b_ = n_; \
+    aot_savepc(pc); \
+    aot_Protect(luaD_checkstack(L, n_)); \
+    ra_ = base + (a); \
+    L->top = ra_ + n_; \
+  } \
+  for (j_ = 0; j_ < b_ && j_ < n_; j_++) \
+    setobjs2s(L, ra_ + j_, base - n_ + j_); \
+  for (; j_ < b_; j_++) \
+    setnilvalue(ra_ + j_); }
+
+
+#define aot_tforcall(pc,a,c) { \
+  StkId cb_ = base + (a) + 3; \
+  setobjs2s(L, cb_ + 2, base + (a) + 2); \
+  setobjs2s(L, cb_ + 1, base + (a) + 1); \
+  setobjs2s(L, cb_, base + (a)); \
+  L->top = cb_ + 3; \
+  aot_savepc(pc); \
+  aot_Protect(luaD_call(L, cb_, (c))); \
+  L->top = ci->top; }
+
+#endif
@@ -335,7 +335,7 @@ LUA_API int lua_compare (lua_State *L, int index1, int index2, int op) {
 
 
 LUA_API size_t lua_stringtonumber (lua_State *L, const char *s) {
-  size_t sz = luaO_str2num(s, L->top);
+  size_t sz = luaO_str2num(L, s, L->top);
   if (sz != 0)
     api_incr_top(L);
   return sz;
@@ -465,7 +465,7 @@ LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
 
 LUA_API void lua_pushinteger (lua_State *L, lua_Integer n) {
   lua_lock(L);
-  setivalue(L->top, n);
+  setivalue(L, L->top, n);
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -634,7 +634,7 @@ LUA_API int lua_geti (lua_State *L, int idx, lua_Integer n) {
     api_incr_top(L);
   }
   else {
-    setivalue(L->top, n);
+    setivalue(L, L->top, n);
     api_incr_top(L);
     luaV_finishget(L, t, L->top - 1, L->top - 1, slot);
   }
@@ -788,7 +788,7 @@ LUA_API void lua_seti (lua_State *L, int idx, lua_Integer n) {
   if (luaV_fastset(L, t, n, slot, luaH_getint, L->top - 1))
     L->top--;  /* pop value */
   else {
-    setivalue(L->top, n);
+    setivalue(L, L->top, n);
     api_incr_top(L);
     luaV_finishset(L, t, L->top - 1, L->top - 2, slot);
     L->top -= 2;  /* pop value and key */
@@ -895,6 +895,20 @@ LUA_API void lua_setuservalue (lua_State *L, int idx) {
 }
 
 
+/*
+** removes all the entries of the table at 'idx', keeping its allocated
+** parts (and its metatable)
+*/
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId o;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  luaH_clear(hvalue(o));
+  lua_unlock(L);
+}
+
+
 /*
 ** 'load' and 'call' functions (run Lua code)
 */
@@ -1078,7 +1092,8 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning;  /* restore previous state */
-      if (debt > 0 && g->gcstate == GCSpause)  /* end of cycle? */
+      /* end of cycle? (minor collections are whole cycles) */
+      if (debt > 0 && (g->gcstate == GCSpause || (g->gcgen && !g->gcmajor)))
         res = 1;  /* signal it */
       break;
     }
@@ -1097,6 +1112,41 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: case LUA_GCINC: {
+      res = isgenmode(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      luaC_changemode(L, what == LUA_GCGEN);
+      break;
+    }
+    case LUA_GCSETMINORMUL: {
+      res = g->gcminormul;
+      if (data < 1) data = 1;  /* avoid a collection at each allocation */
+      g->gcminormul = data;
+      break;
+    }
+    case LUA_GCSETMAJORMUL: {
+      res = g->gcmajormul;
+      if (data < 1) data = 1;
+      g->gcmajormul = data;
+      break;
+    }
+    case LUA_GCSETSTEPTIME: {  /* maximum step duration (us), 0 for none */
+      res = g->gcsteptime;
+      if (data < 0) data = 0;
+      g->gcsteptime = data;
+      g->gcstepwork = GCSTEPSIZE * 10;  /* first guess, then measured */
+      break;
+    }
+    case LUA_GCSTATS: {
+      res = g->gcstatson;
+      if (data)  /* (re)start recording */
+        memset(&g->gcstats, 0, sizeof(g->gcstats));
+      g->gcstatson = (data != 0);
+      break;
+    }
+    case LUA_GCIDLE: {  /* collect during idle time ('data' us at most) */
+      res = luaC_idlestep(L, cast(lua_Unsigned, data > 0 ? data : 0) * 1000);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -173,23 +173,36 @@ static int luaB_rawset (lua_State *L) {
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", NULL};
+    "isrunning", "generational", "incremental", "steptime", "idle", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCSETSTEPTIME, LUA_GCIDLE};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   int ex = (int)luaL_optinteger(L, 2, 0);
-  int res = lua_gc(L, o, ex);
+  int res;
+  if (o == LUA_GCGEN || o == LUA_GCINC) {  /* optional mode parameters? */
+    int gen = (o == LUA_GCGEN);
+    int ex2 = (int)luaL_optinteger(L, 3, 0);
+    if (ex != 0)  /* minor multiplier or pause */
+      lua_gc(L, gen ? LUA_GCSETMINORMUL : LUA_GCSETPAUSE, ex);
+    if (ex2 != 0)  /* major multiplier or step multiplier */
+      lua_gc(L, gen ? LUA_GCSETMAJORMUL : LUA_GCSETSTEPMUL, ex2);
+  }
+  res = lua_gc(L, o, ex);
   switch (o) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, (lua_Number)res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: case LUA_GCISRUNNING: {
+    case LUA_GCSTEP: case LUA_GCISRUNNING: case LUA_GCIDLE: {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCGEN: case LUA_GCINC: {  /* return previous mode */
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushinteger(L, res);
       return 1;
@@ -15,6 +15,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -89,7 +90,18 @@ static void DumpString (const TString *s, DumpState *D) {
 
 static void DumpCode (const Proto *f, DumpState *D) {
   DumpInt(f->sizecode, D);
+#if defined(LUA_USE_SUPERINSTRUCTIONS)
+  {  /* dump base opcodes only, superinstructions are rebuilt on load */
+    int pc;
+    for (pc = 0; pc < f->sizecode; pc++) {
+      Instruction i = f->code[pc];
+      SET_OPCODE(i, GET_BASEOPCODE(i));
+      DumpVar(i, D);
+    }
+  }
+#else
   DumpVector(f->code, f->sizecode, D);
+#endif
 }
 
 
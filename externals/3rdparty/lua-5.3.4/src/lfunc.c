@@ -16,6 +16,7 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -105,6 +106,10 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->icache = NULL;
+  f->jit = NULL;
+  f->jitcount = 0;
+  f->aot = NULL;
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -124,6 +129,9 @@ Proto *luaF_newproto (lua_State *L) {
 
 void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode);
+  if (f->icache)
+    luaM_freearray(L, f->icache, f->sizecode);
+  luaJ_freeproto(L, f);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
@@ -133,6 +141,23 @@ void luaF_freeproto (lua_State *L, Proto *f) {
 }
 
 
+#if defined(LUA_USE_INLINECACHE)
+/*
+** Creates the inline caches of a function, once its code is final: one
+** per instruction, holding the index of the node where the instruction
+** last found its short string key (a hint, checked on each use, so
+** table resizes and removals never need to invalidate it)
+*/
+void luaF_initicache (lua_State *L, Proto *f) {
+  int pc;
+  lua_assert(f->icache == NULL);
+  f->icache = luaM_newvector(L, f->sizecode, unsigned int);
+  for (pc = 0; pc < f->sizecode; pc++)
+    f->icache[pc] = 0;
+}
+#endif
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
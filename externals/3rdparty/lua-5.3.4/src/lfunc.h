@@ -54,6 +54,11 @@ LUAI_FUNC void luaF_initupvals (lua_State *L, LClosure *cl);
 LUAI_FUNC UpVal *luaF_findupval (lua_State *L, StkId level);
 LUAI_FUNC void luaF_close (lua_State *L, StkId level);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
+#if defined(LUA_USE_INLINECACHE)
+LUAI_FUNC void luaF_initicache (lua_State *L, Proto *f);
+#else
+#define luaF_initicache(L,f)	((void)0)
+#endif
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
 
@@ -60,10 +60,10 @@
 
 
 /*
-** 'makewhite' erases all color bits then sets only the current white
-** bit
+** 'makewhite' erases all color bits (and the old bit) then sets only
+** the current white bit
 */
-#define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS))
+#define maskcolors	(~(bit2mask(BLACKBIT, OLDBIT) | WHITEBITS))
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
@@ -132,7 +132,8 @@ static void removeentry (Node *n) {
 /*
 ** tells whether a key or value can be cleared from a weak
 ** table. Non-collectable objects are never removed from weak
-** tables. Strings behave as 'values', so are never removed too. for
+** tables. Strings (and boxed integers) behave as 'values', so are
+** never removed too. for
 ** other objects: if really collected, cannot keep them; for objects
 ** being finalized, keep them in keys, but not in values
 */
@@ -142,6 +143,10 @@ static int iscleared (global_State *g, const TValue *o) {
     markobject(g, tsvalue(o));  /* strings are 'values', so are never weak */
     return 0;
   }
+  else if (ttisinteger(o)) {  /* boxed integer? */
+    markobject(g, gcvalue(o));
+    return 0;
+  }
   else return iswhite(gcvalue(o));
 }
 
@@ -246,6 +251,11 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
       break;
     }
+    case LUA_TNUMBOX: {
+      gray2black(o);
+      g->GCmemtrav += sizeof(IntBox);
+      break;
+    }
     case LUA_TUSERDATA: {
       TValue uvalue;
       markobjectN(g, gco2u(o)->metatable);  /* mark its metatable */
@@ -360,9 +370,9 @@ static void restartcollection (global_State *g) {
 */
 static void traverseweakvalue (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
-  /* if there is array part, assume it may have white values (it is not
-     worth traversing it now just to check) */
-  int hasclears = (h->sizearray > 0);
+  /* if there is array or paged part, assume it may have white values (it
+     is not worth traversing it now just to check) */
+  int hasclears = (h->sizearray > 0 || h->pages != NULL);
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
@@ -378,6 +388,8 @@ static void traverseweakvalue (global_State *g, Table *h) {
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
+  else if (isgenerational(g))
+    gray2black(h);  /* nothing to clear (see 'blacklist') */
 }
 
 
@@ -404,6 +416,13 @@ static int traverseephemeron (global_State *g, Table *h) {
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
   }
+  /* traverse paged part */
+  forpagedslots(h, o, {
+    if (valiswhite(o)) {
+      marked = 1;
+      reallymarkobject(g, gcvalue(o));
+    }
+  });
   /* traverse hash part */
   for (n = gnode(h, 0); n < limit; n++) {
     checkdeadkey(n);
@@ -426,6 +445,8 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
+  else if (isgenerational(g))
+    gray2black(h);  /* nothing to clear (see 'blacklist') */
   return marked;
 }
 
@@ -435,6 +456,7 @@ static void traversestrongtable (global_State *g, Table *h) {
   unsigned int i;
   for (i = 0; i < h->sizearray; i++)  /* traverse array part */
     markvalue(g, &h->array[i]);
+  forpagedslots(h, o, markvalue(g, o));  /* traverse paged part */
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
@@ -467,7 +489,10 @@ static lu_mem traversetable (global_State *g, Table *h) {
   else  /* not weak */
     traversestrongtable(g, h);
   return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                         sizeof(Node) * cast(size_t, allocsizenode(h));
+                         sizeof(Node) * cast(size_t, allocsizenode(h)) +
+                         ((h->pages == NULL) ? 0 :
+                           sizeof(TValue) * h->pages->nslots +
+                           sizeof(ArrayPage *) * h->pages->npages);
 }
 
 
@@ -490,6 +515,7 @@ static int traverseproto (global_State *g, Proto *f) {
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                         (f->icache ? sizeof(unsigned int) * f->sizecode : 0) +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
@@ -664,6 +690,10 @@ static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
       if (iscleared(g, o))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
+    forpagedslots(h, o, {
+      if (iscleared(g, o))  /* value was collected? */
+        setnilvalue(o);  /* remove value */
+    });
     for (n = gnode(h, 0); n < limit; n++) {
       if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
         setnilvalue(gval(n));  /* remove value ... */
@@ -715,6 +745,7 @@ static void freeobj (lua_State *L, GCObject *o) {
       luaM_freemem(L, o, sizelstring(gco2ts(o)->u.lnglen));
       break;
     }
+    case LUA_TNUMBOX: luaM_free(L, gco2ib(o)); break;
     default: lua_assert(0);
   }
 }
@@ -730,11 +761,26 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count);
 ** white; change all non-dead objects back to white, preparing for next
 ** collection cycle. Return where to continue the traversal or NULL if
 ** list is finished.
+** In generational mode, surviving objects keep their colors and become
+** old. New objects are always at the beginning of the lists (objects
+** moved to the beginning of a list lose their old bit), so the sweep
+** stops at the first old object.
 */
 static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
   global_State *g = G(L);
   int ow = otherwhite(g);
-  int white = luaC_white(g);  /* current white */
+  int toclear, toset;  /* bits to clear and to set in all live objects */
+  int tostop;  /* stop sweep when this is true */
+  if (isgenerational(g)) {  /* generational mode? */
+    toclear = ~0;  /* clear nothing */
+    toset = bitmask(OLDBIT);  /* set the old bit of all surviving objects */
+    tostop = bitmask(OLDBIT);  /* do not sweep old generation */
+  }
+  else {  /* incremental mode */
+    toclear = maskcolors;  /* clear all color bits + old bit */
+    toset = luaC_white(g);  /* make object white */
+    tostop = 0;  /* do not stop */
+  }
   while (*p != NULL && count-- > 0) {
     GCObject *curr = *p;
     int marked = curr->marked;
@@ -742,8 +788,10 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
     }
-    else {  /* change mark to 'white' */
-      curr->marked = cast_byte((marked & maskcolors) | white);
+    else {
+      if (testbits(marked, tostop))
+        return NULL;  /* stop sweeping this list */
+      curr->marked = cast_byte((marked & toclear) | toset);  /* update marks */
       p = &curr->next;  /* go to next element */
     }
   }
@@ -791,6 +839,7 @@ static GCObject *udata2finalize (global_State *g) {
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
+  resetoldbit(o);  /* moved to the beginning of a list (see 'sweeplist') */
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
   return o;
@@ -906,7 +955,8 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
   else {  /* move 'o' to 'finobj' list */
     GCObject **p;
     if (issweepphase(g)) {
-      makewhite(g, o);  /* "sweep" object 'o' */
+      if (!isgenerational(g))  /* (survivors stay black in gen. mode) */
+        makewhite(g, o);  /* "sweep" object 'o' */
       if (g->sweepgc == &o->next)  /* should not remove 'sweepgc' object */
         g->sweepgc = sweeptolive(L, g->sweepgc);  /* change 'sweepgc' */
     }
@@ -916,6 +966,7 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
     o->next = g->finobj;  /* link it in 'finobj' list */
     g->finobj = o;
     l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+    resetoldbit(o);  /* moved to the beginning of a list (see 'sweeplist') */
   }
 }
 
@@ -930,20 +981,68 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
 */
 
 
+/*
+** monotonic clock (in nanoseconds) timing the collector work, for the
+** pause time statistics and the pacing of steps on time
+*/
+#if !defined(l_gcclock)
+
+#include <time.h>
+
+#if defined(CLOCK_MONOTONIC)
+static lua_Unsigned l_gcclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lua_Unsigned, ts.tv_sec) * 1000000000u +
+         cast(lua_Unsigned, ts.tv_nsec);
+}
+#else
+#define l_gcclock()  \
+	(cast(lua_Unsigned, clock()) * (1000000000u / CLOCKS_PER_SEC))
+#endif
+
+#endif
+
+
+/* true if the collector work must be timed */
+#define timinggc(g)	((g)->gcstatson || (g)->gcsteptime > 0)
+
+
+/*
+** add duration 't' (in nanoseconds) to histogram 'h'
+*/
+static void recordtime (GCHistogram *h, lua_Unsigned t) {
+  lua_Unsigned us = t / 1000;
+  int i = 0;
+  while (us > 0 && i < GCHISTSIZE - 1) {  /* i = log2(us) + 1 */
+    us >>= 1;
+    i++;
+  }
+  h->buckets[i]++;
+  h->count++;
+  h->total += t;
+  if (t > h->max)
+    h->max = t;
+}
+
+
 /*
 ** Set a reasonable "time" to wait before starting a new GC cycle; cycle
 ** will start when memory use hits threshold. (Division by 'estimate'
 ** should be OK: it cannot be zero (because Lua cannot even start with
 ** less than PAUSEADJ bytes).
 */
-static void setpause (global_State *g) {
-  l_mem threshold, debt;
+static l_mem pausethreshold (global_State *g) {
   l_mem estimate = g->GCestimate / PAUSEADJ;  /* adjust 'estimate' */
   lua_assert(estimate > 0);
-  threshold = (g->gcpause < MAX_LMEM / estimate)  /* overflow? */
-            ? estimate * g->gcpause  /* no overflow */
-            : MAX_LMEM;  /* overflow; truncate to maximum */
-  debt = gettotalbytes(g) - threshold;
+  return (g->gcpause < MAX_LMEM / estimate)  /* overflow? */
+         ? estimate * g->gcpause  /* no overflow */
+         : MAX_LMEM;  /* overflow; truncate to maximum */
+}
+
+
+static void setpause (global_State *g) {
+  l_mem debt = gettotalbytes(g) - pausethreshold(g);
   luaE_setdebt(g, debt);
 }
 
@@ -963,14 +1062,24 @@ static void entersweep (lua_State *L) {
 }
 
 
-void luaC_freeallobjects (lua_State *L) {
+/*
+** call the finalizers of all objects, as the state is being closed
+*/
+void luaC_callallfinalizers (lua_State *L) {
   global_State *g = G(L);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
   lua_assert(g->tobefnz == NULL);
+}
+
+
+void luaC_freeallobjects (lua_State *L) {
+  global_State *g = G(L);
+  luaC_callallfinalizers(L);
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
   g->gckind = KGC_NORMAL;
+  g->gcgen = g->gcmajor = 0;  /* sweep whole lists */
   sweepwholelist(L, &g->finobj);
   sweepwholelist(L, &g->allgc);
   sweepwholelist(L, &g->fixedgc);  /* collect fixed objects */
@@ -978,11 +1087,27 @@ void luaC_freeallobjects (lua_State *L) {
 }
 
 
+/*
+** turn black all the tables of a weak list, emptying it. In generational
+** mode, the tables left gray by the atomic phase would no longer be
+** visited (a gray table gets no barrier), so they become black, like
+** every other survivor.
+*/
+static void blacklist (GCObject **l) {
+  while (*l != NULL) {
+    Table *h = gco2t(*l);
+    *l = h->gclist;
+    gray2black(h);
+  }
+}
+
+
 static l_mem atomic (lua_State *L) {
   global_State *g = G(L);
   l_mem work;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
@@ -1019,6 +1144,11 @@ static l_mem atomic (lua_State *L) {
   clearvalues(g, g->weak, origweak);
   clearvalues(g, g->allweak, origall);
   luaS_clearcache(g);
+  if (isgenerational(g)) {  /* weak lists must be empty for next cycle */
+    blacklist(&g->weak);
+    blacklist(&g->allweak);
+    blacklist(&g->ephemeron);
+  }
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   work += g->GCmemtrav;  /* complete counting */
   return work;  /* estimate of memory marked by 'atomic' */
@@ -1052,18 +1182,23 @@ static lu_mem singlestep (lua_State *L) {
     }
     case GCSpropagate: {
       g->GCmemtrav = 0;
-      lua_assert(g->gray);
-      propagatemark(g);
-       if (g->gray == NULL)  /* no more gray objects? */
+      if (g->gray)  /* (may be empty in a minor collection) */
+        propagatemark(g);
+      if (g->gray == NULL)  /* no more gray objects? */
         g->gcstate = GCSatomic;  /* finish propagate phase */
       return g->GCmemtrav;  /* memory traversed in this step */
     }
     case GCSatomic: {
       lu_mem work;
+      lua_Unsigned start = g->gcstatson ? l_gcclock() : 0;
       propagateall(g);  /* make sure gray list is empty */
+      if (g->gcmajor)  /* major collection in generational mode? */
+        g->gcgen = 1;  /* survivors become old */
       work = atomic(L);  /* work is what was traversed by 'atomic' */
       entersweep(L);
       g->GCestimate = gettotalbytes(g);  /* first estimate */;
+      if (g->gcstatson)
+        recordtime(&g->gcstats.atomic, l_gcclock() - start);
       return work;
     }
     case GCSswpallgc: {  /* sweep "regular" objects */
@@ -1076,7 +1211,8 @@ static lu_mem singlestep (lua_State *L) {
       return sweepstep(L, g, GCSswpend, NULL);
     }
     case GCSswpend: {  /* finish sweeps */
-      makewhite(g, g->mainthread);  /* sweep main thread */
+      if (!isgenerational(g))
+        makewhite(g, g->mainthread);  /* sweep main thread */
       checkSizes(L, g);
       g->gcstate = GCScallfin;
       return 0;
@@ -1122,27 +1258,228 @@ static l_mem getdebt (global_State *g) {
   }
 }
 
+/*
+** Generational mode: objects surviving a collection become old and
+** stay black. A minor collection only marks the objects created since
+** the previous one (reached from the roots, from the threads, or from
+** the old objects through the barriers, which are kept active between
+** collections) and only sweeps them. Threads are traversed by every
+** collection, as they are always gray. A major collection runs when
+** memory grows 'gcmajormul'% over its use after the previous major
+** collection. It runs incrementally: a sweep turns all objects white,
+** then a whole cycle runs, whose atomic phase turns the collector back
+** to generational mode ('gcgen') so that its survivors become old.
+** Between collections, the collector stays in the propagate state.
+*/
+
+
+/*
+** set the debt of the next minor collection, after 'gcminormul'% of
+** the memory in use is allocated
+*/
+static void setminordebt (global_State *g) {
+  l_mem credit = cast(l_mem, gettotalbytes(g) / 100) * g->gcminormul;
+  luaE_setdebt(g, -(credit > GCSTEPSIZE ? credit : GCSTEPSIZE));
+}
+
+
+/*
+** start a major collection: sweep all objects to turn them back to
+** white (as white has not changed, nothing is collected)
+*/
+static void startmajor (lua_State *L, global_State *g) {
+  g->gcgen = 0;
+  g->gcmajor = 1;
+  entersweep(L);
+}
+
+
+static void endmajor (global_State *g) {
+  lua_assert(g->gcgen && g->gcstate == GCSpause);
+  g->gcmajor = 0;
+  g->gcstate = GCSpropagate;  /* skip restart */
+  g->GClastmajor = gettotalbytes(g);
+  setminordebt(g);
+}
+
+
+/*
+** run the current major collection until its end
+*/
+static void finishmajor (lua_State *L, global_State *g) {
+  luaC_runtilstate(L, bitmask(GCSpause));
+  if (!g->gcgen) {  /* objects were only turned white? */
+    luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
+    luaC_runtilstate(L, bitmask(GCSpause));  /* run it */
+  }
+  endmajor(g);
+}
+
+
+/*
+** run a whole major collection (finishing first the one running, if
+** any)
+*/
+static void fullgen (lua_State *L, global_State *g) {
+  if (g->gcmajor)
+    finishmajor(L, g);
+  startmajor(L, g);
+  finishmajor(L, g);
+}
+
+
+/*
+** run a cycle marking and sweeping only new objects
+*/
+static void youngcollection (lua_State *L, global_State *g) {
+  lua_assert(g->gcstate == GCSpropagate);
+  luaC_runtilstate(L, bitmask(GCSpause));  /* run complete (minor) cycle */
+  g->gcstate = GCSpropagate;  /* skip restart */
+  setminordebt(g);
+}
+
+
+/*
+** change the collector mode, 'gen' being true for generational mode
+*/
+void luaC_changemode (lua_State *L, int gen) {
+  global_State *g = G(L);
+  if (!gen == !isgenmode(g))
+    return;  /* nothing to change */
+  if (gen) {  /* finish current cycle, then run a major collection */
+    luaC_runtilstate(L, bitmask(GCSpause));
+    g->gcmajor = 1;
+    finishmajor(L, g);
+  }
+  else {  /* back to incremental: turn all objects white */
+    if (g->gcmajor)
+      finishmajor(L, g);
+    g->gcgen = 0;
+    entersweep(L);
+    luaC_runtilstate(L, bitmask(GCSpause));
+    g->GCestimate = gettotalbytes(g);
+    setpause(g);
+  }
+}
+
+
+/*
+** Pacing on time ('gcsteptime'): a step stops after 'gcstepwork' units
+** of work even if it did not pay all its debt (so the next allocation
+** runs another step). That budget follows the measured speed of the
+** collector for steps to last about 'gcsteptime'. Steps running the
+** atomic phase do not count, as it cannot be split (nor can minor
+** collections), and they may last longer.
+*/
+static void adjuststepwork (global_State *g, lu_mem work, lua_Unsigned t) {
+  lua_Number target = cast_num(g->gcsteptime) * 1000;  /* in ns */
+  lua_Number fit = (t > 0) ? cast_num(work) * target / cast_num(t)
+                           : cast_num(MAX_LMEM);
+  lua_Number budget = (cast_num(g->gcstepwork) + fit) / 2;  /* smooth */
+  if (budget < GCSTEPSIZE)
+    g->gcstepwork = GCSTEPSIZE;
+  else if (budget >= cast_num(MAX_LMEM))
+    g->gcstepwork = MAX_LMEM;
+  else
+    g->gcstepwork = cast(lu_mem, budget);
+}
+
+
 /*
 ** performs a basic GC step when collector is running
 */
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
+  lu_mem budget = (g->gcsteptime > 0) ? g->gcstepwork : MAX_LUMEM;
+  lu_mem done = 0;
+  lua_Unsigned start;
+  lu_byte state;
   if (!g->gcrunning) {  /* not running? */
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  start = timinggc(g) ? l_gcclock() : 0;
+  if (g->gcgen && !g->gcmajor) {  /* generational mode, between cycles? */
+    if (gettotalbytes(g) <= (g->GClastmajor / 100) * (100 + g->gcmajormul)) {
+      youngcollection(L, g);
+      if (g->gcstatson)
+        recordtime(&g->gcstats.step, l_gcclock() - start);
+      return;
+    }
+    startmajor(L, g);  /* major collection, run incrementally */
+  }
+  state = g->gcstate;
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
-  } while (debt > -GCSTEPSIZE && g->gcstate != GCSpause);
-  if (g->gcstate == GCSpause)
+    done += work;
+  } while (debt > -GCSTEPSIZE && done < budget && g->gcstate != GCSpause);
+  /* steps running the atomic phase (they start at the pause or before
+     the atomic phase and end after it) do not measure the speed */
+  if (g->gcsteptime > 0 &&
+      !((state <= GCSatomic || state == GCSpause) && g->gcstate > GCSatomic))
+    adjuststepwork(g, done, l_gcclock() - start);
+  if (g->gcstate == GCSpause && !g->gcmajor)
     setpause(g);  /* pause until next cycle */
-  else {
+  else if (g->gcstate == GCSpause && g->gcgen)
+    endmajor(g);  /* back to minor collections */
+  else {  /* (a major collection goes on after its first sweep) */
     debt = (debt / g->gcstepmul) * STEPMULADJ;  /* convert 'work units' to Kb */
     luaE_setdebt(g, debt);
     runafewfinalizers(L);
   }
+  if (g->gcstatson)
+    recordtime(&g->gcstats.step, l_gcclock() - start);
+}
+
+
+/*
+** Idle-time collection: runs the collector for about 'budget' ns while
+** the program has nothing else to do. The work done is banked as credit
+** (the allocation it pays for, see 'luaC_step'), so that allocations
+** trigger steps later. A new cycle (or a minor collection) is started
+** early once memory went half way to its threshold. Returns 1 if there
+** was nothing worth doing, so that further calls are useless until the
+** program allocates more.
+*/
+int luaC_idlestep (lua_State *L, lua_Unsigned budget) {
+  global_State *g = G(L);
+  lua_Unsigned start = l_gcclock();
+  lu_mem work = 0;
+  if (!g->gcrunning)
+    return 1;
+  if (g->gcgen && !g->gcmajor) {  /* generational mode, between cycles? */
+    if (gettotalbytes(g) <= (g->GClastmajor / 100) * (100 + g->gcmajormul)) {
+      l_mem credit = cast(l_mem, gettotalbytes(g) / 100) * g->gcminormul;
+      if (g->GCdebt <= -(credit / 2))
+        return 1;  /* too few new objects yet */
+      youngcollection(L, g);  /* (cannot be split) */
+      return 0;
+    }
+    startmajor(L, g);  /* major collection, run incrementally */
+  }
+  else if (g->gcstate == GCSpause && !g->gcmajor &&
+           g->GCdebt <= -((pausethreshold(g) - cast(l_mem, g->GCestimate)) / 2))
+    return 1;  /* too early for a new cycle */
+  do {
+    work += singlestep(L);
+  } while (g->gcstate != GCSpause && l_gcclock() - start < budget);
+  if (g->gcstate == GCSpause && !g->gcmajor)
+    setpause(g);  /* pause until next cycle */
+  else if (g->gcstate == GCSpause && g->gcgen)
+    endmajor(g);  /* back to minor collections */
+  else {
+    l_mem credit = cast(l_mem, work / g->gcstepmul) * STEPMULADJ;
+    luaE_setdebt(g, g->GCdebt - credit);
+    runafewfinalizers(L);
+  }
+  return 0;
+}
+
+
+LUA_API const GCStats *luaC_getstats (lua_State *L) {
+  return &G(L)->gcstats;
 }
 
 
@@ -1159,6 +1496,11 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
   lua_assert(g->gckind == KGC_NORMAL);
   if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
+  if (isgenmode(g)) {
+    fullgen(L, g);
+    g->gckind = KGC_NORMAL;
+    return;
+  }
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
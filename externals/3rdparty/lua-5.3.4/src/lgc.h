@@ -55,10 +55,16 @@
 ** ones) must be kept. During a collection, the sweep
 ** phase may break the invariant, as objects turned white may point to
 ** still-black objects. The invariant is restored when sweep ends and
-** all objects are white again.
+** all objects are white again. In generational mode, old objects stay
+** black between collections, so the invariant must be kept all times.
 */
 
-#define keepinvariant(g)	((g)->gcstate <= GCSatomic)
+#define isgenerational(g)	((g)->gcgen)
+
+/* generational mode ('gcgen' is off while a major collection marks) */
+#define isgenmode(g)	((g)->gcgen || (g)->gcmajor)
+
+#define keepinvariant(g)	(isgenerational(g) || (g)->gcstate <= GCSatomic)
 
 
 /*
@@ -79,6 +85,7 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define OLDBIT		4  /* object is old (only used in generational mode) */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -91,6 +98,9 @@
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
+#define isold(x)	testbit((x)->marked, OLDBIT)
+#define resetoldbit(o)	resetbit((o)->marked, OLDBIT)
+
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	(!(((m) ^ WHITEBITS) & (ow)))
 #define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
@@ -132,10 +142,13 @@
          luaC_upvalbarrier_(L,uv) : cast_void(0))
 
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
+LUAI_FUNC void luaC_callallfinalizers (lua_State *L);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
+LUAI_FUNC void luaC_changemode (lua_State *L, int gen);
+LUAI_FUNC int luaC_idlestep (lua_State *L, lua_Unsigned budget);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
@@ -144,4 +157,11 @@ LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount (lua_State *L, UpVal *uv);
 
 
+/*
+** GC pause times of the state of 'L'; they are recorded only while
+** enabled with 'lua_gc(L, LUA_GCSTATS, 1)', which also resets them
+*/
+LUA_API const GCStats *luaC_getstats (lua_State *L);
+
+
 #endif
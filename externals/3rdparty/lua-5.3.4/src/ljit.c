@@ -0,0 +1,1042 @@
+/*
+** Baseline JIT compiler (x86-64)
+** See Copyright Notice in lua.h
+**
+** Hot functions are translated instruction by instruction into x86-64
+** code, using one template per opcode. Native code works directly on the
+** lua stack (no register allocation), so its state is always the state
+** the interpreter would have at the same instruction: any case a
+** template does not handle (other types, metamethods, errors, calls,
+** allocations) just returns to the interpreter at that instruction.
+** Native code never raises errors, never calls lua code and never
+** allocates, so the stack cannot move while it runs.
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* MAP_ANONYMOUS */
+#endif
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "ljit.h"
+
+
+#if defined(LUA_USE_JIT)
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "lfunc.h"
+#include "lgc.h"
+#include "lopcodes.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "lvm.h"
+
+
+/* entries (calls, loop iterations) of a function before it is compiled */
+#define JIT_THRESHOLD	50
+
+/*
+** minimum count of instructions run by native code from an entry point,
+** when they contain no loop: running fewer instructions costs more than
+** interpreting them
+*/
+#define JIT_MINRUN	4
+
+
+typedef struct JitCode JitCode;
+
+/* native code of a function, see 'luaJ_execute' */
+typedef int (*JitFunction) (lua_State *L, StkId base, LClosure *cl,
+                            const unsigned char *entry);
+
+struct JitCode {
+  unsigned char *code;  /* executable mapping, starting with the prologue */
+  size_t size;  /* size of the mapping */
+  unsigned int *entries;  /* offset of each instruction (0 if not compiled) */
+};
+
+
+/* x86-64 registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSP	4
+#define RSI	6
+#define RDI	7
+#define R12	12
+#define R13	13
+#define R14	14
+#define R15	15
+#define XMM0	0
+#define XMM1	1
+
+/* registers holding the state of the function during the whole run */
+#define RBASE	RBX  /* 'base' */
+#define RKST	R12  /* 'k' */
+#define RSTATE	R13  /* 'L' */
+#define RCL	R14  /* 'cl' */
+
+/* condition codes (CC_ALWAYS is a plain jump) */
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_S	0x8
+#define CC_P	0xA
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+#define CC_ALWAYS	0x10
+
+#define TVSIZE	((int)sizeof(TValue))
+#define TTOFF	((int)offsetof(TValue, tt_))
+
+
+/* a memory operand '[base + disp]' */
+typedef struct Operand {
+  int base;
+  int disp;
+} Operand;
+
+
+/* pending jump, patched once all the instructions are emitted */
+typedef struct Fixup {
+  size_t pos;  /* position of the 32 bits displacement */
+  int pc;  /* target instruction */
+  int exit;  /* true: return to the interpreter at 'pc' */
+} Fixup;
+
+
+typedef struct JitState {
+  Proto *p;
+  unsigned char *buf;
+  size_t size;
+  size_t capacity;
+  unsigned int *native;  /* offset of the code of each instruction */
+  Fixup *fixups;
+  int nfixups;
+  int sizefixups;
+  size_t epilogue;  /* offset of the common return sequence */
+  int failed;  /* an allocation failed */
+} JitState;
+
+
+/*
+** {======================================================
+** Machine code emission
+** =======================================================
+*/
+
+static void emit1 (JitState *J, int b) {
+  if (J->size == J->capacity) {
+    size_t capacity = (J->capacity == 0) ? 4096 : J->capacity * 2;
+    unsigned char *buf = (unsigned char *)realloc(J->buf, capacity);
+    if (buf == NULL) {
+      J->failed = 1;
+      J->size = 0;  /* keep emitting (in vain) without overflowing */
+      return;
+    }
+    J->buf = buf;
+    J->capacity = capacity;
+  }
+  J->buf[J->size++] = cast(unsigned char, b);
+}
+
+
+static void emit4 (JitState *J, int v) {
+  unsigned int u = cast(unsigned int, v);
+  emit1(J, u & 0xFF);
+  emit1(J, (u >> 8) & 0xFF);
+  emit1(J, (u >> 16) & 0xFF);
+  emit1(J, (u >> 24) & 0xFF);
+}
+
+
+static void emit8 (JitState *J, size_t v) {
+  emit4(J, cast_int(v & 0xFFFFFFFFu));
+  emit4(J, cast_int(v >> 32));
+}
+
+
+/* optional legacy prefix, REX prefix when needed, 1 or 2 opcode bytes */
+static void emit_opcode (JitState *J, int prefix, int w, int op, int reg,
+                         int rm) {
+  int rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+  if (prefix)
+    emit1(J, prefix);
+  if (rex != 0x40)
+    emit1(J, rex);
+  if (op > 0xFF)
+    emit1(J, op >> 8);
+  emit1(J, op & 0xFF);
+}
+
+
+/* instruction with a register 'reg' (or opcode extension) and '[o]' */
+static void emit_mem (JitState *J, int prefix, int w, int op, int reg,
+                      Operand o) {
+  emit_opcode(J, prefix, w, op, reg, o.base);
+  emit1(J, 0x80 | ((reg & 7) << 3) | (o.base & 7));  /* [base + disp32] */
+  if ((o.base & 7) == RSP)
+    emit1(J, 0x24);  /* SIB needed for RSP and R12 bases */
+  emit4(J, o.disp);
+}
+
+
+/* instruction with two registers (or an opcode extension and 'rm') */
+static void emit_reg (JitState *J, int prefix, int w, int op, int reg,
+                      int rm) {
+  emit_opcode(J, prefix, w, op, reg, rm);
+  emit1(J, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+static void emit_movimm (JitState *J, int reg, size_t imm) {
+  emit_opcode(J, 0, 1, 0xB8 + (reg & 7), 0, reg);  /* mov reg, imm64 */
+  emit8(J, imm);
+}
+
+
+static void emit_push (JitState *J, int reg) {
+  if (reg & 8)
+    emit1(J, 0x41);
+  emit1(J, 0x50 + (reg & 7));
+}
+
+
+static void emit_pop (JitState *J, int reg) {
+  if (reg & 8)
+    emit1(J, 0x41);
+  emit1(J, 0x58 + (reg & 7));
+}
+
+
+static void emit_call (JitState *J, size_t f) {
+  emit_movimm(J, RAX, f);
+  emit_reg(J, 0, 0, 0xFF, 2, RAX);  /* call rax */
+}
+
+
+/* jump (or conditional jump) to be patched, returns its position */
+static size_t emit_jump (JitState *J, int cc) {
+  if (cc == CC_ALWAYS)
+    emit1(J, 0xE9);
+  else {
+    emit1(J, 0x0F);
+    emit1(J, 0x80 | cc);
+  }
+  emit4(J, 0);
+  return J->size - 4;
+}
+
+
+static void patch (JitState *J, size_t pos, size_t target) {
+  int rel = cast_int(target) - cast_int(pos + 4);
+  if (J->failed)
+    return;
+  J->buf[pos] = cast(unsigned char, rel & 0xFF);
+  J->buf[pos + 1] = cast(unsigned char, (rel >> 8) & 0xFF);
+  J->buf[pos + 2] = cast(unsigned char, (rel >> 16) & 0xFF);
+  J->buf[pos + 3] = cast(unsigned char, (rel >> 24) & 0xFF);
+}
+
+
+#define patchhere(J,pos)	patch(J, pos, (J)->size)
+
+
+static void addfixup (JitState *J, size_t pos, int pc, int exit) {
+  if (J->nfixups == J->sizefixups) {
+    int size = (J->sizefixups == 0) ? 64 : J->sizefixups * 2;
+    Fixup *fixups = (Fixup *)realloc(J->fixups, size * sizeof(Fixup));
+    if (fixups == NULL) {
+      J->failed = 1;
+      return;
+    }
+    J->fixups = fixups;
+    J->sizefixups = size;
+  }
+  J->fixups[J->nfixups].pos = pos;
+  J->fixups[J->nfixups].pc = pc;
+  J->fixups[J->nfixups].exit = exit;
+  J->nfixups++;
+}
+
+
+/* jump to the native code of instruction 'pc' */
+static void emit_branch (JitState *J, int cc, int pc) {
+  addfixup(J, emit_jump(J, cc), pc, 0);
+}
+
+
+/* return to the interpreter, at instruction 'pc' */
+static void emit_exit (JitState *J, int cc, int pc) {
+  addfixup(J, emit_jump(J, cc), pc, 1);
+}
+
+
+/* return to the interpreter from the epilogue, with 'pc' in eax */
+static void emit_exitstub (JitState *J, int pc) {
+  emit1(J, 0xB8);  /* mov eax, imm32 */
+  emit4(J, pc);
+  patch(J, emit_jump(J, CC_ALWAYS), J->epilogue);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+static Operand operand (int base, int disp) {
+  Operand o;
+  o.base = base;
+  o.disp = disp;
+  return o;
+}
+
+
+#define tag(o)		operand((o).base, (o).disp + TTOFF)
+#define regop(r)	operand(RBASE, (r) * TVSIZE)
+#define rkop(x) \
+  (ISK(x) ? operand(RKST, INDEXK(x) * TVSIZE) : regop(x))
+
+
+static void emit_cmptag (JitState *J, Operand o, int tt) {
+  emit_mem(J, 0, 0, 0x81, 7, tag(o));  /* cmp dword [o.tt_], tt */
+  emit4(J, tt);
+}
+
+
+static void emit_settag (JitState *J, Operand o, int tt) {
+  emit_mem(J, 0, 0, 0xC7, 0, tag(o));  /* mov dword [o.tt_], tt */
+  emit4(J, tt);
+}
+
+
+/* 'setobj' */
+static void emit_copy (JitState *J, Operand dst, Operand src) {
+  emit_mem(J, 0, 0, 0x0F10, XMM0, src);  /* movups xmm0, [src] */
+  emit_mem(J, 0, 0, 0x0F11, XMM0, dst);  /* movups [dst], xmm0 */
+}
+
+
+static void emit_setint (JitState *J, Operand o, int reg) {
+  emit_mem(J, 0, 1, 0x89, reg, o);  /* mov [o], reg */
+  emit_settag(J, o, LUA_TNUMINT);
+}
+
+
+static void emit_setflt (JitState *J, Operand o, int xmm) {
+  emit_mem(J, 0xF2, 0, 0x0F11, xmm, o);  /* movsd [o], xmm */
+  emit_settag(J, o, LUA_TNUMFLT);
+}
+
+
+/* loads the number at 'o' in 'xmm' ('tonumber'), exits if not a number */
+static void emit_tofloat (JitState *J, int xmm, Operand o, int pc) {
+  size_t notflt, done;
+  emit_cmptag(J, o, LUA_TNUMFLT);
+  notflt = emit_jump(J, CC_NE);
+  emit_mem(J, 0xF2, 0, 0x0F10, xmm, o);  /* movsd xmm, [o] */
+  done = emit_jump(J, CC_ALWAYS);
+  patchhere(J, notflt);
+  emit_cmptag(J, o, LUA_TNUMINT);
+  emit_exit(J, CC_NE, pc);  /* strings and metamethods */
+  emit_mem(J, 0xF2, 1, 0x0F2A, xmm, o);  /* cvtsi2sd xmm, [o] */
+  patchhere(J, done);
+}
+
+
+/* jumps to the code of the falsy case if 'o' is false or nil */
+static size_t emit_jumpiffalse (JitState *J, Operand o, size_t *nil) {
+  size_t notbool;
+  emit_cmptag(J, o, LUA_TNIL);
+  *nil = emit_jump(J, CC_E);
+  emit_cmptag(J, o, LUA_TBOOLEAN);
+  notbool = emit_jump(J, CC_NE);
+  emit_mem(J, 0, 0, 0x81, 7, o);  /* cmp dword [o], 0 */
+  emit4(J, 0);
+  patchhere(J, notbool);  /* flags are 'not equal' here when not boolean */
+  return emit_jump(J, CC_E);
+}
+
+
+static lua_Number jit_mod (lua_Number a, lua_Number b) {
+  lua_Number m;
+  luai_nummod(NULL, a, b, m);
+  return m;
+}
+
+
+static lua_Number jit_idiv (lua_Number a, lua_Number b) {
+  return luai_numidiv(NULL, a, b);
+}
+
+
+static lua_Number jit_pow (lua_Number a, lua_Number b) {
+  return luai_numpow(NULL, a, b);
+}
+
+
+/*
+** raw equality for 'OP_EQ': 1 or 0, or -1 when the interpreter must
+** decide ('__eq' metamethods, integer and float operands)
+*/
+static int jit_equal (const TValue *a, const TValue *b) {
+  if (ttype(a) != ttype(b))  /* not the same variant? */
+    return (ttisnumber(a) && ttisnumber(b)) ? -1 : 0;
+  switch (ttype(a)) {
+    case LUA_TNIL: return 1;
+    case LUA_TNUMINT: return (ivalue(a) == ivalue(b));
+    case LUA_TNUMFLT: return luai_numeq(fltvalue(a), fltvalue(b));
+    case LUA_TBOOLEAN: return (bvalue(a) == bvalue(b));
+    case LUA_TLIGHTUSERDATA: return (pvalue(a) == pvalue(b));
+    case LUA_TLCF: return (fvalue(a) == fvalue(b));
+    case LUA_TSHRSTR: return eqshrstr(tsvalue(a), tsvalue(b));
+    case LUA_TLNGSTR: return luaS_eqlngstr(tsvalue(a), tsvalue(b));
+    default:  /* the same object is always equal to itself */
+      return (gcvalue(a) == gcvalue(b)) ? 1 : -1;
+  }
+}
+
+
+/* arithmetic and bitwise operators */
+static int emit_arith (JitState *J, Instruction i, int pc, OpCode op) {
+  Operand ra = regop(GETARG_A(i));
+  Operand rb = rkop(GETARG_B(i));
+  Operand rc = rkop(GETARG_C(i));
+  int hasint = (op != OP_DIV && op != OP_POW);
+  int hasflt = (op != OP_BAND && op != OP_BOR && op != OP_BXOR &&
+                op != OP_SHL && op != OP_SHR);
+  size_t notint1 = 0, notint2 = 0, done = 0;
+  if (hasint) {
+    emit_cmptag(J, rb, LUA_TNUMINT);
+    notint1 = emit_jump(J, CC_NE);
+    emit_cmptag(J, rc, LUA_TNUMINT);
+    notint2 = emit_jump(J, CC_NE);
+    emit_mem(J, 0, 1, 0x8B, RAX, rb);  /* mov rax, [rb] */
+    switch (op) {
+      case OP_ADD: emit_mem(J, 0, 1, 0x03, RAX, rc); break;
+      case OP_SUB: emit_mem(J, 0, 1, 0x2B, RAX, rc); break;
+      case OP_MUL: emit_mem(J, 0, 1, 0x0FAF, RAX, rc); break;
+      case OP_BAND: emit_mem(J, 0, 1, 0x23, RAX, rc); break;
+      case OP_BOR: emit_mem(J, 0, 1, 0x0B, RAX, rc); break;
+      case OP_BXOR: emit_mem(J, 0, 1, 0x33, RAX, rc); break;
+      case OP_SHL: case OP_SHR: {
+        emit_reg(J, 0, 1, 0x8B, RDI, RAX);  /* mov rdi, rax */
+        emit_mem(J, 0, 1, 0x8B, RSI, rc);  /* mov rsi, [rc] */
+        if (op == OP_SHR)
+          emit_reg(J, 0, 1, 0xF7, 3, RSI);  /* neg rsi */
+        emit_call(J, (size_t)luaV_shiftl);
+        break;
+      }
+      case OP_MOD: case OP_IDIV: {
+        emit_mem(J, 0, 1, 0x8B, RDX, rc);  /* mov rdx, [rc] */
+        emit_reg(J, 0, 1, 0x85, RDX, RDX);  /* test rdx, rdx */
+        emit_exit(J, CC_E, pc);  /* division by zero error */
+        emit_reg(J, 0, 1, 0x8B, RSI, RAX);  /* mov rsi, rax */
+        emit_reg(J, 0, 1, 0x8B, RDI, RSTATE);  /* mov rdi, L */
+        emit_call(J, (op == OP_MOD) ? (size_t)luaV_mod : (size_t)luaV_div);
+        break;
+      }
+      default: lua_assert(0);
+    }
+    emit_setint(J, ra, RAX);
+    if (!hasflt) {  /* integer operands only */
+      done = emit_jump(J, CC_ALWAYS);
+      patchhere(J, notint1);
+      patchhere(J, notint2);
+      emit_exit(J, CC_ALWAYS, pc);
+      patchhere(J, done);
+      return 1;
+    }
+    done = emit_jump(J, CC_ALWAYS);
+    patchhere(J, notint1);
+    patchhere(J, notint2);
+  }
+  emit_tofloat(J, XMM0, rb, pc);
+  emit_tofloat(J, XMM1, rc, pc);
+  switch (op) {
+    case OP_ADD: emit_reg(J, 0xF2, 0, 0x0F58, XMM0, XMM1); break;
+    case OP_SUB: emit_reg(J, 0xF2, 0, 0x0F5C, XMM0, XMM1); break;
+    case OP_MUL: emit_reg(J, 0xF2, 0, 0x0F59, XMM0, XMM1); break;
+    case OP_DIV: emit_reg(J, 0xF2, 0, 0x0F5E, XMM0, XMM1); break;
+    case OP_MOD: emit_call(J, (size_t)jit_mod); break;
+    case OP_IDIV: emit_call(J, (size_t)jit_idiv); break;
+    case OP_POW: emit_call(J, (size_t)jit_pow); break;
+    default: lua_assert(0);
+  }
+  emit_setflt(J, ra, XMM0);
+  if (hasint)
+    patchhere(J, done);
+  return 1;
+}
+
+
+static int emit_unary (JitState *J, Instruction i, int pc, OpCode op) {
+  Operand ra = regop(GETARG_A(i));
+  Operand rb = regop(GETARG_B(i));
+  size_t notint, done;
+  emit_cmptag(J, rb, LUA_TNUMINT);
+  notint = emit_jump(J, CC_NE);
+  emit_mem(J, 0, 1, 0x8B, RAX, rb);  /* mov rax, [rb] */
+  emit_reg(J, 0, 1, 0xF7, (op == OP_UNM) ? 3 : 2, RAX);  /* neg/not rax */
+  emit_setint(J, ra, RAX);
+  done = emit_jump(J, CC_ALWAYS);
+  patchhere(J, notint);
+  if (op == OP_UNM) {
+    emit_cmptag(J, rb, LUA_TNUMFLT);
+    emit_exit(J, CC_NE, pc);
+    emit_mem(J, 0, 1, 0x8B, RAX, rb);  /* mov rax, [rb] */
+    emit_reg(J, 0, 1, 0x0FBA, 7, RAX);  /* btc rax, 63 (sign bit) */
+    emit1(J, 63);
+    emit_mem(J, 0, 1, 0x89, RAX, ra);  /* mov [ra], rax */
+    emit_settag(J, ra, LUA_TNUMFLT);
+  }
+  else
+    emit_exit(J, CC_ALWAYS, pc);
+  patchhere(J, done);
+  return 1;
+}
+
+
+/*
+** comparisons: the next instruction is a jump, done when the result is
+** 'A', skipped otherwise
+*/
+static int emit_compare (JitState *J, Instruction i, int pc, OpCode op) {
+  Proto *p = J->p;
+  Operand rb = rkop(GETARG_B(i));
+  Operand rc = rkop(GETARG_C(i));
+  int a = GETARG_A(i);
+  Instruction jmp;
+  int target, skip;
+  size_t notint1, notint2;
+  if (pc + 1 >= p->sizecode)
+    return 0;
+  jmp = p->code[pc + 1];
+  if (GET_BASEOPCODE(jmp) != OP_JMP || GETARG_A(jmp) != 0)
+    return 0;  /* upvalues to close */
+  target = pc + 2 + GETARG_sBx(jmp);
+  skip = pc + 2;
+  emit_cmptag(J, rb, LUA_TNUMINT);
+  notint1 = emit_jump(J, CC_NE);
+  emit_cmptag(J, rc, LUA_TNUMINT);
+  notint2 = emit_jump(J, CC_NE);
+  emit_mem(J, 0, 1, 0x8B, RAX, rb);  /* mov rax, [rb] */
+  emit_mem(J, 0, 1, 0x3B, RAX, rc);  /* cmp rax, [rc] */
+  switch (op) {
+    case OP_EQ: emit_branch(J, a ? CC_E : CC_NE, target); break;
+    case OP_LT: emit_branch(J, a ? CC_L : CC_GE, target); break;
+    case OP_LE: emit_branch(J, a ? CC_LE : CC_G, target); break;
+    default: lua_assert(0);
+  }
+  emit_branch(J, CC_ALWAYS, skip);
+  patchhere(J, notint1);
+  patchhere(J, notint2);
+  if (op == OP_EQ) {
+    emit_mem(J, 0, 1, 0x8D, RDI, rb);  /* lea rdi, [rb] */
+    emit_mem(J, 0, 1, 0x8D, RSI, rc);  /* lea rsi, [rc] */
+    emit_call(J, (size_t)jit_equal);
+    emit_reg(J, 0, 0, 0x85, RAX, RAX);  /* test eax, eax */
+    emit_exit(J, CC_S, pc);
+    emit_branch(J, a ? CC_NE : CC_E, target);
+  }
+  else {  /* floats (mixed operands are left to the interpreter) */
+    emit_cmptag(J, rb, LUA_TNUMFLT);
+    emit_exit(J, CC_NE, pc);
+    emit_cmptag(J, rc, LUA_TNUMFLT);
+    emit_exit(J, CC_NE, pc);
+    emit_mem(J, 0xF2, 0, 0x0F10, XMM0, rb);  /* movsd xmm0, [rb] */
+    emit_mem(J, 0xF2, 0, 0x0F10, XMM1, rc);  /* movsd xmm1, [rc] */
+    emit_reg(J, 0x66, 0, 0x0F2E, XMM1, XMM0);  /* ucomisd xmm1, xmm0 */
+    /* 'above' conditions are false for NaN, as C comparisons */
+    if (op == OP_LT)
+      emit_branch(J, a ? CC_A : CC_BE, target);
+    else
+      emit_branch(J, a ? CC_AE : CC_B, target);
+  }
+  emit_branch(J, CC_ALWAYS, skip);
+  return 1;
+}
+
+
+/* OP_TEST and OP_TESTSET */
+static int emit_test (JitState *J, Instruction i, int pc, OpCode op) {
+  Proto *p = J->p;
+  Operand ra = regop(GETARG_A(i));
+  Operand rb = (op == OP_TEST) ? ra : regop(GETARG_B(i));
+  int c = GETARG_C(i);
+  Instruction jmp;
+  int target, skip;
+  size_t nil, isfalse;
+  if (pc + 1 >= p->sizecode)
+    return 0;
+  jmp = p->code[pc + 1];
+  if (GET_BASEOPCODE(jmp) != OP_JMP || GETARG_A(jmp) != 0)
+    return 0;
+  target = pc + 2 + GETARG_sBx(jmp);
+  skip = pc + 2;
+  isfalse = emit_jumpiffalse(J, rb, &nil);
+  /* true value: jump if 'c' */
+  if (!c)
+    emit_branch(J, CC_ALWAYS, skip);
+  else {
+    if (op == OP_TESTSET)
+      emit_copy(J, ra, rb);
+    emit_branch(J, CC_ALWAYS, target);
+  }
+  patchhere(J, isfalse);
+  patchhere(J, nil);
+  /* false value: jump if not 'c' */
+  if (c)
+    emit_branch(J, CC_ALWAYS, skip);
+  else {
+    if (op == OP_TESTSET)
+      emit_copy(J, ra, rb);
+    emit_branch(J, CC_ALWAYS, target);
+  }
+  return 1;
+}
+
+
+/* loads the table of the value at 'o' in rax, exits if not a table */
+static void emit_loadtable (JitState *J, Operand o, int pc) {
+  emit_cmptag(J, o, ctb(LUA_TTABLE));
+  emit_exit(J, CC_NE, pc);
+  emit_mem(J, 0, 1, 0x8B, RAX, o);  /* mov rax, [o] */
+}
+
+
+/* loads the address of the value of upvalue 'n' in 'reg' */
+static void emit_upval (JitState *J, int reg, int n) {
+  emit_mem(J, 0, 1, 0x8B, reg, operand(RCL,  /* mov reg, cl->upvals[n] */
+           cast_int(offsetof(LClosure, upvals) + n * sizeof(UpVal *))));
+  emit_mem(J, 0, 1, 0x8B, reg, operand(reg, offsetof(UpVal, v)));
+}
+
+
+/*
+** loads in rdx the slot of key 'key' (a RK operand) in the table in rax,
+** and returns it. Handled keys are short string constants, found through
+** the inline cache of the instruction, and integers (in the array part,
+** other parts through 'luaH_getint'); exits in all the other cases and
+** when the slot is nil (no new keys, no metamethods).
+*/
+static Operand emit_getslot (JitState *J, int pc, int key) {
+  Proto *p = J->p;
+  TValue *kv = ISK(key) ? &p->k[INDEXK(key)] : NULL;
+  Operand slot;
+  if (kv != NULL && ttisshrstring(kv) && p->icache != NULL) {
+    /* node = gnode(t, icache[pc] & (sizenode(t) - 1)) */
+    emit_mem(J, 0, 0, 0x0FB6, RCX,  /* movzx ecx, byte [t.lsizenode] */
+             operand(RAX, offsetof(Table, lsizenode)));
+    emit1(J, 0xBA);  /* mov edx, 1 */
+    emit4(J, 1);
+    emit_reg(J, 0, 0, 0xD3, 4, RDX);  /* shl edx, cl */
+    emit_reg(J, 0, 0, 0xFF, 1, RDX);  /* dec edx */
+    emit_movimm(J, RCX, (size_t)&p->icache[pc]);
+    emit_mem(J, 0, 0, 0x23, RDX, operand(RCX, 0));  /* and edx, [rcx] */
+    emit_reg(J, 0, 1, 0x69, RDX, RDX);  /* imul rdx, rdx, sizeof(Node) */
+    emit4(J, sizeof(Node));
+    emit_mem(J, 0, 1, 0x03, RDX, operand(RAX, offsetof(Table, node)));
+    /* check that the key is in that node */
+    emit_cmptag(J, operand(RDX, offsetof(Node, i_key)), ctb(LUA_TSHRSTR));
+    emit_exit(J, CC_NE, pc);
+    emit_movimm(J, RCX, (size_t)tsvalue(kv));
+    emit_mem(J, 0, 1, 0x39, RCX, operand(RDX, offsetof(Node, i_key)));
+    emit_exit(J, CC_NE, pc);
+    slot = operand(RDX, offsetof(Node, i_val));
+  }
+  else if (kv == NULL || ttisinteger(kv)) {
+    Operand ko = rkop(key);
+    size_t notarray, done;
+    if (kv == NULL) {
+      emit_cmptag(J, ko, LUA_TNUMINT);
+      emit_exit(J, CC_NE, pc);
+    }
+    emit_mem(J, 0, 1, 0x8B, RCX, ko);  /* mov rcx, [key] */
+    emit_reg(J, 0, 1, 0xFF, 1, RCX);  /* dec rcx */
+    emit_mem(J, 0, 0, 0x8B, RDX, operand(RAX, offsetof(Table, sizearray)));
+    emit_reg(J, 0, 1, 0x3B, RCX, RDX);  /* cmp rcx, rdx */
+    notarray = emit_jump(J, CC_AE);  /* unsigned: also for keys below 1 */
+    emit_reg(J, 0, 1, 0x69, RDX, RCX);  /* imul rdx, rcx, sizeof(TValue) */
+    emit4(J, TVSIZE);
+    emit_mem(J, 0, 1, 0x03, RDX, operand(RAX, offsetof(Table, array)));
+    done = emit_jump(J, CC_ALWAYS);
+    patchhere(J, notarray);  /* paged or hash part: rdx = luaH_getint(t, k) */
+    emit_reg(J, 0, 1, 0x8B, R15, RAX);  /* mov r15, rax */
+    emit_reg(J, 0, 1, 0x8B, RDI, RAX);  /* mov rdi, rax */
+    emit_mem(J, 0, 1, 0x8B, RSI, ko);  /* mov rsi, [key] */
+    emit_call(J, (size_t)luaH_getint);
+    emit_reg(J, 0, 1, 0x8B, RDX, RAX);  /* mov rdx, rax */
+    emit_reg(J, 0, 1, 0x8B, RAX, R15);  /* mov rax, r15 */
+    patchhere(J, done);
+    slot = operand(RDX, 0);
+  }
+  else {
+    emit_exit(J, CC_ALWAYS, pc);
+    return operand(RDX, 0);
+  }
+  emit_cmptag(J, slot, LUA_TNIL);
+  emit_exit(J, CC_E, pc);
+  return slot;
+}
+
+
+/* stores 'v' in 'slot' of the table in rax ('luaV_fastset') */
+static void emit_setslot (JitState *J, Operand slot, Operand v, int pc) {
+  size_t notcollectable;
+  /* 'luaC_barrierback' is left to the interpreter */
+  emit_mem(J, 0, 0, 0xF6, 0, tag(v));  /* test byte [v.tt_], collectable */
+  emit1(J, BIT_ISCOLLECTABLE);
+  notcollectable = emit_jump(J, CC_E);
+  emit_mem(J, 0, 0, 0xF6, 0, operand(RAX, offsetof(Table, marked)));
+  emit1(J, bitmask(BLACKBIT));  /* test byte [t.marked], black */
+  emit_exit(J, CC_NE, pc);
+  patchhere(J, notcollectable);
+  emit_copy(J, slot, v);
+}
+
+
+/* checks for hooks set while running native code, before jumping back */
+static void emit_loopcheck (JitState *J, int target) {
+  emit_mem(J, 0, 0, 0x81, 7, operand(RSTATE, offsetof(lua_State, hookmask)));
+  emit4(J, 0);  /* cmp dword [L.hookmask], 0 */
+  emit_exit(J, CC_NE, target);
+}
+
+
+static int emit_forprep (JitState *J, Instruction i, int pc) {
+  Operand init = regop(GETARG_A(i));
+  Operand limit = regop(GETARG_A(i) + 1);
+  Operand step = regop(GETARG_A(i) + 2);
+  /* integer loops only, as 'forlimit' is then trivial */
+  emit_cmptag(J, init, LUA_TNUMINT);
+  emit_exit(J, CC_NE, pc);
+  emit_cmptag(J, limit, LUA_TNUMINT);
+  emit_exit(J, CC_NE, pc);
+  emit_cmptag(J, step, LUA_TNUMINT);
+  emit_exit(J, CC_NE, pc);
+  emit_mem(J, 0, 1, 0x8B, RAX, init);  /* mov rax, [init] */
+  emit_mem(J, 0, 1, 0x2B, RAX, step);  /* sub rax, [step] */
+  emit_mem(J, 0, 1, 0x89, RAX, init);  /* mov [init], rax */
+  emit_branch(J, CC_ALWAYS, pc + 1 + GETARG_sBx(i));
+  return 1;
+}
+
+
+static int emit_forloop (JitState *J, Instruction i, int pc) {
+  Operand idx = regop(GETARG_A(i));
+  Operand limit = regop(GETARG_A(i) + 1);
+  Operand step = regop(GETARG_A(i) + 2);
+  Operand ext = regop(GETARG_A(i) + 3);
+  int target = pc + 1 + GETARG_sBx(i);
+  size_t negative, done1, loop, done2;
+  emit_cmptag(J, idx, LUA_TNUMINT);
+  emit_exit(J, CC_NE, pc);  /* float loop */
+  emit_mem(J, 0, 1, 0x8B, RCX, step);  /* mov rcx, [step] */
+  emit_mem(J, 0, 1, 0x8B, RAX, idx);  /* mov rax, [idx] */
+  emit_reg(J, 0, 1, 0x01, RCX, RAX);  /* add rax, rcx */
+  emit_reg(J, 0, 1, 0x85, RCX, RCX);  /* test rcx, rcx */
+  negative = emit_jump(J, CC_LE);
+  emit_mem(J, 0, 1, 0x3B, RAX, limit);  /* cmp rax, [limit] */
+  done1 = emit_jump(J, CC_G);
+  loop = emit_jump(J, CC_ALWAYS);
+  patchhere(J, negative);
+  emit_mem(J, 0, 1, 0x3B, RAX, limit);  /* cmp rax, [limit] */
+  done2 = emit_jump(J, CC_L);
+  patchhere(J, loop);
+  emit_mem(J, 0, 1, 0x89, RAX, idx);  /* mov [idx], rax */
+  emit_setint(J, ext, RAX);
+  emit_loopcheck(J, target);
+  emit_branch(J, CC_ALWAYS, target);
+  patchhere(J, done1);
+  patchhere(J, done2);
+  return 1;
+}
+
+
+/* emits the code of instruction 'pc', returns 0 if not supported */
+static int emit_instruction (JitState *J, int pc) {
+  Proto *p = J->p;
+  Instruction i = p->code[pc];
+  OpCode op = GET_BASEOPCODE(i);
+  Operand ra = regop(GETARG_A(i));
+  switch (op) {
+    case OP_MOVE:
+      emit_copy(J, ra, regop(GETARG_B(i)));
+      return 1;
+    case OP_LOADK:
+      emit_copy(J, ra, operand(RKST, GETARG_Bx(i) * TVSIZE));
+      return 1;
+    case OP_LOADBOOL:
+      emit_mem(J, 0, 0, 0xC7, 0, ra);  /* mov dword [ra], B */
+      emit4(J, GETARG_B(i));
+      emit_settag(J, ra, LUA_TBOOLEAN);
+      if (GETARG_C(i))
+        emit_branch(J, CC_ALWAYS, pc + 2);
+      return 1;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      int a = GETARG_A(i);
+      do {
+        emit_settag(J, regop(a++), LUA_TNIL);
+      } while (b--);
+      return 1;
+    }
+    case OP_GETUPVAL:
+      emit_upval(J, RAX, GETARG_B(i));
+      emit_copy(J, ra, operand(RAX, 0));
+      return 1;
+    case OP_GETTABUP: case OP_GETTABLE: {
+      Operand slot;
+      if (op == OP_GETTABUP) {
+        emit_upval(J, RAX, GETARG_B(i));
+        emit_loadtable(J, operand(RAX, 0), pc);
+      }
+      else
+        emit_loadtable(J, regop(GETARG_B(i)), pc);
+      slot = emit_getslot(J, pc, GETARG_C(i));
+      emit_copy(J, ra, slot);
+      return 1;
+    }
+    case OP_SETTABUP: case OP_SETTABLE: {
+      Operand slot;
+      if (op == OP_SETTABUP) {
+        emit_upval(J, RAX, GETARG_A(i));
+        emit_loadtable(J, operand(RAX, 0), pc);
+      }
+      else
+        emit_loadtable(J, ra, pc);
+      slot = emit_getslot(J, pc, GETARG_B(i));
+      emit_setslot(J, slot, rkop(GETARG_C(i)), pc);
+      return 1;
+    }
+    case OP_SELF: {
+      Operand rb = regop(GETARG_B(i));
+      Operand slot;
+      emit_loadtable(J, rb, pc);
+      slot = emit_getslot(J, pc, GETARG_C(i));
+      emit_copy(J, regop(GETARG_A(i) + 1), rb);
+      emit_copy(J, ra, slot);
+      return 1;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR:
+      return emit_arith(J, i, pc, op);
+    case OP_UNM: case OP_BNOT:
+      return emit_unary(J, i, pc, op);
+    case OP_NOT: {
+      Operand rb = regop(GETARG_B(i));
+      size_t nil, isfalse, done;
+      isfalse = emit_jumpiffalse(J, rb, &nil);
+      emit_mem(J, 0, 0, 0xC7, 0, ra);  /* mov dword [ra], 0 */
+      emit4(J, 0);
+      done = emit_jump(J, CC_ALWAYS);
+      patchhere(J, isfalse);
+      patchhere(J, nil);
+      emit_mem(J, 0, 0, 0xC7, 0, ra);  /* mov dword [ra], 1 */
+      emit4(J, 1);
+      patchhere(J, done);
+      emit_settag(J, ra, LUA_TBOOLEAN);
+      return 1;
+    }
+    case OP_JMP: {
+      int target = pc + 1 + GETARG_sBx(i);
+      if (GETARG_A(i) != 0)
+        return 0;  /* upvalues to close */
+      if (target <= pc)
+        emit_loopcheck(J, target);
+      emit_branch(J, CC_ALWAYS, target);
+      return 1;
+    }
+    case OP_EQ: case OP_LT: case OP_LE:
+      return emit_compare(J, i, pc, op);
+    case OP_TEST: case OP_TESTSET:
+      return emit_test(J, i, pc, op);
+    case OP_FORPREP:
+      return emit_forprep(J, i, pc);
+    case OP_FORLOOP:
+      return emit_forloop(J, i, pc);
+    default:  /* calls, returns, closures, concatenation, ... */
+      return 0;
+  }
+}
+
+/* }====================================================== */
+
+
+static void freejitstate (JitState *J) {
+  free(J->buf);
+  free(J->native);
+  free(J->fixups);
+}
+
+
+/*
+** compiles 'p'. Layout: prologue, epilogue, the code of each instruction
+** (an exit to the interpreter for unsupported ones), then exit stubs.
+*/
+static JitCode *compile (Proto *p) {
+  static const int saved[] = { RBX, R12, R13, R14, R15 };  /* aligns stack */
+  JitState J;
+  JitCode *jc = NULL;
+  int *stubs = NULL;
+  int pc, n, loop, entries = 0;
+  memset(&J, 0, sizeof(J));
+  J.p = p;
+  J.native = (unsigned int *)malloc(p->sizecode * sizeof(unsigned int));
+  stubs = (int *)malloc(p->sizecode * sizeof(int));
+  jc = (JitCode *)malloc(sizeof(JitCode));
+  if (jc != NULL)
+    jc->entries = (unsigned int *)malloc(p->sizecode * sizeof(unsigned int));
+  if (J.native == NULL || stubs == NULL || jc == NULL || jc->entries == NULL)
+    goto fail;
+  /* prologue: int f (lua_State *L, StkId base, LClosure *cl, entry) */
+  for (n = 0; n < 5; n++)
+    emit_push(&J, saved[n]);
+  emit_reg(&J, 0, 1, 0x8B, RSTATE, RDI);
+  emit_reg(&J, 0, 1, 0x8B, RBASE, RSI);
+  emit_reg(&J, 0, 1, 0x8B, RCL, RDX);
+  emit_movimm(&J, RKST, (size_t)p->k);
+  emit_reg(&J, 0, 0, 0xFF, 4, RCX);  /* jmp rcx */
+  J.epilogue = J.size;
+  for (n = 4; n >= 0; n--)
+    emit_pop(&J, saved[n]);
+  emit1(&J, 0xC3);  /* ret */
+  for (pc = 0; pc < p->sizecode; pc++) {
+    int nfixups = J.nfixups;
+    J.native[pc] = cast(unsigned int, J.size);
+    stubs[pc] = -1;
+    if (emit_instruction(&J, pc))
+      jc->entries[pc] = J.native[pc];
+    else {
+      J.size = J.native[pc];  /* discard any partial code */
+      J.nfixups = nfixups;
+      emit_exitstub(&J, pc);
+      jc->entries[pc] = 0;
+    }
+  }
+  /* only keep the entry points running a loop or enough instructions */
+  for (pc = p->sizecode - 1, n = 0, loop = 0; pc >= 0; pc--) {
+    Instruction i = p->code[pc];
+    if (jc->entries[pc] == 0) {
+      n = loop = 0;
+      continue;
+    }
+    n++;
+    if (GET_BASEOPCODE(i) == OP_FORLOOP ||
+        (GET_BASEOPCODE(i) == OP_JMP && GETARG_sBx(i) < 0))
+      loop = 1;
+    if (n < JIT_MINRUN && !loop)
+      jc->entries[pc] = 0;
+    else
+      entries++;
+  }
+  for (n = 0; n < J.nfixups; n++) {
+    Fixup *f = &J.fixups[n];
+    if (!f->exit)
+      patch(&J, f->pos, J.native[f->pc]);
+    else {
+      if (stubs[f->pc] < 0) {
+        stubs[f->pc] = cast_int(J.size);
+        emit_exitstub(&J, f->pc);
+      }
+      patch(&J, f->pos, stubs[f->pc]);
+    }
+  }
+  if (J.failed || entries == 0)
+    goto fail;
+  jc->size = J.size;
+  jc->code = (unsigned char *)mmap(NULL, jc->size, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jc->code == MAP_FAILED)
+    goto fail;
+  memcpy(jc->code, J.buf, J.size);
+  if (mprotect(jc->code, jc->size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(jc->code, jc->size);
+    goto fail;
+  }
+  free(stubs);
+  freejitstate(&J);
+  return jc;
+ fail:
+  if (jc != NULL)
+    free(jc->entries);
+  free(jc);
+  free(stubs);
+  freejitstate(&J);
+  return NULL;
+}
+
+
+void luaJ_execute (lua_State *L, CallInfo *ci) {
+  LClosure *cl = clLvalue(ci->func);
+  Proto *p = cl->p;
+  JitCode *jc = p->jit;
+  unsigned int entry;
+  if (jc == NULL) {
+    if (p->jitcount < 0 || ++p->jitcount < JIT_THRESHOLD)
+      return;
+    jc = p->jit = compile(p);
+    if (jc == NULL) {
+      p->jitcount = -1;  /* do not try again */
+      return;
+    }
+  }
+  entry = jc->entries[ci->u.l.savedpc - p->code];
+  if (entry != 0) {  /* instruction compiled? */
+    JitFunction f = (JitFunction)(void *)jc->code;
+    int pc = f(L, ci->u.l.base, cl, jc->code + entry);
+    ci->u.l.savedpc = p->code + pc;
+  }
+}
+
+
+void luaJ_freeproto (lua_State *L, Proto *p) {
+  JitCode *jc = p->jit;
+  UNUSED(L);
+  if (jc != NULL) {
+    munmap(jc->code, jc->size);
+    free(jc->entries);
+    free(jc);
+    p->jit = NULL;
+  }
+}
+
+
+LUA_API int luaJ_setmode (lua_State *L, int enabled) {
+  lua_lock(L);
+  G(L)->jitmode = cast_byte(enabled != 0);
+  lua_unlock(L);
+  return 1;
+}
+
+#else
+
+LUA_API int luaJ_setmode (lua_State *L, int enabled) {
+  UNUSED(L); UNUSED(enabled);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,47 @@
+/*
+** Baseline JIT compiler (x86-64)
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+#if defined(LUA_USE_JIT) && defined(LUA_USE_NANBOXING)
+#error "the JIT compiler emits code for the value+tag layout of TValue"
+#endif
+
+#if defined(LUA_USE_JIT)
+
+/*
+** run the native code of the function of 'ci' (of prototype 'p') from
+** its current instruction, if the function is hot enough to be compiled
+** ('jitcount' is negative when it could not be compiled); native
+** code returns to the interpreter on any instruction or case it does
+** not handle, leaving 'savedpc' on that instruction
+*/
+#define luaJ_enter(L,ci,p) \
+  { if (G(L)->jitmode && (p)->jitcount >= 0 && !L->hookmask) \
+      luaJ_execute(L, ci); }
+
+LUAI_FUNC void luaJ_execute (lua_State *L, CallInfo *ci);
+LUAI_FUNC void luaJ_freeproto (lua_State *L, Proto *p);
+
+#else
+
+#define luaJ_enter(L,ci,p)	((void)0)
+#define luaJ_freeproto(L,p)	((void)0)
+
+#endif
+
+
+/*
+** enables or disables the JIT compiler for all the threads of the state
+** of 'L'. Returns 0 if the JIT compiler is not available in this build.
+*/
+LUA_API int luaJ_setmode (lua_State *L, int enabled);
+
+#endif
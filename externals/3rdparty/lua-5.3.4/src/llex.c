@@ -208,11 +208,13 @@ static int check_next2 (LexState *ls, const char *set) {
 
 /* LUA_NUMBER */
 /*
-** this function is quite liberal in what it accepts, as 'luaO_str2num'
+** this function is quite liberal in what it accepts, as 'luaO_str2val'
 ** will reject ill-formed numerals.
 */
 static int read_numeral (LexState *ls, SemInfo *seminfo) {
-  TValue obj;
+  lua_Integer i;
+  lua_Number n;
+  int isint;
   const char *expo = "Ee";
   int first = ls->current;
   lua_assert(lisdigit(ls->current));
@@ -229,15 +231,14 @@ static int read_numeral (LexState *ls, SemInfo *seminfo) {
     else break;
   }
   save(ls, '\0');
-  if (luaO_str2num(luaZ_buffer(ls->buff), &obj) == 0)  /* format error? */
-    lexerror(ls, "malformed number", TK_FLT);
-  if (ttisinteger(&obj)) {
-    seminfo->i = ivalue(&obj);
+  if (luaO_str2val(luaZ_buffer(ls->buff), &i, &n, &isint) == 0)
+    lexerror(ls, "malformed number", TK_FLT);  /* format error */
+  if (isint) {
+    seminfo->i = i;
     return TK_INT;
   }
   else {
-    lua_assert(ttisfloat(&obj));
-    seminfo->r = fltvalue(&obj);
+    seminfo->r = n;
     return TK_FLT;
   }
 }
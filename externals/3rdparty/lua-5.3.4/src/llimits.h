@@ -200,6 +200,15 @@ typedef unsigned long Instruction;
 #endif
 
 
+/*
+** Number of table traversal cursors (see 'luaH_next'), indexed by table
+** address (better be a power of 2)
+*/
+#if !defined(NEXTCURSORS)
+#define NEXTCURSORS		8
+#endif
+
+
 /* minimum size for string buffer */
 #if !defined(LUA_MINBUFFER)
 #define LUA_MINBUFFER	32
@@ -57,6 +57,7 @@
 /* Variant tags for numbers */
 #define LUA_TNUMFLT	(LUA_TNUMBER | (0 << 4))  /* float numbers */
 #define LUA_TNUMINT	(LUA_TNUMBER | (1 << 4))  /* integer numbers */
+#define LUA_TNUMBOX	(LUA_TNUMBER | (2 << 4))  /* boxed integers ('IntBox') */
 
 
 /* Bit mark for collectable types */
@@ -94,6 +95,32 @@ struct GCObject {
 ** an actual value plus a tag with its type.
 */
 
+#if defined(LUA_USE_NANBOXING)	/* { */
+
+/*
+** NaN boxing: a value is a single 64-bit word. Floats are stored as
+** themselves; all the other values are NaNs, the high 16 bits of which
+** (0xFFF1 to 0xFFFF, see 'nbword') hold a 4-bit box tag and the low 48
+** bits the value itself: a pointer (x86-64 Linux user space addresses
+** fit in 47 bits), a boolean, or an integer between -2^47 and 2^47-1.
+** Other integers go into an immutable collectable 'IntBox', so that
+** integers keep their full 64 bits. Any NaN float is stored as the
+** canonical quiet NaN, which cannot be taken for a boxed value.
+*/
+#if LUA_FLOAT_TYPE != LUA_FLOAT_DOUBLE || LUA_INT_TYPE != LUA_INT_LONGLONG
+#error "NaN boxing needs double floats and 64-bit integers"
+#endif
+
+typedef union Value {
+  lua_Unsigned u;  /* boxed value */
+  lua_Number n;    /* float numbers */
+} Value;
+
+
+#define TValuefields	Value value_
+
+#else				/* }{ */
+
 /*
 ** Union of all Lua values
 */
@@ -109,6 +136,8 @@ typedef union Value {
 
 #define TValuefields	Value value_; int tt_
 
+#endif				/* } */
+
 
 typedef struct lua_TValue {
   TValuefields;
@@ -116,6 +145,206 @@ typedef struct lua_TValue {
 
 
 
+#if defined(LUA_USE_NANBOXING)	/* { */
+
+/*
+** Box tags (bits 48-51 of the boxed values). Collectable values come
+** last, both string tags differ only by their low bit, and both integer
+** tags have their 3 low bits set (see 'ttisstring' and 'ttisinteger')
+*/
+#define NB_NIL		1
+#define NB_BOOLEAN	2
+#define NB_LIGHTUSERDATA	3
+#define NB_LCF		4
+#define NB_DEADKEY	5
+#define NB_INT		7	/* integers stored in the 48 bits */
+#define NB_SHRSTR	8
+#define NB_LNGSTR	9
+#define NB_TABLE	10
+#define NB_LCL		11
+#define NB_CCL		12
+#define NB_USERDATA	13
+#define NB_THREAD	14
+#define NB_BIGINT	15	/* integers stored in an 'IntBox' */
+
+#define NB_SHIFT	48
+#define NB_PAYLOAD	((cast(lua_Unsigned, 1) << NB_SHIFT) - 1)
+
+/* boxed value with tag 't' and a null payload */
+#define nbword(t)	(cast(lua_Unsigned, 0xFFF0 | (t)) << NB_SHIFT)
+
+/* boxed value with tag 't' holding pointer 'p' */
+#define nbbox(t,p)	(nbword(t) | cast(lua_Unsigned, cast(size_t, (p))))
+
+/* canonical NaN (words from 'nbword(NB_NIL)' up are boxed values) */
+#define NB_NAN		(cast(lua_Unsigned, 0x7FF8) << NB_SHIFT)
+
+/* boxed integers and NaN floats are the rare cases */
+#if defined(__GNUC__)
+#define nbunlikely(x)	__builtin_expect((x) != 0, 0)
+#else
+#define nbunlikely(x)	(x)
+#endif
+
+/* whether integer 'i' fits in the 48 bits of a boxed value */
+#define nbfitsint(i)  \
+	(l_castS2U(i) + (cast(lua_Unsigned, 1) << (NB_SHIFT - 1)) <= NB_PAYLOAD)
+
+
+/* macro defining a nil value */
+#define NILCONSTANT	{nbword(NB_NIL)}
+
+
+#define val_(o)		((o)->value_)
+
+#define nbtag(o)	cast_int((val_(o).u >> NB_SHIFT) & 0xF)
+#define nbis(o,t)	((val_(o).u >> NB_SHIFT) == (0xFFF0 | (t)))
+#define nbpayload(o)	(val_(o).u & NB_PAYLOAD)
+#define nbpointer(o)	cast(void *, cast(size_t, nbpayload(o)))
+
+
+/* raw type tag of a TValue (see 'luaO_nbtags_') */
+#define rttype(o)	(ttisfloat(o) ? LUA_TNUMFLT : luaO_nbtags_[nbtag(o)])
+
+/* tag with no variants (bits 0-3) */
+#define novariant(x)	((x) & 0x0F)
+
+/* type tag of a TValue (bits 0-3 for tags + variant bits 4-5) */
+#define ttype(o)	(rttype(o) & 0x3F)
+
+/* type tag of a TValue with no variants (bits 0-3) */
+#define ttnov(o)	(novariant(rttype(o)))
+
+
+/* Macros to test type */
+#define checktag(o,t)		(rttype(o) == (t))
+#define checktype(o,t)		(ttnov(o) == (t))
+#define ttisnumber(o)		(ttisfloat(o) || ttisinteger(o))
+#define ttisfloat(o)		(val_(o).u < nbword(NB_NIL))
+#define ttisinteger(o)		(((val_(o).u >> NB_SHIFT) | 8) == 0xFFFF)
+#define ttisnil(o)		(val_(o).u == nbword(NB_NIL))
+#define ttisboolean(o)		nbis((o), NB_BOOLEAN)
+#define ttislightuserdata(o)	nbis((o), NB_LIGHTUSERDATA)
+#define ttisstring(o)		(((val_(o).u >> NB_SHIFT) | 1) == (0xFFF0 | NB_LNGSTR))
+#define ttisshrstring(o)	nbis((o), NB_SHRSTR)
+#define ttislngstring(o)	nbis((o), NB_LNGSTR)
+#define ttistable(o)		nbis((o), NB_TABLE)
+#define ttisfunction(o)		(ttisclosure(o) || ttislcf(o))
+#define ttisclosure(o)		((val_(o).u >> NB_SHIFT) - (0xFFF0 | NB_LCL) <= 1)
+#define ttisCclosure(o)		nbis((o), NB_CCL)
+#define ttisLclosure(o)		nbis((o), NB_LCL)
+#define ttislcf(o)		nbis((o), NB_LCF)
+#define ttisfulluserdata(o)	nbis((o), NB_USERDATA)
+#define ttisthread(o)		nbis((o), NB_THREAD)
+#define ttisdeadkey(o)		nbis((o), NB_DEADKEY)
+
+
+/* Macros to access values */
+#define ivalue(o)	check_exp(ttisinteger(o), \
+	(nbunlikely(nbis((o), NB_BIGINT)) ? cast(IntBox *, nbpointer(o))->i \
+	                                : l_castU2S(val_(o).u << 16) >> 16))
+#define fltvalue(o)	check_exp(ttisfloat(o), val_(o).n)
+#define nvalue(o)	check_exp(ttisnumber(o), \
+	(ttisinteger(o) ? cast_num(ivalue(o)) : fltvalue(o)))
+#define gcvalue(o)	check_exp(iscollectable(o), cast(GCObject *, nbpointer(o)))
+#define pvalue(o)	check_exp(ttislightuserdata(o), nbpointer(o))
+#define tsvalue(o)	check_exp(ttisstring(o), gco2ts(gcvalue(o)))
+#define uvalue(o)	check_exp(ttisfulluserdata(o), gco2u(gcvalue(o)))
+#define clvalue(o)	check_exp(ttisclosure(o), gco2cl(gcvalue(o)))
+#define clLvalue(o)	check_exp(ttisLclosure(o), gco2lcl(gcvalue(o)))
+#define clCvalue(o)	check_exp(ttisCclosure(o), gco2ccl(gcvalue(o)))
+#define fvalue(o)	check_exp(ttislcf(o), \
+	cast(lua_CFunction, cast(size_t, nbpayload(o))))
+#define hvalue(o)	check_exp(ttistable(o), gco2t(gcvalue(o)))
+#define bvalue(o)	check_exp(ttisboolean(o), cast_int(nbpayload(o)))
+#define thvalue(o)	check_exp(ttisthread(o), gco2th(gcvalue(o)))
+/* a dead value may get the 'gc' field, but cannot access its contents */
+#define deadvalue(o)	check_exp(ttisdeadkey(o), nbpointer(o))
+
+#define l_isfalse(o)	(ttisnil(o) || (ttisboolean(o) && bvalue(o) == 0))
+
+
+#define iscollectable(o)	(val_(o).u >= nbword(NB_SHRSTR))
+
+
+/* Macros for internal tests */
+#define righttt(obj)		(gcvalue(obj)->tt == \
+	(ttisinteger(obj) ? LUA_TNUMBOX : ttype(obj)))
+
+#define checkliveness(L,obj) \
+	lua_longassert(!iscollectable(obj) || \
+		(righttt(obj) && (L == NULL || !isdead(G(L),gcvalue(obj)))))
+
+
+/* Macros to set values */
+#define setfltvalue(obj,x) \
+  { TValue *io=(obj); val_(io).n=(x); \
+    if (nbunlikely(val_(io).u >= nbword(NB_NIL))) val_(io).u = NB_NAN; }
+
+#define chgfltvalue(obj,x) \
+  { TValue *io=(obj); lua_assert(ttisfloat(io)); val_(io).n=(x); \
+    if (nbunlikely(val_(io).u >= nbword(NB_NIL))) val_(io).u = NB_NAN; }
+
+#define setivalue(L,obj,x) \
+  { TValue *io=(obj); lua_Integer i_=(x); \
+    if (nbunlikely(!nbfitsint(i_))) luaO_boxinteger(L, io, i_); \
+    else val_(io).u = nbword(NB_INT) | (l_castS2U(i_) & NB_PAYLOAD); }
+
+#define chgivalue(L,obj,x) \
+  { lua_assert(ttisinteger(obj)); setivalue(L,obj,x); }
+
+#define setnilvalue(obj) (val_(obj).u = nbword(NB_NIL))
+
+#define setfvalue(obj,x) \
+  { TValue *io=(obj); val_(io).u=nbbox(NB_LCF, (x)); }
+
+/* (light userdata beyond 48 bits, such as hashed integers, are truncated) */
+#define setpvalue(obj,x) \
+  { TValue *io=(obj); \
+    val_(io).u=nbbox(NB_LIGHTUSERDATA, cast(size_t, (x)) & NB_PAYLOAD); }
+
+#define setbvalue(obj,x) \
+  { TValue *io=(obj); val_(io).u=nbword(NB_BOOLEAN) | ((x) != 0); }
+
+#define setgcovalue(L,obj,x) \
+  { TValue *io = (obj); GCObject *i_g=(x); \
+    val_(io).u = nbbox(luaO_nbboxtag(i_g->tt), i_g); }
+
+#define setsvalue(L,obj,x) \
+  { TValue *io = (obj); TString *x_ = (x); \
+    val_(io).u = nbbox(NB_SHRSTR + ((x_->tt) >> 4), x_); \
+    checkliveness(L,io); }
+
+#define setuvalue(L,obj,x) \
+  { TValue *io = (obj); Udata *x_ = (x); \
+    val_(io).u = nbbox(NB_USERDATA, x_); \
+    checkliveness(L,io); }
+
+#define setthvalue(L,obj,x) \
+  { TValue *io = (obj); lua_State *x_ = (x); \
+    val_(io).u = nbbox(NB_THREAD, x_); \
+    checkliveness(L,io); }
+
+#define setclLvalue(L,obj,x) \
+  { TValue *io = (obj); LClosure *x_ = (x); \
+    val_(io).u = nbbox(NB_LCL, x_); \
+    checkliveness(L,io); }
+
+#define setclCvalue(L,obj,x) \
+  { TValue *io = (obj); CClosure *x_ = (x); \
+    val_(io).u = nbbox(NB_CCL, x_); \
+    checkliveness(L,io); }
+
+#define sethvalue(L,obj,x) \
+  { TValue *io = (obj); Table *x_ = (x); \
+    val_(io).u = nbbox(NB_TABLE, x_); \
+    checkliveness(L,io); }
+
+#define setdeadvalue(obj)  \
+	(val_(obj).u = nbword(NB_DEADKEY) | nbpayload(obj))
+
+#else				/* }{ */
+
 /* macro defining a nil value */
 #define NILCONSTANT	{NULL}, LUA_TNIL
 
@@ -201,11 +430,12 @@ typedef struct lua_TValue {
 #define chgfltvalue(obj,x) \
   { TValue *io=(obj); lua_assert(ttisfloat(io)); val_(io).n=(x); }
 
-#define setivalue(obj,x) \
-  { TValue *io=(obj); val_(io).i=(x); settt_(io, LUA_TNUMINT); }
+#define setivalue(L,obj,x) \
+  { TValue *io=(obj); val_(io).i=(x); settt_(io, LUA_TNUMINT); (void)L; }
 
-#define chgivalue(obj,x) \
-  { TValue *io=(obj); lua_assert(ttisinteger(io)); val_(io).i=(x); }
+#define chgivalue(L,obj,x) \
+  { TValue *io=(obj); lua_assert(ttisinteger(io)); val_(io).i=(x); \
+    (void)L; }
 
 #define setnilvalue(obj) settt_(obj, LUA_TNIL)
 
@@ -254,6 +484,8 @@ typedef struct lua_TValue {
 
 #define setdeadvalue(obj)	settt_(obj, LUA_TDEADKEY)
 
+#endif				/* } */
+
 
 
 #define setobj(L,obj1,obj2) \
@@ -368,6 +600,21 @@ typedef union UUdata {
 #define getudatamem(u)  \
   check_exp(sizeof((u)->ttuv_), (cast(char*, (u)) + sizeof(UUdata)))
 
+#if defined(LUA_USE_NANBOXING)
+
+#define setuservalue(L,u,o) \
+	{ const TValue *io=(o); Udata *iu = (u); \
+	  iu->user_ = io->value_; \
+	  checkliveness(L,io); }
+
+
+#define getuservalue(L,u,o) \
+	{ TValue *io=(o); const Udata *iu = (u); \
+	  io->value_ = iu->user_; \
+	  checkliveness(L,io); }
+
+#else
+
 #define setuservalue(L,u,o) \
 	{ const TValue *io=(o); Udata *iu = (u); \
 	  iu->user_ = io->value_; iu->ttuv_ = rttype(io); \
@@ -379,6 +626,18 @@ typedef union UUdata {
 	  io->value_ = iu->user_; settt_(io, iu->ttuv_); \
 	  checkliveness(L,io); }
 
+#endif
+
+
+/*
+** Boxed integer (see 'luaO_boxinteger'): an integer which does not fit
+** in a NaN boxed value
+*/
+typedef struct IntBox {
+  CommonHeader;
+  lua_Integer i;
+} IntBox;
+
 
 /*
 ** Description of an upvalue for function prototypes
@@ -424,6 +683,10 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last-created closure with this prototype */
+  unsigned int *icache;  /* inline caches (see 'luaF_initicache') */
+  struct JitCode *jit;  /* native code (see 'luaJ_execute') */
+  int jitcount;  /* entries before compilation, -1 if it failed */
+  int (*aot) (lua_State *L, struct CallInfo *ci);  /* compiled code (see laot.h) */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -482,10 +745,17 @@ typedef union TKey {
 
 
 /* copy a value into a key without messing up field 'next' */
+#if defined(LUA_USE_NANBOXING)
+#define setnodekey(L,key,obj) \
+	{ TKey *k_=(key); const TValue *io_=(obj); \
+	  k_->nk.value_ = io_->value_; \
+	  (void)L; checkliveness(L,io_); }
+#else
 #define setnodekey(L,key,obj) \
 	{ TKey *k_=(key); const TValue *io_=(obj); \
 	  k_->nk.value_ = io_->value_; k_->nk.tt_ = io_->tt_; \
 	  (void)L; checkliveness(L,io_); }
+#endif
 
 
 typedef struct Node {
@@ -494,6 +764,27 @@ typedef struct Node {
 } Node;
 
 
+/*
+** Paged part of tables (see ltable.c): integer keys above the array
+** part, in pages of 'PAGESIZE' keys only holding the slots of their
+** present keys
+*/
+typedef struct ArrayPage {
+  unsigned int present;  /* bit 'i' set when key 'i' of the page has a slot */
+  lu_byte n;  /* number of slots (bits set in 'present') */
+  lu_byte size;  /* number of allocated slots */
+  TValue v[1];  /* slots, in key order */
+} ArrayPage;
+
+
+typedef struct ArrayPages {
+  unsigned int npages;  /* the pages cover keys 1 to 'npages * PAGESIZE' */
+  unsigned int nslots;  /* number of slots in all the pages */
+  unsigned int maxslots;  /* slots allowed before a rehash */
+  ArrayPage *page[1];  /* pages (NULL when without slots) */
+} ArrayPages;
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
@@ -504,6 +795,7 @@ typedef struct Table {
   Node *lastfree;  /* any free position is before this position */
   struct Table *metatable;
   GCObject *gclist;
+  ArrayPages *pages;  /* paged part (NULL if none) */
 } Table;
 
 
@@ -527,6 +819,12 @@ typedef struct Table {
 
 LUAI_DDEC const TValue luaO_nilobject_;
 
+#if defined(LUA_USE_NANBOXING)
+LUAI_DDEC const lu_byte luaO_nbtags_[16];
+LUAI_FUNC int luaO_nbboxtag (int tt);
+LUAI_FUNC void luaO_boxinteger (lua_State *L, TValue *obj, lua_Integer i);
+#endif
+
 /* size of buffer for 'luaO_utf8esc' function */
 #define UTF8BUFFSZ	8
 
@@ -536,7 +834,9 @@ LUAI_FUNC int luaO_utf8esc (char *buff, unsigned long x);
 LUAI_FUNC int luaO_ceillog2 (unsigned int x);
 LUAI_FUNC void luaO_arith (lua_State *L, int op, const TValue *p1,
                            const TValue *p2, TValue *res);
-LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
+LUAI_FUNC size_t luaO_str2val (const char *s, lua_Integer *i, lua_Number *n,
+                                int *isint);
+LUAI_FUNC size_t luaO_str2num (lua_State *L, const char *s, TValue *o);
 LUAI_FUNC int luaO_hexavalue (int c);
 LUAI_FUNC void luaO_tostring (lua_State *L, StkId obj);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
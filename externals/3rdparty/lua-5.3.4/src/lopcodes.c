@@ -65,6 +65,10 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "MOVE2",
+  "GETTABLE2",
+  "MULADD",
+  "MULMUL",
   NULL
 };
 
@@ -120,5 +124,38 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVE2 */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLE2 */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULADD */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULMUL */
 };
 
+
+#if defined(LUA_USE_SUPERINSTRUCTIONS)
+/*
+** Peephole pass over the code of a function, tagging the instructions
+** followed by an instruction they can be fused with (the pairs most
+** executed by the benchmarks, see LuaRunner --opcode-stats). Any
+** previous tagging is replaced, as the pass only looks at base opcodes.
+** Chains work too: in MOVE;MOVE;MOVE the first two are tagged, and a
+** jump to the second one still runs a valid superinstruction.
+*/
+void luaP_fuse (Instruction *code, int sizecode) {
+  int pc;
+  for (pc = 0; pc < sizecode; pc++) {
+    OpCode op = GET_BASEOPCODE(code[pc]);
+    OpCode next = (pc + 1 < sizecode) ? GET_BASEOPCODE(code[pc + 1])
+                                      : OP_EXTRAARG;
+    OpCode fused = op;
+    if (op == OP_MOVE && next == OP_MOVE)
+      fused = OP_MOVE2;
+    else if (op == OP_GETTABLE && next == OP_GETTABLE)
+      fused = OP_GETTABLE2;
+    else if (op == OP_MUL && next == OP_ADD)
+      fused = OP_MULADD;
+    else if (op == OP_MUL && next == OP_MUL)
+      fused = OP_MULMUL;
+    SET_OPCODE(code[pc], fused);
+  }
+}
+#endif
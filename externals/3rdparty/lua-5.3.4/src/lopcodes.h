@@ -230,11 +230,36 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/*
+** Superinstructions (see 'luaP_fuse'): an instruction followed by a
+** given one is tagged with one of these opcodes, and its handler runs
+** the next instruction without going through dispatch. Both
+** instructions are kept unchanged otherwise, so jumps, line info and
+** debug information are not affected.
+*/
+OP_MOVE2,/*	MOVE followed by MOVE					*/
+OP_GETTABLE2,/*	GETTABLE followed by GETTABLE				*/
+OP_MULADD,/*	MUL followed by ADD					*/
+OP_MULMUL/*	MUL followed by MUL					*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_MULMUL) + 1)
+
+/* opcode without superinstruction (for code analysis and dumps) */
+#define luaP_baseop(o)	((o) <= OP_EXTRAARG ? (o) : \
+	(o) == OP_MOVE2 ? OP_MOVE : \
+	(o) == OP_GETTABLE2 ? OP_GETTABLE : OP_MUL)
+
+#define GET_BASEOPCODE(i)	(cast(OpCode, luaP_baseop(GET_OPCODE(i))))
+
+#if defined(LUA_USE_SUPERINSTRUCTIONS)
+LUAI_FUNC void luaP_fuse (Instruction *code, int sizecode);
+#else
+#define luaP_fuse(code,sizecode)	((void)0)
+#endif
 
 
 
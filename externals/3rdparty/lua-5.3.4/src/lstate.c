@@ -36,6 +36,14 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 #endif
 
+#if !defined(LUAI_GENMINORMUL)
+#define LUAI_GENMINORMUL	20  /* minor collection after 20% of growth */
+#endif
+
+#if !defined(LUAI_GENMAJORMUL)
+#define LUAI_GENMAJORMUL	100  /* major collection when memory doubles */
+#endif
+
 
 /*
 ** a macro to help the creation of a unique random seed when a state is
@@ -310,7 +318,10 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->mainthread = L;
   g->seed = makeseed(L);
   g->gcrunning = 0;  /* no GC while building state */
+  g->jitmode = 0;
+  g->gcstatson = 0;
   g->GCestimate = 0;
+  g->GClastmajor = 0;
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
   setnilvalue(&g->l_registry);
@@ -318,6 +329,7 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->version = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_NORMAL;
+  g->gcgen = g->gcmajor = 0;
   g->allgc = g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
@@ -328,6 +340,12 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcminormul = LUAI_GENMINORMUL;
+  g->gcmajormul = LUAI_GENMAJORMUL;
+  g->gcsteptime = 0;
+  g->gcstepwork = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  memset(g->nextcursors, 0, sizeof(g->nextcursors));
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
@@ -345,3 +363,24 @@ LUA_API void lua_close (lua_State *L) {
 }
 
 
+/*
+** closes the state of a process about to exit: runs the finalizers of
+** all objects ('__gc' metamethods, which close files and release other
+** resources) like 'lua_close', but frees nothing, leaving all the
+** memory of the state to the system (freeing every object one by one
+** takes long with large heaps)
+*/
+LUA_API void lua_fastclose (lua_State *L) {
+  global_State *g;
+  L = G(L)->mainthread;  /* only the main thread can be closed */
+  lua_lock(L);
+  g = G(L);
+  luaF_close(L, L->stack);  /* close all upvalues for this thread */
+  luaC_callallfinalizers(L);
+  if (g->version)  /* closing a fully built state? */
+    luai_userstateclose(L);
+  /* objects, string table, stacks and main block are left to the system */
+  lua_unlock(L);
+}
+
+
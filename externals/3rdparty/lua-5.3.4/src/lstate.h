@@ -62,6 +62,38 @@ typedef struct stringtable {
 } stringtable;
 
 
+/*
+** Histogram of the durations of some collector work (in nanoseconds).
+** Bucket 0 counts durations under 1 microsecond, bucket 'i' durations
+** in [2^(i-1), 2^i) microseconds (the last one also longer ones)
+*/
+#define GCHISTSIZE	24
+
+typedef struct GCHistogram {
+  lua_Unsigned count;  /* number of recorded durations */
+  lua_Unsigned total;  /* sum of the durations */
+  lua_Unsigned max;  /* longest duration */
+  lua_Unsigned buckets[GCHISTSIZE];
+} GCHistogram;
+
+
+/*
+** cursor of the traversal of table 't': position (as numbered by
+** 'luaH_next') of the last key returned for it
+*/
+typedef struct NextCursor {
+  struct Table *t;
+  unsigned int index;
+} NextCursor;
+
+
+/* GC pause times, recorded when 'gcstatson' (see 'luaC_getstats') */
+typedef struct GCStats {
+  GCHistogram step;  /* calls to 'luaC_step' (minor collections included) */
+  GCHistogram atomic;  /* atomic phases */
+} GCStats;
+
+
 /*
 ** Information about a call.
 ** When a thread yields, 'func' is adjusted to pretend that the
@@ -123,13 +155,18 @@ typedef struct global_State {
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
   lu_mem GCmemtrav;  /* memory traversed by the GC */
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
+  lu_mem GClastmajor;  /* memory in use after last major collection */
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
   unsigned int seed;  /* randomized seed for hashes */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
+  lu_byte gcgen;  /* true if GC is in generational mode */
+  lu_byte gcmajor;  /* true while a major collection runs */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte jitmode;  /* true if the JIT compiler is enabled */
+  lu_byte gcstatson;  /* true if GC pause times are recorded */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -144,6 +181,11 @@ typedef struct global_State {
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
+  int gcminormul;  /* allocation between minor collections (% of memory) */
+  int gcmajormul;  /* growth that triggers a major collection (%) */
+  int gcsteptime;  /* maximum duration of a GC step (us), 0 if unbounded */
+  lu_mem gcstepwork;  /* work of a step that fits in 'gcsteptime' */
+  GCStats gcstats;  /* GC pause times */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number */
@@ -151,6 +193,7 @@ typedef struct global_State {
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  NextCursor nextcursors[NEXTCURSORS];  /* cursors of table traversals */
 } global_State;
 
 
@@ -198,6 +241,7 @@ union GCUnion {
   struct Table h;
   struct Proto p;
   struct lua_State th;  /* thread */
+  struct IntBox ib;
 };
 
 
@@ -214,6 +258,7 @@ union GCUnion {
 #define gco2t(o)  check_exp((o)->tt == LUA_TTABLE, &((cast_u(o))->h))
 #define gco2p(o)  check_exp((o)->tt == LUA_TPROTO, &((cast_u(o))->p))
 #define gco2th(o)  check_exp((o)->tt == LUA_TTHREAD, &((cast_u(o))->th))
+#define gco2ib(o)  check_exp((o)->tt == LUA_TNUMBOX, &((cast_u(o))->ib))
 
 
 /* macro to convert a Lua object into a GCObject */
@@ -46,6 +46,97 @@ int luaS_eqlngstr (TString *a, TString *b) {
 }
 
 
+#if defined(LUA_USE_WORDHASH)
+
+/*
+** Word-at-a-time hash (in the style of wyhash): reads the string 8 bytes
+** at a time (in native byte order) and mixes words with 64x64->128 bit
+** multiplications folded back to 64 bits. All bytes are hashed, long
+** strings included, so keys sharing long prefixes do not collide.
+*/
+
+typedef unsigned long long l_hashword;
+
+#define HASHK0	0xa0761d6478bd642fULL
+#define HASHK1	0xe7037ed1a0b428dbULL
+#define HASHK2	0x8ebc6af09c88c6e3ULL
+
+
+static l_hashword read8 (const char *p) {
+  l_hashword w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+
+static l_hashword read4 (const char *p) {
+  unsigned int w;  /* (at least 32 bits) */
+  memcpy(&w, p, 4);
+  return w & 0xffffffffULL;
+}
+
+
+/* 'a' * 'b' on 128 bits, returned as 'a' (low half) and 'b' (high half) */
+static void mul128 (l_hashword *a, l_hashword *b) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 r = (unsigned __int128)*a * *b;
+  *a = (l_hashword)r;
+  *b = (l_hashword)(r >> 64);
+#else
+  l_hashword ha = *a >> 32, hb = *b >> 32;
+  l_hashword la = *a & 0xffffffffULL, lb = *b & 0xffffffffULL;
+  l_hashword hl = ha * lb, lh = la * hb, ll = la * lb;
+  l_hashword lo = ll + (hl << 32);
+  l_hashword carry = (lo < ll);
+  l_hashword t = lo;
+  lo += lh << 32;
+  carry += (lo < t);
+  *a = lo;
+  *b = ha * hb + (hl >> 32) + (lh >> 32) + carry;
+#endif
+}
+
+
+static l_hashword mix (l_hashword a, l_hashword b) {
+  mul128(&a, &b);
+  return a ^ b;
+}
+
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  l_hashword h = seed ^ HASHK0;  /* seed and length mixed in at the end */
+  l_hashword a, b;
+  if (l <= 16) {
+    if (l >= 4) {  /* two (possibly overlapping) pairs of 4 bytes */
+      size_t m = (l >> 3) << 2;
+      a = (read4(str) << 32) | read4(str + m);
+      b = (read4(str + l - 4) << 32) | read4(str + l - 4 - m);
+    }
+    else if (l > 0) {
+      a = (cast(l_hashword, cast_byte(str[0])) << 16) |
+          (cast(l_hashword, cast_byte(str[l >> 1])) << 8) |
+          cast_byte(str[l - 1]);
+      b = 0;
+    }
+    else
+      a = b = 0;
+  }
+  else {
+    size_t i = l;
+    for (; i > 16; i -= 16, str += 16)
+      h = mix(read8(str) ^ HASHK1, read8(str + 8) ^ h);
+    a = read8(str + i - 16);  /* last 16 bytes (may overlap) */
+    b = read8(str + i - 8);
+  }
+  a ^= HASHK1;
+  b ^= h;
+  mul128(&a, &b);
+  h = mix(a ^ HASHK0 ^ l, b ^ HASHK2);
+  return cast(unsigned int, h ^ (h >> 32));
+}
+
+#else
+
 unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
   unsigned int h = seed ^ cast(unsigned int, l);
   size_t step = (l >> LUAI_HASHLIMIT) + 1;
@@ -54,6 +145,8 @@ unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
   return h;
 }
 
+#endif
+
 
 unsigned int luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_TLNGSTR);
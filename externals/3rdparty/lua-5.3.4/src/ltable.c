@@ -16,15 +16,35 @@
 ** Non-negative integer keys are all candidates to be kept in the array
 ** part. The actual size of the array is the largest 'n' such that
 ** more than half the slots between 1 and n are in use.
+** Integer keys above the array part that are too sparse for it, but
+** still fill more than 1/PAGEDENSITY of a range, go to the paged part:
+** pages of PAGESIZE keys with a bitmap of the present keys, holding
+** the slots of those keys only (packed in key order, found by counting
+** the bits below their own), so keys with gaps such as identifiers take
+** a slot each, instead of a node of the hash part.
 ** Hash uses a mix of chained scatter table with Brent's variation.
 ** A main invariant of these tables is that, if an element is not
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+**
+** When built with LUA_USE_SWISSTABLE, the hash part is instead an open
+** addressing table (in the style of SwissTable): one control byte per
+** node, either "empty" or 7 bits of the hash of its key, is stored after
+** the node array, and lookups test groups of 16 control bytes at once
+** (with SSE2 when available), only comparing the keys of the nodes whose
+** control byte matches. Nodes never move until the next rehash, so
+** traversals, the collector and the inline caches work on the same node
+** array as before; 'gnext' is not used.
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
+
+#if defined(LUA_USE_SWISSTABLE) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "lua.h"
 
@@ -55,6 +75,42 @@
 #define MAXHBITS	(MAXABITS - 1)
 
 
+/*
+** Minimum density of the paged part: more than 1/PAGEDENSITY of the
+** keys of its range must be present, and at least MINPAGEDKEYS of them
+** (a slot and its share of a page header and directory entry then take
+** less memory than a node). Pages allocate MINPAGESLOTS slots first.
+*/
+#define PAGEDENSITY	8
+#define MINPAGEDKEYS	8
+#define MINPAGESLOTS	4
+
+
+/* index of the lowest bit set in 'm' (not 0), number of bits set in 'm' */
+#if defined(__GNUC__)
+#define firstbit(m)	__builtin_ctz(m)
+#define popcount(m)	__builtin_popcount(m)
+#else
+static int firstbit (unsigned int m) {
+  int i = 0;
+  while (!(m & 1)) {
+    m >>= 1;
+    i++;
+  }
+  return i;
+}
+
+static int popcount (unsigned int m) {
+  int n = 0;
+  for (; m != 0; m &= m - 1)
+    n++;
+  return n;
+}
+#endif
+
+
+#if !defined(LUA_USE_SWISSTABLE)
+
 #define hashpow2(t,n)		(gnode(t, lmod((n), sizenode(t))))
 
 #define hashstr(t,str)		hashpow2(t, (str)->hash)
@@ -80,6 +136,11 @@ static const Node dummynode_ = {
 };
 
 
+#define freenodes(L,n,size)	luaM_freearray(L, n, cast(size_t, size))
+
+#endif
+
+
 /*
 ** Hash for floating-point numbers.
 ** The main computation should be just
@@ -110,6 +171,156 @@ static int l_hashfloat (lua_Number n) {
 #endif
 
 
+#if defined(LUA_USE_SWISSTABLE)
+
+/*
+** {=============================================================
+** Control bytes
+** ==============================================================
+*/
+
+#define GROUPSIZE	16
+
+/* control byte of a never used node (used ones hold 7 bits of a hash) */
+#define CTRL_EMPTY	0x80
+
+/* control bytes past the nodes of hash parts smaller than a group */
+#define CTRL_SENTINEL	0xFE
+
+/* the control bytes of a table follow its nodes */
+#define ctrlbytes(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+/* number of control bytes of a hash part of 'size' nodes */
+#define sizectrl(size)	((size) < GROUPSIZE ? GROUPSIZE : (size))
+
+/* number of nodes allocated for 'size' nodes and their control bytes */
+#define sizenodeblock(size) (cast(size_t, size) + \
+	(sizectrl(cast(size_t, size)) + sizeof(Node) - 1) / sizeof(Node))
+
+#define freenodes(L,n,size)	luaM_freearray(L, n, sizenodeblock(size))
+
+/*
+** number of keys an empty hash part of 'size' nodes can take: hash parts
+** larger than a group keep 1/8 of their nodes empty, to end the probe
+** sequences of missing keys early
+*/
+#define maxgrowth(size)	((size) <= GROUPSIZE ? (size) : (size) - (size) / 8)
+
+/* index of the last group of nodes of a table */
+#define groupmask(t)	(cast(unsigned int, sizenode(t) - 1) / GROUPSIZE)
+
+/* control byte of a hash (the group is chosen with the low bits) */
+#define ctrlhash(h)	cast_int((h) >> 25)
+
+
+/* a dummy hash part, where no key can be found nor inserted */
+static const struct {
+  Node node;
+  lu_byte ctrl[GROUPSIZE];
+} dummy_ = {
+  {{NILCONSTANT}, {{NILCONSTANT, 0}}},
+  {CTRL_SENTINEL, CTRL_SENTINEL, CTRL_SENTINEL, CTRL_SENTINEL,
+   CTRL_SENTINEL, CTRL_SENTINEL, CTRL_SENTINEL, CTRL_SENTINEL,
+   CTRL_SENTINEL, CTRL_SENTINEL, CTRL_SENTINEL, CTRL_SENTINEL,
+   CTRL_SENTINEL, CTRL_SENTINEL, CTRL_SENTINEL, CTRL_SENTINEL}
+};
+
+#define dummynode		(&dummy_.node)
+
+
+/* one bit per control byte of a group */
+typedef unsigned int l_groupmask;
+
+#if defined(__SSE2__)
+
+/* bit 'i' is set when control byte 'i' of group 'g' is 'c' */
+static l_groupmask matchgroup (const lu_byte *g, int c) {
+  __m128i group = _mm_loadu_si128(cast(const __m128i *, g));
+  __m128i eq = _mm_cmpeq_epi8(group, _mm_set1_epi8(cast(char, c)));
+  return cast(l_groupmask, _mm_movemask_epi8(eq));
+}
+
+#else
+
+static l_groupmask matchgroup (const lu_byte *g, int c) {
+  l_groupmask m = 0;
+  int i;
+  for (i = 0; i < GROUPSIZE; i++)
+    m |= cast(l_groupmask, g[i] == c) << i;
+  return m;
+}
+
+#endif
+
+
+/*
+** spreads the bits of a hash value: both its low bits (choosing the
+** group) and its high bits (the control byte) must vary, but integer
+** keys are often sequential and pointers aligned
+*/
+static unsigned int mixhash (unsigned int h) {
+  h *= 0x9e3779b1u;
+  return h ^ (h >> 16);
+}
+
+
+#define hashint(i)	mixhash(cast(unsigned int, l_castS2U(i)))
+
+/* string hashes are already spread */
+#define hashstr(str)	((str)->hash)
+
+
+static unsigned int hashkey (const TValue *key) {
+  switch (ttype(key)) {
+    case LUA_TNUMINT:
+      return hashint(ivalue(key));
+    case LUA_TNUMFLT:
+      return mixhash(cast(unsigned int, l_hashfloat(fltvalue(key))));
+    case LUA_TSHRSTR:
+      return hashstr(tsvalue(key));
+    case LUA_TLNGSTR:
+      return luaS_hashlongstr(tsvalue(key));
+    case LUA_TBOOLEAN:
+      return mixhash(bvalue(key));
+    case LUA_TLIGHTUSERDATA:
+      return mixhash(point2uint(pvalue(key)));
+    case LUA_TLCF:
+      return mixhash(point2uint(fvalue(key)));
+    default:
+      lua_assert(!ttisdeadkey(key));
+      return mixhash(point2uint(gcvalue(key)));
+  }
+}
+
+
+/*
+** runs 'body' for each node 'n' of table 't' whose control byte matches
+** hash 'h', in probe order: groups at triangular offsets (which visit
+** all of them) from the group chosen by 'h'. Stops after a group with
+** an empty node, as a key with that hash would have been inserted there.
+*/
+#define probenodes(t,h,n,body) { \
+  const lu_byte *ctrl_ = ctrlbytes(t); \
+  unsigned int h_ = (h); \
+  unsigned int gmask_ = groupmask(t); \
+  unsigned int g_ = h_ & gmask_; \
+  unsigned int step_ = 0; \
+  for (;;) { \
+    const lu_byte *group_ = ctrl_ + g_ * GROUPSIZE; \
+    l_groupmask m_; \
+    for (m_ = matchgroup(group_, ctrlhash(h_)); m_ != 0; m_ &= m_ - 1) { \
+      Node *n = gnode(t, g_ * GROUPSIZE + firstbit(m_)); \
+      body \
+    } \
+    if (matchgroup(group_, CTRL_EMPTY) != 0 || step_ == gmask_) \
+      break; \
+    g_ = (g_ + ++step_) & gmask_; \
+  } }
+
+/* }============================================================= */
+
+#else
+
 /*
 ** returns the 'main' position of an element in a table (that is, the index
 ** of its hash value)
@@ -136,6 +347,8 @@ static Node *mainposition (const Table *t, const TValue *key) {
   }
 }
 
+#endif
+
 
 /*
 ** returns the index for 'key' if 'key' is an appropriate key to live in
@@ -151,18 +364,141 @@ static unsigned int arrayindex (const TValue *key) {
 }
 
 
+/*
+** {=============================================================
+** Paged part
+** ==============================================================
+*/
+
+/* bytes of a page of 'size' slots, of a paged part of 'n' pages */
+#define sizepage(size)	(offsetof(ArrayPage, v) + sizeof(TValue) * (size))
+#define sizepages(n)	(offsetof(ArrayPages, page) + sizeof(ArrayPage *) * (n))
+
+/* index in 'pg->v' of the slot of bit 'b' (whether present or not) */
+#define slotindex(pg,b)	popcount((pg)->present & ((1u << (b)) - 1))
+
+
+/*
+** keys from 1 to this limit are numbered by themselves in traversals
+** (array part, then paged part)
+*/
+static unsigned int sizeintkeys (const Table *t) {
+  unsigned int size = sizepaged(t);
+  return (size > t->sizearray) ? size : t->sizearray;
+}
+
+
+/* slot of key 'k + 1' in the paged part of 't' ('k < sizepaged(t)') */
+static const TValue *getpaged (const Table *t, unsigned int k) {
+  const ArrayPage *pg = t->pages->page[k >> PAGEBITS];
+  unsigned int b = k & (PAGESIZE - 1);
+  if (pg != NULL && (pg->present & (1u << b)))
+    return &pg->v[slotindex(pg, b)];
+  return luaO_nilobject;
+}
+
+
+/* adds the slot of key 'k + 1' to the paged part of 't' */
+static TValue *newpagedkey (lua_State *L, Table *t, unsigned int k) {
+  ArrayPage **ppg = &t->pages->page[k >> PAGEBITS];
+  ArrayPage *pg = *ppg;
+  unsigned int b = k & (PAGESIZE - 1);
+  int i;
+  if (pg == NULL) {
+    pg = cast(ArrayPage *, luaM_malloc(L, sizepage(MINPAGESLOTS)));
+    pg->present = 0;
+    pg->n = 0;
+    pg->size = MINPAGESLOTS;
+    *ppg = pg;
+  }
+  else if (pg->n == pg->size) {  /* page full? */
+    int size = pg->size * 2;
+    pg = cast(ArrayPage *, luaM_realloc_(L, pg, sizepage(pg->size),
+                                            sizepage(size)));
+    pg->size = cast_byte(size);
+    *ppg = pg;
+  }
+  lua_assert(!(pg->present & (1u << b)) && pg->n < pg->size);
+  i = slotindex(pg, b);
+  memmove(&pg->v[i + 1], &pg->v[i], sizeof(TValue) * (pg->n - i));
+  pg->present |= 1u << b;
+  pg->n++;
+  t->pages->nslots++;
+  setnilvalue(&pg->v[i]);
+  return &pg->v[i];
+}
+
+
+/* removes the slots of the removed keys of a page, freeing it if empty */
+static ArrayPage *compactpage (lua_State *L, ArrayPage *pg) {
+  unsigned int m, present = 0;
+  int i = 0, n = 0;
+  for (m = pg->present; m != 0; m &= m - 1, i++) {
+    if (!ttisnil(&pg->v[i])) {
+      present |= m & (0u - m);  /* lowest bit of 'm' */
+      setobj(L, &pg->v[n], &pg->v[i]);
+      n++;
+    }
+  }
+  if (n == 0) {
+    luaM_freemem(L, pg, sizepage(pg->size));
+    return NULL;
+  }
+  pg->present = present;
+  pg->n = cast_byte(n);
+  return pg;
+}
+
+
+static void freepages (lua_State *L, ArrayPages *ap) {
+  unsigned int p;
+  for (p = 0; p < ap->npages; p++) {
+    if (ap->page[p] != NULL)
+      luaM_freemem(L, ap->page[p], sizepage(ap->page[p]->size));
+  }
+  luaM_freemem(L, ap, sizepages(ap->npages));
+}
+
+/* }============================================================= */
+
+
 /*
 ** returns the index of a 'key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by 0.
+** elements in the array part, then elements in the paged part, then
+** elements in the hash part. The beginning of a traversal is signaled
+** by 0.
 */
 static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   unsigned int i;
+  unsigned int nint = sizeintkeys(t);
   if (ttisnil(key)) return 0;  /* first iteration */
   i = arrayindex(key);
-  if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
+  if (i != 0 && i <= nint)  /* is 'key' inside array or paged part? */
     return i;  /* yes; that's the index */
   else {
+#if defined(LUA_USE_SWISSTABLE)
+    unsigned int h = hashkey(key);
+    probenodes(t, h, n, {
+      if (luaV_rawequalobj(gkey(n), key)) {
+        i = cast_int(n - gnode(t, 0));  /* key index in hash table */
+        /* hash elements are numbered after array and paged ones */
+        return (i + 1) + nint;
+      }
+    })
+    /* key may be dead already, but it is ok to use it in 'next'; it is
+       only looked for after live keys, as the object of a dead key may
+       have been freed and its address reused by a key inserted later */
+    if (iscollectable(key)) {
+      probenodes(t, h, n, {
+        if (ttisdeadkey(gkey(n)) && deadvalue(gkey(n)) == gcvalue(key)) {
+          i = cast_int(n - gnode(t, 0));
+          return (i + 1) + nint;
+        }
+      })
+    }
+    luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    return 0;  /* to avoid warnings */
+#else
     int nx;
     Node *n = mainposition(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -171,31 +507,97 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
             (ttisdeadkey(gkey(n)) && iscollectable(key) &&
              deadvalue(gkey(n)) == gcvalue(key))) {
         i = cast_int(n - gnode(t, 0));  /* key index in hash table */
-        /* hash elements are numbered after array ones */
-        return (i + 1) + t->sizearray;
+        /* hash elements are numbered after array and paged ones */
+        return (i + 1) + nint;
       }
       nx = gnext(n);
       if (nx == 0)
         luaG_runerror(L, "invalid key to 'next'");  /* key not found */
       else n += nx;
     }
+#endif
   }
 }
 
 
+/*
+** true if 'key' (not nil) is at index 'i' of table 't', as numbered by
+** 'findindex'
+*/
+static int iskeyat (const Table *t, const TValue *key, unsigned int i) {
+  unsigned int nint = sizeintkeys(t);
+  if (i <= nint)  /* array or paged part? */
+    return (ttisinteger(key) && l_castS2U(ivalue(key)) == i);
+  else {
+    const Node *n;
+    i -= nint + 1;
+    if (i >= cast(unsigned int, sizenode(t)))
+      return 0;
+    n = gnode(t, i);
+    /* key may be dead already, but it is ok to use it in 'next' */
+    return (luaV_rawequalobj(gkey(n), key) ||
+             (ttisdeadkey(gkey(n)) && iscollectable(key) &&
+              deadvalue(gkey(n)) == gcvalue(key)));
+  }
+}
+
+
+/* traversal cursor of table 't' */
+#define nextcursor(g,t) \
+	(&(g)->nextcursors[(point2uint(t) >> 6) & (NEXTCURSORS - 1)])
+
+
+/*
+** A traversal usually goes on from the key 'luaH_next' last returned:
+** a cursor remembers the index of that key for its table, so the next
+** step does not need to look for it again (by hashing it and comparing
+** keys along its chain or probe sequence). The cursor is only a hint,
+** checked against the key: any other key, or a key moved by a rehash,
+** goes through 'findindex' as usual.
+*/
 int luaH_next (lua_State *L, Table *t, StkId key) {
-  unsigned int i = findindex(L, t, key);  /* find original element */
+  NextCursor *c = nextcursor(G(L), t);
+  unsigned int nint = sizeintkeys(t);
+  unsigned int i;
+  if (c->t == t && !ttisnil(key) && iskeyat(t, key, c->index))
+    i = c->index;  /* continuing the last traversal of 't' */
+  else
+    i = findindex(L, t, key);  /* find original element */
   for (; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setivalue(key, i + 1);
+      setivalue(L, key, i + 1);
       setobj2s(L, key+1, &t->array[i]);
+      c->t = t;
+      c->index = i + 1;
       return 1;
     }
   }
-  for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {  /* hash part */
+  /* then paged part, a page at a time from key 'i + 1' */
+  for (; i < nint; i = (i | (PAGESIZE - 1)) + 1) {
+    const ArrayPage *pg = t->pages->page[i >> PAGEBITS];
+    unsigned int m;
+    if (pg == NULL)
+      continue;
+    m = pg->present & (~0u << (i & (PAGESIZE - 1)));  /* keys from 'i + 1' */
+    for (; m != 0; m &= m - 1) {
+      unsigned int b = firstbit(m);
+      const TValue *slot = &pg->v[slotindex(pg, b)];
+      if (!ttisnil(slot)) {  /* a non-nil value? */
+        unsigned int k = (i & ~(PAGESIZE - 1)) + b + 1;
+        setivalue(L, key, k);
+        setobj2s(L, key+1, slot);
+        c->t = t;
+        c->index = k;
+        return 1;
+      }
+    }
+  }
+  for (i -= nint; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, gkey(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
+      c->t = t;
+      c->index = (i + 1) + nint;
       return 1;
     }
   }
@@ -222,11 +624,12 @@ static unsigned int computesizes (unsigned int nums[], unsigned int *pna) {
   unsigned int a = 0;  /* number of elements smaller than 2^i */
   unsigned int na = 0;  /* number of elements to go to array part */
   unsigned int optimal = 0;  /* optimal size for array part */
-  /* loop while keys can fill more than half of total size */
-  for (i = 0, twotoi = 1; *pna > twotoi / 2; i++, twotoi *= 2) {
+  /* loop while keys can fill enough of total size */
+  for (i = 0, twotoi = 1; i <= MAXABITS && *pna > twotoi / 2;
+       i++, twotoi *= 2) {
     if (nums[i] > 0) {
       a += nums[i];
-      if (a > twotoi/2) {  /* more than half elements present? */
+      if (a > twotoi / 2) {  /* more than half elements present? */
         optimal = twotoi;  /* optimal size (till now) */
         na = a;  /* all elements up to 'optimal' will go to array part */
       }
@@ -238,6 +641,38 @@ static unsigned int computesizes (unsigned int nums[], unsigned int *pna) {
 }
 
 
+/*
+** Compute the number of pages of the paged part of table 't', whose
+** array part has 'asize' slots: the paged part covers the integer keys
+** above 'asize' up to the largest power of 2 such that more than
+** 1/PAGEDENSITY of the keys in between are present. 'pnp' leaves with
+** the number of keys that will go to the paged part.
+*/
+static unsigned int computepages (unsigned int nums[], unsigned int asize,
+                                  unsigned int *pnp) {
+  int i;
+  unsigned int twotoi;  /* 2^i (candidate for the end of the paged part) */
+  unsigned int a = 0;  /* number of elements between 'asize' and 2^i */
+  unsigned int np = 0;  /* number of elements to go to the paged part */
+  unsigned int limit = 0;  /* end of the paged part */
+  for (i = 0, twotoi = 1; i <= MAXABITS; i++, twotoi *= 2) {
+    if (twotoi > asize && nums[i] > 0) {  /* keys above the array part? */
+      a += nums[i];
+      if (a > (twotoi - asize) / PAGEDENSITY) {  /* enough of them? */
+        limit = twotoi;
+        np = a;
+      }
+    }
+  }
+  if (np < MINPAGEDKEYS) {  /* too few keys to be worth pages? */
+    *pnp = 0;
+    return 0;
+  }
+  *pnp = np;
+  return (limit + PAGESIZE - 1) / PAGESIZE;
+}
+
+
 static int countint (const TValue *key, unsigned int *nums) {
   unsigned int k = arrayindex(key);
   if (k != 0) {  /* is 'key' an appropriate array index? */
@@ -280,6 +715,27 @@ static unsigned int numusearray (const Table *t, unsigned int *nums) {
 }
 
 
+/* count keys in the paged part of table 't', as 'numusearray' */
+static unsigned int numusepaged (const Table *t, unsigned int *nums) {
+  unsigned int p;
+  unsigned int ause = 0;
+  for (p = 0; p < t->pages->npages; p++) {
+    const ArrayPage *pg = t->pages->page[p];
+    unsigned int m;
+    int i = 0;
+    if (pg == NULL)
+      continue;
+    for (m = pg->present; m != 0; m &= m - 1, i++) {
+      if (!ttisnil(&pg->v[i])) {
+        nums[luaO_ceillog2(p * PAGESIZE + firstbit(m) + 1)]++;
+        ause++;
+      }
+    }
+  }
+  return ause;
+}
+
+
 static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
   int totaluse = 0;  /* total number of elements */
   int ause = 0;  /* elements added to 'nums' (can go to array part) */
@@ -305,6 +761,27 @@ static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
 }
 
 
+/* makes all the nodes of the (not dummy) hash part of 't' free */
+static void clearnodes (Table *t) {
+  int i;
+  int size = sizenode(t);
+  for (i = 0; i < size; i++) {
+    Node *n = gnode(t, i);
+    gnext(n) = 0;
+    setnilvalue(wgkey(n));
+    setnilvalue(gval(n));
+  }
+#if defined(LUA_USE_SWISSTABLE)
+  memset(ctrlbytes(t), CTRL_EMPTY, size);
+  memset(ctrlbytes(t) + size, CTRL_SENTINEL, sizectrl(size) - size);
+  /* 'lastfree - node' counts the keys that can still be inserted */
+  t->lastfree = gnode(t, maxgrowth(size));
+#else
+  t->lastfree = gnode(t, size);  /* all positions are free */
+#endif
+}
+
+
 static void setnodevector (lua_State *L, Table *t, unsigned int size) {
   if (size == 0) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
@@ -312,35 +789,86 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
     t->lastfree = NULL;  /* signal that it is using dummy node */
   }
   else {
-    int i;
     int lsize = luaO_ceillog2(size);
+#if defined(LUA_USE_SWISSTABLE)
+    if (lsize < MAXHBITS && maxgrowth(twoto(lsize)) < cast_int(size))
+      lsize++;  /* keep room for empty nodes */
+#endif
     if (lsize > MAXHBITS)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
+#if defined(LUA_USE_SWISSTABLE)
+    t->node = luaM_newvector(L, sizenodeblock(size), Node);
+#else
     t->node = luaM_newvector(L, size, Node);
-    for (i = 0; i < (int)size; i++) {
-      Node *n = gnode(t, i);
-      gnext(n) = 0;
-      setnilvalue(wgkey(n));
-      setnilvalue(gval(n));
-    }
+#endif
     t->lsizenode = cast_byte(lsize);
-    t->lastfree = gnode(t, size);  /* all positions are free */
+    clearnodes(t);
   }
 }
 
 
-void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
-                                          unsigned int nhsize) {
+/*
+** creates a paged part of 'npages' pages for an array part of 'nasize'
+** slots, taking the pages of the old paged part 'pold' it still covers
+** (whose keys are all above 'nasize')
+*/
+static ArrayPages *newpages (lua_State *L, unsigned int npages,
+                             unsigned int nasize, ArrayPages *pold) {
+  ArrayPages *ap;
+  unsigned int p;
+  if (npages == 0)
+    return NULL;
+  ap = cast(ArrayPages *, luaM_malloc(L, sizepages(npages)));
+  ap->npages = npages;
+  ap->nslots = 0;
+  ap->maxslots = UINT_MAX;  /* no rehash while re-inserting keys */
+  for (p = 0; p < npages; p++) {
+    ArrayPage *pg = NULL;
+    if (pold != NULL && p < pold->npages && p * PAGESIZE >= nasize &&
+        pold->page[p] != NULL) {
+      pg = compactpage(L, pold->page[p]);
+      pold->page[p] = NULL;
+      if (pg != NULL)
+        ap->nslots += pg->n;
+    }
+    ap->page[p] = pg;
+  }
+  return ap;
+}
+
+
+/* re-inserts the keys of the pages left in the old paged part 'ap' */
+static void reinsertpages (lua_State *L, Table *t, ArrayPages *ap) {
+  unsigned int p;
+  for (p = 0; p < ap->npages; p++) {
+    ArrayPage *pg = ap->page[p];
+    unsigned int m;
+    int i = 0;
+    if (pg == NULL)
+      continue;
+    for (m = pg->present; m != 0; m &= m - 1, i++) {
+      if (!ttisnil(&pg->v[i]))
+        luaH_setint(L, t, p * PAGESIZE + firstbit(m) + 1, &pg->v[i]);
+    }
+  }
+}
+
+
+static void resize (lua_State *L, Table *t, unsigned int nasize,
+                    unsigned int npages, unsigned int nhsize) {
   unsigned int i;
   int j;
   unsigned int oldasize = t->sizearray;
   int oldhsize = allocsizenode(t);
   Node *nold = t->node;  /* save old hash ... */
+  ArrayPages *pold = t->pages;  /* ... and old paged part */
+  ArrayPages *pnew = newpages(L, npages, nasize, pold);
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
-  /* create new hash part with appropriate size */
+  /* create new hash and paged parts with appropriate sizes */
   setnodevector(L, t, nhsize);
+  t->pages = pnew;
   if (nasize < oldasize) {  /* array part must shrink? */
     t->sizearray = nasize;
     /* re-insert elements from vanishing slice */
@@ -361,7 +889,21 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
     }
   }
   if (oldhsize > 0)  /* not the dummy node? */
-    luaM_freearray(L, nold, cast(size_t, oldhsize)); /* free old hash */
+    freenodes(L, nold, oldhsize);  /* free old hash */
+  if (pold != NULL) {  /* re-insert elements from the other old pages */
+    reinsertpages(L, t, pold);
+    freepages(L, pold);
+  }
+  if (pnew != NULL)  /* rehash once the paged part doubled */
+    pnew->maxslots = pnew->nslots * 2 + PAGESIZE;
+}
+
+
+void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
+                                          unsigned int nhsize) {
+  /* keep the paged part while it covers keys above the array part */
+  unsigned int npages = (sizepaged(t) > nasize) ? t->pages->npages : 0;
+  resize(L, t, nasize, npages, nhsize);
 }
 
 
@@ -376,20 +918,29 @@ void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
 static void rehash (lua_State *L, Table *t, const TValue *ek) {
   unsigned int asize;  /* optimal size for array part */
   unsigned int na;  /* number of keys in the array part */
+  unsigned int npages;  /* optimal number of pages for paged part */
+  unsigned int np;  /* number of keys in the paged part */
+  unsigned int nint;  /* number of integer keys */
   unsigned int nums[MAXABITS + 1];
   int i;
   int totaluse;
   for (i = 0; i <= MAXABITS; i++) nums[i] = 0;  /* reset counts */
   na = numusearray(t, nums);  /* count keys in array part */
+  if (t->pages != NULL)  /* count keys in paged part */
+    na += numusepaged(t, nums);
   totaluse = na;  /* all those keys are integer keys */
   totaluse += numusehash(t, nums, &na);  /* count keys in hash part */
   /* count extra key */
   na += countint(ek, nums);
   totaluse++;
+  nint = na;
   /* compute new size for array part */
   asize = computesizes(nums, &na);
+  /* compute new size for paged part, from the other integer keys */
+  npages = computepages(nums, asize, &np);
+  lua_assert(na + np <= nint);
   /* resize the table to new computed sizes */
-  luaH_resize(L, t, asize, totaluse - na);
+  resize(L, t, asize, npages, totaluse - na - np);
 }
 
 
@@ -406,19 +957,74 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  t->pages = NULL;
   setnodevector(L, t, 0);
   return t;
 }
 
 
+/*
+** removes all the entries of 't', keeping its parts allocated: filling
+** it again does not need any rehash while it fits. (Removed values need
+** no barrier, and cached absent metamethods are still absent.)
+*/
+void luaH_clear (Table *t) {
+  unsigned int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (t->pages != NULL) {  /* empty the pages, keeping them allocated */
+    for (i = 0; i < t->pages->npages; i++) {
+      if (t->pages->page[i] != NULL) {
+        t->pages->page[i]->present = 0;
+        t->pages->page[i]->n = 0;
+      }
+    }
+    t->pages->nslots = 0;
+  }
+  if (!isdummy(t))
+    clearnodes(t);
+}
+
+
 void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t))
-    luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
+    freenodes(L, t->node, sizenode(t));
+  if (t->pages != NULL)
+    freepages(L, t->pages);
   luaM_freearray(L, t->array, t->sizearray);
   luaM_free(L, t);
 }
 
 
+#if defined(LUA_USE_SWISSTABLE)
+
+/*
+** returns the first never used node in the probe sequence of hash 'h',
+** marked as used, or NULL when the table must grow
+*/
+static Node *getfreepos (Table *t, unsigned int h) {
+  lu_byte *ctrl;
+  unsigned int gmask, g, step = 0;
+  if (isdummy(t) || t->lastfree == t->node)  /* no room left? */
+    return NULL;
+  ctrl = ctrlbytes(t);
+  gmask = groupmask(t);
+  g = h & gmask;
+  for (;;) {
+    l_groupmask m = matchgroup(ctrl + g * GROUPSIZE, CTRL_EMPTY);
+    if (m != 0) {
+      unsigned int i = g * GROUPSIZE + firstbit(m);
+      ctrl[i] = cast_byte(ctrlhash(h));
+      t->lastfree--;  /* one less key can be inserted */
+      return gnode(t, i);
+    }
+    lua_assert(step < gmask);
+    g = (g + ++step) & gmask;
+  }
+}
+
+#else
+
 static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
@@ -430,6 +1036,8 @@ static Node *getfreepos (Table *t) {
   return NULL;  /* could not find a free place */
 }
 
+#endif
+
 
 
 /*
@@ -438,6 +1046,8 @@ static Node *getfreepos (Table *t) {
 ** position or not: if it is not, move colliding node to an empty place and
 ** put new key in its main position; otherwise (colliding node is in its main
 ** position), new key goes to an empty position.
+** (With LUA_USE_SWISSTABLE, the new key simply goes to the first empty
+** node of its probe sequence.)
 */
 TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
   Node *mp;
@@ -446,12 +1056,28 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
   else if (ttisfloat(key)) {
     lua_Integer k;
     if (luaV_tointeger(key, &k, 0)) {  /* does index fit in an integer? */
-      setivalue(&aux, k);
+      setivalue(L, &aux, k);
       key = &aux;  /* insert it as an integer */
     }
     else if (luai_numisnan(fltvalue(key)))
       luaG_runerror(L, "table index is NaN");
   }
+  if (ttisinteger(key) &&  /* key in the paged part? */
+      l_castS2U(ivalue(key)) - 1 < sizepaged(t)) {
+    if (t->pages->nslots >= t->pages->maxslots) {  /* grew enough? */
+      rehash(L, t, key);  /* maybe move keys to the array part */
+      return luaH_set(L, t, key);  /* insert key into new parts */
+    }
+    return newpagedkey(L, t, cast(unsigned int, ivalue(key) - 1));
+  }
+#if defined(LUA_USE_SWISSTABLE)
+  mp = getfreepos(t, hashkey(key));
+  if (mp == NULL) {  /* no room left? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
+  }
+#else
   mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
@@ -484,6 +1110,7 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
       mp = f;
     }
   }
+#endif
   setnodekey(L, &mp->i_key, key);
   luaC_barrierback(L, t, key);
   lua_assert(ttisnil(gval(mp)));
@@ -498,7 +1125,15 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
   /* (1 <= key && key <= t->sizearray) */
   if (l_castS2U(key) - 1 < t->sizearray)
     return &t->array[key - 1];
+  else if (l_castS2U(key) - 1 < sizepaged(t))
+    return getpaged(t, cast(unsigned int, key - 1));
   else {
+#if defined(LUA_USE_SWISSTABLE)
+    probenodes(t, hashint(key), n, {
+      if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
+        return gval(n);  /* that's it */
+    })
+#else
     Node *n = hashint(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
@@ -509,6 +1144,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
         n += nx;
       }
     }
+#endif
     return luaO_nilobject;
   }
 }
@@ -518,6 +1154,14 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
+#if defined(LUA_USE_SWISSTABLE)
+  lua_assert(key->tt == LUA_TSHRSTR);
+  probenodes(t, hashstr(key), n, {
+    if (ttisshrstring(gkey(n)) && eqshrstr(tsvalue(gkey(n)), key))
+      return gval(n);  /* that's it */
+  })
+  return luaO_nilobject;  /* not found */
+#else
   Node *n = hashstr(t, key);
   lua_assert(key->tt == LUA_TSHRSTR);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -531,6 +1175,42 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
       n += nx;
     }
   }
+#endif
+}
+
+
+/*
+** Same as 'luaH_getshortstr', also setting '*slot' to the index of the
+** node holding the key (left unchanged when the key is not found)
+*/
+const TValue *luaH_getshortstrslot (Table *t, TString *key,
+                                    unsigned int *slot) {
+#if defined(LUA_USE_SWISSTABLE)
+  lua_assert(key->tt == LUA_TSHRSTR);
+  probenodes(t, hashstr(key), n, {
+    if (ttisshrstring(gkey(n)) && eqshrstr(tsvalue(gkey(n)), key)) {
+      *slot = cast(unsigned int, n - gnode(t, 0));
+      return gval(n);  /* that's it */
+    }
+  })
+  return luaO_nilobject;  /* not found */
+#else
+  Node *n = hashstr(t, key);
+  lua_assert(key->tt == LUA_TSHRSTR);
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    const TValue *k = gkey(n);
+    if (ttisshrstring(k) && eqshrstr(tsvalue(k), key)) {
+      *slot = cast(unsigned int, n - gnode(t, 0));
+      return gval(n);  /* that's it */
+    }
+    else {
+      int nx = gnext(n);
+      if (nx == 0)
+        return luaO_nilobject;  /* not found */
+      n += nx;
+    }
+  }
+#endif
 }
 
 
@@ -539,6 +1219,13 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric (Table *t, const TValue *key) {
+#if defined(LUA_USE_SWISSTABLE)
+  probenodes(t, hashkey(key), n, {
+    if (luaV_rawequalobj(gkey(n), key))
+      return gval(n);  /* that's it */
+  })
+  return luaO_nilobject;  /* not found */
+#else
   Node *n = mainposition(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (luaV_rawequalobj(gkey(n), key))
@@ -550,6 +1237,7 @@ static const TValue *getgeneric (Table *t, const TValue *key) {
       n += nx;
     }
   }
+#endif
 }
 
 
@@ -603,7 +1291,7 @@ void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
     cell = cast(TValue *, p);
   else {
     TValue k;
-    setivalue(&k, key);
+    setivalue(L, &k, key);
     cell = luaH_newkey(L, t, &k);
   }
   setobj2t(L, cell, value);
@@ -651,7 +1339,7 @@ int luaH_getn (Table *t) {
     return i;
   }
   /* else must find a boundary in hash part */
-  else if (isdummy(t))  /* hash part is empty? */
+  else if (isdummy(t) && t->pages == NULL)  /* no other parts? */
     return j;  /* that is easy... */
   else return unbound_search(t, j);
 }
@@ -661,7 +1349,12 @@ int luaH_getn (Table *t) {
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
+#if defined(LUA_USE_SWISSTABLE)
+  /* first node of the group where the probe sequence of 'key' starts */
+  return gnode(t, (hashkey(key) & groupmask(t)) * GROUPSIZE);
+#else
   return mainposition(t, key);
+#endif
 }
 
 int luaH_isdummy (const Table *t) { return isdummy(t); }
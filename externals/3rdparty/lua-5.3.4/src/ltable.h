@@ -35,6 +35,30 @@
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
+/* keys per page of the paged part (bits of 'ArrayPage.present') */
+#define PAGEBITS	5
+#define PAGESIZE	(1u << PAGEBITS)
+
+/* keys covered by the paged part of 't' (from 1, the array part first) */
+#define sizepaged(t)	((t)->pages == NULL ? 0u : (t)->pages->npages * PAGESIZE)
+
+/*
+** runs 'body' for each slot 'o' of the paged part of 't' (slots of
+** removed keys hold nil until the next rehash)
+*/
+#define forpagedslots(t,o,body) { \
+  if ((t)->pages != NULL) { \
+    ArrayPage **p_ = (t)->pages->page; \
+    ArrayPage **plast_ = p_ + (t)->pages->npages; \
+    for (; p_ < plast_; p_++) { \
+      if (*p_ != NULL) { \
+        TValue *o = (*p_)->v, *olast_ = o + (*p_)->n; \
+        for (; o < olast_; o++) body \
+      } \
+    } \
+  } }
+
+
 /* returns the key, given the value of a table entry */
 #define keyfromval(v) \
   (gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
@@ -44,6 +68,8 @@ LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getshortstrslot (Table *t, TString *key,
+                                              unsigned int *slot);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key);
@@ -53,6 +79,8 @@ LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
+/* removes all the entries of a table, keeping its allocated parts */
+LUAI_FUNC void luaH_clear (Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
 
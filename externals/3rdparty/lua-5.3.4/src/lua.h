@@ -144,6 +144,7 @@ extern const char lua_ident[];
 */
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
 LUA_API void       (lua_close) (lua_State *L);
+LUA_API void       (lua_fastclose) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
 
 LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
@@ -264,6 +265,7 @@ LUA_API void  (lua_rawseti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API void  (lua_setuservalue) (lua_State *L, int idx);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
 
 
 /*
@@ -308,6 +310,13 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCSETMINORMUL	12
+#define LUA_GCSETMAJORMUL	13
+#define LUA_GCSETSTEPTIME	14
+#define LUA_GCSTATS		15
+#define LUA_GCIDLE		16
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
@@ -273,10 +273,14 @@
 ** this attribute. Unfortunately, gcc does not offer a way to check
 ** whether the target offers that support, and those without support
 ** give a warning about it. To avoid these warnings, change to the
-** default definition.
+** default definition. LUA_EXPORT_INTERNALS exports them anyway, for
+** ahead-of-time compiled code linked against the Lua library (see
+** laot.h).
 */
-#if defined(__GNUC__) && ((__GNUC__*100 + __GNUC_MINOR__) >= 302) && \
-    defined(__ELF__)		/* { */
+#if defined(LUA_EXPORT_INTERNALS)	/* { */
+#define LUAI_FUNC	extern
+#elif defined(__GNUC__) && ((__GNUC__*100 + __GNUC_MINOR__) >= 302) && \
+    defined(__ELF__)		/* }{ */
 #define LUAI_FUNC	__attribute__((visibility("hidden"))) extern
 #else				/* }{ */
 #define LUAI_FUNC	extern
@@ -19,6 +19,7 @@
 #include "lfunc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstring.h"
 #include "lundump.h"
 #include "lzio.h"
@@ -109,6 +110,8 @@ static void LoadCode (LoadState *S, Proto *f) {
   f->code = luaM_newvector(S->L, n, Instruction);
   f->sizecode = n;
   LoadVector(S, f->code, n);
+  luaP_fuse(f->code, n);  /* superinstructions */
+  luaF_initicache(S->L, f);
 }
 
 
@@ -136,7 +139,7 @@ static void LoadConstants (LoadState *S, Proto *f) {
       setfltvalue(o, LoadNumber(S));
       break;
     case LUA_TNUMINT:
-      setivalue(o, LoadInteger(S));
+      setivalue(S->L, o, LoadInteger(S));
       break;
     case LUA_TSHRSTR:
     case LUA_TLNGSTR:
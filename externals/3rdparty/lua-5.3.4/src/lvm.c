@@ -18,10 +18,12 @@
 
 #include "lua.h"
 
+#include "laot.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -70,14 +72,16 @@
 ** by the macro 'tonumber'.
 */
 int luaV_tonumber_ (const TValue *obj, lua_Number *n) {
-  TValue v;
+  lua_Integer i;
+  int isint;
   if (ttisinteger(obj)) {
     *n = cast_num(ivalue(obj));
     return 1;
   }
   else if (cvt2num(obj) &&  /* string convertible to number? */
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
-    *n = nvalue(&v);  /* convert result of 'luaO_str2num' to a float */
+            luaO_str2val(svalue(obj), &i, n, &isint) == vslen(obj) + 1) {
+    if (isint)
+      *n = cast_num(i);  /* convert result of 'luaO_str2val' to a float */
     return 1;
   }
   else
@@ -91,28 +95,29 @@ int luaV_tonumber_ (const TValue *obj, lua_Number *n) {
 ** mode == 1: takes the floor of the number
 ** mode == 2: takes the ceil of the number
 */
-int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode) {
-  TValue v;
- again:
-  if (ttisfloat(obj)) {
-    lua_Number n = fltvalue(obj);
-    lua_Number f = l_floor(n);
-    if (n != f) {  /* not an integral value? */
-      if (mode == 0) return 0;  /* fails if mode demands integral value */
-      else if (mode > 1)  /* needs ceil? */
-        f += 1;  /* convert floor to ceil (remember: n != f) */
-    }
-    return lua_numbertointeger(f, p);
+static int flttointeger (lua_Number n, lua_Integer *p, int mode) {
+  lua_Number f = l_floor(n);
+  if (n != f) {  /* not an integral value? */
+    if (mode == 0) return 0;  /* fails if mode demands integral value */
+    else if (mode > 1)  /* needs ceil? */
+      f += 1;  /* convert floor to ceil (remember: n != f) */
   }
+  return lua_numbertointeger(f, p);
+}
+
+
+int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode) {
+  lua_Number n;
+  int isint;
+  if (ttisfloat(obj))
+    return flttointeger(fltvalue(obj), p, mode);
   else if (ttisinteger(obj)) {
     *p = ivalue(obj);
     return 1;
   }
   else if (cvt2num(obj) &&
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
-    obj = &v;
-    goto again;  /* convert result from 'luaO_str2num' to an integer */
-  }
+            luaO_str2val(svalue(obj), p, &n, &isint) == vslen(obj) + 1)
+    return isint || flttointeger(n, p, mode);  /* convert a float result */
   return 0;  /* conversion failed */
 }
 
@@ -521,15 +526,15 @@ void luaV_objlen (lua_State *L, StkId ra, const TValue *rb) {
       Table *h = hvalue(rb);
       tm = fasttm(L, h->metatable, TM_LEN);
       if (tm) break;  /* metamethod? break switch to call it */
-      setivalue(ra, luaH_getn(h));  /* else primitive len */
+      setivalue(L, ra, luaH_getn(h));  /* else primitive len */
       return;
     }
     case LUA_TSHRSTR: {
-      setivalue(ra, tsvalue(rb)->shrlen);
+      setivalue(L, ra, tsvalue(rb)->shrlen);
       return;
     }
     case LUA_TLNGSTR: {
-      setivalue(ra, tsvalue(rb)->u.lnglen);
+      setivalue(L, ra, tsvalue(rb)->u.lnglen);
       return;
     }
     default: {  /* try metamethod */
@@ -650,6 +655,54 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 }
 
 
+/*
+** put in 'ra' a closure of prototype 'p', reusing the cached one when
+** it has the right upvalues ('encup' are the upvalues of the enclosing
+** function, 'base' its base)
+*/
+void luaV_closure (lua_State *L, Proto *p, UpVal **encup, StkId base,
+                   StkId ra) {
+  LClosure *ncl = getcached(p, encup, base);  /* cached closure */
+  if (ncl == NULL)  /* no match? */
+    pushclosure(L, p, encup, base, ra);  /* create a new one */
+  else
+    setclLvalue(L, ra, ncl);  /* push cashed closure */
+}
+
+
+/*
+** prepare a numeric 'for' loop: convert its control values (in 'ra',
+** 'ra + 1' and 'ra + 2') to all integers or all floats, and pre-
+** decrement the initial value
+*/
+void luaV_forprep (lua_State *L, StkId ra) {
+  TValue *init = ra;
+  TValue *plimit = ra + 1;
+  TValue *pstep = ra + 2;
+  lua_Integer ilimit;
+  int stopnow;
+  if (ttisinteger(init) && ttisinteger(pstep) &&
+      forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {
+    /* all values are integer */
+    lua_Integer initv = (stopnow ? 0 : ivalue(init));
+    setivalue(L, plimit, ilimit);
+    setivalue(L, init, intop(-, initv, ivalue(pstep)));
+  }
+  else {  /* try making all values floats */
+    lua_Number ninit; lua_Number nlimit; lua_Number nstep;
+    if (!tonumber(plimit, &nlimit))
+      luaG_runerror(L, "'for' limit must be a number");
+    setfltvalue(plimit, nlimit);
+    if (!tonumber(pstep, &nstep))
+      luaG_runerror(L, "'for' step must be a number");
+    setfltvalue(pstep, nstep);
+    if (!tonumber(init, &ninit))
+      luaG_runerror(L, "'for' initial value must be a number");
+    setfltvalue(init, luai_numsub(L, ninit, nstep));
+  }
+}
+
+
 /*
 ** finish execution of an opcode interrupted by an yield
 */
@@ -657,7 +710,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = GET_BASEOPCODE(inst);
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV:
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
@@ -762,23 +815,86 @@ void luaV_finishOp (lua_State *L) {
   lua_assert(base <= L->top && L->top < L->stack + L->stacksize); \
 }
 
+/*
+** By default, use a 'switch' to dispatch opcodes; LUA_USE_JUMPTABLE
+** (set by the build where supported) uses a computed goto table
+** instead (see ljumptab.h)
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#define LUA_USE_JUMPTABLE	0
+#endif
+
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
 
 
+/*
+** end of a superinstruction: run the next instruction with the handler
+** at label 'lbl', without dispatch (and without the hook check: when
+** hooks are on, the next instruction is dispatched normally instead)
+*/
+#define vmfuse(lbl)	{ \
+  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) { vmbreak; } \
+  i = *(ci->u.l.savedpc++); \
+  ra = RA(i); \
+  goto lbl; }
+
+
+/* arithmetic opcodes with integer and float versions */
+#define op_arith(iop,fop,tm)	{ \
+  TValue *rb = RKB(i); \
+  TValue *rc = RKC(i); \
+  lua_Number nb; lua_Number nc; \
+  if (ttisinteger(rb) && ttisinteger(rc)) { \
+    lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc); \
+    setivalue(L, ra, intop(iop, ib, ic)); \
+  } \
+  else if (tonumber(rb, &nb) && tonumber(rc, &nc)) { \
+    setfltvalue(ra, fop(L, nb, nc)); \
+  } \
+  else { Protect(luaT_trybinTM(L, rb, rc, ra, tm)); } }
+
+
+#if defined(LUA_USE_INLINECACHE)
+/*
+** raw access through an inline cache: a short string key is first
+** looked for in the node where the instruction found it last time, so a
+** hit costs a type and a pointer comparison. A miss (the key moved, the
+** table is a different one, or the key is not there) does a normal
+** lookup and updates the cache.
+*/
+static const TValue *geticached (Table *h, const TValue *key,
+                                 unsigned int *ic) {
+  if (ttisshrstring(key)) {
+    Node *n = gnode(h, *ic & (sizenode(h) - 1));
+    if (ttisshrstring(gkey(n)) && tsvalue(gkey(n)) == tsvalue(key))
+      return gval(n);
+    return luaH_getshortstrslot(h, tsvalue(key), ic);
+  }
+  return luaH_get(h, key);
+}
+
+/* raw access using the inline cache of the running instruction */
+#define luaH_getcached(h,k) \
+  geticached(h, k, &cl->p->icache[pcRel(ci->u.l.savedpc, cl->p)])
+#else
+#define luaH_getcached	luaH_get
+#endif
+
+
 /*
 ** copy of 'luaV_gettable', but protecting the call to potential
 ** metamethod (which can reallocate the stack)
 */
 #define gettableProtected(L,t,k,v)  { const TValue *slot; \
-  if (luaV_fastget(L,t,k,slot,luaH_get)) { setobj2s(L, v, slot); } \
+  if (luaV_fastget(L,t,k,slot,luaH_getcached)) { setobj2s(L, v, slot); } \
   else Protect(luaV_finishget(L,t,k,v,slot)); }
 
 
 /* same for 'luaV_settable' */
 #define settableProtected(L,t,k,v) { const TValue *slot; \
-  if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
+  if (!luaV_fastset(L,t,k,slot,luaH_getcached,v)) \
     Protect(luaV_finishset(L,t,k,v,slot)); }
 
 
@@ -788,22 +904,34 @@ void luaV_execute (lua_State *L) {
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);  /* local reference to function's closure */
   k = cl->p->k;  /* local reference to function's constant table */
+  if (luaA_enter(L, ci, cl->p)) {  /* compiled code called a lua function? */
+    ci = L->ci;
+    goto newframe;
+  }
   base = ci->u.l.base;  /* local copy of function's base */
+  luaJ_enter(L, ci, cl->p);  /* run native code first, if any */
   /* main loop of interpreter */
   for (;;) {
     Instruction i;
     StkId ra;
     vmfetch();
     vmdispatch (GET_OPCODE(i)) {
-      vmcase(OP_MOVE) {
+      vmcase(OP_MOVE) l_move: {
         setobjs2s(L, ra, RB(i));
         vmbreak;
       }
+      vmcase(OP_MOVE2) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(l_move);
+      }
       vmcase(OP_LOADK) {
         TValue *rb = k + GETARG_Bx(i);
         setobj2s(L, ra, rb);
@@ -839,12 +967,18 @@ void luaV_execute (lua_State *L) {
         gettableProtected(L, upval, rc, ra);
         vmbreak;
       }
-      vmcase(OP_GETTABLE) {
+      vmcase(OP_GETTABLE) l_gettable: {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
         gettableProtected(L, rb, rc, ra);
         vmbreak;
       }
+      vmcase(OP_GETTABLE2) {
+        StkId rb = RB(i);
+        TValue *rc = RKC(i);
+        gettableProtected(L, rb, rc, ra);
+        vmfuse(l_gettable);
+      }
       vmcase(OP_SETTABUP) {
         TValue *upval = cl->upvals[GETARG_A(i)]->v;
         TValue *rb = RKB(i);
@@ -877,57 +1011,34 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_SELF) {
         const TValue *aux;
         StkId rb = RB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
+        TValue *rc = RKC(i);  /* key must be a string */
         setobjs2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
+        if (luaV_fastget(L, rb, rc, aux, luaH_getcached)) {
           setobj2s(L, ra, aux);
         }
         else Protect(luaV_finishget(L, rb, rc, ra, aux));
         vmbreak;
       }
-      vmcase(OP_ADD) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        lua_Number nb; lua_Number nc;
-        if (ttisinteger(rb) && ttisinteger(rc)) {
-          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(+, ib, ic));
-        }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
-          setfltvalue(ra, luai_numadd(L, nb, nc));
-        }
-        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_ADD)); }
+      vmcase(OP_ADD) l_add: {
+        op_arith(+, luai_numadd, TM_ADD);
         vmbreak;
       }
       vmcase(OP_SUB) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        lua_Number nb; lua_Number nc;
-        if (ttisinteger(rb) && ttisinteger(rc)) {
-          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(-, ib, ic));
-        }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
-          setfltvalue(ra, luai_numsub(L, nb, nc));
-        }
-        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SUB)); }
+        op_arith(-, luai_numsub, TM_SUB);
         vmbreak;
       }
-      vmcase(OP_MUL) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        lua_Number nb; lua_Number nc;
-        if (ttisinteger(rb) && ttisinteger(rc)) {
-          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(*, ib, ic));
-        }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
-          setfltvalue(ra, luai_nummul(L, nb, nc));
-        }
-        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_MUL)); }
+      vmcase(OP_MUL) l_mul: {
+        op_arith(*, luai_nummul, TM_MUL);
         vmbreak;
       }
+      vmcase(OP_MULADD) {
+        op_arith(*, luai_nummul, TM_MUL);
+        vmfuse(l_add);
+      }
+      vmcase(OP_MULMUL) {
+        op_arith(*, luai_nummul, TM_MUL);
+        vmfuse(l_mul);
+      }
       vmcase(OP_DIV) {  /* float division (always with floats) */
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
@@ -943,7 +1054,7 @@ void luaV_execute (lua_State *L) {
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
-          setivalue(ra, intop(&, ib, ic));
+          setivalue(L, ra, intop(&, ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_BAND)); }
         vmbreak;
@@ -953,7 +1064,7 @@ void luaV_execute (lua_State *L) {
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
-          setivalue(ra, intop(|, ib, ic));
+          setivalue(L, ra, intop(|, ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_BOR)); }
         vmbreak;
@@ -963,7 +1074,7 @@ void luaV_execute (lua_State *L) {
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
-          setivalue(ra, intop(^, ib, ic));
+          setivalue(L, ra, intop(^, ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_BXOR)); }
         vmbreak;
@@ -973,7 +1084,7 @@ void luaV_execute (lua_State *L) {
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
-          setivalue(ra, luaV_shiftl(ib, ic));
+          setivalue(L, ra, luaV_shiftl(ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SHL)); }
         vmbreak;
@@ -983,7 +1094,7 @@ void luaV_execute (lua_State *L) {
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
-          setivalue(ra, luaV_shiftl(ib, -ic));
+          setivalue(L, ra, luaV_shiftl(ib, -ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SHR)); }
         vmbreak;
@@ -994,7 +1105,7 @@ void luaV_execute (lua_State *L) {
         lua_Number nb; lua_Number nc;
         if (ttisinteger(rb) && ttisinteger(rc)) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, luaV_mod(L, ib, ic));
+          setivalue(L, ra, luaV_mod(L, ib, ic));
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
           lua_Number m;
@@ -1010,7 +1121,7 @@ void luaV_execute (lua_State *L) {
         lua_Number nb; lua_Number nc;
         if (ttisinteger(rb) && ttisinteger(rc)) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, luaV_div(L, ib, ic));
+          setivalue(L, ra, luaV_div(L, ib, ic));
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
           setfltvalue(ra, luai_numidiv(L, nb, nc));
@@ -1033,7 +1144,7 @@ void luaV_execute (lua_State *L) {
         lua_Number nb;
         if (ttisinteger(rb)) {
           lua_Integer ib = ivalue(rb);
-          setivalue(ra, intop(-, 0, ib));
+          setivalue(L, ra, intop(-, 0, ib));
         }
         else if (tonumber(rb, &nb)) {
           setfltvalue(ra, luai_numunm(L, nb));
@@ -1047,7 +1158,7 @@ void luaV_execute (lua_State *L) {
         TValue *rb = RB(i);
         lua_Integer ib;
         if (tointeger(rb, &ib)) {
-          setivalue(ra, intop(^, ~l_castS2U(0), ib));
+          setivalue(L, ra, intop(^, ~l_castS2U(0), ib));
         }
         else {
           Protect(luaT_trybinTM(L, rb, rb, ra, TM_BNOT));
@@ -1079,6 +1190,8 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
+        if (GETARG_sBx(i) < 0)  /* loop? */
+          luaJ_enter(L, ci, cl->p);
         vmbreak;
       }
       vmcase(OP_EQ) {
@@ -1135,6 +1248,8 @@ void luaV_execute (lua_State *L) {
           if (nresults >= 0)
             L->top = ci->top;  /* adjust results */
           Protect((void)0);  /* update 'base' */
+          if (nresults >= 0)  /* next instruction does not use 'top'? */
+            luaJ_enter(L, ci, cl->p);  /* back to native code */
         }
         else {  /* Lua function */
           ci = L->ci;
@@ -1194,8 +1309,9 @@ void luaV_execute (lua_State *L) {
           lua_Integer limit = ivalue(ra + 1);
           if ((0 < step) ? (idx <= limit) : (limit <= idx)) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
-            chgivalue(ra, idx);  /* update internal index... */
-            setivalue(ra + 3, idx);  /* ...and external index */
+            chgivalue(L, ra, idx);  /* update internal index... */
+            setivalue(L, ra + 3, idx);  /* ...and external index */
+            luaJ_enter(L, ci, cl->p);
           }
         }
         else {  /* floating loop */
@@ -1207,35 +1323,13 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            luaJ_enter(L, ci, cl->p);
           }
         }
         vmbreak;
       }
       vmcase(OP_FORPREP) {
-        TValue *init = ra;
-        TValue *plimit = ra + 1;
-        TValue *pstep = ra + 2;
-        lua_Integer ilimit;
-        int stopnow;
-        if (ttisinteger(init) && ttisinteger(pstep) &&
-            forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {
-          /* all values are integer */
-          lua_Integer initv = (stopnow ? 0 : ivalue(init));
-          setivalue(plimit, ilimit);
-          setivalue(init, intop(-, initv, ivalue(pstep)));
-        }
-        else {  /* try making all values floats */
-          lua_Number ninit; lua_Number nlimit; lua_Number nstep;
-          if (!tonumber(plimit, &nlimit))
-            luaG_runerror(L, "'for' limit must be a number");
-          setfltvalue(plimit, nlimit);
-          if (!tonumber(pstep, &nstep))
-            luaG_runerror(L, "'for' step must be a number");
-          setfltvalue(pstep, nstep);
-          if (!tonumber(init, &ninit))
-            luaG_runerror(L, "'for' initial value must be a number");
-          setfltvalue(init, luai_numsub(L, ninit, nstep));
-        }
+        luaV_forprep(L, ra);
         ci->u.l.savedpc += GETARG_sBx(i);
         vmbreak;
       }
@@ -1257,6 +1351,7 @@ void luaV_execute (lua_State *L) {
         if (!ttisnil(ra + 1)) {  /* continue loop? */
           setobjs2s(L, ra, ra + 1);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+           luaJ_enter(L, ci, cl->p);
         }
         vmbreak;
       }
@@ -1283,12 +1378,7 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_CLOSURE) {
-        Proto *p = cl->p->p[GETARG_Bx(i)];
-        LClosure *ncl = getcached(p, cl->upvals, base);  /* cached closure */
-        if (ncl == NULL)  /* no match? */
-          pushclosure(L, p, cl->upvals, base, ra);  /* create a new one */
-        else
-          setclLvalue(L, ra, ncl);  /* push cashed closure */
+        luaV_closure(L, cl->p->p[GETARG_Bx(i)], cl->upvals, base, ra);
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -109,5 +109,8 @@ LUAI_FUNC lua_Integer luaV_div (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Integer luaV_mod (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y);
 LUAI_FUNC void luaV_objlen (lua_State *L, StkId ra, const TValue *rb);
+LUAI_FUNC void luaV_closure (lua_State *L, Proto *p, UpVal **encup,
+                             StkId base, StkId ra);
+LUAI_FUNC void luaV_forprep (lua_State *L, StkId ra);
 
 #endif
@@ -23,6 +23,12 @@
 #include <vector>
 #include <memory>
 #include <tuple>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "luaRunner/value.hpp"
+#include "luaRunner/function.hpp"
 
 namespace luaRunner
 {
@@ -46,17 +52,157 @@ public:
 	using PluginSearchPaths = std::vector<std::string>;
 	using ScriptParameters = std::vector<std::string>;
 	using LoadResult = std::tuple<Result, std::string>;
+	using ResolveResult = std::tuple<Result, std::string>;
 	using ScriptReturnValue = std::uint8_t; // Clamped to [0-127]
 	using ExecuteResult = std::tuple<Result, ScriptReturnValue, std::string>;
+	using SerializedValues = std::string;
+
+	enum class OutputPolicy
+	{
+		Default = 0, /**< C library default buffering, print flushes each line (standard lua behavior) */
+		Unbuffered = 1, /**< Every write goes straight to the standard output */
+		Line = 2, /**< Flushed at each line feed */
+		Full = 3, /**< Flushed when the buffer is full, at exit, or when requested (lrbi.flush) */
+	};
+
+	enum class GcMode
+	{
+		Incremental = 0, /**< Standard lua 5.3 incremental collector, interleaving its steps with the script */
+		Generational = 1, /**< Minor collections of the recently created objects, full collections only when memory grows (lua 5.4 like) */
+	};
+
+	/** Histogram of garbage collector pause durations */
+	struct GcHistogram
+	{
+		static constexpr std::size_t BucketsCount = 24u;
+
+		std::uint64_t count{ 0u }; /**< Number of pauses */
+		std::chrono::nanoseconds total{}; /**< Sum of the pause durations */
+		std::chrono::nanoseconds max{}; /**< Longest pause */
+		std::array<std::uint64_t, BucketsCount> buckets{}; /**< buckets[0] counts pauses under 1 microsecond, buckets[i] pauses in [2^(i-1), 2^i[ microseconds (the last one also longer ones) */
+	};
+
+	/** Garbage collector pause durations, see setGcStatisticsEnabled */
+	struct GcStatistics
+	{
+		bool enabled{ false }; /**< Whether pauses are being recorded */
+		GcHistogram steps{}; /**< Every collector step (run when the script allocates, or by collectgarbage("step")), generational minor collections included */
+		GcHistogram atomicPhases{}; /**< Atomic phases, the part of each collection cycle that cannot be split into steps (already included in the steps running them) */
+	};
+
+	/** Options of executeLuaFileAsFilter */
+	struct FilterOptions
+	{
+		enum class RecordFormat
+		{
+			Lines = 0, /**< Records are separated by line feeds (not included in the records) */
+			Fixed = 1, /**< Records are 'recordSize' bytes long */
+			LengthPrefixed = 2, /**< Each record is preceded by its length (32 bits, little endian) */
+		};
+
+		RecordFormat recordFormat{ RecordFormat::Lines };
+		std::size_t recordSize{ 0u }; /**< For RecordFormat::Fixed */
+		std::size_t batchSize{ 1024u }; /**< Maximum count of records passed to each process call */
+		std::vector<std::string> inputs{}; /**< Files to read in order ("-" for the standard input), the standard input if empty */
+	};
 
 	static Executor& getInstance() noexcept;
 
+	/**
+	* Sets the buffering policy of the standard output, shared by print, io.write, lrbi.emit and the runner messages.
+	* Must be called before anything is written to the standard output. Except for Default, print no longer flushes by itself.
+	* @param[in] policy The buffering policy.
+	* @param[in] bufferSize The buffer size for Line and Full policies (0 for the C library default).
+	*/
+	virtual void setOutputPolicy(OutputPolicy const policy, std::size_t const bufferSize) noexcept = 0;
+
+	/** Enables counting of the executed opcodes and opcode pairs (to choose superinstructions), execution is then much slower. */
+	virtual void setOpcodeStatisticsEnabled(bool const enabled) noexcept = 0;
+
+	/** Returns a report of the 'maxEntries' most executed opcodes and opcode pairs, since statistics were enabled. */
+	virtual std::string getOpcodeStatistics(std::size_t const maxEntries) const noexcept = 0;
+
+	/** Enables the baseline JIT compiler of the lua interpreter (hot functions are compiled to native code). Returns false if it is not available in this build (x86-64 Linux only). */
+	virtual bool setJitEnabled(bool const enabled) noexcept = 0;
+
+	/** Sets the mode of the garbage collector (Incremental by default). Scripts can also switch with collectgarbage("generational") or collectgarbage("incremental"). */
+	virtual void setGcMode(GcMode const mode) noexcept = 0;
+
+	/** Enables recording the duration of every garbage collector step and atomic phase (resetting the previous statistics), or stops recording. Scripts can read them with lrbi.gc_stats(). */
+	virtual void setGcStatisticsEnabled(bool const enabled) noexcept = 0;
+
+	/** Returns the garbage collector pause durations recorded since statistics were enabled. */
+	virtual GcStatistics getGcStatistics() const noexcept = 0;
+
+	/**
+	* Paces the garbage collector on time rather than on allocated memory only: each step stops once it estimates (from the measured collector speed) it would last longer than 'maxStepDuration', the remaining work being done by the next steps, which are then more frequent.
+	* Atomic phases and generational minor collections cannot be split and may last longer. Scripts can also set it with collectgarbage("steptime", microseconds).
+	* @param[in] maxStepDuration The target maximum duration of a step, 0 to go back to the standard pacing.
+	*/
+	virtual void setGcStepTimeTarget(std::chrono::microseconds const maxStepDuration) noexcept = 0;
+
+	/**
+	* Runs the garbage collector for about 'budget', for hosts calling it when the executor is idle (between two requests, or when their own loop has nothing to do).
+	* The work done there is credited to the script, so that its allocations trigger collection steps later: most of the collector work moves out of the script execution.
+	* @param[in] budget The time to spend collecting (a single atomic phase or generational minor collection may take longer).
+	* @return True if there was nothing worth collecting: further calls are useless until the script runs again.
+	*/
+	virtual bool collectGarbageWhileIdle(std::chrono::microseconds const budget) noexcept = 0;
+
+	/** Lets the event loop (running the tasks and timers of scripts) call collectGarbageWhileIdle with 'slice' budgets whenever it waits for a timer or an event (0, the default, to disable). */
+	virtual void setIdleGcSlice(std::chrono::microseconds const slice) noexcept = 0;
+
+	/**
+	* Lets the destructor (called at exit for the getInstance executor) skip freeing the lua objects one by one, which takes long with large heaps.
+	* The __gc finalizers still run (files are closed and flushed), but all the memory of the lua_State is left to the system: only for a process about to exit.
+	*/
+	virtual void setFastClose(bool const enabled) noexcept = 0;
+
 	virtual void setPluginSearchPaths(PluginSearchPaths const& searchPaths) noexcept = 0;
 	virtual LoadResult loadPlugin(std::string const& pluginName) noexcept = 0;
 
 	/** Result, ErrorString (if Result != Success) */
 	virtual ExecuteResult executeLuaFileWithParameters(std::string const& luaFilePath, ScriptParameters const& parameters) noexcept = 0;
 
+	/**
+	* Executes a script, passing it arguments and collecting all the values it returns, both as serialized messages (see luaRunner/serializer.hpp).
+	* The script receives the arguments as its chunk varargs (...).
+	* @param[in] luaFilePath The script to execute.
+	* @param[in] arguments A message built with serializer::Writer, or an empty string for no arguments.
+	* @param[out] results The message of the returned values, to be read with serializer::Reader (appended to the string).
+	*/
+	virtual ExecuteResult executeLuaFileWithArguments(std::string const& luaFilePath, SerializedValues const& arguments, SerializedValues& results) noexcept = 0;
+
+	/**
+	* Executes a script (with argv/argc like executeLuaFileWithParameters) and streams all the values it returns to 'visitor', straight from the lua stack.
+	* On ReturnError (a returned value cannot be converted, like a function), the visitor may have been notified of part of the values.
+	*/
+	virtual ExecuteResult executeLuaFileWithVisitor(std::string const& luaFilePath, ScriptParameters const& parameters, value::Visitor& visitor) noexcept = 0;
+
+	/** Executes a script (with argv/argc like executeLuaFileWithParameters) and appends all the values it returns to 'results'. */
+	virtual ExecuteResult executeLuaFileWithResults(std::string const& luaFilePath, ScriptParameters const& parameters, value::Values& results) noexcept = 0;
+
+	/**
+	* Executes a script defining a 'process(batch, count)' global function (with argv/argc like executeLuaFileWithParameters), then calls it with batches of records read from the inputs.
+	* 'batch' is an array of 'count' views (see lrbi.mmap) over the read buffers or the memory mapped files, no record is copied.
+	* The batch table and its views are reused by the next call, a record to be kept must be copied (tostring) or re-viewed (view:view()).
+	* Output should be written with lrbi.emit, which is buffered. Returns ExecError if the script or an input fails.
+	*/
+	virtual ExecuteResult executeLuaFileAsFilter(std::string const& luaFilePath, ScriptParameters const& parameters, FilterOptions const& options) noexcept = 0;
+
+	/**
+	* Resolves a function defined by a previously executed script (or a plugin) into a handle, to be called repeatedly without going through a script file.
+	* 'name' is a global function name, or a dotted path like "module.func" (the module is loaded with 'require' if it is not a global).
+	* Returns ExecError if the name cannot be resolved to a function.
+	*/
+	virtual ResolveResult resolveFunction(std::string const& name, function::Function& function) noexcept = 0;
+
+	/** Posts an event to the running script, dispatched to the handler registered with lrbi.on(name, handler). Can be called from any thread. */
+	virtual void postEvent(std::string const& name, std::string const& data) noexcept = 0;
+
+	/** Returns a file descriptor becoming readable when the script's event loop has to wake up (to be added to an external epoll set), -1 if not supported. */
+	virtual int getWakeupFd() const noexcept = 0;
+
 	static std::string resultToString(Result const result) noexcept;
 
 	// Deleted compiler auto-generated methods
@@ -0,0 +1,370 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <lua.hpp>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+
+namespace luaRunner
+{
+namespace function
+{
+
+enum class Result
+{
+	Success = 0, /**< Success */
+	InvalidFunction = 1, /**< The handle is not bound to a function */
+	CallError = 2, /**< The function raised an error */
+	ReturnError = 3, /**< The returned value cannot be converted to the expected type */
+};
+
+namespace detail
+{
+
+/* Arguments conversion */
+inline void push(lua_State* luaState, bool const value) noexcept
+{
+	lua_pushboolean(luaState, value ? 1 : 0);
+}
+
+template<typename T, std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value, int> = 0>
+inline void push(lua_State* luaState, T const value) noexcept
+{
+	lua_pushinteger(luaState, static_cast<lua_Integer>(value));
+}
+
+template<typename T, std::enable_if_t<std::is_floating_point<T>::value, int> = 0>
+inline void push(lua_State* luaState, T const value) noexcept
+{
+	lua_pushnumber(luaState, static_cast<lua_Number>(value));
+}
+
+inline void push(lua_State* luaState, char const* const value) noexcept
+{
+	lua_pushstring(luaState, value);
+}
+
+inline void push(lua_State* luaState, std::string const& value) noexcept
+{
+	lua_pushlstring(luaState, value.data(), value.size());
+}
+
+template<typename... Params>
+inline void pushAll(lua_State* luaState, Params const&... params) noexcept
+{
+	int const expand[] = { 0, (push(luaState, params), 0)... };
+	(void)expand;
+}
+
+template<typename Tuple, std::size_t... Indexes>
+inline void pushTuple(lua_State* luaState, Tuple const& params, std::index_sequence<Indexes...>) noexcept
+{
+	pushAll(luaState, std::get<Indexes>(params)...);
+}
+
+/* Returned value conversion, returns false if the value has not the expected type */
+inline bool get(lua_State* luaState, int const index, bool& value) noexcept
+{
+	if (!lua_isboolean(luaState, index))
+		return false;
+	value = lua_toboolean(luaState, index) != 0;
+	return true;
+}
+
+template<typename T, std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value, int> = 0>
+inline bool get(lua_State* luaState, int const index, T& value) noexcept
+{
+	auto isInteger = 0;
+	auto const v = lua_tointegerx(luaState, index, &isInteger);
+	value = static_cast<T>(v);
+	return isInteger != 0;
+}
+
+template<typename T, std::enable_if_t<std::is_floating_point<T>::value, int> = 0>
+inline bool get(lua_State* luaState, int const index, T& value) noexcept
+{
+	auto isNumber = 0;
+	auto const v = lua_tonumberx(luaState, index, &isNumber);
+	value = static_cast<T>(v);
+	return isNumber != 0;
+}
+
+inline bool get(lua_State* luaState, int const index, std::string& value)
+{
+	if (lua_type(luaState, index) != LUA_TSTRING)
+		return false;
+	auto length = std::size_t{ 0u };
+	auto const* const data = lua_tolstring(luaState, index, &length);
+	value.assign(data, length);
+	return true;
+}
+
+/** Handling of the returned value, for a single call and for a batch */
+template<typename R>
+struct Returns
+{
+	using CallResult = std::tuple<Result, R, std::string>;
+	using BatchResults = std::vector<R>;
+	static constexpr int Count = 1;
+
+	static CallResult failure(Result const result, std::string error)
+	{
+		return CallResult{ result, R{}, std::move(error) };
+	}
+
+	/** Converts and pops the returned value */
+	static CallResult read(lua_State* luaState)
+	{
+		auto value = R{};
+		auto const success = get(luaState, -1, value);
+		lua_pop(luaState, 1);
+		if (!success)
+			return failure(Result::ReturnError, "Invalid returned value type");
+		return CallResult{ Result::Success, std::move(value), std::string{} };
+	}
+
+	/** Converts and pops the returned value of the call 'index' of a batch */
+	static bool store(lua_State* luaState, BatchResults* const results, std::size_t const index)
+	{
+		auto success = true;
+		if (results != nullptr)
+			success = get(luaState, -1, (*results)[index]);
+		lua_pop(luaState, 1);
+		return success;
+	}
+};
+
+template<>
+struct Returns<void>
+{
+	using CallResult = std::tuple<Result, std::string>;
+	using BatchResults = void;
+	static constexpr int Count = 0;
+
+	static CallResult failure(Result const result, std::string error)
+	{
+		return CallResult{ result, std::move(error) };
+	}
+
+	static CallResult read(lua_State* /*luaState*/)
+	{
+		return CallResult{ Result::Success, std::string{} };
+	}
+
+	static bool store(lua_State* /*luaState*/, BatchResults* const /*results*/, std::size_t const /*index*/) noexcept
+	{
+		return true;
+	}
+};
+
+template<typename Signature>
+struct Caller;
+
+template<typename R, typename... Params>
+struct Caller<R(Params...)>
+{
+	using CallResult = typename Returns<R>::CallResult;
+	using BatchArguments = std::vector<std::tuple<std::decay_t<Params>...>>;
+	using BatchResults = typename Returns<R>::BatchResults;
+	using BatchResult = std::tuple<Result, std::size_t, std::string>;
+
+	static CallResult invoke(lua_State* luaState, int const ref, Params const&... params)
+	{
+		if (ref == LUA_NOREF || ref == LUA_REFNIL)
+			return Returns<R>::failure(Result::InvalidFunction, "Invalid function");
+		if (!lua_checkstack(luaState, static_cast<int>(sizeof...(Params)) + 1))
+			return Returns<R>::failure(Result::CallError, "stack overflow");
+
+		lua_rawgeti(luaState, LUA_REGISTRYINDEX, ref);
+		pushAll(luaState, params...);
+		if (lua_pcall(luaState, static_cast<int>(sizeof...(Params)), Returns<R>::Count, 0) != LUA_OK)
+			return Returns<R>::failure(Result::CallError, popError(luaState));
+		return Returns<R>::read(luaState);
+	}
+
+	static BatchResult invokeBatch(lua_State* luaState, int const ref, BatchArguments const& arguments, BatchResults* const results)
+	{
+		if (ref == LUA_NOREF || ref == LUA_REFNIL)
+			return BatchResult{ Result::InvalidFunction, 0u, "Invalid function" };
+		resize(results, arguments.size());
+
+		auto context = BatchContext{ ref, &arguments, results, 0u, false };
+		lua_pushcfunction(luaState, &batchLoop);
+		lua_pushlightuserdata(luaState, &context);
+		if (lua_pcall(luaState, 1, 0, 0) != LUA_OK)
+		{
+			auto error = popError(luaState);
+			return BatchResult{ context.returnError ? Result::ReturnError : Result::CallError, context.done, std::move(error) };
+		}
+		return BatchResult{ Result::Success, context.done, std::string{} };
+	}
+
+private:
+	/** Only contains trivially destructible members, batchLoop may longjmp */
+	struct BatchContext
+	{
+		int ref;
+		BatchArguments const* arguments;
+		BatchResults* results;
+		std::size_t done; /**< Count of successful calls */
+		bool returnError;
+	};
+
+	/** The whole batch runs in a single protected call */
+	static int batchLoop(lua_State* luaState)
+	{
+		auto& context = *static_cast<BatchContext*>(lua_touserdata(luaState, 1));
+		luaL_checkstack(luaState, static_cast<int>(sizeof...(Params)) + 2, "callBatch");
+		lua_rawgeti(luaState, LUA_REGISTRYINDEX, context.ref);
+		auto const& arguments = *context.arguments;
+		auto const count = arguments.size();
+		for (; context.done < count; ++context.done)
+		{
+			lua_pushvalue(luaState, 2);
+			pushTuple(luaState, arguments[context.done], std::index_sequence_for<Params...>{});
+			lua_call(luaState, static_cast<int>(sizeof...(Params)), Returns<R>::Count);
+			if (!Returns<R>::store(luaState, context.results, context.done))
+			{
+				context.returnError = true;
+				return luaL_error(luaState, "Invalid returned value type");
+			}
+		}
+		return 0;
+	}
+
+	static std::string popError(lua_State* luaState)
+	{
+		auto const* const message = lua_tostring(luaState, -1);
+		auto error = std::string{ message != nullptr ? message : "(error object is not a string)" };
+		lua_pop(luaState, 1);
+		return error;
+	}
+
+	template<typename T>
+	static void resize(std::vector<T>* const results, std::size_t const size)
+	{
+		if (results != nullptr)
+			results->resize(size);
+	}
+	static void resize(void* const /*results*/, std::size_t const /*size*/) noexcept {}
+};
+
+} // namespace detail
+
+/**
+* Handle to a lua function, resolved once (see Executor::resolveFunction) and kept in the registry, to be called repeatedly from C++.
+* Calls do not look anything up by name, nor allocate (unless the function returns or raises a string).
+* Supported parameter and returned types: bool, integral and floating point types, std::string (and char const* parameters).
+* Must be used from the thread running the Executor, and destroyed before it.
+*/
+class Function final
+{
+public:
+	/** Unbound handle */
+	Function() noexcept = default;
+
+	/** Takes ownership of the registry reference 'ref' (to a function) */
+	Function(lua_State* luaState, int const ref) noexcept
+		: _state(luaState)
+		, _ref(ref)
+	{
+	}
+
+	~Function() noexcept
+	{
+		release();
+	}
+
+	Function(Function&& other) noexcept
+		: _state(other._state)
+		, _ref(other._ref)
+	{
+		other._ref = LUA_NOREF;
+	}
+
+	Function& operator=(Function&& other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			_state = other._state;
+			_ref = other._ref;
+			other._ref = LUA_NOREF;
+		}
+		return *this;
+	}
+
+	bool isValid() const noexcept
+	{
+		return _ref != LUA_NOREF && _ref != LUA_REFNIL;
+	}
+
+	/**
+	* Calls the function, for example: auto const result = f.call<double(int, std::string)>(42, "text");
+	* Returns a tuple of Result, returned value (not present for void) and error string (if Result != Success).
+	*/
+	template<typename Signature, typename... Args>
+	typename detail::Caller<Signature>::CallResult call(Args&&... args) const
+	{
+		return detail::Caller<Signature>::invoke(_state, _ref, std::forward<Args>(args)...);
+	}
+
+	/**
+	* Calls the function once per tuple of 'arguments', in a single protected call.
+	* Returned values are stored in 'results' (resized to the count of arguments), if not nullptr.
+	* Returns a tuple of Result, count of successful calls (the batch stops at the first error) and error string (if Result != Success).
+	*/
+	template<typename Signature>
+	typename detail::Caller<Signature>::BatchResult callBatch(typename detail::Caller<Signature>::BatchArguments const& arguments, typename detail::Caller<Signature>::BatchResults* const results = nullptr) const
+	{
+		return detail::Caller<Signature>::invokeBatch(_state, _ref, arguments, results);
+	}
+
+	// Deleted compiler auto-generated methods
+	Function(Function const&) = delete;
+	Function& operator=(Function const&) = delete;
+
+private:
+	// Private methods
+	void release() noexcept
+	{
+		if (_state != nullptr && isValid())
+			luaL_unref(_state, LUA_REGISTRYINDEX, _ref);
+		_ref = LUA_NOREF;
+	}
+
+	// Private members
+	lua_State* _state{ nullptr };
+	int _ref{ LUA_NOREF };
+};
+
+/* Operator overloads */
+constexpr bool operator!(Result const result)
+{
+	return result != Result::Success;
+}
+
+} // namespace function
+} // namespace luaRunner
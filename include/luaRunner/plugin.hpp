@@ -38,3 +38,69 @@ typedef bool (LUARUNNER_CALL_CONVENTION *InitPluginFunc)(lua_State* luaState);
 
 /** True if success. Plugin must export a function named 'UninitPlugin' with that prototype. */
 typedef void (LUARUNNER_CALL_CONVENTION *UninitPluginFunc)(lua_State* luaState);
+
+/* ************************************************************ */
+/* Host interface                                               */
+/* ************************************************************ */
+
+/** Version of the LuaRunnerHostInterface structure. Fields are only appended, check 'version' before using a field added after version 1. */
+#define LUARUNNER_HOST_INTERFACE_VERSION 2
+
+/** Registry key (light userdata) of the LuaRunnerHostInterface, see luaRunner_getHostInterface. */
+#define LUARUNNER_HOST_INTERFACE_KEY "luaRunner.hostInterface"
+
+/** Opaque handle of an asynchronous call in progress. */
+typedef struct LuaRunnerAsyncCall LuaRunnerAsyncCall;
+
+/**
+* Called on the lua thread once an asynchronous call completed, to push its results on the stack.
+* Must return the number of pushed results, or push an error message and return -1 to raise an error in the caller.
+* Must not raise lua errors itself. This is the last time 'userData' is used by the host, the function can release it.
+*/
+typedef int (LUARUNNER_CALL_CONVENTION *AsyncCompletionFunc)(lua_State* luaState, void* userData);
+
+/**
+* Services offered by the host to plugins. Retrieve it using luaRunner_getHostInterface.
+*
+* Asynchronous calls let a lua_CFunction run slow operations on its own thread without blocking the interpreter:
+*   int myLib_slowOperation(lua_State* luaState)
+*   {
+*     auto const* host = luaRunner_getHostInterface(luaState);
+*     auto* call = host->beginAsyncCall(host->context, luaState);
+*     std::thread([host, call] { ...work...; host->completeAsyncCall(host->context, call, &pushResults, data); }).detach();
+*     return host->awaitAsyncCall(host->context, luaState, call);
+*   }
+* When called from a task (lrbi.spawn) the calling coroutine is suspended and other tasks keep running until the call completes.
+* Otherwise the event loop runs until the call completes. All calls must be completed before UninitPlugin returns.
+*
+* Events let background threads of a plugin deliver data to lua without touching the lua_State:
+*   host->postEvent(host->context, "myLib.data", buffer, bufferSize);
+* Events are queued in a lock-free queue and dispatched, in batches, to the handler registered by the script using lrbi.on(name, handler).
+*/
+typedef struct
+{
+	unsigned int version; /**< LUARUNNER_HOST_INTERFACE_VERSION of the host */
+	void* context; /**< Must be passed as first parameter of all methods */
+
+	/** Starts an asynchronous call. Must be called on the lua thread, from the lua_CFunction that will return awaitAsyncCall. */
+	LuaRunnerAsyncCall* (LUARUNNER_CALL_CONVENTION *beginAsyncCall)(void* context, lua_State* luaState);
+	/** Completes an asynchronous call, 'completion' will be called on the lua thread with 'userData'. Can be called from any thread, exactly once per call. */
+	void (LUARUNNER_CALL_CONVENTION *completeAsyncCall)(void* context, LuaRunnerAsyncCall* call, AsyncCompletionFunc completion, void* userData);
+	/** Waits for the call to complete. Must be returned by the lua_CFunction that began the call, its results are the results pushed by 'completion'. */
+	int (LUARUNNER_CALL_CONVENTION *awaitAsyncCall)(void* context, lua_State* luaState, LuaRunnerAsyncCall* call);
+
+	/* Version 2 */
+	/** Posts an event, 'data' is copied and delivered as a lua string. Can be called from any thread. */
+	void (LUARUNNER_CALL_CONVENTION *postEvent)(void* context, char const* name, void const* data, size_t size);
+	/** Returns a file descriptor becoming readable when the event loop has to wake up (posted events, completed calls), -1 if not supported. Must not be read from. */
+	int (LUARUNNER_CALL_CONVENTION *getWakeupFd)(void* context);
+} LuaRunnerHostInterface;
+
+/** Returns the host interface, or nullptr if the host does not provide one. */
+inline LuaRunnerHostInterface const* luaRunner_getHostInterface(lua_State* luaState)
+{
+	lua_getfield(luaState, LUA_REGISTRYINDEX, LUARUNNER_HOST_INTERFACE_KEY);
+	auto const* const hostInterface = static_cast<LuaRunnerHostInterface const*>(lua_touserdata(luaState, -1));
+	lua_pop(luaState, 1);
+	return hostInterface;
+}
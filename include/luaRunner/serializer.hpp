@@ -0,0 +1,148 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+* Binary serialization format of lua values (lrbi.serialize, Executor::executeLuaFileWithArguments).
+*
+* A message is the format version (1 byte) and the count of values (varint), followed by the values.
+* Each value is a type tag (1 byte) followed by:
+*   - Nil, False, True: nothing
+*   - Integer: zigzag encoded varint
+*   - Number: 8 bytes (native double)
+*   - String: length (varint) and bytes
+*   - Table, SharedTable: array count (varint), hash count (4 bytes), then the array values and the hash key/value pairs
+*   - Reference: index (varint) of a SharedTable already read in the same message (all tables are numbered from 0, in reading order)
+* References represent shared tables and cycles. Tables are only written as SharedTable when referenced, so readers only keep track of those.
+*/
+
+namespace luaRunner
+{
+namespace serializer
+{
+
+constexpr std::uint8_t FormatVersion = 1u;
+
+enum class Type : std::uint8_t
+{
+	Nil = 0,
+	False = 1,
+	True = 2,
+	Integer = 3,
+	Number = 4,
+	String = 5,
+	Table = 6,
+	Reference = 7,
+	SharedTable = 8,
+};
+
+/** Appends a message to a buffer. The buffer can be reused (cleared) between messages, to avoid reallocations. */
+class Writer final
+{
+public:
+	/** Starts a message of 'valuesCount' values at the end of 'buffer'. */
+	Writer(std::string& buffer, std::uint32_t const valuesCount);
+
+	void writeNil();
+	void writeBoolean(bool const value);
+	void writeInteger(std::int64_t const value);
+	void writeNumber(double const value);
+	void writeString(char const* const data, std::size_t const length);
+	void writeString(std::string const& value);
+	/** Starts a table, it must be followed by 'arrayCount' values then 'hashCount' key/value pairs. Returns the index of the table (for 'writeReference' and 'patchHashCount'). */
+	std::uint64_t beginTable(std::uint64_t const arrayCount, std::uint32_t const hashCount);
+	/** Changes the hash count of a table, when it was not known in 'beginTable'. */
+	void patchHashCount(std::uint64_t const tableIndex, std::uint32_t const hashCount) noexcept;
+	/** Writes a reference to a table already begun in this message, the table is marked as shared. */
+	void writeReference(std::uint64_t const tableIndex);
+
+	std::string& getBuffer() noexcept
+	{
+		return _buffer;
+	}
+
+	// Deleted compiler auto-generated methods
+	Writer(Writer&&) = delete;
+	Writer(Writer const&) = delete;
+	Writer& operator=(Writer const&) = delete;
+	Writer& operator=(Writer&&) = delete;
+
+private:
+	// Private members
+	std::string& _buffer;
+	std::vector<std::size_t> _tablePositions{}; /**< Position of each table tag in the buffer */
+};
+
+/** Value read by the Reader. Only the fields matching 'type' are valid. */
+struct Token
+{
+	Type type{ Type::Nil };
+	std::int64_t integer{ 0 };
+	double number{ 0.0 };
+	char const* string{ nullptr }; /**< Points into the message, not NUL terminated */
+	std::size_t length{ 0u };
+	std::uint64_t arrayCount{ 0u }; /**< Table */
+	std::uint32_t hashCount{ 0u }; /**< Table */
+	bool shared{ false }; /**< Table, true if referenced later in the message (SharedTable tags are read as Table tokens) */
+	std::uint64_t reference{ 0u }; /**< Reference */
+};
+
+/** Reads a message token by token. Tables are not skipped: their array values and key/value pairs are the next tokens. */
+class Reader final
+{
+public:
+	/** Starts reading the message in [data, data + size). Check 'isValid' for a bad header. */
+	Reader(char const* const data, std::size_t const size) noexcept;
+
+	/** Count of (top level) values in the message. */
+	std::uint32_t getValuesCount() const noexcept
+	{
+		return _valuesCount;
+	}
+
+	/** Reads the next token. Returns false at the end of the data, or if the data is malformed (see 'isValid'). */
+	bool next(Token& token) noexcept;
+
+	bool isValid() const noexcept
+	{
+		return _valid;
+	}
+
+	// Deleted compiler auto-generated methods
+	Reader(Reader&&) = delete;
+	Reader(Reader const&) = delete;
+	Reader& operator=(Reader const&) = delete;
+	Reader& operator=(Reader&&) = delete;
+
+private:
+	// Private members
+	char const* _cursor{ nullptr };
+	char const* _end{ nullptr };
+	std::uint32_t _valuesCount{ 0u };
+	bool _valid{ false };
+};
+
+} // namespace serializer
+} // namespace luaRunner
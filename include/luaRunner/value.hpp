@@ -0,0 +1,193 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <memory>
+#include "luaRunner/serializer.hpp"
+
+namespace luaRunner
+{
+namespace value
+{
+
+/**
+* Receives lua values (returned by a script) as a stream of calls, straight from the lua_State.
+* A table is notified by 'beginTable', followed by its 'arrayCount' array values, then 'hashCount' key/value pairs (key first), and 'endTable'.
+* A table already notified (shared or cyclic) is notified by 'visitReference' with its index (tables are numbered from 0, in 'beginTable' calls order).
+* Strings are only valid during the call.
+*/
+class Visitor
+{
+public:
+	/** Called first, with the count of top level values to be notified. */
+	virtual void beginValues(std::size_t const count) = 0;
+	virtual void endValues() = 0;
+
+	virtual void visitNil() = 0;
+	virtual void visitBoolean(bool const value) = 0;
+	virtual void visitInteger(std::int64_t const value) = 0;
+	virtual void visitNumber(double const value) = 0;
+	virtual void visitString(char const* const data, std::size_t const length) = 0;
+	virtual void beginTable(std::size_t const arrayCount, std::size_t const hashCount) = 0;
+	virtual void endTable() = 0;
+	virtual void visitReference(std::size_t const tableIndex) = 0;
+
+	/** Destructor */
+	virtual ~Visitor() noexcept = default;
+};
+
+/** Lightweight tree of lua values. Only the fields matching 'type' are valid. */
+struct Value
+{
+	enum class Type : std::uint8_t
+	{
+		Nil = 0,
+		Boolean = 1,
+		Integer = 2,
+		Number = 3,
+		String = 4,
+		Table = 5,
+		Reference = 6, /**< Shared or cyclic table, see 'reference' */
+	};
+
+	Type type{ Type::Nil };
+	bool boolean{ false };
+	std::int64_t integer{ 0 };
+	double number{ 0.0 };
+	std::string string{};
+	std::vector<Value> array{}; /**< Table values at keys 1..n */
+	std::vector<std::pair<Value, Value>> hash{}; /**< Other table key/value pairs */
+	std::size_t reference{ 0u }; /**< Index of the referenced table, in depth first order of the tables of the whole result */
+};
+
+using Values = std::vector<Value>;
+
+/** Visitor building a tree of Values. */
+class ValueBuilder final : public Visitor
+{
+public:
+	/** Built values are appended to 'values'. */
+	explicit ValueBuilder(Values& values) noexcept;
+
+	// Visitor overrides
+	virtual void beginValues(std::size_t const count) override;
+	virtual void endValues() override;
+	virtual void visitNil() override;
+	virtual void visitBoolean(bool const value) override;
+	virtual void visitInteger(std::int64_t const value) override;
+	virtual void visitNumber(double const value) override;
+	virtual void visitString(char const* const data, std::size_t const length) override;
+	virtual void beginTable(std::size_t const arrayCount, std::size_t const hashCount) override;
+	virtual void endTable() override;
+	virtual void visitReference(std::size_t const tableIndex) override;
+
+private:
+	struct OpenTable
+	{
+		Value* table{ nullptr };
+		std::size_t arrayCount{ 0u };
+		bool pendingKey{ false }; /**< A key has been added to the hash part, waiting for its value */
+	};
+
+	// Private methods
+	Value& add();
+
+	// Private members
+	Values& _values;
+	std::vector<OpenTable> _openTables{};
+};
+
+/** Visitor writing values as JSON: top level values as an array, tables without hash part as arrays, other tables as objects (keys converted to strings). Shared tables and cycles are written as null. */
+class JsonWriter final : public Visitor
+{
+public:
+	explicit JsonWriter(std::ostream& stream) noexcept;
+
+	// Visitor overrides
+	virtual void beginValues(std::size_t const count) override;
+	virtual void endValues() override;
+	virtual void visitNil() override;
+	virtual void visitBoolean(bool const value) override;
+	virtual void visitInteger(std::int64_t const value) override;
+	virtual void visitNumber(double const value) override;
+	virtual void visitString(char const* const data, std::size_t const length) override;
+	virtual void beginTable(std::size_t const arrayCount, std::size_t const hashCount) override;
+	virtual void endTable() override;
+	virtual void visitReference(std::size_t const tableIndex) override;
+
+private:
+	struct Scope
+	{
+		bool isObject{ false };
+		std::size_t arrayRemaining{ 0u }; /**< Array values still to come, written with their index as key in objects */
+		std::size_t nextIndex{ 1u };
+		bool expectingKey{ false };
+		bool first{ true };
+	};
+
+	enum class Role
+	{
+		Value,
+		Key,
+	};
+
+	// Private methods
+	/** Writes what comes before the next value (separator, array index key), and returns whether that value is an object key. */
+	Role prepare();
+	void writeEscaped(char const* const data, std::size_t const length);
+
+	// Private members
+	std::ostream& _stream;
+	std::vector<Scope> _scopes{};
+	std::size_t _ignoredDepth{ 0u }; /**< Tables used as keys cannot be written in JSON, their content is ignored */
+};
+
+/** Visitor writing values as a serializer message (see luaRunner/serializer.hpp), appended to 'buffer'. */
+class BinaryWriter final : public Visitor
+{
+public:
+	explicit BinaryWriter(std::string& buffer) noexcept;
+
+	// Visitor overrides
+	virtual void beginValues(std::size_t const count) override;
+	virtual void endValues() override;
+	virtual void visitNil() override;
+	virtual void visitBoolean(bool const value) override;
+	virtual void visitInteger(std::int64_t const value) override;
+	virtual void visitNumber(double const value) override;
+	virtual void visitString(char const* const data, std::size_t const length) override;
+	virtual void beginTable(std::size_t const arrayCount, std::size_t const hashCount) override;
+	virtual void endTable() override;
+	virtual void visitReference(std::size_t const tableIndex) override;
+
+private:
+	// Private members
+	std::string& _buffer;
+	std::unique_ptr<serializer::Writer> _writer{ nullptr }; /**< Created by beginValues, once the count of values is known */
+};
+
+} // namespace value
+} // namespace luaRunner
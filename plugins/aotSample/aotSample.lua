@@ -0,0 +1,44 @@
+-- Sample module compiled ahead-of-time into the AotSample plugin
+--   LuaRunner -p AotSample script.lua
+--   local stats = require("aotSample")
+
+local stats = {}
+
+function stats.sum(values)
+	local total = 0
+	for i = 1, #values do
+		total = total + values[i]
+	end
+	return total
+end
+
+function stats.mean(values)
+	if #values == 0 then
+		return nil
+	end
+	return stats.sum(values) / #values
+end
+
+function stats.variance(values)
+	local mean = stats.mean(values)
+	if mean == nil then
+		return nil
+	end
+	local total = 0
+	for _, value in ipairs(values) do
+		local delta = value - mean
+		total = total + delta * delta
+	end
+	return total / #values
+end
+
+function stats.histogram(values, bucketSize)
+	local buckets = {}
+	for _, value in ipairs(values) do
+		local bucket = value // bucketSize
+		buckets[bucket] = (buckets[bucket] or 0) + 1
+	end
+	return buckets
+end
+
+return stats
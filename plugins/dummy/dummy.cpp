@@ -23,6 +23,8 @@
 #include <thread>
 #include <string>
 #include <iostream>
+#include <vector>
+#include <mutex>
 #include <stdlib.h>
 
 std::string valueToString(lua_State* luaState, int index)
@@ -143,6 +145,65 @@ int dummy_varParams(lua_State* luaState)
 	return 0; // Return 0 variable
 }
 
+/** Threads started by dummy_asyncWork, joined when the plugin is unloaded. Never destroyed: UninitPlugin may be called after static destructors ran. */
+static auto* const s_asyncThreadsLock = new std::mutex{};
+static auto* const s_asyncThreads = new std::vector<std::thread>{};
+
+/** Pushes the result of dummy_asyncWork, called on the lua thread once the work is done. */
+static int LUARUNNER_CALL_CONVENTION dummy_asyncWorkCompletion(lua_State* luaState, void* userData)
+{
+	auto* const result = static_cast<std::string*>(userData);
+	lua_pushstring(luaState, result->c_str());
+	delete result;
+
+	return 1; // Return 1 variable
+}
+
+/** Sample asynchronous method: works on its own thread for the specified milliseconds, without blocking the interpreter. */
+int dummy_asyncWork(lua_State* luaState)
+{
+	auto const msec = luaL_checkinteger(luaState, 1);
+	auto const* const hostInterface = luaRunner_getHostInterface(luaState);
+	if (hostInterface == nullptr)
+		return luaL_error(luaState, "Host does not support asynchronous calls");
+
+	auto* const call = hostInterface->beginAsyncCall(hostInterface->context, luaState);
+	{
+		std::lock_guard<std::mutex> const lock{ *s_asyncThreadsLock };
+		s_asyncThreads->emplace_back([hostInterface, call, msec]()
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+			auto* const result = new std::string("Worked for " + std::to_string(msec) + " msec");
+			hostInterface->completeAsyncCall(hostInterface->context, call, &dummy_asyncWorkCompletion, result);
+		});
+	}
+
+	return hostInterface->awaitAsyncCall(hostInterface->context, luaState, call);
+}
+
+/** Sample event producer: posts 'count' "dummy.tick" events from its own thread, one every 'msec' milliseconds. The payload of each event is its sequence number. */
+int dummy_startTicker(lua_State* luaState)
+{
+	auto const count = luaL_checkinteger(luaState, 1);
+	auto const msec = luaL_checkinteger(luaState, 2);
+	auto const* const hostInterface = luaRunner_getHostInterface(luaState);
+	if (hostInterface == nullptr || hostInterface->version < 2)
+		return luaL_error(luaState, "Host does not support events");
+
+	std::lock_guard<std::mutex> const lock{ *s_asyncThreadsLock };
+	s_asyncThreads->emplace_back([hostInterface, count, msec]()
+	{
+		for (auto tick = lua_Integer{ 1 }; tick <= count; ++tick)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+			auto const payload = std::to_string(tick);
+			hostInterface->postEvent(hostInterface->context, "dummy.tick", payload.data(), payload.size());
+		}
+	});
+
+	return 0; // Return 0 variable
+}
+
 constexpr luaL_Reg dummyLib[] = {
 	// Dummy methods
 	{"helloWorld", dummy_helloWorld},
@@ -150,6 +211,8 @@ constexpr luaL_Reg dummyLib[] = {
 	{"getTable", dummy_getTable},
 	{"optParams", dummy_optParams},
 	{"varParams", dummy_varParams},
+	{"asyncWork", dummy_asyncWork},
+	{"startTicker", dummy_startTicker},
 	{NULL, NULL}
 };
 
@@ -169,4 +232,8 @@ LUARUNNER_API bool LUARUNNER_CALL_CONVENTION InitPlugin(lua_State* luaState)
 
 LUARUNNER_API void LUARUNNER_CALL_CONVENTION UninitPlugin(lua_State* luaState)
 {
+	std::lock_guard<std::mutex> const lock{ *s_asyncThreadsLock };
+	for (auto& thread : *s_asyncThreads)
+		thread.join();
+	s_asyncThreads->clear();
 }
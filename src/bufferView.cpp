@@ -0,0 +1,291 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bufferView.hpp"
+#include <climits>
+#include <cstring>
+#include <new>
+
+namespace luaRunner
+{
+namespace builtin
+{
+namespace bufferView
+{
+
+constexpr auto MetatableName = "lrbi.view";
+
+/** Translates a relative string position (negative means back from end), same rules than the lua string library. */
+static lua_Integer posrelat(lua_Integer const pos, std::size_t const len) noexcept
+{
+	if (pos >= 0)
+		return pos;
+	else if (0u - static_cast<std::size_t>(pos) > len)
+		return 0;
+	return static_cast<lua_Integer>(len) + pos + 1;
+}
+
+/** Computes the [start, end] (1-based, inclusive) range from optional arguments at 'index' and 'index + 1'. Returns false if the range is empty. */
+static bool getRange(lua_State* luaState, View const& view, int const index, lua_Integer const defaultEnd, std::size_t& start, std::size_t& end)
+{
+	auto const len = view.size;
+	auto posStart = posrelat(luaL_optinteger(luaState, index, 1), len);
+	auto posEnd = posrelat(luaL_optinteger(luaState, index + 1, defaultEnd), len);
+	if (posStart < 1)
+		posStart = 1;
+	if (posEnd > static_cast<lua_Integer>(len))
+		posEnd = static_cast<lua_Integer>(len);
+	if (posStart > posEnd)
+		return false;
+	start = static_cast<std::size_t>(posStart);
+	end = static_cast<std::size_t>(posEnd);
+	return true;
+}
+
+/** Returns the needle at stack 'index', which can either be a string or another View. */
+static char const* checkNeedle(lua_State* luaState, int const index, std::size_t& needleLength)
+{
+	auto const* const view = test(luaState, index);
+	if (view != nullptr)
+	{
+		needleLength = view->size;
+		return view->data;
+	}
+	return luaL_checklstring(luaState, index, &needleLength);
+}
+
+/** Plain (no pattern) search of 'needle' in 'haystack'. Returns nullptr if not found. */
+static char const* plainFind(char const* haystack, std::size_t haystackLength, char const* const needle, std::size_t const needleLength) noexcept
+{
+	if (needleLength == 0u)
+		return haystack;
+	if (needleLength > haystackLength)
+		return nullptr;
+
+	auto const firstChar = needle[0];
+	auto const* const last = haystack + (haystackLength - needleLength);
+	while (haystack <= last)
+	{
+		// memchr is vectorized by the C library, use it to skip to the next candidate
+		auto const* const candidate = static_cast<char const*>(std::memchr(haystack, firstChar, static_cast<std::size_t>(last - haystack) + 1u));
+		if (candidate == nullptr)
+			return nullptr;
+		if (std::memcmp(candidate + 1, needle + 1, needleLength - 1u) == 0)
+			return candidate;
+		haystack = candidate + 1;
+	}
+	return nullptr;
+}
+
+/*
+* Returns the size of the view, in bytes.
+*/
+static int view_len(lua_State* luaState)
+{
+	auto const& view = check(luaState, 1);
+	lua_pushinteger(luaState, static_cast<lua_Integer>(view.size));
+	return 1;
+}
+
+/*
+* Copies the whole view into a lua string.
+*/
+static int view_tostring(lua_State* luaState)
+{
+	auto const& view = check(luaState, 1);
+	lua_pushlstring(luaState, view.data, view.size);
+	return 1;
+}
+
+/*
+* Copies a part of the view into a lua string. Same parameters than string.sub.
+* [in] i Start position (default 1).
+* [in] j End position (default -1).
+*/
+static int view_sub(lua_State* luaState)
+{
+	auto const& view = check(luaState, 1);
+	auto start = std::size_t{ 0u };
+	auto end = std::size_t{ 0u };
+	if (getRange(luaState, view, 2, -1, start, end))
+		lua_pushlstring(luaState, view.data + start - 1u, end - start + 1u);
+	else
+		lua_pushliteral(luaState, "");
+	return 1;
+}
+
+/*
+* Returns a new view over a part of the view, without copying anything. Same parameters than string.sub.
+* [in] i Start position (default 1).
+* [in] j End position (default -1).
+*/
+static int view_view(lua_State* luaState)
+{
+	auto const& view = check(luaState, 1);
+	auto start = std::size_t{ 0u };
+	auto end = std::size_t{ 0u };
+	if (getRange(luaState, view, 2, -1, start, end))
+		push(luaState, view.owner, view.data + start - 1u, end - start + 1u);
+	else
+		push(luaState, view.owner, view.data, 0u);
+	return 1;
+}
+
+/*
+* Returns the internal numerical codes of the bytes. Same parameters than string.byte.
+* [in] i Start position (default 1).
+* [in] j End position (default i).
+*/
+static int view_byte(lua_State* luaState)
+{
+	auto const& view = check(luaState, 1);
+	auto const defaultEnd = posrelat(luaL_optinteger(luaState, 2, 1), view.size);
+	auto start = std::size_t{ 0u };
+	auto end = std::size_t{ 0u };
+	if (!getRange(luaState, view, 2, defaultEnd, start, end))
+		return 0;
+
+	auto const count = end - start + 1u;
+	if (count >= static_cast<std::size_t>(INT_MAX))
+		return luaL_error(luaState, "view slice too long");
+	luaL_checkstack(luaState, static_cast<int>(count), "view slice too long");
+	for (auto pos = start; pos <= end; ++pos)
+		lua_pushinteger(luaState, static_cast<unsigned char>(view.data[pos - 1u]));
+	return static_cast<int>(count);
+}
+
+/*
+* Looks for the first plain occurence of 'needle' in the view. Lua patterns are not supported.
+* [in] needle The string (or view) to search for.
+* [in] init Position where to start the search (default 1).
+* Returns the start and end positions of the occurence, or nil if not found.
+*/
+static int view_find(lua_State* luaState)
+{
+	auto const& view = check(luaState, 1);
+	auto needleLength = std::size_t{ 0u };
+	auto const* const needle = checkNeedle(luaState, 2, needleLength);
+	auto init = posrelat(luaL_optinteger(luaState, 3, 1), view.size);
+	if (init < 1)
+		init = 1;
+	if (init > static_cast<lua_Integer>(view.size) + 1)
+	{
+		lua_pushnil(luaState);
+		return 1;
+	}
+
+	auto const offset = static_cast<std::size_t>(init - 1);
+	auto const* const found = plainFind(view.data + offset, view.size - offset, needle, needleLength);
+	if (found == nullptr)
+	{
+		lua_pushnil(luaState);
+		return 1;
+	}
+	auto const position = static_cast<lua_Integer>(found - view.data) + 1;
+	lua_pushinteger(luaState, position);
+	lua_pushinteger(luaState, position + static_cast<lua_Integer>(needleLength) - 1);
+	return 2;
+}
+
+/** Iterator function for view_lines. Upvalue 1 is the view, upvalue 2 is the offset of the next line. */
+static int view_lines_next(lua_State* luaState)
+{
+	auto const& view = check(luaState, lua_upvalueindex(1));
+	auto const offset = static_cast<std::size_t>(lua_tointeger(luaState, lua_upvalueindex(2)));
+	if (offset >= view.size)
+		return 0;
+
+	auto const* const lineStart = view.data + offset;
+	auto const remaining = view.size - offset;
+	auto const* const lineEnd = static_cast<char const*>(std::memchr(lineStart, '\n', remaining));
+	auto const lineLength = lineEnd != nullptr ? static_cast<std::size_t>(lineEnd - lineStart) : remaining;
+	auto const nextOffset = offset + lineLength + (lineEnd != nullptr ? 1u : 0u);
+
+	lua_pushinteger(luaState, static_cast<lua_Integer>(nextOffset));
+	lua_replace(luaState, lua_upvalueindex(2));
+	push(luaState, view.owner, lineStart, lineLength);
+	return 1;
+}
+
+/*
+* Returns an iterator over the lines of the view. Each line is returned as a view, without the end of line character.
+*/
+static int view_lines(lua_State* luaState)
+{
+	check(luaState, 1);
+	lua_settop(luaState, 1);
+	lua_pushinteger(luaState, 0);
+	lua_pushcclosure(luaState, view_lines_next, 2);
+	return 1;
+}
+
+static int view_gc(lua_State* luaState)
+{
+	auto& view = check(luaState, 1);
+	view.~View();
+	return 0;
+}
+
+constexpr luaL_Reg viewMethods[] = {
+	{"len", view_len},
+	{"sub", view_sub},
+	{"view", view_view},
+	{"byte", view_byte},
+	{"find", view_find},
+	{"lines", view_lines},
+	{"tostring", view_tostring},
+	{NULL, NULL}
+};
+
+constexpr luaL_Reg viewMetamethods[] = {
+	{"__len", view_len},
+	{"__tostring", view_tostring},
+	{"__gc", view_gc},
+	{NULL, NULL}
+};
+
+void registerMetatable(lua_State* luaState) noexcept
+{
+	luaL_newmetatable(luaState, MetatableName);
+	luaL_setfuncs(luaState, viewMetamethods, 0);
+	luaL_newlib(luaState, viewMethods);
+	lua_setfield(luaState, -2, "__index");
+	lua_pop(luaState, 1); /* remove metatable from the stack */
+}
+
+View& push(lua_State* luaState, std::shared_ptr<void const> owner, char const* const data, std::size_t const size)
+{
+	auto* const view = new (lua_newuserdata(luaState, sizeof(View))) View{ std::move(owner), data, size };
+	luaL_setmetatable(luaState, MetatableName);
+	return *view;
+}
+
+View* test(lua_State* luaState, int const index) noexcept
+{
+	return static_cast<View*>(luaL_testudata(luaState, index, MetatableName));
+}
+
+View& check(lua_State* luaState, int const index)
+{
+	return *static_cast<View*>(luaL_checkudata(luaState, index, MetatableName));
+}
+
+} // namespace bufferView
+} // namespace builtin
+} // namespace luaRunner
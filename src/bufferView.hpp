@@ -0,0 +1,55 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <memory>
+#include <cstddef>
+#include <lua.hpp>
+
+namespace luaRunner
+{
+namespace builtin
+{
+namespace bufferView
+{
+
+/** Read-only window over memory owned outside of the lua heap (memory mapped file, read buffer, ...) */
+struct View
+{
+	std::shared_ptr<void const> owner{}; /**< Keeps the underlying memory alive as long as the view exists */
+	char const* data{ nullptr };
+	std::size_t size{ 0u };
+};
+
+/** Registers the View metatable in the specified lua_State. Must be called before any other method of this namespace. */
+void registerMetatable(lua_State* luaState) noexcept;
+
+/** Pushes a new View on the stack. The memory is not copied, 'owner' must keep it alive. */
+View& push(lua_State* luaState, std::shared_ptr<void const> owner, char const* const data, std::size_t const size);
+
+/** Returns the View at the specified stack index, or nullptr if the value is not a View. */
+View* test(lua_State* luaState, int const index) noexcept;
+
+/** Returns the View at the specified stack index, raises a lua error if the value is not a View. */
+View& check(lua_State* luaState, int const index);
+
+} // namespace bufferView
+} // namespace builtin
+} // namespace luaRunner
@@ -18,9 +18,18 @@
 */
 
 #include "luaRunner/execute.hpp"
+#include "bufferView.hpp"
+#include "mappedFile.hpp"
+#include "eventLoop.hpp"
+#include "pluginManager.hpp"
+#include "parallelMap.hpp"
+#include "serializer.hpp"
+#include "gcStats.hpp"
 #include <lua.hpp>
 #include <cassert>
 #include <chrono>
+#include <cstdio>
+#include <limits>
 #include <thread>
 
 namespace luaRunner
@@ -29,14 +38,150 @@ namespace builtin
 {
 
 /*
-* Pauses current thread for the specified milliseconds
-* [in] msec The number of milliseconds to pause the current thread for.
+* Pauses the current task for the specified milliseconds, letting other tasks run meanwhile.
+* Outside of a task, runs the event loop for the specified milliseconds.
+* [in] msec The number of milliseconds to pause the current task for.
 */
 int utils_sleep(lua_State* luaState)
 {
 	auto const msec = luaL_checkinteger(luaState, 1);
 
-	std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+	auto* const loop = eventLoop::EventLoop::get(luaState);
+	if (loop == nullptr)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+		return 0; // Return 0 variable
+	}
+
+	return loop->sleep(luaState, std::chrono::milliseconds(msec));
+}
+
+/*
+* Creates a new task running the specified function in a coroutine scheduled by the event loop.
+* The task starts running as soon as the current code waits (lrbi.sleep, lrbi.wait) or the script returns.
+* [in] func The function to run.
+* [in] ... Parameters passed to the function.
+* Returns the task (a coroutine) that can be passed to lrbi.wait.
+*/
+int utils_spawn(lua_State* luaState)
+{
+	luaL_checktype(luaState, 1, LUA_TFUNCTION);
+
+	auto* const loop = eventLoop::EventLoop::get(luaState);
+	if (loop == nullptr)
+		return luaL_error(luaState, "No event loop available");
+
+	loop->spawn(luaState, lua_gettop(luaState) - 1);
+
+	return 1; // Return 1 variable
+}
+
+/*
+* Calls the specified function (in a new task) after the specified milliseconds, and optionally periodically.
+* [in] msec The number of milliseconds before the first call.
+* [in] func The function to call.
+* [in] period Optional period (in milliseconds) between calls. The function is called only once if not specified or 0.
+* Returns the timer ID that can be passed to lrbi.cancel.
+*/
+int utils_timer(lua_State* luaState)
+{
+	auto const msec = luaL_checkinteger(luaState, 1);
+	luaL_checktype(luaState, 2, LUA_TFUNCTION);
+	auto const period = luaL_optinteger(luaState, 3, 0);
+
+	auto* const loop = eventLoop::EventLoop::get(luaState);
+	if (loop == nullptr)
+		return luaL_error(luaState, "No event loop available");
+
+	lua_pushinteger(luaState, loop->addTimer(luaState, 2, std::chrono::milliseconds(msec), std::chrono::milliseconds(period)));
+
+	return 1; // Return 1 variable
+}
+
+/*
+* Cancels a timer created by lrbi.timer.
+* [in] timerID The timer to cancel.
+* Returns true if the timer was cancelled, false if not found.
+*/
+int utils_cancel(lua_State* luaState)
+{
+	auto const timerID = luaL_checkinteger(luaState, 1);
+
+	auto* const loop = eventLoop::EventLoop::get(luaState);
+	lua_pushboolean(luaState, loop != nullptr && loop->cancelTimer(luaState, timerID));
+
+	return 1; // Return 1 variable
+}
+
+/*
+* Waits for the specified task to complete and returns its results (or raises its error).
+* Without parameter, runs the event loop until there is nothing left to do (cannot be called from a task).
+* [in] task Optional task returned by lrbi.spawn.
+*/
+int utils_wait(lua_State* luaState)
+{
+	auto* const loop = eventLoop::EventLoop::get(luaState);
+	if (loop == nullptr)
+		return luaL_error(luaState, "No event loop available");
+
+	if (lua_isnoneornil(luaState, 1))
+	{
+		if (lua_isyieldable(luaState))
+			return luaL_error(luaState, "Cannot wait for all tasks from within a task");
+
+		{
+			auto error = std::string{};
+			if (loop->run(luaState, error))
+				return 0; // Return 0 variable
+
+			// Copy the error to the lua stack, lua_error never returns so the string must be destroyed before raising it
+			lua_pushstring(luaState, error.c_str());
+		}
+		return lua_error(luaState);
+	}
+
+	luaL_checktype(luaState, 1, LUA_TTHREAD);
+	return loop->wait(luaState, 1);
+}
+
+/*
+* Registers the handler of the events posted (by plugins or lrbi.post) with the specified name.
+* Events are dispatched in batches: the handler is called in a new task with an array of all payloads received since its last call.
+* Registered handlers keep the script alive, remove them when no more events are expected.
+* [in] name The name of the events.
+* [in] handler The function to call, or nil to remove the handler.
+*/
+int utils_on(lua_State* luaState)
+{
+	auto const* const name = luaL_checkstring(luaState, 1);
+	if (!lua_isnil(luaState, 2))
+		luaL_checktype(luaState, 2, LUA_TFUNCTION);
+
+	auto* const loop = eventLoop::EventLoop::get(luaState);
+	if (loop == nullptr)
+		return luaL_error(luaState, "No event loop available");
+
+	loop->setEventHandler(luaState, name, 2);
+
+	return 0; // Return 0 variable
+}
+
+/*
+* Posts an event, dispatched later by the event loop to the handler registered with lrbi.on.
+* [in] name The name of the event.
+* [in] payload Optional string delivered to the handler (empty string if not specified).
+*/
+int utils_post(lua_State* luaState)
+{
+	auto const* const name = luaL_checkstring(luaState, 1);
+	auto length = std::size_t{ 0u };
+	auto const* const payload = luaL_optlstring(luaState, 2, "", &length);
+
+	auto* const loop = eventLoop::EventLoop::get(luaState);
+	if (loop == nullptr)
+		return luaL_error(luaState, "No event loop available");
+
+	loop->postEvent(name, std::string(payload, length));
 
 	return 0; // Return 0 variable
 }
@@ -49,22 +194,257 @@ int utils_require(lua_State* luaState)
 {
 	auto const* const pluginName = luaL_checklstring(luaState, 1, NULL);
 
-	auto& executor{ execute::Executor::getInstance() };
-	auto const loadResult = executor.loadPlugin(pluginName);
-	auto const result = std::get<0>(loadResult);
-	auto const errorString = std::get<1>(loadResult);
-	if (!result)
+	// Load the plugin in the lua_State we are called from (which may be a parallel_map worker, not the executor's one)
+	auto* const manager = plugin::Manager::get(luaState);
+	if (manager == nullptr)
+		return luaL_error(luaState, "No plugin manager available");
+
+	{
+		auto const loadResult = manager->loadPlugin(pluginName);
+		if (std::get<0>(loadResult))
+			return 0; // Return 0 variable
+
+		// Copy the error to the lua stack, lua_error never returns so the strings must be destroyed before raising it
+		auto const resultString = luaRunner::execute::Executor::resultToString(luaRunner::execute::Executor::Result::LoadError);
+		lua_pushfstring(luaState, "Failed to load plugin: %s: %s", resultString.c_str(), std::get<1>(loadResult).c_str());
+	}
+	return lua_error(luaState);
+}
+
+/*
+* Maps the specified file in memory and returns a read-only view over its content. The file is never copied into the lua heap.
+* The view supports len, sub, view, byte, find (plain), lines and tostring methods (see bufferView.cpp).
+* [in] path The path of the file to map.
+*/
+int utils_mmap(lua_State* luaState)
+{
+	auto const* const filePath = luaL_checklstring(luaState, 1, NULL);
+
+	{
+		auto openResult = mmap::MappedFile::open(filePath);
+		auto const& mappedFile = std::get<0>(openResult);
+		if (mappedFile)
+		{
+			bufferView::push(luaState, mappedFile, mappedFile->data(), mappedFile->size());
+			return 1; // Return 1 variable
+		}
+
+		// Copy the error to the lua stack, lua_error never returns so the result must be destroyed before raising it
+		lua_pushstring(luaState, std::get<1>(openResult).c_str());
+	}
+	return lua_error(luaState);
+}
+
+/*
+* Calls a function for each item of an array, in parallel on a pool of worker lua_States (with the same plugins loaded), and returns the results in order.
+* Items and results are serialized between states, so they can only be nil, booleans, numbers, strings (or views) and tables of those.
+* [in] function The function to call as function(item, index). Either:
+*   - a lua function without upvalues (other than _ENV),
+*   - a "module.function" name (module is loaded in the workers using require),
+*   - a lua source string, either a function expression or a chunk returning a function.
+* [in] array The items to process.
+* [in] options Optional table:
+*   - workers: Maximum count of workers to use (defaults to the count of hardware threads).
+*   - into: Table to store the results in (instead of a new table).
+*   - results: "table" (default) or "buffer" to return a view over the results packed as native doubles (all results must be numbers).
+* Returns the results table (or view).
+*/
+int utils_parallel_map(lua_State* luaState)
+{
+	return parallel::map(luaState);
+}
+
+/*
+* Serializes values into a compact binary string (see luaRunner/serializer.hpp), which can be stored or sent and read back by lrbi.deserialize.
+* Supported values are nil, booleans, numbers, strings (and views) and tables of those. Shared tables and cycles are preserved.
+* [in] ... The values to serialize.
+* Returns the serialized string.
+*/
+int utils_serialize(lua_State* luaState)
+{
+	// Reused between calls, so serializing does not reallocate once the buffer reached its working size
+	static thread_local auto s_buffer = std::string{};
+	constexpr auto MaxKeptCapacity = std::size_t{ 16u * 1024u * 1024u };
+
+	auto const valuesCount = lua_gettop(luaState);
+	auto success = true;
+	s_buffer.clear();
 	{
-		luaL_error(luaState, (std::string("Failed to load plugin: ") + luaRunner::execute::Executor::resultToString(result) + ": " + errorString).c_str());
+		// lua_error never returns, so the error message must be destroyed before raising it
+		auto error = std::string{};
+		{
+			serializer::LuaWriter writer{ s_buffer, static_cast<std::uint32_t>(valuesCount) };
+			for (auto index = 1; success && index <= valuesCount; ++index)
+				success = writer.write(luaState, index, error);
+		}
+		if (success)
+			lua_pushlstring(luaState, s_buffer.data(), s_buffer.size());
+		else
+			lua_pushfstring(luaState, "lrbi.serialize: %s", error.c_str());
+	}
+
+	// Do not keep a huge buffer alive because of a single big call (assigning an empty string would keep its capacity)
+	if (s_buffer.capacity() > MaxKeptCapacity)
+		std::string{}.swap(s_buffer);
+	if (!success)
+		return lua_error(luaState); // The error message is already on the lua stack
+
+	return 1; // Return 1 variable
+}
+
+/*
+* Reads values serialized by lrbi.serialize (or by the host, see luaRunner/serializer.hpp).
+* [in] data The serialized string (or view).
+* Returns the values.
+*/
+int utils_deserialize(lua_State* luaState)
+{
+	auto size = std::size_t{ 0u };
+	auto const* data = static_cast<char const*>(nullptr);
+	if (auto const* const view = bufferView::test(luaState, 1))
+	{
+		data = view->data;
+		size = view->size;
+	}
+	else
+	{
+		data = luaL_checklstring(luaState, 1, &size);
+	}
+
+	auto const count = serializer::readMessage(luaState, data, size);
+	if (count < 0)
+		return luaL_error(luaState, "lrbi.deserialize: malformed or unsupported data");
+
+	return count; // Return all deserialized variables
+}
+
+/*
+* Writes values to the standard output, without any separator. Strings and views are written as is (views are not copied into a lua string).
+* Unlike print, it never flushes by itself, use it instead of print or io.write in '--filter' scripts.
+* [in] ... The strings, views or numbers to write.
+*/
+int utils_emit(lua_State* luaState)
+{
+	auto const count = lua_gettop(luaState);
+	for (auto index = 1; index <= count; ++index)
+	{
+		auto size = std::size_t{ 0u };
+		auto const* data = static_cast<char const*>(nullptr);
+		if (auto const* const view = bufferView::test(luaState, index))
+		{
+			data = view->data;
+			size = view->size;
+		}
+		else
+		{
+			data = luaL_checklstring(luaState, index, &size);
+		}
+		std::fwrite(data, 1u, size, stdout);
 	}
 
 	return 0; // Return 0 variable
 }
 
+/*
+* Flushes the standard output (print, io.write and lrbi.emit output).
+*/
+int utils_flush(lua_State* /*luaState*/)
+{
+	std::fflush(stdout);
+
+	return 0; // Return 0 variable
+}
+
+/*
+* Same as the standard print, except that the standard output is not flushed after each line (see Executor::setOutputPolicy).
+* [in] ... The values to print.
+*/
+int utils_print(lua_State* luaState)
+{
+	auto const count = lua_gettop(luaState);
+	lua_getglobal(luaState, "tostring");
+	for (auto index = 1; index <= count; ++index)
+	{
+		lua_pushvalue(luaState, -1);
+		lua_pushvalue(luaState, index);
+		lua_call(luaState, 1, 1);
+		auto length = std::size_t{ 0u };
+		auto const* const str = lua_tolstring(luaState, -1, &length);
+		if (str == nullptr)
+			return luaL_error(luaState, "'tostring' must return a string to 'print'");
+		if (index > 1)
+			std::fwrite("\t", 1u, 1u, stdout);
+		std::fwrite(str, 1u, length, stdout);
+		lua_pop(luaState, 1);
+	}
+	std::fwrite("\n", 1u, 1u, stdout);
+
+	return 0; // Return 0 variable
+}
+
+/*
+* Returns the garbage collector pause durations recorded since statistics were enabled (Executor::setGcStatisticsEnabled or the --gc-stats option), as a table:
+* { enabled = boolean, steps = histogram, atomic_phases = histogram }, with histogram = { count = integer, total = microseconds, max = microseconds, buckets = {...} }.
+* buckets[1] counts pauses under 1 microsecond, buckets[i] pauses in [2^(i-2), 2^(i-1)[ microseconds (the last one also longer ones).
+*/
+int utils_gc_stats(lua_State* luaState)
+{
+	gcStats::pushStatistics(luaState);
+
+	return 1; // Return 1 variable
+}
+
+/*
+* Creates a table with space preallocated for the specified number of items, so filling it does not resize it.
+* [in] narray Optional number of array items (integer keys from 1 to narray), 0 by default.
+* [in] nhash Optional number of other entries, 0 by default.
+* Returns the new table.
+*/
+int utils_table_new(lua_State* luaState)
+{
+	auto const narray = luaL_optinteger(luaState, 1, 0);
+	auto const nhash = luaL_optinteger(luaState, 2, 0);
+	luaL_argcheck(luaState, narray >= 0 && narray <= std::numeric_limits<int>::max(), 1, "out of range");
+	luaL_argcheck(luaState, nhash >= 0 && nhash <= std::numeric_limits<int>::max(), 2, "out of range");
+
+	lua_createtable(luaState, static_cast<int>(narray), static_cast<int>(nhash));
+
+	return 1; // Return 1 variable
+}
+
+/*
+* Removes all the entries of a table, keeping the space allocated for them so it can be filled again without resizing it (eg. a scratch table reused by a loop).
+* The metatable of the table is kept. The table must not be cleared while it is traversed (next then fails on the removed key).
+* [in] table The table to clear.
+*/
+int utils_table_clear(lua_State* luaState)
+{
+	luaL_checktype(luaState, 1, LUA_TTABLE);
+
+	lua_cleartable(luaState, 1);
+
+	return 0; // Return 0 variable
+}
+
 constexpr luaL_Reg builtins[] = {
 	// Utils methods
 	{"sleep", utils_sleep},
+	{"spawn", utils_spawn},
+	{"timer", utils_timer},
+	{"cancel", utils_cancel},
+	{"wait", utils_wait},
+	{"on", utils_on},
+	{"post", utils_post},
 	{"require", utils_require},
+	{"mmap", utils_mmap},
+	{"parallel_map", utils_parallel_map},
+	{"serialize", utils_serialize},
+	{"deserialize", utils_deserialize},
+	{"emit", utils_emit},
+	{"flush", utils_flush},
+	{"gc_stats", utils_gc_stats},
+	{"table_new", utils_table_new},
+	{"table_clear", utils_table_clear},
 	{NULL, NULL}
 };
 
@@ -76,9 +456,16 @@ int luaopen_builtins(lua_State* luaState)
 
 void loadBuiltins(lua_State* luaState) noexcept
 {
+	bufferView::registerMetatable(luaState);
 	luaL_requiref(luaState, "lrbi", luaopen_builtins, 1);
 	lua_pop(luaState, 1);  /* remove lib from the stack (luaL_requiref left it on the stack) */
 }
 
+void loadBufferedPrint(lua_State* luaState) noexcept
+{
+	lua_pushcfunction(luaState, utils_print);
+	lua_setglobal(luaState, "print");
+}
+
 } // namespace builtin
 } // namespace luaRunner
@@ -32,5 +32,8 @@ namespace builtin
 
 void loadBuiltins(lua_State* luaState) noexcept;
 
+/** Replaces the standard print function by one not flushing the standard output after each line. */
+void loadBufferedPrint(lua_State* luaState) noexcept;
+
 } // namespace builtin
 } // namespace luaRunner
@@ -0,0 +1,945 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "eventLoop.hpp"
+#include "timerWheel.hpp"
+#include "mpscQueue.hpp"
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#else // !__linux__
+#include <condition_variable>
+#endif // __linux__
+
+/** State of an asynchronous plugin call (opaque for plugins) */
+struct LuaRunnerAsyncCall
+{
+	lua_State* thread{ nullptr }; /**< Task suspended until the call completes, nullptr if not awaited from a task (yet) */
+	bool completed{ false }; /**< Completion has been received by the lua thread */
+	AsyncCompletionFunc completion{ nullptr };
+	void* userData{ nullptr };
+};
+
+namespace luaRunner
+{
+namespace eventLoop
+{
+
+constexpr auto RegistryKey = "lrbi.eventLoop";
+constexpr auto TaskResultsKey = "lrbi.taskResults";
+constexpr auto EventHandlersKey = "lrbi.eventHandlers";
+constexpr std::size_t MaxEventsPerPass = 1024u; /**< Maximum events dispatched during a loop pass, so tasks and timers are not starved by a flooding producer */
+
+#ifdef __linux__
+/** Blocks until a deadline or a wakeup, using a timerfd and an eventfd polled by epoll. */
+class Poller final
+{
+public:
+	Poller() noexcept
+		: _epollFd(epoll_create1(EPOLL_CLOEXEC))
+		, _timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+		, _eventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+	{
+		assert(_epollFd != -1 && _timerFd != -1 && _eventFd != -1 && "Failed to create EventLoop file descriptors");
+		for (auto const fd : { _timerFd, _eventFd })
+		{
+			epoll_event event{};
+			event.events = EPOLLIN;
+			event.data.fd = fd;
+			epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event);
+		}
+	}
+
+	~Poller() noexcept
+	{
+		::close(_eventFd);
+		::close(_timerFd);
+		::close(_epollFd);
+	}
+
+	/** Blocks until 'deadline' (time_point::max() for no deadline) or until 'wakeup' is called. */
+	void wait(EventLoop::Clock::time_point const deadline) noexcept
+	{
+		if (deadline != EventLoop::Clock::time_point::max())
+		{
+			auto const remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - EventLoop::Clock::now()).count();
+			if (remaining <= 0)
+				return;
+			itimerspec spec{};
+			spec.it_value.tv_sec = static_cast<decltype(spec.it_value.tv_sec)>(remaining / 1000000000);
+			spec.it_value.tv_nsec = static_cast<decltype(spec.it_value.tv_nsec)>(remaining % 1000000000);
+			timerfd_settime(_timerFd, 0, &spec, nullptr);
+		}
+
+		epoll_event events[2];
+		auto const count = epoll_wait(_epollFd, events, 2, -1);
+		for (auto i = 0; i < count; ++i)
+		{
+			// Drain the counter so the fd is not readable anymore
+			std::uint64_t value{ 0u };
+			auto const result = ::read(events[i].data.fd, &value, sizeof(value));
+			(void)result;
+		}
+	}
+
+	void wakeup() noexcept
+	{
+		std::uint64_t const value{ 1u };
+		auto const result = ::write(_eventFd, &value, sizeof(value));
+		(void)result;
+	}
+
+	int getWakeupFd() const noexcept
+	{
+		return _eventFd;
+	}
+
+private:
+	int _epollFd{ -1 };
+	int _timerFd{ -1 };
+	int _eventFd{ -1 };
+};
+#else // !__linux__
+/** Blocks until a deadline or a wakeup, using a condition variable. */
+class Poller final
+{
+public:
+	void wait(EventLoop::Clock::time_point const deadline) noexcept
+	{
+		std::unique_lock<std::mutex> lock{ _lock };
+		if (deadline == EventLoop::Clock::time_point::max())
+			_condition.wait(lock, [this] { return _signaled; });
+		else
+			_condition.wait_until(lock, deadline, [this] { return _signaled; });
+		_signaled = false;
+	}
+
+	void wakeup() noexcept
+	{
+		{
+			std::lock_guard<std::mutex> const lock{ _lock };
+			_signaled = true;
+		}
+		_condition.notify_one();
+	}
+
+	int getWakeupFd() const noexcept
+	{
+		return -1;
+	}
+
+private:
+	std::mutex _lock{};
+	std::condition_variable _condition{};
+	bool _signaled{ false };
+};
+#endif // __linux__
+
+class EventLoopImpl final : public EventLoop
+{
+public:
+	// Constructor
+	EventLoopImpl(lua_State* luaState) noexcept;
+
+	// EventLoop overrides
+	virtual void spawn(lua_State* luaState, int const nargs) noexcept override;
+	virtual int sleep(lua_State* luaState, std::chrono::milliseconds const duration) noexcept override;
+	virtual TimerID addTimer(lua_State* luaState, int const functionIndex, std::chrono::milliseconds const delay, std::chrono::milliseconds const period) noexcept override;
+	virtual bool cancelTimer(lua_State* luaState, TimerID const timerID) noexcept override;
+	virtual int wait(lua_State* luaState, int const taskIndex) override;
+	virtual bool run(lua_State* luaState, std::string& error) noexcept override;
+	virtual LuaRunnerAsyncCall* beginAsyncCall(lua_State* luaState) noexcept override;
+	virtual void completeAsyncCall(LuaRunnerAsyncCall* call, AsyncCompletionFunc completion, void* userData) noexcept override;
+	virtual int awaitAsyncCall(lua_State* luaState, LuaRunnerAsyncCall* call) override;
+	virtual void setEventHandler(lua_State* luaState, std::string const& name, int const functionIndex) noexcept override;
+	virtual void postEvent(std::string name, std::string data) noexcept override;
+	virtual int getWakeupFd() const noexcept override;
+	virtual bool hasPendingWork() const noexcept override;
+	virtual void wakeup() noexcept override;
+	virtual bool collectGarbage(lua_State* luaState, std::chrono::microseconds const budget) noexcept override;
+	virtual void setIdleGcSlice(std::chrono::microseconds const slice) noexcept override;
+
+	/** Destroy method for COM-like interface */
+	virtual void destroy() noexcept override;
+
+private:
+	struct Task
+	{
+		int threadRef{ LUA_NOREF };
+		bool parked{ false }; /**< Task yielded through one of the loop primitives, and will be resumed by the loop */
+		std::vector<lua_State*> waiters{};
+	};
+
+	struct LoopTimer : TimerWheel::Timer
+	{
+		TimerID id{ 0 };
+		lua_State* thread{ nullptr }; /**< Task to resume (sleep timer), or nullptr for function timers */
+		int functionRef{ LUA_NOREF }; /**< Function to spawn (function timers) */
+		TimerWheel::Tick period{ 0u };
+	};
+
+	struct FailedTask
+	{
+		lua_State* thread{ nullptr };
+		int threadRef{ LUA_NOREF };
+		std::string error{};
+	};
+
+	struct PostedEvent : MpscQueue::Node
+	{
+		std::string name{};
+		std::string data{};
+	};
+
+	// Destructor
+	~EventLoopImpl() noexcept;
+
+	// Private methods
+	TimerWheel::Tick nowTick() const noexcept;
+	bool isSuspendableTask(lua_State* luaState) const noexcept;
+	void schedule(lua_State* thread, int const nargs) noexcept;
+	void runOnce(lua_State* luaState, Clock::time_point const waitLimit) noexcept;
+	bool processTimers(lua_State* luaState) noexcept;
+	void resumeTask(lua_State* luaState, lua_State* thread, int const nargs) noexcept;
+	void completeTask(lua_State* luaState, lua_State* thread, bool const success) noexcept;
+	int pushTaskResults(lua_State* luaState, int const taskIndex);
+	void markFailureHandled(lua_State* luaState, lua_State* thread) noexcept;
+	bool processAsyncCompletions(lua_State* luaState) noexcept;
+	int finishAsyncCall(lua_State* luaState, LuaRunnerAsyncCall* call);
+	bool processEvents(lua_State* luaState) noexcept;
+	static int resumeContinuation(lua_State* luaState, int status, lua_KContext ctx);
+	static int asyncCompletionTrampoline(lua_State* luaState);
+	static int idleCollect(lua_State* luaState);
+
+	// Private members
+	Clock::time_point const _origin{ Clock::now() };
+	Poller _poller{};
+	TimerWheel _wheel{ 0u };
+	TimerID _nextTimerID{ 1 };
+	std::unordered_map<TimerID, std::unique_ptr<LoopTimer>> _timers{};
+	std::unordered_map<lua_State*, Task> _tasks{};
+	std::deque<std::pair<lua_State*, int>> _ready{};
+	std::vector<FailedTask> _unhandledFailures{};
+	std::size_t _pendingAsyncCalls{ 0u };
+	std::mutex _asyncCompletionsLock{};
+	std::vector<LuaRunnerAsyncCall*> _asyncCompletions{}; /**< Completed calls not processed yet by the lua thread, protected by _asyncCompletionsLock */
+	MpscQueue _events{};
+	std::atomic<std::size_t> _pendingEvents{ 0u }; /**< Events being posted or not processed yet, the producer taking it from 0 wakes the loop up */
+	std::size_t _eventHandlersCount{ 0u };
+	std::chrono::microseconds _idleGcSlice{ 0 };
+	LuaRunnerHostInterface _hostInterface{};
+};
+
+/** Host interface entry points, forwarding to the EventLoop passed as context */
+static LuaRunnerAsyncCall* LUARUNNER_CALL_CONVENTION hostBeginAsyncCall(void* context, lua_State* luaState)
+{
+	return static_cast<EventLoop*>(context)->beginAsyncCall(luaState);
+}
+
+static void LUARUNNER_CALL_CONVENTION hostCompleteAsyncCall(void* context, LuaRunnerAsyncCall* call, AsyncCompletionFunc completion, void* userData)
+{
+	static_cast<EventLoop*>(context)->completeAsyncCall(call, completion, userData);
+}
+
+static int LUARUNNER_CALL_CONVENTION hostAwaitAsyncCall(void* context, lua_State* luaState, LuaRunnerAsyncCall* call)
+{
+	return static_cast<EventLoop*>(context)->awaitAsyncCall(luaState, call);
+}
+
+static void LUARUNNER_CALL_CONVENTION hostPostEvent(void* context, char const* name, void const* data, size_t size)
+{
+	static_cast<EventLoop*>(context)->postEvent(name, std::string(static_cast<char const*>(data), size));
+}
+
+static int LUARUNNER_CALL_CONVENTION hostGetWakeupFd(void* context)
+{
+	return static_cast<EventLoop*>(context)->getWakeupFd();
+}
+
+// Constructor
+EventLoopImpl::EventLoopImpl(lua_State* luaState) noexcept
+{
+	// Attach ourself to the lua_State
+	lua_pushlightuserdata(luaState, this);
+	lua_setfield(luaState, LUA_REGISTRYINDEX, RegistryKey);
+
+	// Weak table of completed tasks (coroutine -> results table)
+	lua_newtable(luaState);
+	lua_createtable(luaState, 0, 1);
+	lua_pushliteral(luaState, "k");
+	lua_setfield(luaState, -2, "__mode");
+	lua_setmetatable(luaState, -2);
+	lua_setfield(luaState, LUA_REGISTRYINDEX, TaskResultsKey);
+
+	// Event handlers (name -> function)
+	lua_newtable(luaState);
+	lua_setfield(luaState, LUA_REGISTRYINDEX, EventHandlersKey);
+
+	// Expose the host interface to plugins
+	_hostInterface.version = LUARUNNER_HOST_INTERFACE_VERSION;
+	_hostInterface.context = static_cast<EventLoop*>(this);
+	_hostInterface.beginAsyncCall = &hostBeginAsyncCall;
+	_hostInterface.completeAsyncCall = &hostCompleteAsyncCall;
+	_hostInterface.awaitAsyncCall = &hostAwaitAsyncCall;
+	_hostInterface.postEvent = &hostPostEvent;
+	_hostInterface.getWakeupFd = &hostGetWakeupFd;
+	lua_pushlightuserdata(luaState, &_hostInterface);
+	lua_setfield(luaState, LUA_REGISTRYINDEX, LUARUNNER_HOST_INTERFACE_KEY);
+}
+
+// Destructor
+EventLoopImpl::~EventLoopImpl() noexcept
+{
+	// Nothing to release in the lua_State, all references are dropped when it is closed
+
+	// Drop events never dispatched
+	while (auto* const node = _events.pop())
+		delete static_cast<PostedEvent*>(node);
+}
+
+// EventLoop overrides
+void EventLoopImpl::spawn(lua_State* luaState, int const nargs) noexcept
+{
+	auto* const thread = lua_newthread(luaState);
+	// Move the function and its arguments to the new coroutine
+	lua_rotate(luaState, -(nargs + 2), 1);
+	lua_xmove(luaState, thread, nargs + 1);
+
+	// Keep a reference on the coroutine as long as the task is alive
+	lua_pushvalue(luaState, -1);
+	auto& task = _tasks[thread];
+	task.threadRef = luaL_ref(luaState, LUA_REGISTRYINDEX);
+
+	schedule(thread, nargs);
+}
+
+int EventLoopImpl::sleep(lua_State* luaState, std::chrono::milliseconds const duration) noexcept
+{
+	// Inside a task, suspend it and let the loop resume it when the timer expires
+	if (isSuspendableTask(luaState))
+	{
+		auto timer = std::make_unique<LoopTimer>();
+		timer->id = _nextTimerID++;
+		timer->thread = luaState;
+		timer->expiry = nowTick() + static_cast<TimerWheel::Tick>(std::max(duration.count(), decltype(duration.count())(0)));
+		_wheel.add(*timer);
+		_timers[timer->id] = std::move(timer);
+		_tasks[luaState].parked = true;
+		return lua_yield(luaState, 0);
+	}
+
+	// Otherwise keep running the loop (so other tasks make progress) until the duration elapsed
+	auto const deadline = Clock::now() + duration;
+	while (Clock::now() < deadline)
+		runOnce(luaState, deadline);
+	return 0;
+}
+
+EventLoop::TimerID EventLoopImpl::addTimer(lua_State* luaState, int const functionIndex, std::chrono::milliseconds const delay, std::chrono::milliseconds const period) noexcept
+{
+	auto timer = std::make_unique<LoopTimer>();
+	auto const timerID = _nextTimerID++;
+	timer->id = timerID;
+	lua_pushvalue(luaState, functionIndex);
+	timer->functionRef = luaL_ref(luaState, LUA_REGISTRYINDEX);
+	timer->period = static_cast<TimerWheel::Tick>(std::max(period.count(), decltype(period.count())(0)));
+	timer->expiry = nowTick() + static_cast<TimerWheel::Tick>(std::max(delay.count(), decltype(delay.count())(0)));
+	_wheel.add(*timer);
+	_timers[timerID] = std::move(timer);
+	return timerID;
+}
+
+bool EventLoopImpl::cancelTimer(lua_State* luaState, TimerID const timerID) noexcept
+{
+	auto const it = _timers.find(timerID);
+	// Sleep timers are internal and cannot be cancelled
+	if (it == _timers.end() || it->second->thread != nullptr)
+		return false;
+
+	_wheel.remove(*it->second);
+	luaL_unref(luaState, LUA_REGISTRYINDEX, it->second->functionRef);
+	_timers.erase(it);
+	return true;
+}
+
+int EventLoopImpl::wait(lua_State* luaState, int const taskIndex)
+{
+	auto* const target = lua_tothread(luaState, taskIndex);
+	if (target == luaState)
+		return luaL_error(luaState, "a task cannot wait for itself");
+
+	// Already completed
+	auto const resultsCount = pushTaskResults(luaState, taskIndex);
+	if (resultsCount >= 0)
+		return resultsCount;
+
+	auto const it = _tasks.find(target);
+	if (it == _tasks.end())
+		return luaL_argerror(luaState, taskIndex, "not a task");
+
+	// Inside a task, suspend it until the target completes (completeTask will resume us with the results)
+	if (isSuspendableTask(luaState))
+	{
+		it->second.waiters.push_back(luaState);
+		_tasks[luaState].parked = true;
+		// The continuation receives the values on top of the current stack, remember where they start
+		return lua_yieldk(luaState, 0, static_cast<lua_KContext>(lua_gettop(luaState)), &EventLoopImpl::resumeContinuation);
+	}
+
+	// Otherwise run the loop until the target completes
+	while (_tasks.count(target) != 0)
+	{
+		if (!hasPendingWork())
+			return luaL_error(luaState, "task can never complete, nothing left to run in the event loop");
+		runOnce(luaState, Clock::time_point::max());
+	}
+	return std::max(pushTaskResults(luaState, taskIndex), 0);
+}
+
+bool EventLoopImpl::run(lua_State* luaState, std::string& error) noexcept
+{
+	while (hasPendingWork())
+		runOnce(luaState, Clock::time_point::max());
+
+	if (_unhandledFailures.empty())
+		return true;
+
+	error = _unhandledFailures.front().error;
+	for (auto const& failure : _unhandledFailures)
+		luaL_unref(luaState, LUA_REGISTRYINDEX, failure.threadRef);
+	_unhandledFailures.clear();
+	return false;
+}
+
+LuaRunnerAsyncCall* EventLoopImpl::beginAsyncCall(lua_State* /*luaState*/) noexcept
+{
+	++_pendingAsyncCalls;
+	return new LuaRunnerAsyncCall;
+}
+
+void EventLoopImpl::completeAsyncCall(LuaRunnerAsyncCall* call, AsyncCompletionFunc completion, void* userData) noexcept
+{
+	{
+		std::lock_guard<std::mutex> const lock{ _asyncCompletionsLock };
+		call->completion = completion;
+		call->userData = userData;
+		_asyncCompletions.push_back(call);
+	}
+	wakeup();
+}
+
+int EventLoopImpl::awaitAsyncCall(lua_State* luaState, LuaRunnerAsyncCall* call)
+{
+	// Inside a task, suspend it until the completion is processed by the loop (which will resume us with the results)
+	if (!call->completed && isSuspendableTask(luaState))
+	{
+		call->thread = luaState;
+		_tasks[luaState].parked = true;
+		return lua_yieldk(luaState, 0, static_cast<lua_KContext>(lua_gettop(luaState)), &EventLoopImpl::resumeContinuation);
+	}
+
+	// Otherwise run the loop until the completion is received
+	while (!call->completed)
+		runOnce(luaState, Clock::time_point::max());
+
+	auto const count = finishAsyncCall(luaState, call);
+	if (count < 0)
+		return lua_error(luaState);
+	return count;
+}
+
+void EventLoopImpl::setEventHandler(lua_State* luaState, std::string const& name, int const functionIndex) noexcept
+{
+	auto const absIndex = lua_absindex(luaState, functionIndex);
+	lua_getfield(luaState, LUA_REGISTRYINDEX, EventHandlersKey);
+	lua_getfield(luaState, -1, name.c_str());
+	auto const hadHandler = !lua_isnil(luaState, -1);
+	lua_pop(luaState, 1);
+
+	lua_pushvalue(luaState, absIndex);
+	lua_setfield(luaState, -2, name.c_str());
+	lua_pop(luaState, 1); // Remove the handlers table
+
+	auto const hasHandler = !lua_isnil(luaState, absIndex);
+	if (hasHandler && !hadHandler)
+		++_eventHandlersCount;
+	else if (!hasHandler && hadHandler)
+		--_eventHandlersCount;
+}
+
+void EventLoopImpl::postEvent(std::string name, std::string data) noexcept
+{
+	// Count the event before it is visible, so the consumer never blocks while a push is in progress
+	auto const wasIdle = _pendingEvents.fetch_add(1u, std::memory_order_acq_rel) == 0u;
+
+	auto* const event = new PostedEvent;
+	event->name = std::move(name);
+	event->data = std::move(data);
+	_events.push(event);
+
+	// Only wake the loop up once per batch of events
+	if (wasIdle)
+		wakeup();
+}
+
+int EventLoopImpl::getWakeupFd() const noexcept
+{
+	return _poller.getWakeupFd();
+}
+
+bool EventLoopImpl::hasPendingWork() const noexcept
+{
+	// Registered event handlers keep the loop alive, until they are removed
+	return !_ready.empty() || !_wheel.empty() || _pendingAsyncCalls != 0u || _eventHandlersCount != 0u || _pendingEvents.load(std::memory_order_acquire) != 0u;
+}
+
+void EventLoopImpl::wakeup() noexcept
+{
+	_poller.wakeup();
+}
+
+bool EventLoopImpl::collectGarbage(lua_State* luaState, std::chrono::microseconds const budget) noexcept
+{
+	// Finalizers may run and raise errors, which are dropped (nobody to report them to while idle)
+	lua_pushcfunction(luaState, &EventLoopImpl::idleCollect);
+	lua_pushinteger(luaState, static_cast<lua_Integer>(budget.count()));
+	if (lua_pcall(luaState, 1, 1, 0) != LUA_OK)
+	{
+		lua_pop(luaState, 1);
+		return false;
+	}
+	auto const done = lua_toboolean(luaState, -1) != 0;
+	lua_pop(luaState, 1);
+	return done;
+}
+
+void EventLoopImpl::setIdleGcSlice(std::chrono::microseconds const slice) noexcept
+{
+	_idleGcSlice = std::max(slice, std::chrono::microseconds{ 0 });
+}
+
+// Private methods
+TimerWheel::Tick EventLoopImpl::nowTick() const noexcept
+{
+	return static_cast<TimerWheel::Tick>(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - _origin).count());
+}
+
+bool EventLoopImpl::isSuspendableTask(lua_State* luaState) const noexcept
+{
+	return _tasks.count(luaState) != 0 && lua_isyieldable(luaState);
+}
+
+void EventLoopImpl::schedule(lua_State* thread, int const nargs) noexcept
+{
+	_ready.emplace_back(thread, nargs);
+}
+
+void EventLoopImpl::runOnce(lua_State* luaState, Clock::time_point const waitLimit) noexcept
+{
+	auto const processedCompletions = processAsyncCompletions(luaState);
+	auto const processedEvents = processEvents(luaState);
+	auto const processedTimers = processTimers(luaState);
+
+	// Only run tasks already scheduled, tasks rescheduled during this pass will run during next one
+	auto count = _ready.size();
+	if (count != 0u || processedCompletions || processedEvents || processedTimers)
+	{
+		while (count-- > 0u && !_ready.empty())
+		{
+			auto const ready = _ready.front();
+			_ready.pop_front();
+			resumeTask(luaState, ready.first, ready.second);
+		}
+		// Return to the caller so it can check if what it waits for happened
+		return;
+	}
+
+	// An event is being pushed by another thread, it will be available shortly (its producer may not wake us up)
+	if (_pendingEvents.load(std::memory_order_acquire) != 0u)
+	{
+		std::this_thread::yield();
+		return;
+	}
+
+	// Nothing to run, block until next timer expiry (or waitLimit)
+	auto deadline = waitLimit;
+	auto const nextTick = _wheel.nextWakeupTick();
+	if (nextTick != TimerWheel::NoExpiry)
+		deadline = std::min(deadline, _origin + std::chrono::milliseconds(nextTick));
+
+	// Meanwhile, let the garbage collector work, one slice per pass so events and timers are not delayed more than a slice
+	if (_idleGcSlice.count() != 0)
+	{
+		auto slice = _idleGcSlice;
+		if (deadline != Clock::time_point::max())
+			slice = std::min(slice, std::chrono::duration_cast<std::chrono::microseconds>(deadline - Clock::now()));
+		if (slice.count() > 0 && !collectGarbage(luaState, slice))
+			return;
+	}
+
+	_poller.wait(deadline);
+}
+
+/** Processes expired timers. Returns true if at least one timer expired. */
+bool EventLoopImpl::processTimers(lua_State* luaState) noexcept
+{
+	auto expired = false;
+	_wheel.advance(nowTick(), [this, luaState, &expired](TimerWheel::Timer& wheelTimer)
+	{
+		auto& timer = static_cast<LoopTimer&>(wheelTimer);
+		expired = true;
+		auto const timerID = timer.id;
+
+		// Sleep timer: resume the task
+		if (timer.thread != nullptr)
+		{
+			schedule(timer.thread, 0);
+			_timers.erase(timerID);
+			return;
+		}
+
+		// Function timer: spawn a task running the function
+		lua_rawgeti(luaState, LUA_REGISTRYINDEX, timer.functionRef);
+		spawn(luaState, 0);
+		lua_pop(luaState, 1); // Remove the task from the stack
+
+		if (timer.period != 0u)
+		{
+			timer.expiry += timer.period;
+			_wheel.add(timer);
+		}
+		else
+		{
+			luaL_unref(luaState, LUA_REGISTRYINDEX, timer.functionRef);
+			_timers.erase(timerID);
+		}
+	});
+	return expired;
+}
+
+void EventLoopImpl::resumeTask(lua_State* luaState, lua_State* thread, int const nargs) noexcept
+{
+	auto const it = _tasks.find(thread);
+	if (it == _tasks.end())
+		return;
+	it->second.parked = false;
+
+	auto const status = lua_resume(thread, luaState, nargs);
+	if (status == LUA_YIELD)
+	{
+		// Yielded through coroutine.yield, discard the yielded values and reschedule it
+		if (!_tasks[thread].parked)
+		{
+			lua_pop(thread, lua_gettop(thread));
+			schedule(thread, 0);
+		}
+		return;
+	}
+
+	completeTask(luaState, thread, status == LUA_OK);
+}
+
+void EventLoopImpl::completeTask(lua_State* luaState, lua_State* thread, bool const success) noexcept
+{
+	lua_checkstack(luaState, 4);
+
+	// Build the results table: { success, values... , n = count }
+	auto const valuesCount = success ? lua_gettop(thread) : 1;
+	lua_createtable(luaState, valuesCount + 1, 1);
+	auto const resultsIndex = lua_gettop(luaState);
+	lua_pushboolean(luaState, success);
+	lua_rawseti(luaState, resultsIndex, 1);
+	if (success)
+	{
+		luaL_checkstack(luaState, valuesCount, "too many task results");
+		lua_xmove(thread, luaState, valuesCount);
+		for (auto index = valuesCount; index > 0; --index)
+			lua_rawseti(luaState, resultsIndex, index + 1);
+	}
+	else
+	{
+		// Add the coroutine traceback to the error message
+		auto const* const message = lua_tostring(thread, -1);
+		luaL_traceback(luaState, thread, message != nullptr ? message : "(error object is not a string)", 0);
+		lua_rawseti(luaState, resultsIndex, 2);
+	}
+	lua_pushinteger(luaState, valuesCount + 1);
+	lua_setfield(luaState, resultsIndex, "n");
+
+	// Store the results so the task can be waited for later
+	auto task = std::move(_tasks[thread]);
+	_tasks.erase(thread);
+	lua_getfield(luaState, LUA_REGISTRYINDEX, TaskResultsKey);
+	lua_rawgeti(luaState, LUA_REGISTRYINDEX, task.threadRef);
+	lua_pushvalue(luaState, resultsIndex);
+	lua_rawset(luaState, -3);
+	lua_pop(luaState, 1); // Remove the results weak table
+
+	// Resume all waiters with (success, values...)
+	for (auto* const waiter : task.waiters)
+	{
+		luaL_checkstack(waiter, valuesCount + 1, "too many task results");
+		for (auto index = 1; index <= valuesCount + 1; ++index)
+		{
+			lua_rawgeti(luaState, resultsIndex, index);
+			lua_xmove(luaState, waiter, 1);
+		}
+		schedule(waiter, valuesCount + 1);
+	}
+
+	// Failed task nobody is waiting for yet, keep it so the error is not silently lost
+	if (!success && task.waiters.empty())
+	{
+		lua_rawgeti(luaState, resultsIndex, 2);
+		_unhandledFailures.push_back(FailedTask{ thread, task.threadRef, lua_tostring(luaState, -1) });
+		lua_pop(luaState, 1);
+	}
+	else
+	{
+		luaL_unref(luaState, LUA_REGISTRYINDEX, task.threadRef);
+	}
+
+	lua_pop(luaState, 1); // Remove the results table
+}
+
+/** Pushes the results of a completed task (raises its error if it failed). Returns the count of pushed values, or -1 if the task has not completed. */
+int EventLoopImpl::pushTaskResults(lua_State* luaState, int const taskIndex)
+{
+	lua_getfield(luaState, LUA_REGISTRYINDEX, TaskResultsKey);
+	lua_pushvalue(luaState, taskIndex);
+	lua_rawget(luaState, -2);
+	if (!lua_istable(luaState, -1))
+	{
+		lua_pop(luaState, 2);
+		return -1;
+	}
+
+	auto const resultsIndex = lua_gettop(luaState);
+	lua_getfield(luaState, resultsIndex, "n");
+	auto const count = static_cast<int>(lua_tointeger(luaState, -1));
+	lua_pop(luaState, 1);
+
+	lua_rawgeti(luaState, resultsIndex, 1);
+	auto const success = lua_toboolean(luaState, -1);
+	lua_pop(luaState, 1);
+	if (!success)
+	{
+		markFailureHandled(luaState, lua_tothread(luaState, taskIndex));
+		lua_rawgeti(luaState, resultsIndex, 2);
+		lua_error(luaState);
+	}
+
+	luaL_checkstack(luaState, count, "too many task results");
+	// Remove the weak table and results table from the stack, keeping the results table in the weak table
+	lua_remove(luaState, resultsIndex - 1);
+	auto const tableIndex = resultsIndex - 1;
+	for (auto index = 2; index <= count; ++index)
+		lua_rawgeti(luaState, tableIndex, index);
+	lua_remove(luaState, tableIndex);
+	return count - 1;
+}
+
+void EventLoopImpl::markFailureHandled(lua_State* luaState, lua_State* thread) noexcept
+{
+	auto const it = std::find_if(_unhandledFailures.begin(), _unhandledFailures.end(), [thread](FailedTask const& failure)
+	{
+		return failure.thread == thread;
+	});
+	if (it == _unhandledFailures.end())
+		return;
+
+	luaL_unref(luaState, LUA_REGISTRYINDEX, it->threadRef);
+	_unhandledFailures.erase(it);
+}
+
+/** Processes asynchronous calls completed since last call. Returns true if at least one call completed. */
+bool EventLoopImpl::processAsyncCompletions(lua_State* luaState) noexcept
+{
+	auto completions = decltype(_asyncCompletions){};
+	{
+		std::lock_guard<std::mutex> const lock{ _asyncCompletionsLock };
+		if (_asyncCompletions.empty())
+			return false;
+		completions.swap(_asyncCompletions);
+	}
+
+	for (auto* const call : completions)
+	{
+		call->completed = true;
+		// Not awaited from a task, awaitAsyncCall will finish it
+		if (call->thread == nullptr)
+			continue;
+
+		// Run the completion (protected) and resume the task with (success, results...) or (false, error)
+		auto* const thread = call->thread;
+		auto const base = lua_gettop(luaState);
+		lua_pushcfunction(luaState, &EventLoopImpl::asyncCompletionTrampoline);
+		lua_pushlightuserdata(luaState, call);
+		auto const success = lua_pcall(luaState, 1, LUA_MULTRET, 0) == LUA_OK;
+		auto const count = lua_gettop(luaState) - base;
+
+		delete call;
+		--_pendingAsyncCalls;
+
+		luaL_checkstack(thread, count + 1, "too many async call results");
+		lua_pushboolean(thread, success);
+		lua_xmove(luaState, thread, count);
+		schedule(thread, count + 1);
+	}
+	return true;
+}
+
+/**
+* Dispatches posted events. Events are grouped by name, each handler being called once (in a new task) with an array of all its event payloads.
+* Events without handler are dropped. Returns true if at least one event was processed.
+*/
+bool EventLoopImpl::processEvents(lua_State* luaState) noexcept
+{
+	if (_pendingEvents.load(std::memory_order_acquire) == 0u)
+		return false;
+
+	// Group events by name, keeping posting order
+	auto batches = std::vector<std::pair<std::string, std::vector<std::unique_ptr<PostedEvent>>>>{};
+	auto processed = std::size_t{ 0u };
+	while (processed < MaxEventsPerPass)
+	{
+		auto* const node = _events.pop();
+		if (node == nullptr)
+			break;
+		++processed;
+		auto event = std::unique_ptr<PostedEvent>{ static_cast<PostedEvent*>(node) };
+		auto batch = std::find_if(batches.begin(), batches.end(), [&event](decltype(batches)::value_type const& b)
+		{
+			return b.first == event->name;
+		});
+		if (batch == batches.end())
+		{
+			batches.emplace_back(event->name, decltype(batches)::value_type::second_type{});
+			batch = std::prev(batches.end());
+		}
+		batch->second.push_back(std::move(event));
+	}
+	if (processed == 0u)
+		return false;
+	_pendingEvents.fetch_sub(processed, std::memory_order_acq_rel);
+
+	lua_getfield(luaState, LUA_REGISTRYINDEX, EventHandlersKey);
+	for (auto const& batch : batches)
+	{
+		lua_getfield(luaState, -1, batch.first.c_str());
+		if (lua_isnil(luaState, -1))
+		{
+			lua_pop(luaState, 1);
+			continue;
+		}
+
+		auto const& events = batch.second;
+		lua_createtable(luaState, static_cast<int>(events.size()), 0);
+		auto index = lua_Integer{ 1 };
+		for (auto const& event : events)
+		{
+			lua_pushlstring(luaState, event->data.data(), event->data.size());
+			lua_rawseti(luaState, -2, index++);
+		}
+		spawn(luaState, 1);
+		lua_pop(luaState, 1); // Remove the task from the stack
+	}
+	lua_pop(luaState, 1); // Remove the handlers table
+	return true;
+}
+
+/** Calls the completion of an asynchronous call, pushing its results. Returns their count, or -1 if the completion pushed an error. Releases the call. */
+int EventLoopImpl::finishAsyncCall(lua_State* luaState, LuaRunnerAsyncCall* call)
+{
+	auto const completion = call->completion;
+	auto* const userData = call->userData;
+	delete call;
+	--_pendingAsyncCalls;
+
+	return completion(luaState, userData);
+}
+
+/** lua_CFunction calling the completion of the asynchronous call passed as light userdata, raising its error if any. */
+int EventLoopImpl::asyncCompletionTrampoline(lua_State* luaState)
+{
+	auto* const call = static_cast<LuaRunnerAsyncCall*>(lua_touserdata(luaState, 1));
+	lua_pop(luaState, 1);
+	auto const count = call->completion(luaState, call->userData);
+	if (count < 0)
+		return lua_error(luaState);
+	return count;
+}
+
+/** Runs the garbage collector for the budget (microseconds) at stack index 1, in a protected call (see 'collectGarbage'). */
+int EventLoopImpl::idleCollect(lua_State* luaState)
+{
+	auto const usec = std::min(luaL_checkinteger(luaState, 1), static_cast<lua_Integer>(std::numeric_limits<int>::max()));
+	lua_pushboolean(luaState, lua_gc(luaState, LUA_GCIDLE, static_cast<int>(usec)));
+	return 1;
+}
+
+/**
+* Continuation of tasks suspended by 'wait' or 'awaitAsyncCall'.
+* Above 'ctx' values, the stack contains the values the task was resumed with: success flag then results (or error).
+*/
+int EventLoopImpl::resumeContinuation(lua_State* luaState, int /*status*/, lua_KContext ctx)
+{
+	auto const flagIndex = static_cast<int>(ctx) + 1;
+	if (!lua_toboolean(luaState, flagIndex))
+	{
+		lua_settop(luaState, flagIndex + 1);
+		return lua_error(luaState);
+	}
+	return lua_gettop(luaState) - flagIndex;
+}
+
+/** Destroy method for COM-like interface */
+void EventLoopImpl::destroy() noexcept
+{
+	delete this;
+}
+
+/** EventLoop Entry point */
+EventLoop* EventLoop::createRawEventLoop(lua_State* luaState)
+{
+	return new EventLoopImpl(luaState);
+}
+
+EventLoop* EventLoop::get(lua_State* luaState) noexcept
+{
+	lua_getfield(luaState, LUA_REGISTRYINDEX, RegistryKey);
+	auto* const loop = static_cast<EventLoop*>(lua_touserdata(luaState, -1));
+	lua_pop(luaState, 1);
+	return loop;
+}
+
+} // namespace eventLoop
+} // namespace luaRunner
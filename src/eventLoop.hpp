@@ -0,0 +1,132 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <lua.hpp>
+#include "luaRunner/plugin.hpp"
+
+namespace luaRunner
+{
+namespace eventLoop
+{
+
+/**
+* Cooperative scheduler for lua coroutines (tasks) and timers, driven by epoll and timerfd on Linux.
+* All methods must be called from the thread owning the lua_State, except 'wakeup', 'postEvent' and 'completeAsyncCall'.
+*/
+class EventLoop
+{
+public:
+	using UniquePointer = std::unique_ptr<EventLoop, void(*)(EventLoop*)>;
+	using Clock = std::chrono::steady_clock;
+	using TimerID = lua_Integer;
+
+	/**
+	* @brief Factory method to create a new EventLoop.
+	* @details Creates a new EventLoop as a unique pointer, and attaches it to the specified lua_State (see 'get').
+	* @param[in] luaState A valid lua_State.
+	* @return A new EventLoop as a EventLoop::UniquePointer.
+	*/
+	static UniquePointer create(lua_State* luaState)
+	{
+		auto deleter = [](EventLoop* self)
+		{
+			self->destroy();
+		};
+		return UniquePointer(createRawEventLoop(luaState), deleter);
+	}
+
+	/** Returns the EventLoop attached to the specified lua_State (or any of its coroutines), nullptr if none. */
+	static EventLoop* get(lua_State* luaState) noexcept;
+
+	/** Creates a task running the function at stack index -(nargs + 1) with the 'nargs' values above it. Pops them and pushes the task (a coroutine) on the stack. */
+	virtual void spawn(lua_State* luaState, int const nargs) noexcept = 0;
+
+	/** Suspends the calling task for 'duration' (or runs the loop for that duration outside of a task). Must be returned by the calling lua_CFunction. */
+	virtual int sleep(lua_State* luaState, std::chrono::milliseconds const duration) noexcept = 0;
+
+	/** Calls the function at stack 'functionIndex' in a new task after 'delay', and then every 'period' (if not zero). */
+	virtual TimerID addTimer(lua_State* luaState, int const functionIndex, std::chrono::milliseconds const delay, std::chrono::milliseconds const period) noexcept = 0;
+
+	/** Cancels a timer. Returns false if the timer was not found (already fired or cancelled). */
+	virtual bool cancelTimer(lua_State* luaState, TimerID const timerID) noexcept = 0;
+
+	/** Waits for the task at stack 'taskIndex' to complete and returns its results (raises its error). Must be returned by the calling lua_CFunction. */
+	virtual int wait(lua_State* luaState, int const taskIndex) = 0;
+
+	/** Runs the loop until there is nothing left to do. Returns false if a task failed without anyone waiting for it, 'error' is then set. */
+	virtual bool run(lua_State* luaState, std::string& error) noexcept = 0;
+
+	/** Starts an asynchronous call, see LuaRunnerHostInterface::beginAsyncCall. */
+	virtual LuaRunnerAsyncCall* beginAsyncCall(lua_State* luaState) noexcept = 0;
+
+	/** Completes an asynchronous call, see LuaRunnerHostInterface::completeAsyncCall. Can be called from any thread. */
+	virtual void completeAsyncCall(LuaRunnerAsyncCall* call, AsyncCompletionFunc completion, void* userData) noexcept = 0;
+
+	/** Waits for an asynchronous call to complete, see LuaRunnerHostInterface::awaitAsyncCall. Must be returned by the calling lua_CFunction. */
+	virtual int awaitAsyncCall(lua_State* luaState, LuaRunnerAsyncCall* call) = 0;
+
+	/** Registers the function at stack 'functionIndex' as the handler of events named 'name' (replacing any previous one). A nil value removes the handler. */
+	virtual void setEventHandler(lua_State* luaState, std::string const& name, int const functionIndex) noexcept = 0;
+
+	/** Posts an event to be dispatched to the handler registered for 'name'. Can be called from any thread. */
+	virtual void postEvent(std::string name, std::string data) noexcept = 0;
+
+	/** Returns a file descriptor becoming readable when the loop has to wake up (to be polled by an external loop, never read from), -1 if not supported. */
+	virtual int getWakeupFd() const noexcept = 0;
+
+	/** Returns true if the loop has ready tasks, pending timers, or any other pending work. */
+	virtual bool hasPendingWork() const noexcept = 0;
+
+	/** Wakes up the loop if blocked waiting for events. Can be called from any thread. */
+	virtual void wakeup() noexcept = 0;
+
+	/** Runs the garbage collector for about 'budget', as the program is idle (see Executor::collectGarbageWhileIdle). Returns true if there was nothing worth collecting. */
+	virtual bool collectGarbage(lua_State* luaState, std::chrono::microseconds const budget) noexcept = 0;
+
+	/** Lets the loop run the garbage collector in slices of 'slice' when it has nothing else to do (0 to disable). */
+	virtual void setIdleGcSlice(std::chrono::microseconds const slice) noexcept = 0;
+
+	// Deleted compiler auto-generated methods
+	EventLoop(EventLoop&&) = delete;
+	EventLoop(EventLoop const&) = delete;
+	EventLoop& operator=(EventLoop const&) = delete;
+	EventLoop& operator=(EventLoop&&) = delete;
+
+protected:
+	/** Constructor */
+	EventLoop() noexcept = default;
+
+	/** Destructor */
+	virtual ~EventLoop() noexcept = default;
+
+private:
+	/** Entry point */
+	static EventLoop* createRawEventLoop(lua_State* luaState);
+
+	/** Destroy method for COM-like interface */
+	virtual void destroy() noexcept = 0;
+};
+
+} // namespace eventLoop
+} // namespace luaRunner
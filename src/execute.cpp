@@ -20,8 +20,22 @@
 #include "luaRunner/execute.hpp"
 #include "pluginManager.hpp"
 #include "builtin.hpp"
+#include "eventLoop.hpp"
+#include "serializer.hpp"
+#include "luaVisitor.hpp"
+#include "filter.hpp"
+#include "opcodeStats.hpp"
+#include "gcStats.hpp"
+#include <cstdio>
 #include <lua.hpp>
+// Lua internals, for the JIT compiler switch
+extern "C"
+{
+#include <ljit.h>
+}
 #include <cassert>
+#include <algorithm>
+#include <limits>
 
 namespace luaRunner
 {
@@ -37,25 +51,47 @@ public:
 	~ExecutorImpl() noexcept;
 
 	// Executor overrides
+	virtual void setOutputPolicy(OutputPolicy const policy, std::size_t const bufferSize) noexcept override;
+	virtual void setOpcodeStatisticsEnabled(bool const enabled) noexcept override;
+	virtual std::string getOpcodeStatistics(std::size_t const maxEntries) const noexcept override;
+	virtual bool setJitEnabled(bool const enabled) noexcept override;
+	virtual void setGcMode(GcMode const mode) noexcept override;
+	virtual void setGcStatisticsEnabled(bool const enabled) noexcept override;
+	virtual GcStatistics getGcStatistics() const noexcept override;
+	virtual void setGcStepTimeTarget(std::chrono::microseconds const maxStepDuration) noexcept override;
+	virtual bool collectGarbageWhileIdle(std::chrono::microseconds const budget) noexcept override;
+	virtual void setIdleGcSlice(std::chrono::microseconds const slice) noexcept override;
+	virtual void setFastClose(bool const enabled) noexcept override;
 	virtual void setPluginSearchPaths(PluginSearchPaths const& searchPaths) noexcept override;
 	virtual LoadResult loadPlugin(std::string const& pluginName) noexcept override;
 	virtual ExecuteResult executeLuaFileWithParameters(std::string const& luaFilePath, ScriptParameters const& parameters) noexcept override;
+	virtual ExecuteResult executeLuaFileWithArguments(std::string const& luaFilePath, SerializedValues const& arguments, SerializedValues& results) noexcept override;
+	virtual ExecuteResult executeLuaFileWithVisitor(std::string const& luaFilePath, ScriptParameters const& parameters, value::Visitor& visitor) noexcept override;
+	virtual ExecuteResult executeLuaFileWithResults(std::string const& luaFilePath, ScriptParameters const& parameters, value::Values& results) noexcept override;
+	virtual ExecuteResult executeLuaFileAsFilter(std::string const& luaFilePath, ScriptParameters const& parameters, FilterOptions const& options) noexcept override;
+	virtual ResolveResult resolveFunction(std::string const& name, function::Function& function) noexcept override;
+	virtual void postEvent(std::string const& name, std::string const& data) noexcept override;
+	virtual int getWakeupFd() const noexcept override;
 
 private:
 
 	// Private methods
 	void pushParamsToLua(ScriptParameters const& parameters) noexcept;
 	ExecuteResult execute() noexcept;
+	ExecuteResult executeWithResults(int const argumentsCount) noexcept;
 
 	// Private members
 	lua_State* _state{ nullptr };
 	plugin::Manager::UniquePointer _pluginManager{ nullptr, nullptr };
+	eventLoop::EventLoop::UniquePointer _eventLoop{ nullptr, nullptr };
+	bool _fastClose{ false };
 };
 
 // Constructor
 ExecutorImpl::ExecutorImpl() noexcept
 	: _state(luaL_newstate())
 	, _pluginManager(plugin::Manager::create(_state))
+	, _eventLoop(eventLoop::EventLoop::create(_state))
 {
 	// Load lua libs
 	luaL_openlibs(_state);
@@ -66,12 +102,98 @@ ExecutorImpl::ExecutorImpl() noexcept
 // Destructor
 ExecutorImpl::~ExecutorImpl() noexcept
 {
-	_pluginManager->unloadAllPlugins();
+	// Plugins stay mapped until the lua_State is closed, as their functions and finalizers can still be called
+	_pluginManager->uninitAllPlugins();
 	if (_state != nullptr)
-		lua_close(_state);
+	{
+		if (_fastClose)
+			lua_fastclose(_state);
+		else
+			lua_close(_state);
+	}
+	_pluginManager->unloadAllPlugins();
 }
 
 // Executor overrides
+void ExecutorImpl::setOutputPolicy(OutputPolicy const policy, std::size_t const bufferSize) noexcept
+{
+	auto const size = bufferSize != 0u ? bufferSize : std::size_t{ BUFSIZ };
+	switch (policy)
+	{
+		case OutputPolicy::Default:
+			return;
+		case OutputPolicy::Unbuffered:
+			std::setvbuf(stdout, nullptr, _IONBF, 0u);
+			break;
+		case OutputPolicy::Line:
+			std::setvbuf(stdout, nullptr, _IOLBF, size);
+			break;
+		case OutputPolicy::Full:
+			std::setvbuf(stdout, nullptr, _IOFBF, size);
+			break;
+		default:
+			assert(false && "OutputPolicy value not handled");
+			return;
+	}
+
+	// Let the policy decide when print output is flushed
+	builtin::loadBufferedPrint(_state);
+}
+
+void ExecutorImpl::setOpcodeStatisticsEnabled(bool const enabled) noexcept
+{
+	if (enabled)
+		opcodeStats::start(_state);
+	else
+		opcodeStats::stop(_state);
+}
+
+std::string ExecutorImpl::getOpcodeStatistics(std::size_t const maxEntries) const noexcept
+{
+	return opcodeStats::getReport(maxEntries);
+}
+
+bool ExecutorImpl::setJitEnabled(bool const enabled) noexcept
+{
+	return luaJ_setmode(_state, enabled ? 1 : 0) != 0;
+}
+
+void ExecutorImpl::setGcMode(GcMode const mode) noexcept
+{
+	lua_gc(_state, mode == GcMode::Generational ? LUA_GCGEN : LUA_GCINC, 0);
+}
+
+void ExecutorImpl::setGcStatisticsEnabled(bool const enabled) noexcept
+{
+	gcStats::setEnabled(_state, enabled);
+}
+
+Executor::GcStatistics ExecutorImpl::getGcStatistics() const noexcept
+{
+	return gcStats::getStatistics(_state);
+}
+
+void ExecutorImpl::setGcStepTimeTarget(std::chrono::microseconds const maxStepDuration) noexcept
+{
+	auto const usec = std::min(maxStepDuration.count(), static_cast<std::chrono::microseconds::rep>(std::numeric_limits<int>::max()));
+	lua_gc(_state, LUA_GCSETSTEPTIME, static_cast<int>(std::max(usec, std::chrono::microseconds::rep{ 0 })));
+}
+
+bool ExecutorImpl::collectGarbageWhileIdle(std::chrono::microseconds const budget) noexcept
+{
+	return _eventLoop->collectGarbage(_state, budget);
+}
+
+void ExecutorImpl::setIdleGcSlice(std::chrono::microseconds const slice) noexcept
+{
+	_eventLoop->setIdleGcSlice(slice);
+}
+
+void ExecutorImpl::setFastClose(bool const enabled) noexcept
+{
+	_fastClose = enabled;
+}
+
 void ExecutorImpl::setPluginSearchPaths(PluginSearchPaths const& searchPaths) noexcept
 {
 	// Clear previous search paths
@@ -108,6 +230,197 @@ Executor::ExecuteResult ExecutorImpl::executeLuaFileWithParameters(std::string c
 	return execute();
 }
 
+Executor::ExecuteResult ExecutorImpl::executeLuaFileWithArguments(std::string const& luaFilePath, SerializedValues const& arguments, SerializedValues& results) noexcept
+{
+	auto const base = lua_gettop(_state);
+	if (luaL_loadfile(_state, luaFilePath.c_str()))
+	{
+		return { Result::ParseError, ScriptReturnValue(253u), lua_tostring(_state, -1) };
+	}
+
+	auto argumentsCount = 0;
+	if (!arguments.empty())
+	{
+		argumentsCount = serializer::readMessage(_state, arguments.data(), arguments.size());
+		if (argumentsCount < 0)
+		{
+			lua_settop(_state, base);
+			return { Result::ExecError, ScriptReturnValue(253u), "Malformed arguments" };
+		}
+	}
+
+	auto const result = executeWithResults(argumentsCount);
+	if (!std::get<0>(result))
+	{
+		return result;
+	}
+
+	auto const resultsCount = lua_gettop(_state) - base;
+	auto error = std::string{};
+	auto success = true;
+	{
+		serializer::LuaWriter writer{ results, static_cast<std::uint32_t>(resultsCount) };
+		for (auto index = base + 1; success && index <= base + resultsCount; ++index)
+			success = writer.write(_state, index, error);
+	}
+	lua_settop(_state, base);
+	if (!success)
+	{
+		return { Result::ReturnError, ScriptReturnValue(252u), "Cannot serialize returned values: " + error };
+	}
+
+	return { Result::Success, ScriptReturnValue(0u), "" };
+}
+
+Executor::ExecuteResult ExecutorImpl::executeLuaFileWithVisitor(std::string const& luaFilePath, ScriptParameters const& parameters, value::Visitor& visitor) noexcept
+{
+	pushParamsToLua(parameters);
+
+	auto const base = lua_gettop(_state);
+	if (luaL_loadfile(_state, luaFilePath.c_str()))
+	{
+		return { Result::ParseError, ScriptReturnValue(253u), lua_tostring(_state, -1) };
+	}
+
+	auto const result = executeWithResults(0);
+	if (!std::get<0>(result))
+	{
+		return result;
+	}
+
+	// Stream the returned values straight from the stack
+	auto error = std::string{};
+	auto const success = value::visitLuaValues(_state, base + 1, lua_gettop(_state) - base, visitor, error);
+	lua_settop(_state, base);
+	if (!success)
+	{
+		return { Result::ReturnError, ScriptReturnValue(252u), "Cannot convert returned values: " + error };
+	}
+
+	return { Result::Success, ScriptReturnValue(0u), "" };
+}
+
+Executor::ExecuteResult ExecutorImpl::executeLuaFileWithResults(std::string const& luaFilePath, ScriptParameters const& parameters, value::Values& results) noexcept
+{
+	value::ValueBuilder builder{ results };
+	return executeLuaFileWithVisitor(luaFilePath, parameters, builder);
+}
+
+Executor::ExecuteResult ExecutorImpl::executeLuaFileAsFilter(std::string const& luaFilePath, ScriptParameters const& parameters, FilterOptions const& options) noexcept
+{
+	pushParamsToLua(parameters);
+
+	auto const base = lua_gettop(_state);
+	if (luaL_loadfile(_state, luaFilePath.c_str()))
+	{
+		return { Result::ParseError, ScriptReturnValue(253u), lua_tostring(_state, -1) };
+	}
+
+	auto const result = executeWithResults(0);
+	lua_settop(_state, base);
+	if (!std::get<0>(result))
+	{
+		return result;
+	}
+
+	if (lua_getglobal(_state, "process") != LUA_TFUNCTION)
+	{
+		lua_settop(_state, base);
+		return { Result::ExecError, ScriptReturnValue(253u), "Filter script must define a global 'process(batch, count)' function" };
+	}
+
+	auto error = std::string{};
+	auto const success = filter::run(_state, -1, options, error);
+	lua_settop(_state, base);
+
+	// Run the tasks spawned by the process calls
+	if (success && !_eventLoop->run(_state, error))
+	{
+		std::fflush(stdout);
+		return { Result::ExecError, ScriptReturnValue(253u), error };
+	}
+	std::fflush(stdout);
+	if (!success)
+	{
+		return { Result::ExecError, ScriptReturnValue(253u), error };
+	}
+
+	return { Result::Success, ScriptReturnValue(0u), "" };
+}
+
+/** Resolves the dotted name at index 1 (in protected mode), returns the function */
+static int resolveFunctionPath(lua_State* luaState)
+{
+	auto const* const name = luaL_checkstring(luaState, 1);
+	auto const* segment = name;
+	auto first = true;
+	while (true)
+	{
+		auto const* end = segment;
+		while (*end != '\0' && *end != '.')
+			++end;
+		lua_pushlstring(luaState, segment, static_cast<std::size_t>(end - segment));
+
+		if (first)
+		{
+			lua_pushvalue(luaState, -1);
+			// Not a global, try to load it as a module
+			if (lua_getglobal(luaState, lua_tostring(luaState, -1)) == LUA_TNIL && *end == '.')
+			{
+				lua_pop(luaState, 1);
+				lua_getglobal(luaState, "require");
+				lua_insert(luaState, -2);
+				lua_call(luaState, 1, 1);
+			}
+			else
+			{
+				lua_remove(luaState, -2);
+			}
+			first = false;
+		}
+		else
+		{
+			if (!lua_istable(luaState, -2))
+				return luaL_error(luaState, "'%s': '%s' is not in a table", name, lua_tostring(luaState, -1));
+			lua_gettable(luaState, -2);
+		}
+		lua_remove(luaState, -2); // Remove the segment name (or the parent table)
+
+		if (*end == '\0')
+			break;
+		segment = end + 1;
+	}
+
+	if (!lua_isfunction(luaState, -1))
+		return luaL_error(luaState, "'%s' is not a function", name);
+	return 1;
+}
+
+Executor::ResolveResult ExecutorImpl::resolveFunction(std::string const& name, function::Function& function) noexcept
+{
+	lua_pushcfunction(_state, &resolveFunctionPath);
+	lua_pushlstring(_state, name.data(), name.size());
+	if (lua_pcall(_state, 1, 1, 0))
+	{
+		auto error = std::string{ lua_tostring(_state, -1) };
+		lua_pop(_state, 1);
+		return { Result::ExecError, error };
+	}
+
+	function = function::Function{ _state, luaL_ref(_state, LUA_REGISTRYINDEX) };
+	return { Result::Success, "" };
+}
+
+void ExecutorImpl::postEvent(std::string const& name, std::string const& data) noexcept
+{
+	_eventLoop->postEvent(name, data);
+}
+
+int ExecutorImpl::getWakeupFd() const noexcept
+{
+	return _eventLoop->getWakeupFd();
+}
+
 // Private methods
 void ExecutorImpl::pushParamsToLua(ScriptParameters const& parameters) noexcept
 {
@@ -141,6 +454,13 @@ Executor::ExecuteResult ExecutorImpl::execute() noexcept
 		return { Result::ExecError, ScriptReturnValue(253u), lua_tostring(_state, -1) };
 	}
 
+	// Keep the script alive until all its tasks and timers are done
+	auto loopError = std::string{};
+	if (!_eventLoop->run(_state, loopError))
+	{
+		return { Result::ExecError, ScriptReturnValue(253u), loopError };
+	}
+
 	// Check if there is a returned value by the script
 	auto const type = lua_type(_state, -1);
 	if (type != LUA_TNIL && (type != LUA_TNUMBER || lua_isinteger(_state, -1) == 0))
@@ -157,6 +477,24 @@ Executor::ExecuteResult ExecutorImpl::execute() noexcept
 	return { Result::Success, static_cast<ScriptReturnValue>(retValue), "" };
 }
 
+/** Runs the loaded chunk (below its 'argumentsCount' arguments) keeping all its returned values on the stack, then the event loop. */
+Executor::ExecuteResult ExecutorImpl::executeWithResults(int const argumentsCount) noexcept
+{
+	if (lua_pcall(_state, argumentsCount, LUA_MULTRET, 0))
+	{
+		return { Result::ExecError, ScriptReturnValue(253u), lua_tostring(_state, -1) };
+	}
+
+	// Keep the script alive until all its tasks and timers are done
+	auto loopError = std::string{};
+	if (!_eventLoop->run(_state, loopError))
+	{
+		return { Result::ExecError, ScriptReturnValue(253u), loopError };
+	}
+
+	return { Result::Success, ScriptReturnValue(0u), "" };
+}
+
 // Executor methods
 std::string Executor::resultToString(Result const result) noexcept
 {
@@ -0,0 +1,296 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "filter.hpp"
+#include "bufferView.hpp"
+#include "mappedFile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace luaRunner
+{
+namespace filter
+{
+
+using FilterOptions = execute::Executor::FilterOptions;
+
+static constexpr auto ReadChunkSize = std::size_t{ 1024u * 1024u };
+
+namespace
+{
+
+/**
+* Builds batches of records and hands them to the process function.
+* The batch table and its views are reused from one batch to the next (only their data pointer changes), so no lua object is created per record.
+*/
+class Batcher final
+{
+public:
+	/** Pushes the batch table and the views pool table */
+	Batcher(lua_State* luaState, int const processIndex, std::size_t const batchSize)
+		: _state(luaState)
+		, _processIndex(lua_absindex(luaState, processIndex))
+		, _batchSize(batchSize)
+	{
+		auto const preallocated = static_cast<int>(std::min(batchSize, std::size_t{ 65536u }));
+		lua_createtable(_state, preallocated, 0);
+		_batchIndex = lua_gettop(_state);
+		lua_createtable(_state, preallocated, 0);
+		_poolIndex = lua_gettop(_state);
+		_views.reserve(static_cast<std::size_t>(preallocated));
+	}
+
+	bool add(std::shared_ptr<void const> const& owner, char const* const data, std::size_t const size, std::string& error)
+	{
+		auto const index = static_cast<lua_Integer>(_count + 1u);
+		if (_count == _views.size())
+		{
+			// First time this slot is used
+			_views.push_back(&builtin::bufferView::push(_state, owner, data, size));
+			lua_rawseti(_state, _poolIndex, index);
+		}
+		else
+		{
+			auto& view = *_views[_count];
+			if (view.owner != owner)
+				view.owner = owner;
+			view.data = data;
+			view.size = size;
+		}
+		// The pool keeps the views alive even if the script changes the batch table
+		lua_rawgeti(_state, _poolIndex, index);
+		lua_rawseti(_state, _batchIndex, index);
+
+		++_count;
+		if (_count == _batchSize)
+			return dispatch(error);
+		return true;
+	}
+
+	/** Dispatches the pending batch */
+	bool dispatch(std::string& error)
+	{
+		if (_count == 0u)
+			return true;
+
+		// Only the last batch can be incomplete, remove the previous batch remaining records
+		for (auto index = _count + 1u; index <= _batchSize && index <= _views.size(); ++index)
+		{
+			lua_pushnil(_state);
+			lua_rawseti(_state, _batchIndex, static_cast<lua_Integer>(index));
+		}
+
+		lua_pushvalue(_state, _processIndex);
+		lua_pushvalue(_state, _batchIndex);
+		lua_pushinteger(_state, static_cast<lua_Integer>(_count));
+		_count = 0u;
+		if (lua_pcall(_state, 2, 0, 0))
+		{
+			error = lua_tostring(_state, -1);
+			lua_pop(_state, 1);
+			return false;
+		}
+		return true;
+	}
+
+	// Deleted compiler auto-generated methods
+	Batcher(Batcher&&) = delete;
+	Batcher(Batcher const&) = delete;
+	Batcher& operator=(Batcher const&) = delete;
+	Batcher& operator=(Batcher&&) = delete;
+
+private:
+	// Private members
+	lua_State* _state{ nullptr };
+	int _processIndex{ 0 };
+	std::size_t _batchSize{ 0u };
+	int _batchIndex{ 0 }; /**< Stack index of the batch table */
+	int _poolIndex{ 0 }; /**< Stack index of the table keeping the views alive */
+	std::vector<builtin::bufferView::View*> _views{};
+	std::size_t _count{ 0u }; /**< Records in the pending batch */
+};
+
+} // namespace
+
+/**
+* Splits [data, data + size) into records. Returns the count of bytes consumed, the remaining ones being the start of an incomplete record.
+* If 'isLast', the remaining bytes must form a complete record (a last line without line feed), otherwise this is an error.
+*/
+static bool splitRecords(Batcher& batcher, FilterOptions const& options, std::shared_ptr<void const> const& owner, char const* const data, std::size_t const size, bool const isLast, std::size_t& consumed, std::string& error)
+{
+	auto const* cursor = data;
+	auto const* const end = data + size;
+
+	switch (options.recordFormat)
+	{
+		case FilterOptions::RecordFormat::Lines:
+			while (cursor != end)
+			{
+				auto const* const lineFeed = static_cast<char const*>(std::memchr(cursor, '\n', static_cast<std::size_t>(end - cursor)));
+				if (lineFeed == nullptr)
+				{
+					if (!isLast)
+						break;
+					if (!batcher.add(owner, cursor, static_cast<std::size_t>(end - cursor), error))
+						return false;
+					cursor = end;
+					break;
+				}
+				if (!batcher.add(owner, cursor, static_cast<std::size_t>(lineFeed - cursor), error))
+					return false;
+				cursor = lineFeed + 1;
+			}
+			break;
+		case FilterOptions::RecordFormat::Fixed:
+			while (static_cast<std::size_t>(end - cursor) >= options.recordSize)
+			{
+				if (!batcher.add(owner, cursor, options.recordSize, error))
+					return false;
+				cursor += options.recordSize;
+			}
+			break;
+		case FilterOptions::RecordFormat::LengthPrefixed:
+			while (static_cast<std::size_t>(end - cursor) >= 4u)
+			{
+				// 32 bits little endian length
+				auto const* const prefix = reinterpret_cast<unsigned char const*>(cursor);
+				auto const length = static_cast<std::size_t>(prefix[0]) | (static_cast<std::size_t>(prefix[1]) << 8) | (static_cast<std::size_t>(prefix[2]) << 16) | (static_cast<std::size_t>(prefix[3]) << 24);
+				if (static_cast<std::size_t>(end - cursor) - 4u < length)
+					break;
+				if (!batcher.add(owner, cursor + 4, length, error))
+					return false;
+				cursor += 4u + length;
+			}
+			break;
+		default:
+			error = "Unsupported record format";
+			return false;
+	}
+
+	consumed = static_cast<std::size_t>(cursor - data);
+	if (isLast && cursor != end)
+	{
+		error = "Truncated record at end of input";
+		return false;
+	}
+	return true;
+}
+
+/** Reads a stream with large reads, records never span two buffers (an incomplete record is moved to the next buffer) */
+static bool processStream(Batcher& batcher, FilterOptions const& options, std::FILE* const file, std::string const& name, std::string& error)
+{
+	auto carry = std::shared_ptr<char>{};
+	auto carrySize = std::size_t{ 0u };
+	while (true)
+	{
+		// Grow the buffer if a single record does not fit
+		auto const capacity = std::max(ReadChunkSize, carrySize * 2u);
+		auto buffer = std::shared_ptr<char>{ new char[capacity], std::default_delete<char[]>() };
+		if (carrySize != 0u)
+			std::memcpy(buffer.get(), carry.get(), carrySize);
+
+		auto const read = std::fread(buffer.get() + carrySize, 1u, capacity - carrySize, file);
+		if (std::ferror(file))
+		{
+			error = "Error reading input '" + name + "'";
+			return false;
+		}
+		auto const isLast = read == 0u && std::feof(file);
+		auto const size = carrySize + read;
+
+		auto consumed = std::size_t{ 0u };
+		if (!splitRecords(batcher, options, buffer, buffer.get(), size, isLast, consumed, error))
+			return false;
+		if (isLast)
+			return true;
+
+		carrySize = size - consumed;
+		carry = buffer;
+		if (carrySize != 0u)
+		{
+			// Keep only the incomplete record, not the whole buffer
+			auto tail = std::shared_ptr<char>{ new char[carrySize], std::default_delete<char[]>() };
+			std::memcpy(tail.get(), buffer.get() + consumed, carrySize);
+			carry = std::move(tail);
+		}
+	}
+}
+
+static bool processInput(Batcher& batcher, FilterOptions const& options, std::string const& input, std::string& error)
+{
+	if (input == "-")
+		return processStream(batcher, options, stdin, "stdin", error);
+
+	// Regular files are mapped, records are then views over the mapping
+	auto const openResult = mmap::MappedFile::open(input);
+	auto const& mappedFile = std::get<0>(openResult);
+	if (mappedFile && mappedFile->size() != 0u)
+	{
+		auto consumed = std::size_t{ 0u };
+		return splitRecords(batcher, options, mappedFile, mappedFile->data(), mappedFile->size(), true, consumed, error);
+	}
+
+	// Not mappable, or reported empty (pipe, empty file, ...)
+	auto* const file = std::fopen(input.c_str(), "rb");
+	if (file == nullptr)
+	{
+		error = std::get<1>(openResult).empty() ? "Cannot open input '" + input + "'" : std::get<1>(openResult);
+		return false;
+	}
+	auto const result = processStream(batcher, options, file, input, error);
+	std::fclose(file);
+	return result;
+}
+
+bool run(lua_State* luaState, int const processIndex, FilterOptions const& options, std::string& error)
+{
+	if (options.batchSize == 0u || (options.recordFormat == FilterOptions::RecordFormat::Fixed && options.recordSize == 0u))
+	{
+		error = "Invalid filter options";
+		return false;
+	}
+
+	auto const top = lua_gettop(luaState);
+	Batcher batcher{ luaState, processIndex, options.batchSize };
+	auto success = true;
+	if (options.inputs.empty())
+	{
+		success = processInput(batcher, options, "-", error);
+	}
+	else
+	{
+		for (auto const& input : options.inputs)
+		{
+			success = processInput(batcher, options, input, error);
+			if (!success)
+				break;
+		}
+	}
+
+	if (success)
+		success = batcher.dispatch(error);
+	lua_settop(luaState, top);
+	return success;
+}
+
+} // namespace filter
+} // namespace luaRunner
@@ -0,0 +1,38 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "luaRunner/execute.hpp"
+#include <string>
+#include <lua.hpp>
+
+namespace luaRunner
+{
+namespace filter
+{
+
+/**
+* Reads the inputs described by 'options', splits them into records and calls the function at stack 'processIndex' with batches of records (views), as process(batch, count).
+* Returns false if an input cannot be read, is truncated, or if the function raised an error, 'error' is then set.
+*/
+bool run(lua_State* luaState, int const processIndex, execute::Executor::FilterOptions const& options, std::string& error);
+
+} // namespace filter
+} // namespace luaRunner
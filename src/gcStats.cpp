@@ -0,0 +1,96 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "gcStats.hpp"
+#include <cstdint>
+
+// Lua internals, to read the histograms of the collector
+extern "C"
+{
+#include <lstate.h>
+#include <lgc.h>
+}
+
+namespace luaRunner
+{
+namespace gcStats
+{
+
+using GcHistogram = execute::Executor::GcHistogram;
+static_assert(GcHistogram::BucketsCount == GCHISTSIZE, "GcHistogram must have as many buckets as the lua histograms");
+
+static GcHistogram toHistogram(GCHistogram const& histogram) noexcept
+{
+	auto result = GcHistogram{};
+	result.count = static_cast<std::uint64_t>(histogram.count);
+	result.total = std::chrono::nanoseconds{ static_cast<std::chrono::nanoseconds::rep>(histogram.total) };
+	result.max = std::chrono::nanoseconds{ static_cast<std::chrono::nanoseconds::rep>(histogram.max) };
+	for (auto index = std::size_t{ 0u }; index < GCHISTSIZE; ++index)
+		result.buckets[index] = static_cast<std::uint64_t>(histogram.buckets[index]);
+	return result;
+}
+
+/** Pushes a { count, total, max, buckets } table, durations in microseconds */
+static void pushHistogram(lua_State* luaState, GCHistogram const& histogram)
+{
+	lua_createtable(luaState, 0, 4);
+	lua_pushinteger(luaState, static_cast<lua_Integer>(histogram.count));
+	lua_setfield(luaState, -2, "count");
+	lua_pushnumber(luaState, static_cast<lua_Number>(histogram.total) / 1000.0);
+	lua_setfield(luaState, -2, "total");
+	lua_pushnumber(luaState, static_cast<lua_Number>(histogram.max) / 1000.0);
+	lua_setfield(luaState, -2, "max");
+	lua_createtable(luaState, GCHISTSIZE, 0);
+	for (auto index = 0; index < GCHISTSIZE; ++index)
+	{
+		lua_pushinteger(luaState, static_cast<lua_Integer>(histogram.buckets[index]));
+		lua_rawseti(luaState, -2, index + 1);
+	}
+	lua_setfield(luaState, -2, "buckets");
+}
+
+void setEnabled(lua_State* luaState, bool const enabled) noexcept
+{
+	lua_gc(luaState, LUA_GCSTATS, enabled ? 1 : 0);
+}
+
+execute::Executor::GcStatistics getStatistics(lua_State* luaState) noexcept
+{
+	auto const& stats = *luaC_getstats(luaState);
+	auto result = execute::Executor::GcStatistics{};
+	result.enabled = G(luaState)->gcstatson != 0;
+	result.steps = toHistogram(stats.step);
+	result.atomicPhases = toHistogram(stats.atomic);
+	return result;
+}
+
+void pushStatistics(lua_State* luaState)
+{
+	auto const& stats = *luaC_getstats(luaState);
+	lua_createtable(luaState, 0, 3);
+	lua_pushboolean(luaState, G(luaState)->gcstatson);
+	lua_setfield(luaState, -2, "enabled");
+	pushHistogram(luaState, stats.step);
+	lua_setfield(luaState, -2, "steps");
+	pushHistogram(luaState, stats.atomic);
+	lua_setfield(luaState, -2, "atomic_phases");
+}
+
+} // namespace gcStats
+} // namespace luaRunner
@@ -0,0 +1,40 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "luaRunner/execute.hpp"
+#include <lua.hpp>
+
+namespace luaRunner
+{
+namespace gcStats
+{
+
+/** Starts recording the duration of the garbage collector steps and atomic phases (resetting the previous statistics), or stops recording. */
+void setEnabled(lua_State* luaState, bool const enabled) noexcept;
+
+/** Returns the recorded garbage collector pause durations. */
+execute::Executor::GcStatistics getStatistics(lua_State* luaState) noexcept;
+
+/** Pushes the recorded garbage collector pause durations as a table (see lrbi.gc_stats). */
+void pushStatistics(lua_State* luaState);
+
+} // namespace gcStats
+} // namespace luaRunner
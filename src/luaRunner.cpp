@@ -21,24 +21,159 @@
 #include "luaRunner/version.hpp"
 #include <iostream>
 #include <sstream>
+#include <iomanip>
+#include <chrono>
 #include <string>
 #include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
 
 void printHelp()
 {
-	std::cout << "LuaRunner v" << luaRunner::getVersion() << " usage:" << std::endl;
-	std::cout << "  LuaRunner [Options] <lua script to execute> [lua script parameters]" << std::endl;
-	std::cout << "Options:" << std::endl;
-	std::cout << "  -h -> Display this help and exit" << std::endl;
-	std::cout << "  -v -> Display version and exit" << std::endl;
-	std::cout << "  -p <Name of plugin to load> -> Load specified plugin before executing the lua script. Multiple '-p' options can be specified to load multiple plugins." << std::endl;
-	std::cout << "  -s <Plugins search path> -> Search path for plugins. Multiple '-s' options can be specified to add multiple search paths." << std::endl;
-	std::cout << "Returned value:" << std::endl;
-	std::cout << "  255: Parameter error" << std::endl;
-	std::cout << "  254: Plugin load error" << std::endl;
-	std::cout << "  253: Script error" << std::endl;
-	std::cout << "  252: Invalid script returned value: must either be nothing or an integer value between 0 and 127 (inclusive)" << std::endl;
-	std::cout << "  0-127: Script returned value (0 by default)" << std::endl;
+	std::cout << "LuaRunner v" << luaRunner::getVersion() << " usage:" << "\n";
+	std::cout << "  LuaRunner [Options] <lua script to execute> [lua script parameters]" << "\n";
+	std::cout << "Options:" << "\n";
+	std::cout << "  -h -> Display this help and exit" << "\n";
+	std::cout << "  -v -> Display version and exit" << "\n";
+	std::cout << "  -p <Name of plugin to load> -> Load specified plugin before executing the lua script. Multiple '-p' options can be specified to load multiple plugins." << "\n";
+	std::cout << "  -s <Plugins search path> -> Search path for plugins. Multiple '-s' options can be specified to add multiple search paths." << "\n";
+	std::cout << "  -r <json|binary> -> Write all the values returned by the script to the standard output (as a JSON array, or a serialized message), other messages are then written to the error output." << "\n";
+	std::cout << "  --output <unbuffered|line|full[:<size>]> -> Standard output buffering (print, io.write, lrbi.emit). Fully buffered output is only flushed when the buffer is full, at exit, on errors or by lrbi.flush. Defaults to the C library buffering, full:1048576 in filter mode." << "\n";
+	std::cout << "  --filter -> Filter mode: the script defines a 'process(batch, count)' function, called with batches of records read from the files given as script parameters (or the standard input). Output should be written with lrbi.emit, other messages are then written to the error output." << "\n";
+	std::cout << "  --records <lines|fixed:<size>|prefixed> -> Filter mode records: lines (default), fixed size records, or records preceded by their 32 bits little endian length." << "\n";
+	std::cout << "  --batch <count> -> Filter mode maximum count of records per process call (1024 by default)." << "\n";
+	std::cout << "  --opcode-stats -> Write the most executed opcodes and opcode pairs to the error output once the script is done (execution is much slower)." << "\n";
+	std::cout << "  --jit -> Compile hot lua functions to native code (baseline JIT compiler, x86-64 Linux only)." << "\n";
+	std::cout << "  --gc <incremental|generational> -> Garbage collector mode (incremental by default). The generational mode is usually faster for scripts creating many short-lived objects." << "\n";
+	std::cout << "  --gc-stats -> Write a histogram of the garbage collector pause durations (steps and atomic phases) to the error output once the script is done." << "\n";
+	std::cout << "  --gc-step-time <usec> -> Target maximum duration of a garbage collector step, in microseconds: steps are then shorter and more frequent." << "\n";
+	std::cout << "  --gc-idle <usec> -> Run the garbage collector in slices of at most <usec> microseconds while the event loop waits for timers or events, moving collection work out of the script execution." << "\n";
+	std::cout << "Returned value:" << "\n";
+	std::cout << "  255: Parameter error" << "\n";
+	std::cout << "  254: Plugin load error" << "\n";
+	std::cout << "  253: Script error" << "\n";
+	std::cout << "  252: Invalid script returned value: must either be nothing or an integer value between 0 and 127 (inclusive)" << "\n";
+	std::cout << "  0-127: Script returned value (0 by default, always 0 with '-r')" << "\n";
+}
+
+/** Parses a '--output' parameter */
+bool parseOutputPolicy(std::string const& policy, luaRunner::execute::Executor::OutputPolicy& outputPolicy, std::size_t& bufferSize)
+{
+	using OutputPolicy = luaRunner::execute::Executor::OutputPolicy;
+
+	if (policy == "unbuffered")
+	{
+		outputPolicy = OutputPolicy::Unbuffered;
+		return true;
+	}
+	if (policy == "line")
+	{
+		outputPolicy = OutputPolicy::Line;
+		return true;
+	}
+	auto const full = std::string{ "full" };
+	if (policy.compare(0, full.size(), full) == 0)
+	{
+		outputPolicy = OutputPolicy::Full;
+		if (policy.size() == full.size())
+			return true;
+		if (policy[full.size()] != ':')
+			return false;
+		bufferSize = static_cast<std::size_t>(std::strtoul(policy.c_str() + full.size() + 1, nullptr, 10));
+		return bufferSize != 0u;
+	}
+	return false;
+}
+
+/** Parses a '--records' parameter */
+bool parseRecordFormat(std::string const& format, luaRunner::execute::Executor::FilterOptions& options)
+{
+	using RecordFormat = luaRunner::execute::Executor::FilterOptions::RecordFormat;
+
+	if (format == "lines")
+	{
+		options.recordFormat = RecordFormat::Lines;
+		return true;
+	}
+	if (format == "prefixed")
+	{
+		options.recordFormat = RecordFormat::LengthPrefixed;
+		return true;
+	}
+	auto const prefix = std::string{ "fixed:" };
+	if (format.compare(0, prefix.size(), prefix) == 0)
+	{
+		options.recordFormat = RecordFormat::Fixed;
+		options.recordSize = static_cast<std::size_t>(std::strtoul(format.c_str() + prefix.size(), nullptr, 10));
+		return options.recordSize != 0u;
+	}
+	return false;
+}
+
+/** Parses a '--gc' parameter */
+bool parseGcMode(std::string const& mode, luaRunner::execute::Executor::GcMode& gcMode)
+{
+	using GcMode = luaRunner::execute::Executor::GcMode;
+
+	if (mode == "incremental")
+	{
+		gcMode = GcMode::Incremental;
+		return true;
+	}
+	if (mode == "generational")
+	{
+		gcMode = GcMode::Generational;
+		return true;
+	}
+	return false;
+}
+
+/** Writes a garbage collector pause histogram to the error output */
+void printGcHistogram(char const* const name, luaRunner::execute::Executor::GcHistogram const& histogram)
+{
+	auto const toUsec = [](std::chrono::nanoseconds const duration)
+	{
+		return static_cast<double>(duration.count()) / 1000.0;
+	};
+	std::cerr << std::fixed << std::setprecision(1);
+	std::cerr << name << ": " << histogram.count << " pauses, total " << toUsec(histogram.total) << " us, mean " << (histogram.count != 0u ? toUsec(histogram.total) / static_cast<double>(histogram.count) : 0.0) << " us, max " << toUsec(histogram.max) << " us\n";
+	for (auto index = std::size_t{ 0u }; index < histogram.buckets.size(); ++index)
+	{
+		auto const count = histogram.buckets[index];
+		if (count == 0u)
+			continue;
+		auto const upper = std::uint64_t{ 1u } << index;
+		auto const range = index == 0u ? std::string{ "< 1 us" } : index + 1u == histogram.buckets.size() ? ">= " + std::to_string(upper / 2u) + " us" : std::to_string(upper / 2u) + "-" + std::to_string(upper) + " us";
+		std::cerr << "  " << std::setw(20) << std::left << range << std::right << std::setw(14) << count << "\n";
+	}
+}
+
+/** Executes the script and writes its returned values to the standard output, only if it succeeded. */
+luaRunner::execute::Executor::ExecuteResult executeWithResults(luaRunner::execute::Executor& executor, std::string const& scriptToExecute, luaRunner::execute::Executor::ScriptParameters const& scriptsParameters, std::string const& resultsFormat)
+{
+	auto output = std::string{};
+	auto executeResult = luaRunner::execute::Executor::ExecuteResult{};
+	if (resultsFormat == "json")
+	{
+		auto stream = std::ostringstream{};
+		luaRunner::value::JsonWriter writer{ stream };
+		executeResult = executor.executeLuaFileWithVisitor(scriptToExecute, scriptsParameters, writer);
+		stream << "\n";
+		output = stream.str();
+	}
+	else
+	{
+		luaRunner::value::BinaryWriter writer{ output };
+		executeResult = executor.executeLuaFileWithVisitor(scriptToExecute, scriptsParameters, writer);
+	}
+
+	if (std::get<0>(executeResult) == luaRunner::execute::Executor::Result::Success)
+	{
+		std::cout.write(output.data(), static_cast<std::streamsize>(output.size()));
+		std::cout.flush();
+	}
+	return executeResult;
 }
 
 int main(int argc, char const* argv[])
@@ -47,6 +182,17 @@ int main(int argc, char const* argv[])
 	std::vector<std::string> pluginsSearchPaths{};
 	std::string scriptToExecute{};
 	luaRunner::execute::Executor::ScriptParameters scriptsParameters{};
+	std::string resultsFormat{};
+	bool filterMode{ false };
+	bool opcodeStats{ false };
+	bool jit{ false };
+	bool gcStats{ false };
+	auto gcStepTime = std::chrono::microseconds{ 0 };
+	auto gcIdleSlice = std::chrono::microseconds{ 0 };
+	auto gcMode{ luaRunner::execute::Executor::GcMode::Incremental };
+	auto outputPolicy{ luaRunner::execute::Executor::OutputPolicy::Default };
+	std::size_t outputBufferSize{ 0u };
+	luaRunner::execute::Executor::FilterOptions filterOptions{};
 
 	// Parse arguments
 	decltype(argc) argPos{ 1 };
@@ -64,7 +210,7 @@ int main(int argc, char const* argv[])
 			}
 			else if (arg == "-v")
 			{
-				std::cout << "LuaRunner version v" << luaRunner::getVersion() << std::endl;
+				std::cout << "LuaRunner version v" << luaRunner::getVersion() << "\n";
 				return 0;
 			}
 			else if (arg == "-p")
@@ -74,7 +220,7 @@ int main(int argc, char const* argv[])
 				++argPos;
 				if (argPos >= argc)
 				{
-					std::cout << "Missing parameter for '-p' option." << std::endl << std::endl;
+					std::cout << "Missing parameter for '-p' option." << "\n\n";
 					printHelp();
 					return 255;
 				}
@@ -87,12 +233,119 @@ int main(int argc, char const* argv[])
 				++argPos;
 				if (argPos >= argc)
 				{
-					std::cout << "Missing parameter for '-s' option." << std::endl << std::endl;
+					std::cout << "Missing parameter for '-s' option." << "\n\n";
 					printHelp();
 					return 255;
 				}
 				pluginsSearchPaths.push_back(argv[currentPos + 1]);
 			}
+			else if (arg == "-r")
+			{
+				// This option requires an additional argument
+				auto const currentPos = argPos;
+				++argPos;
+				if (argPos >= argc || (std::string(argv[currentPos + 1]) != "json" && std::string(argv[currentPos + 1]) != "binary"))
+				{
+					std::cout << "Missing or invalid parameter for '-r' option." << "\n\n";
+					printHelp();
+					return 255;
+				}
+				resultsFormat = argv[currentPos + 1];
+			}
+			else if (arg == "--output")
+			{
+				// This option requires an additional argument
+				auto const currentPos = argPos;
+				++argPos;
+				if (argPos >= argc || !parseOutputPolicy(argv[currentPos + 1], outputPolicy, outputBufferSize))
+				{
+					std::cout << "Missing or invalid parameter for '--output' option." << "\n\n";
+					printHelp();
+					return 255;
+				}
+			}
+			else if (arg == "--opcode-stats")
+			{
+				opcodeStats = true;
+			}
+			else if (arg == "--jit")
+			{
+				jit = true;
+			}
+			else if (arg == "--gc")
+			{
+				// This option requires an additional argument
+				auto const currentPos = argPos;
+				++argPos;
+				if (argPos >= argc || !parseGcMode(argv[currentPos + 1], gcMode))
+				{
+					std::cout << "Missing or invalid parameter for '--gc' option." << "\n\n";
+					printHelp();
+					return 255;
+				}
+			}
+			else if (arg == "--gc-stats")
+			{
+				gcStats = true;
+			}
+			else if (arg == "--gc-step-time")
+			{
+				// This option requires an additional argument
+				auto const currentPos = argPos;
+				++argPos;
+				auto const usec = argPos < argc ? std::strtoul(argv[currentPos + 1], nullptr, 10) : 0ul;
+				if (usec == 0ul || usec > 1000000000ul)
+				{
+					std::cout << "Missing or invalid parameter for '--gc-step-time' option." << "\n\n";
+					printHelp();
+					return 255;
+				}
+				gcStepTime = std::chrono::microseconds{ usec };
+			}
+			else if (arg == "--gc-idle")
+			{
+				// This option requires an additional argument
+				auto const currentPos = argPos;
+				++argPos;
+				auto const usec = argPos < argc ? std::strtoul(argv[currentPos + 1], nullptr, 10) : 0ul;
+				if (usec == 0ul || usec > 1000000000ul)
+				{
+					std::cout << "Missing or invalid parameter for '--gc-idle' option." << "\n\n";
+					printHelp();
+					return 255;
+				}
+				gcIdleSlice = std::chrono::microseconds{ usec };
+			}
+			else if (arg == "--filter")
+			{
+				filterMode = true;
+			}
+			else if (arg == "--records")
+			{
+				// This option requires an additional argument
+				auto const currentPos = argPos;
+				++argPos;
+				if (argPos >= argc || !parseRecordFormat(argv[currentPos + 1], filterOptions))
+				{
+					std::cout << "Missing or invalid parameter for '--records' option." << "\n\n";
+					printHelp();
+					return 255;
+				}
+			}
+			else if (arg == "--batch")
+			{
+				// This option requires an additional argument
+				auto const currentPos = argPos;
+				++argPos;
+				auto const batchSize = argPos < argc ? std::strtoul(argv[currentPos + 1], nullptr, 10) : 0ul;
+				if (batchSize == 0ul)
+				{
+					std::cout << "Missing or invalid parameter for '--batch' option." << "\n\n";
+					printHelp();
+					return 255;
+				}
+				filterOptions.batchSize = static_cast<std::size_t>(batchSize);
+			}
 		}
 		// This is the script to execute
 		else
@@ -115,12 +368,35 @@ int main(int argc, char const* argv[])
 
 	if (scriptToExecute.empty())
 	{
-		std::cout << "No script specified." << std::endl << std::endl;
+		std::cout << "No script specified." << "\n\n";
+		printHelp();
+		return 255;
+	}
+
+	if (filterMode && !resultsFormat.empty())
+	{
+		std::cout << "'-r' option cannot be used in filter mode." << "\n\n";
 		printHelp();
 		return 255;
 	}
 
 	auto& executor{ luaRunner::execute::Executor::getInstance() };
+	// The process exits right after the executor is destroyed, let the system release the lua memory
+	executor.setFastClose(true);
+
+	if (filterMode)
+	{
+		filterOptions.inputs = scriptsParameters;
+		if (outputPolicy == luaRunner::execute::Executor::OutputPolicy::Default)
+		{
+			outputPolicy = luaRunner::execute::Executor::OutputPolicy::Full;
+			outputBufferSize = 1024u * 1024u;
+		}
+	}
+	// Must be set before anything is written
+	executor.setOutputPolicy(outputPolicy, outputBufferSize);
+	// Keep the standard output for the returned values (or the filter output)
+	auto& log = (resultsFormat.empty() && !filterMode) ? std::cout : std::cerr;
 
 	// Set plugin search paths
 	executor.setPluginSearchPaths(pluginsSearchPaths);
@@ -128,28 +404,61 @@ int main(int argc, char const* argv[])
 	// Load plugin(s) if any
 	for (auto const& pluginName : pluginsToLoad)
 	{
-		std::cout << "Loading plugin '" << pluginName << "'" << std::endl;
+		log << "Loading plugin '" << pluginName << "'\n";
 		auto const loadResult = executor.loadPlugin(pluginName);
 		auto const result = std::get<0>(loadResult);
 		auto const errorString = std::get<1>(loadResult);
 		if (!result)
 		{
-			std::cout << "Failed to load plugin: " << luaRunner::execute::Executor::resultToString(result) << ": " << errorString << std::endl;
+			// Errors flush the output, keeping it ordered with the error message
+			std::fflush(stdout);
+			log << "Failed to load plugin: " << luaRunner::execute::Executor::resultToString(result) << ": " << errorString << "\n";
+			std::fflush(stdout);
 			return 254;
 		}
 	}
 
+	if (opcodeStats)
+		executor.setOpcodeStatisticsEnabled(true);
+	if (jit && !executor.setJitEnabled(true))
+		log << "JIT compiler not available in this build, ignoring '--jit'\n";
+	executor.setGcMode(gcMode);
+	if (gcStepTime.count() != 0)
+		executor.setGcStepTimeTarget(gcStepTime);
+	if (gcIdleSlice.count() != 0)
+		executor.setIdleGcSlice(gcIdleSlice);
+	if (gcStats)
+		executor.setGcStatisticsEnabled(true);
+
 	// Execute lua file
-	std::cout << "Executing lua script '" << scriptToExecute << "'" << std::endl;
+	log << "Executing lua script '" << scriptToExecute << "'\n";
 
-	auto const executeResult = executor.executeLuaFileWithParameters(scriptToExecute, scriptsParameters);
+	auto const executeResult = filterMode ? executor.executeLuaFileAsFilter(scriptToExecute, scriptsParameters, filterOptions) : resultsFormat.empty() ? executor.executeLuaFileWithParameters(scriptToExecute, scriptsParameters) : executeWithResults(executor, scriptToExecute, scriptsParameters, resultsFormat);
 	auto const result = std::get<0>(executeResult);
 	auto const scriptReturnValue = std::get<1>(executeResult);
 	auto const errorString = std::get<2>(executeResult);
 
 	if (!result)
 	{
-		std::cout << "Failed to execute script: " << luaRunner::execute::Executor::resultToString(result) << ": " << errorString << std::endl;
+		// Errors flush the output, keeping it ordered with the error message
+		std::fflush(stdout);
+		log << "Failed to execute script: " << luaRunner::execute::Executor::resultToString(result) << ": " << errorString << "\n";
+		std::fflush(stdout);
+	}
+
+	if (opcodeStats)
+	{
+		executor.setOpcodeStatisticsEnabled(false);
+		std::fflush(stdout);
+		std::cerr << executor.getOpcodeStatistics(30u);
+	}
+
+	if (gcStats)
+	{
+		auto const statistics = executor.getGcStatistics();
+		std::fflush(stdout);
+		printGcHistogram("GC steps", statistics.steps);
+		printGcHistogram("GC atomic phases", statistics.atomicPhases);
 	}
 
 	return scriptReturnValue;
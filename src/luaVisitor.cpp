@@ -0,0 +1,169 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "luaVisitor.hpp"
+#include "bufferView.hpp"
+#include <unordered_map>
+
+namespace luaRunner
+{
+namespace value
+{
+
+static constexpr int MaxDepth = 200;
+
+namespace
+{
+struct VisitContext
+{
+	Visitor& visitor;
+	std::string& error;
+	std::unordered_map<void const*, std::size_t> tables{}; /**< Tables already notified, and their index */
+};
+} // namespace
+
+static bool visitValue(lua_State* luaState, VisitContext& context, int const index, int const depth)
+{
+	auto& visitor = context.visitor;
+	switch (lua_type(luaState, index))
+	{
+		case LUA_TNIL:
+			visitor.visitNil();
+			return true;
+		case LUA_TBOOLEAN:
+			visitor.visitBoolean(lua_toboolean(luaState, index) != 0);
+			return true;
+		case LUA_TNUMBER:
+			if (lua_isinteger(luaState, index))
+				visitor.visitInteger(static_cast<std::int64_t>(lua_tointeger(luaState, index)));
+			else
+				visitor.visitNumber(static_cast<double>(lua_tonumber(luaState, index)));
+			return true;
+		case LUA_TSTRING:
+		{
+			auto length = std::size_t{ 0u };
+			auto const* const data = lua_tolstring(luaState, index, &length);
+			visitor.visitString(data, length);
+			return true;
+		}
+		case LUA_TUSERDATA:
+		{
+			auto const* const view = builtin::bufferView::test(luaState, index);
+			if (view == nullptr)
+				break;
+			visitor.visitString(view->data, view->size);
+			return true;
+		}
+		case LUA_TTABLE:
+		{
+			// Already notified table (shared or cyclic)
+			auto const* const table = lua_topointer(luaState, index);
+			auto const it = context.tables.find(table);
+			if (it != context.tables.end())
+			{
+				visitor.visitReference(it->second);
+				return true;
+			}
+
+			if (depth >= MaxDepth)
+			{
+				context.error = "table nesting too deep";
+				return false;
+			}
+			if (!lua_checkstack(luaState, 3))
+			{
+				context.error = "stack overflow";
+				return false;
+			}
+
+			auto const arrayCount = static_cast<lua_Integer>(lua_rawlen(luaState, index));
+			auto const isArrayKey = [luaState, arrayCount]()
+			{
+				if (!lua_isinteger(luaState, -2))
+					return false;
+				auto const key = lua_tointeger(luaState, -2);
+				return key >= 1 && key <= arrayCount;
+			};
+
+			// Visitors need the hash count upfront, count it in a first pass
+			auto hashCount = std::size_t{ 0u };
+			lua_pushnil(luaState);
+			while (lua_next(luaState, index) != 0)
+			{
+				if (!isArrayKey())
+					++hashCount;
+				lua_pop(luaState, 1);
+			}
+
+			auto const tableIndex = context.tables.size();
+			context.tables.emplace(table, tableIndex);
+			visitor.beginTable(static_cast<std::size_t>(arrayCount), hashCount);
+
+			for (auto i = lua_Integer{ 1 }; i <= arrayCount; ++i)
+			{
+				lua_rawgeti(luaState, index, i);
+				auto const success = visitValue(luaState, context, lua_gettop(luaState), depth + 1);
+				lua_pop(luaState, 1);
+				if (!success)
+					return false;
+			}
+
+			lua_pushnil(luaState);
+			while (lua_next(luaState, index) != 0)
+			{
+				if (!isArrayKey())
+				{
+					auto const top = lua_gettop(luaState);
+					if (!visitValue(luaState, context, top - 1, depth + 1) || !visitValue(luaState, context, top, depth + 1))
+					{
+						lua_pop(luaState, 2);
+						return false;
+					}
+				}
+				lua_pop(luaState, 1);
+			}
+
+			visitor.endTable();
+			return true;
+		}
+		default:
+			break;
+	}
+
+	context.error = std::string("cannot convert a ") + luaL_typename(luaState, index);
+	return false;
+}
+
+bool visitLuaValues(lua_State* luaState, int const firstIndex, int const count, Visitor& visitor, std::string& error)
+{
+	auto const first = lua_absindex(luaState, firstIndex);
+	auto context = VisitContext{ visitor, error };
+
+	visitor.beginValues(static_cast<std::size_t>(count));
+	for (auto index = first; index < first + count; ++index)
+	{
+		if (!visitValue(luaState, context, index, 0))
+			return false;
+	}
+	visitor.endValues();
+	return true;
+}
+
+} // namespace value
+} // namespace luaRunner
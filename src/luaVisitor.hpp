@@ -0,0 +1,39 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "luaRunner/value.hpp"
+#include <string>
+#include <lua.hpp>
+
+namespace luaRunner
+{
+namespace value
+{
+
+/**
+* Notifies 'visitor' of the 'count' lua values starting at stack 'firstIndex', including 'beginValues' and 'endValues'.
+* Supported values are the same as the serializer ones (views are notified as strings).
+* Returns false if a value is not supported, 'error' is then set and the visitor has only been notified of the values before it.
+*/
+bool visitLuaValues(lua_State* luaState, int const firstIndex, int const count, Visitor& visitor, std::string& error);
+
+} // namespace value
+} // namespace luaRunner
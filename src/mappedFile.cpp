@@ -0,0 +1,122 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mappedFile.hpp"
+#include <cstring>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else // !_WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace luaRunner
+{
+namespace mmap
+{
+
+MappedFile::OpenResult MappedFile::open(std::string const& filePath) noexcept
+{
+	// Cannot use make_shared, constructor is private
+	auto mappedFile = SharedPointer(new MappedFile);
+
+#ifdef _WIN32
+	auto const fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return { nullptr, "Cannot open file '" + filePath + "'" };
+	mappedFile->_fileHandle = fileHandle;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize))
+		return { nullptr, "Cannot get size of file '" + filePath + "'" };
+
+	// Empty files cannot be mapped, keep an empty view
+	if (fileSize.QuadPart == 0)
+		return { mappedFile, "" };
+
+	auto const mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle == nullptr)
+		return { nullptr, "Cannot create mapping for file '" + filePath + "'" };
+	mappedFile->_mappingHandle = mappingHandle;
+
+	auto const* const data = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr)
+		return { nullptr, "Cannot map file '" + filePath + "'" };
+
+	mappedFile->_data = static_cast<char const*>(data);
+	mappedFile->_size = static_cast<std::size_t>(fileSize.QuadPart);
+#else // !_WIN32
+	auto const fd = ::open(filePath.c_str(), O_RDONLY);
+	if (fd == -1)
+		return { nullptr, "Cannot open file '" + filePath + "': " + std::strerror(errno) };
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == -1)
+	{
+		auto const error = std::string(std::strerror(errno));
+		::close(fd);
+		return { nullptr, "Cannot get size of file '" + filePath + "': " + error };
+	}
+
+	// Empty files cannot be mapped, keep an empty view
+	if (fileStat.st_size == 0)
+	{
+		::close(fd);
+		return { mappedFile, "" };
+	}
+
+	auto const size = static_cast<std::size_t>(fileStat.st_size);
+	auto* const data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference on the file
+	::close(fd);
+	if (data == MAP_FAILED)
+		return { nullptr, "Cannot map file '" + filePath + "': " + std::strerror(errno) };
+
+	// Most scripts scan the file from start to end, let the kernel read ahead aggressively
+	::madvise(data, size, MADV_SEQUENTIAL);
+
+	mappedFile->_data = static_cast<char const*>(data);
+	mappedFile->_size = size;
+#endif // _WIN32
+
+	return { mappedFile, "" };
+}
+
+// Destructor
+MappedFile::~MappedFile() noexcept
+{
+#ifdef _WIN32
+	if (_data != nullptr)
+		UnmapViewOfFile(_data);
+	if (_mappingHandle != nullptr)
+		CloseHandle(_mappingHandle);
+	if (_fileHandle != nullptr)
+		CloseHandle(_fileHandle);
+#else // !_WIN32
+	if (_data != nullptr)
+		::munmap(const_cast<char*>(_data), _size);
+#endif // _WIN32
+}
+
+} // namespace mmap
+} // namespace luaRunner
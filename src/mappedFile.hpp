@@ -0,0 +1,79 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <tuple>
+#include <cstddef>
+
+namespace luaRunner
+{
+namespace mmap
+{
+
+/** Read-only memory mapping of a whole file. The mapping is released when the last reference goes away. */
+class MappedFile final
+{
+public:
+	using SharedPointer = std::shared_ptr<MappedFile>;
+	using OpenResult = std::tuple<SharedPointer, std::string>;
+
+	/**
+	* @brief Maps the specified file in memory.
+	* @param[in] filePath Path of the file to map.
+	* @return The mapped file (nullptr on error), ErrorString (if mapped file is nullptr).
+	*/
+	static OpenResult open(std::string const& filePath) noexcept;
+
+	char const* data() const noexcept
+	{
+		return _data;
+	}
+
+	std::size_t size() const noexcept
+	{
+		return _size;
+	}
+
+	// Destructor
+	~MappedFile() noexcept;
+
+	// Deleted compiler auto-generated methods
+	MappedFile(MappedFile&&) = delete;
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile&&) = delete;
+
+private:
+	// Constructor
+	MappedFile() noexcept = default;
+
+	// Private members
+	char const* _data{ nullptr };
+	std::size_t _size{ 0u };
+#ifdef _WIN32
+	void* _fileHandle{ nullptr };
+	void* _mappingHandle{ nullptr };
+#endif // _WIN32
+};
+
+} // namespace mmap
+} // namespace luaRunner
@@ -0,0 +1,107 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+
+namespace luaRunner
+{
+namespace eventLoop
+{
+
+/**
+* Intrusive lock-free multiple producers single consumer queue (Dmitry Vyukov's algorithm).
+* 'push' is wait-free and can be called from any thread, 'pop' must only be called from the consumer thread.
+* Nodes are not owned by the queue.
+*/
+class MpscQueue final
+{
+public:
+	struct Node
+	{
+		std::atomic<Node*> next{ nullptr };
+	};
+
+	// Constructor
+	MpscQueue() noexcept
+		: _head(&_stub)
+		, _tail(&_stub)
+	{
+	}
+
+	void push(Node* node) noexcept
+	{
+		node->next.store(nullptr, std::memory_order_relaxed);
+		auto* const previous = _head.exchange(node, std::memory_order_acq_rel);
+		previous->next.store(node, std::memory_order_release);
+	}
+
+	/** Returns the oldest node, or nullptr if the queue is empty (or a producer is in the middle of a push). */
+	Node* pop() noexcept
+	{
+		auto* tail = _tail;
+		auto* next = tail->next.load(std::memory_order_acquire);
+
+		// Skip the stub node
+		if (tail == &_stub)
+		{
+			if (next == nullptr)
+				return nullptr;
+			_tail = next;
+			tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if (next != nullptr)
+		{
+			_tail = next;
+			return tail;
+		}
+
+		// A producer exchanged the head but did not link its node yet
+		if (tail != _head.load(std::memory_order_acquire))
+			return nullptr;
+
+		// Last node, put the stub back so the node can be returned
+		push(&_stub);
+		next = tail->next.load(std::memory_order_acquire);
+		if (next != nullptr)
+		{
+			_tail = next;
+			return tail;
+		}
+		return nullptr;
+	}
+
+	// Deleted compiler auto-generated methods
+	MpscQueue(MpscQueue&&) = delete;
+	MpscQueue(MpscQueue const&) = delete;
+	MpscQueue& operator=(MpscQueue const&) = delete;
+	MpscQueue& operator=(MpscQueue&&) = delete;
+
+private:
+	// Private members
+	std::atomic<Node*> _head{ nullptr };
+	Node* _tail{ nullptr };
+	Node _stub{};
+};
+
+} // namespace eventLoop
+} // namespace luaRunner
@@ -0,0 +1,149 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "opcodeStats.hpp"
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+
+// Lua internals, to read the instruction being executed
+extern "C"
+{
+#include <lstate.h>
+#include <lobject.h>
+#include <lopcodes.h>
+}
+
+namespace luaRunner
+{
+namespace opcodeStats
+{
+
+/** Same order as the OpCode enum (luaP_opnames is not exported by the lua library) */
+static char const* const OpcodeNames[] = {
+	"MOVE", "LOADK", "LOADKX", "LOADBOOL", "LOADNIL", "GETUPVAL", "GETTABUP", "GETTABLE",
+	"SETTABUP", "SETUPVAL", "SETTABLE", "NEWTABLE", "SELF", "ADD", "SUB", "MUL",
+	"MOD", "POW", "DIV", "IDIV", "BAND", "BOR", "BXOR", "SHL",
+	"SHR", "UNM", "BNOT", "NOT", "LEN", "CONCAT", "JMP", "EQ",
+	"LT", "LE", "TEST", "TESTSET", "CALL", "TAILCALL", "RETURN", "FORLOOP",
+	"FORPREP", "TFORCALL", "TFORLOOP", "SETLIST", "CLOSURE", "VARARG", "EXTRAARG", "MOVE2",
+	"GETTABLE2", "MULADD", "MULMUL",
+};
+static_assert(sizeof(OpcodeNames) / sizeof(OpcodeNames[0]) == NUM_OPCODES, "OpcodeNames must list all the opcodes");
+
+static constexpr auto MaxOpcodes = std::size_t{ 1u } << SIZE_OP;
+
+namespace
+{
+struct Statistics
+{
+	std::array<std::uint64_t, MaxOpcodes> opcodes{};
+	std::array<std::uint64_t, MaxOpcodes * MaxOpcodes> pairs{};
+	std::uint64_t total{ 0u };
+	Proto const* previousProto{ nullptr };
+	Instruction const* previousPc{ nullptr };
+	std::size_t previousOpcode{ 0u };
+};
+} // namespace
+
+static Statistics s_statistics{};
+
+static void countHook(lua_State* luaState, lua_Debug* /*ar*/)
+{
+	auto const* const ci = luaState->ci;
+	if (!isLua(ci))
+		return;
+
+	// The hook is called before executing the instruction, 'savedpc' is already past it
+	auto const* const proto = clLvalue(ci->func)->p;
+	auto const* const pc = ci->u.l.savedpc - 1;
+	// Superinstructions are not fused when hooks are on, count what is actually executed
+	auto const opcode = static_cast<std::size_t>(GET_BASEOPCODE(*pc));
+
+	auto& stats = s_statistics;
+	++stats.opcodes[opcode];
+	++stats.total;
+	// Only count pairs falling through from one instruction to the next one
+	if (stats.previousProto == proto && stats.previousPc + 1 == pc)
+		++stats.pairs[stats.previousOpcode * MaxOpcodes + opcode];
+	stats.previousProto = proto;
+	stats.previousPc = pc;
+	stats.previousOpcode = opcode;
+}
+
+void start(lua_State* luaState) noexcept
+{
+	s_statistics = Statistics{};
+	lua_sethook(luaState, countHook, LUA_MASKCOUNT, 1);
+}
+
+void stop(lua_State* luaState) noexcept
+{
+	lua_sethook(luaState, nullptr, 0, 0);
+}
+
+static std::string opcodeName(std::size_t const opcode)
+{
+	if (opcode < NUM_OPCODES)
+		return OpcodeNames[opcode];
+	return "OP" + std::to_string(opcode);
+}
+
+std::string getReport(std::size_t const maxEntries)
+{
+	auto const& stats = s_statistics;
+	auto const percent = [&stats](std::uint64_t const count)
+	{
+		return stats.total != 0u ? 100.0 * static_cast<double>(count) / static_cast<double>(stats.total) : 0.0;
+	};
+	// Returns the indexes of the 'maxEntries' highest non-zero counts
+	auto const sorted = [maxEntries](auto const& counts)
+	{
+		auto indexes = std::vector<std::size_t>{};
+		for (auto index = std::size_t{ 0u }; index < counts.size(); ++index)
+		{
+			if (counts[index] != 0u)
+				indexes.push_back(index);
+		}
+		std::sort(indexes.begin(), indexes.end(), [&counts](auto const lhs, auto const rhs)
+		{
+			return counts[lhs] > counts[rhs];
+		});
+		if (indexes.size() > maxEntries)
+			indexes.resize(maxEntries);
+		return indexes;
+	};
+
+	auto report = std::ostringstream{};
+	report << std::fixed << std::setprecision(2);
+	report << "Executed instructions: " << stats.total << "\n";
+	report << "Opcodes:\n";
+	for (auto const opcode : sorted(stats.opcodes))
+		report << "  " << std::setw(24) << std::left << opcodeName(opcode) << std::right << std::setw(14) << stats.opcodes[opcode] << std::setw(8) << percent(stats.opcodes[opcode]) << "%\n";
+	report << "Opcode pairs (falling through in the same function):\n";
+	for (auto const pair : sorted(stats.pairs))
+		report << "  " << std::setw(24) << std::left << (opcodeName(pair / MaxOpcodes) + " " + opcodeName(pair % MaxOpcodes)) << std::right << std::setw(14) << stats.pairs[pair] << std::setw(8) << percent(stats.pairs[pair]) << "%\n";
+	return report.str();
+}
+
+} // namespace opcodeStats
+} // namespace luaRunner
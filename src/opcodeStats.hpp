@@ -0,0 +1,41 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <lua.hpp>
+
+namespace luaRunner
+{
+namespace opcodeStats
+{
+
+/** Starts counting the executed opcodes, and the pairs of opcodes executed one after the other in the same function (candidates for superinstructions). Uses a count hook, so execution is much slower. */
+void start(lua_State* luaState) noexcept;
+
+/** Stops counting (removes the hook). */
+void stop(lua_State* luaState) noexcept;
+
+/** Returns a report of the 'maxEntries' most executed opcodes and opcode pairs. */
+std::string getReport(std::size_t const maxEntries);
+
+} // namespace opcodeStats
+} // namespace luaRunner
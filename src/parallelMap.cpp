@@ -0,0 +1,717 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "parallelMap.hpp"
+#include "serializer.hpp"
+#include "bufferView.hpp"
+#include "builtin.hpp"
+#include "pluginManager.hpp"
+#include "eventLoop.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <new>
+
+namespace luaRunner
+{
+namespace parallel
+{
+
+constexpr auto PoolRegistryKey = "lrbi.workerPool";
+constexpr auto PoolMetatableName = "lrbi.workerPool";
+constexpr auto WorkerRegistryKey = "lrbi.parallelWorker";
+constexpr auto ChunkName = "=parallel_map";
+constexpr auto TargetChunkDuration = std::chrono::microseconds(500); /**< Chunks are sized so processing one takes about this long */
+constexpr std::size_t MaxChunkSize = 4096u;
+
+enum class FunctionKind
+{
+	Bytecode, /**< Dumped lua function */
+	Module, /**< "module.function" name */
+	Source, /**< Lua source of a function expression, or of a chunk returning a function */
+};
+
+/** Range of items not processed yet, owned by a worker and stolen from by the others when they are out of work */
+struct Range
+{
+	std::mutex lock{};
+	std::size_t begin{ 0u };
+	std::size_t end{ 0u };
+};
+
+/** Serialized results of consecutive items */
+struct ChunkResults
+{
+	std::size_t begin{ 0u };
+	std::size_t end{ 0u };
+	std::string buffer{};
+};
+
+struct Job
+{
+	// Inputs
+	FunctionKind kind{ FunctionKind::Source };
+	std::string function{};
+	std::string input{};
+	std::vector<std::size_t> offsets{}; /**< Item 'i' is serialized in input[offsets[i], offsets[i + 1]) */
+	bool numericResults{ false };
+	plugin::Manager::PluginSearchPaths pluginSearchPaths{};
+	plugin::Manager::PluginNames pluginNames{};
+	std::vector<std::unique_ptr<Range>> ranges{}; /**< One per participating worker */
+
+	// Outputs
+	std::vector<double> numbers{}; /**< Results when 'numericResults' is set */
+	std::mutex resultsLock{};
+	std::vector<ChunkResults> results{}; /**< Protected by resultsLock */
+	std::atomic<bool> failed{ false };
+	std::string error{}; /**< First error, protected by resultsLock */
+
+	std::size_t activeWorkers{ 0u }; /**< Protected by WorkerPool::_lock */
+
+	std::size_t itemsCount() const noexcept
+	{
+		return offsets.size() - 1u;
+	}
+
+	void fail(std::string message) noexcept
+	{
+		std::lock_guard<std::mutex> const lock{ resultsLock };
+		if (!failed.exchange(true))
+			error = std::move(message);
+	}
+};
+
+class WorkerPool final
+{
+public:
+	// Constructor
+	explicit WorkerPool(std::size_t const workersCount) noexcept
+	{
+		for (auto index = std::size_t{ 0u }; index < workersCount; ++index)
+			_threads.emplace_back(&WorkerPool::workerMain, this, index);
+	}
+
+	// Destructor
+	~WorkerPool() noexcept
+	{
+		{
+			std::lock_guard<std::mutex> const lock{ _lock };
+			_stop = true;
+		}
+		_condition.notify_all();
+		for (auto& thread : _threads)
+			thread.join();
+	}
+
+	std::size_t size() const noexcept
+	{
+		return _threads.size();
+	}
+
+	/** Runs the job on its participating workers (as many as job.ranges), and blocks until they are all done. */
+	void run(Job& job) noexcept
+	{
+		std::unique_lock<std::mutex> lock{ _lock };
+		job.activeWorkers = job.ranges.size();
+		_job = &job;
+		++_generation;
+		_condition.notify_all();
+		_doneCondition.wait(lock, [&job] { return job.activeWorkers == 0u; });
+		_job = nullptr;
+	}
+
+	// Deleted compiler auto-generated methods
+	WorkerPool(WorkerPool&&) = delete;
+	WorkerPool(WorkerPool const&) = delete;
+	WorkerPool& operator=(WorkerPool const&) = delete;
+	WorkerPool& operator=(WorkerPool&&) = delete;
+
+private:
+	/** lua_State owned by a worker thread */
+	class WorkerState final
+	{
+	public:
+		WorkerState() noexcept
+			: _state(luaL_newstate())
+			, _pluginManager(plugin::Manager::create(_state))
+			, _eventLoop(eventLoop::EventLoop::create(_state))
+		{
+			luaL_openlibs(_state);
+			builtin::loadBuiltins(_state);
+			// Nested parallel_map calls are not supported
+			lua_pushboolean(_state, 1);
+			lua_setfield(_state, LUA_REGISTRYINDEX, WorkerRegistryKey);
+		}
+
+		~WorkerState() noexcept
+		{
+			_pluginManager->uninitAllPlugins();
+			lua_close(_state);
+			_pluginManager->unloadAllPlugins();
+		}
+
+		void process(Job& job, std::size_t const workerIndex) noexcept;
+
+	private:
+		bool prepare(Job& job) noexcept;
+		bool loadFunction(Job& job) noexcept;
+		bool takeChunk(Job& job, std::size_t const workerIndex, std::size_t const chunkSize, std::size_t& begin, std::size_t& end) noexcept;
+		bool processItem(Job& job, std::size_t const item, serializer::LuaWriter* const writer) noexcept;
+
+		lua_State* _state{ nullptr };
+		plugin::Manager::UniquePointer _pluginManager{ nullptr, nullptr };
+		eventLoop::EventLoop::UniquePointer _eventLoop{ nullptr, nullptr };
+		std::string _functionKey{}; /**< Kind and definition of the function currently loaded */
+		int _functionRef{ LUA_NOREF };
+		double _secondsPerItem{ 0.0 }; /**< Moving average of the time spent per item, used to size chunks */
+	};
+
+	void workerMain(std::size_t const index) noexcept
+	{
+		WorkerState state;
+		auto seenGeneration = std::size_t{ 0u };
+		while (true)
+		{
+			Job* job{ nullptr };
+			{
+				std::unique_lock<std::mutex> lock{ _lock };
+				_condition.wait(lock, [this, seenGeneration] { return _stop || _generation != seenGeneration; });
+				if (_stop)
+					break;
+				seenGeneration = _generation;
+				job = _job;
+			}
+
+			// Not participating in this job
+			if (index >= job->ranges.size())
+				continue;
+
+			state.process(*job, index);
+
+			std::lock_guard<std::mutex> const lock{ _lock };
+			if (--job->activeWorkers == 0u)
+				_doneCondition.notify_all();
+		}
+	}
+
+	// Private members
+	std::mutex _lock{};
+	std::condition_variable _condition{};
+	std::condition_variable _doneCondition{};
+	bool _stop{ false };
+	std::size_t _generation{ 0u };
+	Job* _job{ nullptr };
+	std::vector<std::thread> _threads{};
+};
+
+/** Pushes the error message at the top of the stack (popping it) into the job, prefixed with 'context'. */
+static void failWithLuaError(lua_State* luaState, Job& job, std::string const& context) noexcept
+{
+	auto const* const message = lua_tostring(luaState, -1);
+	job.fail(context + (message != nullptr ? message : "(error object is not a string)"));
+	lua_pop(luaState, 1);
+}
+
+void WorkerPool::WorkerState::process(Job& job, std::size_t const workerIndex) noexcept
+{
+	if (!prepare(job))
+		return;
+
+	auto chunkResults = std::vector<ChunkResults>{};
+	auto chunkSize = std::size_t{ 1u };
+	auto begin = std::size_t{ 0u };
+	auto end = std::size_t{ 0u };
+	while (!job.failed.load(std::memory_order_relaxed) && takeChunk(job, workerIndex, chunkSize, begin, end))
+	{
+		auto chunk = ChunkResults{ begin, end, {} };
+		auto const start = std::chrono::steady_clock::now();
+		{
+			// Results of the chunk are written as a single message
+			auto writer = job.numericResults ? nullptr : std::make_unique<serializer::LuaWriter>(chunk.buffer, static_cast<std::uint32_t>(end - begin));
+			for (auto item = begin; item < end; ++item)
+			{
+				if (!processItem(job, item, writer.get()))
+					break;
+			}
+		}
+		if (!job.numericResults)
+			chunkResults.push_back(std::move(chunk));
+
+		// Adapt the chunk size to the measured cost of the items, cheap items are processed in large chunks to reduce contention
+		auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		auto const secondsPerItem = elapsed / static_cast<double>(end - begin);
+		_secondsPerItem = _secondsPerItem == 0.0 ? secondsPerItem : (_secondsPerItem * 0.75 + secondsPerItem * 0.25);
+		auto const target = std::chrono::duration<double>(TargetChunkDuration).count();
+		chunkSize = _secondsPerItem > 0.0 ? static_cast<std::size_t>(std::min(target / _secondsPerItem, static_cast<double>(MaxChunkSize))) : MaxChunkSize;
+		chunkSize = std::max(chunkSize, std::size_t{ 1u });
+	}
+
+	// Let the lua_State release the memory used by this job
+	lua_gc(_state, LUA_GCSTEP, 0);
+
+	std::lock_guard<std::mutex> const lock{ job.resultsLock };
+	for (auto& chunk : chunkResults)
+		job.results.push_back(std::move(chunk));
+}
+
+/** Loads the plugins loaded by the script since last job, and the function to call. Returns false if the job failed. */
+bool WorkerPool::WorkerState::prepare(Job& job) noexcept
+{
+	auto const loadedPlugins = _pluginManager->getLoadedPluginNames();
+	if (loadedPlugins.size() != job.pluginNames.size())
+	{
+		_pluginManager->clearPluginSearchPaths();
+		for (auto const& path : job.pluginSearchPaths)
+			_pluginManager->addPluginSearchPaths(path);
+
+		for (auto const& pluginName : job.pluginNames)
+		{
+			if (std::find(loadedPlugins.begin(), loadedPlugins.end(), pluginName) != loadedPlugins.end())
+				continue;
+			auto const loadResult = _pluginManager->loadPlugin(pluginName);
+			if (!std::get<0>(loadResult))
+			{
+				job.fail("Failed to load plugin '" + pluginName + "' in worker: " + std::get<1>(loadResult));
+				return false;
+			}
+		}
+	}
+
+	return loadFunction(job);
+}
+
+bool WorkerPool::WorkerState::loadFunction(Job& job) noexcept
+{
+	// Same function as previous job, keep it
+	auto functionKey = std::string(1, static_cast<char>(job.kind)) + job.function;
+	if (functionKey == _functionKey)
+		return true;
+
+	luaL_unref(_state, LUA_REGISTRYINDEX, _functionRef);
+	_functionRef = LUA_NOREF;
+	_functionKey.clear();
+
+	switch (job.kind)
+	{
+		case FunctionKind::Bytecode:
+		{
+			if (luaL_loadbufferx(_state, job.function.data(), job.function.size(), ChunkName, "b") != LUA_OK)
+			{
+				failWithLuaError(_state, job, "Failed to load function in worker: ");
+				return false;
+			}
+			break;
+		}
+		case FunctionKind::Module:
+		{
+			auto const separator = job.function.rfind('.');
+			auto const moduleName = job.function.substr(0, separator);
+			lua_getglobal(_state, "require");
+			lua_pushstring(_state, moduleName.c_str());
+			if (lua_pcall(_state, 1, 1, 0) != LUA_OK)
+			{
+				failWithLuaError(_state, job, "Failed to load module '" + moduleName + "' in worker: ");
+				return false;
+			}
+			if (lua_type(_state, -1) != LUA_TTABLE)
+			{
+				lua_pop(_state, 1);
+				job.fail("Module '" + moduleName + "' is not a table");
+				return false;
+			}
+			lua_getfield(_state, -1, job.function.c_str() + separator + 1);
+			lua_remove(_state, -2);
+			break;
+		}
+		case FunctionKind::Source:
+		{
+			// Try as a function expression first, then as a chunk returning a function
+			auto const expression = "return " + job.function;
+			if (luaL_loadbufferx(_state, expression.data(), expression.size(), ChunkName, "t") != LUA_OK)
+			{
+				lua_pop(_state, 1);
+				if (luaL_loadbufferx(_state, job.function.data(), job.function.size(), ChunkName, "t") != LUA_OK)
+				{
+					failWithLuaError(_state, job, "Failed to load function in worker: ");
+					return false;
+				}
+			}
+			if (lua_pcall(_state, 0, 1, 0) != LUA_OK)
+			{
+				failWithLuaError(_state, job, "Failed to load function in worker: ");
+				return false;
+			}
+			break;
+		}
+		default:
+			lua_pushnil(_state);
+			break;
+	}
+
+	if (lua_type(_state, -1) != LUA_TFUNCTION)
+	{
+		lua_pop(_state, 1);
+		job.fail("'" + job.function.substr(0, 64) + "' does not resolve to a function");
+		return false;
+	}
+
+	_functionRef = luaL_ref(_state, LUA_REGISTRYINDEX);
+	_functionKey = std::move(functionKey);
+	return true;
+}
+
+/** Takes up to 'chunkSize' items from our range, or steals half of another worker's range when ours is empty. Returns false when there is no work left. */
+bool WorkerPool::WorkerState::takeChunk(Job& job, std::size_t const workerIndex, std::size_t const chunkSize, std::size_t& begin, std::size_t& end) noexcept
+{
+	auto& ownRange = *job.ranges[workerIndex];
+	{
+		std::lock_guard<std::mutex> const lock{ ownRange.lock };
+		if (ownRange.begin < ownRange.end)
+		{
+			begin = ownRange.begin;
+			end = std::min(ownRange.end, begin + chunkSize);
+			ownRange.begin = end;
+			return true;
+		}
+	}
+
+	// Steal the back half of the first non-empty range, starting with our neighbour
+	auto const rangesCount = job.ranges.size();
+	for (auto offset = std::size_t{ 1u }; offset < rangesCount; ++offset)
+	{
+		auto& victim = *job.ranges[(workerIndex + offset) % rangesCount];
+		auto stolenBegin = std::size_t{ 0u };
+		auto stolenEnd = std::size_t{ 0u };
+		{
+			std::lock_guard<std::mutex> const lock{ victim.lock };
+			if (victim.begin >= victim.end)
+				continue;
+			auto const remaining = victim.end - victim.begin;
+			stolenEnd = victim.end;
+			stolenBegin = victim.end - (remaining + 1u) / 2u;
+			victim.end = stolenBegin;
+		}
+
+		begin = stolenBegin;
+		end = std::min(stolenEnd, begin + chunkSize);
+		// Keep the rest of the stolen items in our range (so they can be stolen back)
+		std::lock_guard<std::mutex> const lock{ ownRange.lock };
+		ownRange.begin = end;
+		ownRange.end = stolenEnd;
+		return true;
+	}
+	return false;
+}
+
+bool WorkerPool::WorkerState::processItem(Job& job, std::size_t const item, serializer::LuaWriter* const writer) noexcept
+{
+	auto const base = lua_gettop(_state);
+	lua_rawgeti(_state, LUA_REGISTRYINDEX, _functionRef);
+	if (serializer::readMessage(_state, job.input.data() + job.offsets[item], job.offsets[item + 1u] - job.offsets[item]) != 1)
+	{
+		lua_settop(_state, base);
+		job.fail("Failed to transfer item " + std::to_string(item + 1u) + " to worker");
+		return false;
+	}
+	lua_pushinteger(_state, static_cast<lua_Integer>(item + 1u));
+
+	if (lua_pcall(_state, 2, 1, 0) != LUA_OK)
+	{
+		failWithLuaError(_state, job, "Item " + std::to_string(item + 1u) + ": ");
+		lua_settop(_state, base);
+		return false;
+	}
+
+	auto success = true;
+	if (job.numericResults)
+	{
+		auto isNumber = 0;
+		job.numbers[item] = static_cast<double>(lua_tonumberx(_state, -1, &isNumber));
+		if (!isNumber)
+		{
+			job.fail("Item " + std::to_string(item + 1u) + ": result is not a number (" + luaL_typename(_state, -1) + ")");
+			success = false;
+		}
+	}
+	else
+	{
+		auto error = std::string{};
+		if (!writer->write(_state, -1, error))
+		{
+			job.fail("Item " + std::to_string(item + 1u) + ": invalid result, " + error);
+			success = false;
+		}
+	}
+	lua_settop(_state, base);
+	return success;
+}
+
+/** lua_Writer appending the dumped function to a std::string */
+static int dumpWriter(lua_State* /*luaState*/, void const* data, std::size_t size, void* userData)
+{
+	static_cast<std::string*>(userData)->append(static_cast<char const*>(data), size);
+	return 0;
+}
+
+/** Returns true if 'name' looks like "module.function" (identifiers separated by dots). */
+static bool isModuleFunctionName(std::string const& name) noexcept
+{
+	auto dots = 0;
+	auto identifierStart = true;
+	for (auto const c : name)
+	{
+		if (c == '.')
+		{
+			if (identifierStart)
+				return false;
+			++dots;
+			identifierStart = true;
+			continue;
+		}
+		auto const uc = static_cast<unsigned char>(c);
+		if (!(std::isalnum(uc) || c == '_') || (identifierStart && std::isdigit(uc)))
+			return false;
+		identifierStart = false;
+	}
+	return dots > 0 && !identifierStart;
+}
+
+static int poolGc(lua_State* luaState)
+{
+	auto** const pool = static_cast<WorkerPool**>(luaL_checkudata(luaState, 1, PoolMetatableName));
+	delete *pool;
+	*pool = nullptr;
+	return 0;
+}
+
+/** Returns the worker pool attached to the lua_State, creating it if needed. */
+static WorkerPool& getPool(lua_State* luaState)
+{
+	lua_getfield(luaState, LUA_REGISTRYINDEX, PoolRegistryKey);
+	if (auto** const pool = static_cast<WorkerPool**>(lua_touserdata(luaState, -1)))
+	{
+		lua_pop(luaState, 1);
+		return **pool;
+	}
+	lua_pop(luaState, 1);
+
+	// The pool is owned by a userdata, so it is destroyed (and its threads joined) when the lua_State is closed
+	auto** const pool = static_cast<WorkerPool**>(lua_newuserdata(luaState, sizeof(WorkerPool*)));
+	*pool = nullptr;
+	if (luaL_newmetatable(luaState, PoolMetatableName))
+	{
+		lua_pushcfunction(luaState, poolGc);
+		lua_setfield(luaState, -2, "__gc");
+	}
+	lua_setmetatable(luaState, -2);
+	*pool = new WorkerPool(std::max(std::thread::hardware_concurrency(), 1u));
+	lua_setfield(luaState, LUA_REGISTRYINDEX, PoolRegistryKey);
+	return **pool;
+}
+
+/** Prepares the job from the lua parameters. Returns false if the parameters are not valid, 'error' is then set. */
+static bool prepareJob(lua_State* luaState, Job& job, std::string& error)
+{
+	// Function
+	if (lua_type(luaState, 1) == LUA_TFUNCTION)
+	{
+		if (lua_iscfunction(luaState, 1))
+		{
+			error = "C functions cannot be transferred to workers, use a \"module.function\" name instead";
+			return false;
+		}
+		for (auto upvalue = 1; auto const* const name = lua_getupvalue(luaState, 1, upvalue); ++upvalue)
+		{
+			lua_pop(luaState, 1);
+			// Only the first upvalue can be _ENV, it is set to the worker globals when the function is loaded
+			if (upvalue != 1 || std::strcmp(name, "_ENV") != 0)
+			{
+				error = std::string("function has upvalue '") + name + "' which cannot be transferred to workers, pass its source instead";
+				return false;
+			}
+		}
+		lua_pushvalue(luaState, 1);
+		lua_dump(luaState, dumpWriter, &job.function, 0);
+		lua_pop(luaState, 1);
+		job.kind = FunctionKind::Bytecode;
+	}
+	else
+	{
+		job.function = luaL_checkstring(luaState, 1);
+		job.kind = isModuleFunctionName(job.function) ? FunctionKind::Module : FunctionKind::Source;
+	}
+
+	// Items
+	auto const itemsCount = static_cast<std::size_t>(luaL_len(luaState, 2));
+	job.offsets.reserve(itemsCount + 1u);
+	job.offsets.push_back(0u);
+	for (auto item = std::size_t{ 1u }; item <= itemsCount; ++item)
+	{
+		lua_geti(luaState, 2, static_cast<lua_Integer>(item));
+		// Each item is a message, so workers can read them independently
+		auto const result = serializer::LuaWriter{ job.input, 1u }.write(luaState, -1, error);
+		lua_pop(luaState, 1);
+		if (!result)
+		{
+			error = "item " + std::to_string(item) + ": " + error;
+			return false;
+		}
+		job.offsets.push_back(job.input.size());
+	}
+	if (job.numericResults)
+		job.numbers.resize(itemsCount);
+
+	// Plugins the workers must load
+	if (auto const* const manager = plugin::Manager::get(luaState))
+	{
+		job.pluginSearchPaths = manager->getPluginSearchPaths();
+		job.pluginNames = manager->getLoadedPluginNames();
+	}
+	return true;
+}
+
+/** Pushes the results of a successful job. Returns false if they could not be transferred, 'error' is then set. */
+static bool pushResults(lua_State* luaState, Job& job, int const intoIndex, std::string& error)
+{
+	auto const itemsCount = job.itemsCount();
+	if (job.numericResults)
+	{
+		auto numbers = std::make_shared<std::vector<double>>(std::move(job.numbers));
+		auto const* const data = reinterpret_cast<char const*>(numbers->data());
+		builtin::bufferView::push(luaState, std::move(numbers), data, itemsCount * sizeof(double));
+		return true;
+	}
+
+	if (intoIndex != 0)
+		lua_pushvalue(luaState, intoIndex);
+	else
+		lua_createtable(luaState, static_cast<int>(std::min(itemsCount, std::size_t{ INT_MAX })), 0);
+	auto const resultsIndex = lua_gettop(luaState);
+
+	std::sort(job.results.begin(), job.results.end(), [](ChunkResults const& lhs, ChunkResults const& rhs)
+	{
+		return lhs.begin < rhs.begin;
+	});
+	for (auto const& chunk : job.results)
+	{
+		auto const count = serializer::readMessage(luaState, chunk.buffer.data(), chunk.buffer.size());
+		if (count != static_cast<int>(chunk.end - chunk.begin))
+		{
+			lua_settop(luaState, resultsIndex - 1);
+			error = "failed to transfer results " + std::to_string(chunk.begin + 1u) + " to " + std::to_string(chunk.end) + " from worker";
+			return false;
+		}
+		// Values are on the stack in order, store them from the last one
+		for (auto item = chunk.end; item > chunk.begin; --item)
+			lua_rawseti(luaState, resultsIndex, static_cast<lua_Integer>(item));
+	}
+	return true;
+}
+
+/** Runs the map, pushing the results. Returns false on error, 'error' is then set. */
+static bool runMap(lua_State* luaState, bool const numericResults, lua_Integer const maxWorkers, int const intoIndex, std::string& error)
+{
+	auto job = std::make_unique<Job>();
+	job->numericResults = numericResults;
+	if (!prepareJob(luaState, *job, error))
+		return false;
+
+	auto const itemsCount = job->itemsCount();
+	if (itemsCount != 0u)
+	{
+		auto& pool = getPool(luaState);
+		auto const workersCount = std::min({ pool.size(), itemsCount, static_cast<std::size_t>(std::max(maxWorkers, lua_Integer{ 1 })) });
+
+		// Start with an even split, work stealing balances uneven items
+		for (auto worker = std::size_t{ 0u }; worker < workersCount; ++worker)
+		{
+			auto range = std::make_unique<Range>();
+			range->begin = itemsCount * worker / workersCount;
+			range->end = itemsCount * (worker + 1u) / workersCount;
+			job->ranges.push_back(std::move(range));
+		}
+		pool.run(*job);
+
+		if (job->failed)
+		{
+			error = std::move(job->error);
+			return false;
+		}
+	}
+
+	return pushResults(luaState, *job, intoIndex, error);
+}
+
+int map(lua_State* luaState)
+{
+	lua_getfield(luaState, LUA_REGISTRYINDEX, WorkerRegistryKey);
+	auto const isWorker = lua_toboolean(luaState, -1);
+	lua_pop(luaState, 1);
+	if (isWorker)
+		return luaL_error(luaState, "lrbi.parallel_map cannot be called from a parallel_map worker");
+
+	if (lua_type(luaState, 1) != LUA_TFUNCTION)
+		luaL_checktype(luaState, 1, LUA_TSTRING);
+	luaL_checktype(luaState, 2, LUA_TTABLE);
+
+	// Options
+	auto maxWorkers = static_cast<lua_Integer>(std::max(std::thread::hardware_concurrency(), 1u));
+	auto intoIndex = 0;
+	auto numericResults = false;
+	if (!lua_isnoneornil(luaState, 3))
+	{
+		luaL_checktype(luaState, 3, LUA_TTABLE);
+		if (lua_getfield(luaState, 3, "workers") != LUA_TNIL)
+			maxWorkers = luaL_checkinteger(luaState, -1);
+		if (lua_getfield(luaState, 3, "into") != LUA_TNIL)
+		{
+			luaL_checktype(luaState, -1, LUA_TTABLE);
+			intoIndex = lua_gettop(luaState);
+		}
+		if (lua_getfield(luaState, 3, "results") != LUA_TNIL)
+		{
+			auto const* const results = luaL_checkstring(luaState, -1);
+			if (std::strcmp(results, "buffer") == 0)
+				numericResults = true;
+			else if (std::strcmp(results, "table") != 0)
+				return luaL_error(luaState, "invalid results option '%s' (expected \"table\" or \"buffer\")", results);
+		}
+	}
+
+	{
+		auto error = std::string{};
+		if (runMap(luaState, numericResults, maxWorkers, intoIndex, error))
+			return 1; // Return 1 variable
+
+		// Copy the error to the lua stack, lua_error never returns so the string must be destroyed before raising it
+		lua_pushfstring(luaState, "parallel_map: %s", error.c_str());
+	}
+	return lua_error(luaState);
+}
+
+} // namespace parallel
+} // namespace luaRunner
@@ -0,0 +1,36 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <lua.hpp>
+
+namespace luaRunner
+{
+namespace parallel
+{
+
+/**
+* lua_CFunction implementing lrbi.parallel_map (see builtin.cpp for the lua parameters).
+* The worker pool is created on first call and attached to the lua_State, it is destroyed when the lua_State is closed.
+*/
+int map(lua_State* luaState);
+
+} // namespace parallel
+} // namespace luaRunner
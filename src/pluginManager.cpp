@@ -45,6 +45,7 @@ namespace plugin
 
 constexpr auto InitPluginEntryPointName = "InitPlugin";
 constexpr auto UninitPluginEntryPointName = "UninitPlugin";
+constexpr auto RegistryKey = "lrbi.pluginManager";
 
 class ManagerImpl final : public Manager
 {
@@ -56,7 +57,10 @@ public:
 	virtual void clearPluginSearchPaths() noexcept override;
 	virtual void addPluginSearchPaths(std::string const& path) noexcept override;
 	virtual LoadResult loadPlugin(std::string const& pluginName) noexcept override;
+	virtual void uninitAllPlugins() noexcept override;
 	virtual void unloadAllPlugins() noexcept override;
+	virtual PluginSearchPaths getPluginSearchPaths() const noexcept override;
+	virtual PluginNames getLoadedPluginNames() const noexcept override;
 
 	/** Destroy method for COM-like interface */
 	virtual void destroy() noexcept override;
@@ -68,18 +72,22 @@ private:
 	// Private methods
 
 	// Private members
-	using PluginSearchPaths = std::vector<std::string>;
 	using LoadedPlugins = std::vector<DL_HANDLE>;
 
 	lua_State* _state{ nullptr };
 	PluginSearchPaths _searchPaths{};
 	LoadedPlugins _loadedPlugins{};
+	PluginNames _loadedPluginNames{};
+	std::size_t _uninitializedPlugins{ 0u };
 };
 
 // Constructor
 ManagerImpl::ManagerImpl(lua_State* luaState) noexcept
 	: _state(luaState)
 {
+	// Attach ourself to the lua_State
+	lua_pushlightuserdata(luaState, this);
+	lua_setfield(luaState, LUA_REGISTRYINDEX, RegistryKey);
 }
 
 // Destructor
@@ -145,6 +153,9 @@ Manager::LoadResult ManagerImpl::loadPlugin(std::string const& pluginName) noexc
 			{
 				return { false, "InitPlugin entry point returned an error." };
 			}
+			// Keep track of the plugin so UninitPlugin gets called when unloading
+			_loadedPlugins.push_back(handle);
+			_loadedPluginNames.push_back(pluginName);
 			return { true, "" };
 		}
 	}
@@ -152,15 +163,35 @@ Manager::LoadResult ManagerImpl::loadPlugin(std::string const& pluginName) noexc
 	return { false, "Plugin '" + pluginName + "' not found in specified search paths (" + name + ")." };
 }
 
+void ManagerImpl::uninitAllPlugins() noexcept
+{
+	for (; _uninitializedPlugins < _loadedPlugins.size(); ++_uninitializedPlugins)
+	{
+		UninitPluginFunc uninitFunc = reinterpret_cast<UninitPluginFunc>(DL_SYM(_loadedPlugins[_uninitializedPlugins], UninitPluginEntryPointName));
+		uninitFunc(_state);
+	}
+}
+
 void ManagerImpl::unloadAllPlugins() noexcept
 {
+	uninitAllPlugins();
 	for (auto const handle : _loadedPlugins)
 	{
-		UninitPluginFunc uninitFunc = reinterpret_cast<UninitPluginFunc>(DL_SYM(handle, UninitPluginEntryPointName));
-		uninitFunc(_state);
 		DL_CLOSE(handle);
 	}
 	_loadedPlugins.clear();
+	_uninitializedPlugins = 0u;
+	_loadedPluginNames.clear();
+}
+
+Manager::PluginSearchPaths ManagerImpl::getPluginSearchPaths() const noexcept
+{
+	return _searchPaths;
+}
+
+Manager::PluginNames ManagerImpl::getLoadedPluginNames() const noexcept
+{
+	return _loadedPluginNames;
 }
 
 // Private methods
@@ -177,5 +208,13 @@ Manager* Manager::createRawManager(lua_State* luaState)
 	return new ManagerImpl(luaState);
 }
 
+Manager* Manager::get(lua_State* luaState) noexcept
+{
+	lua_getfield(luaState, LUA_REGISTRYINDEX, RegistryKey);
+	auto* const manager = static_cast<Manager*>(lua_touserdata(luaState, -1));
+	lua_pop(luaState, 1);
+	return manager;
+}
+
 } // namespace plugin
 } // namespace luaRunner
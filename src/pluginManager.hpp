@@ -35,10 +35,12 @@ class Manager
 public:
 	using UniquePointer = std::unique_ptr<Manager, void(*)(Manager*)>;
 	using LoadResult = std::tuple<bool, std::string>;
+	using PluginSearchPaths = std::vector<std::string>;
+	using PluginNames = std::vector<std::string>;
 
 	/**
 	* @brief Factory method to create a new Manager.
-	* @details Creates a new Manager as a unique pointer.
+	* @details Creates a new Manager as a unique pointer, and attaches it to the specified lua_State (see 'get').
 	* @param[in] luaState A valid lua_State.
 	* @return A new Manager as a Manager::UniquePointer.
 	*/
@@ -51,14 +53,26 @@ public:
 		return UniquePointer(createRawManager(luaState), deleter);
 	}
 
+	/** Returns the Manager attached to the specified lua_State, nullptr if none. */
+	static Manager* get(lua_State* luaState) noexcept;
+
 	virtual void clearPluginSearchPaths() noexcept = 0;
 	virtual void addPluginSearchPaths(std::string const& path) noexcept = 0;
 
 	/** Result, ErrorString (if Result != Success) */
 	virtual LoadResult loadPlugin(std::string const& pluginName) noexcept = 0;
 
+	/** Calls the UninitPlugin entry point of all the loaded plugins, without unloading them (the lua_State can still call their functions until it is closed). */
+	virtual void uninitAllPlugins() noexcept = 0;
+
+	/** Uninitializes (if not done yet) and unloads all the loaded plugins. Must be called after the lua_State has been closed if it was ever used. */
 	virtual void unloadAllPlugins() noexcept = 0;
 
+	virtual PluginSearchPaths getPluginSearchPaths() const noexcept = 0;
+
+	/** Returns the names of the loaded plugins, in loading order. */
+	virtual PluginNames getLoadedPluginNames() const noexcept = 0;
+
 	// Deleted compiler auto-generated methods
 	Manager(Manager&&) = delete;
 	Manager(Manager const&) = delete;
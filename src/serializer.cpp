@@ -0,0 +1,470 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "serializer.hpp"
+#include "bufferView.hpp"
+#include <cstring>
+#include <climits>
+#include <algorithm>
+
+namespace luaRunner
+{
+namespace serializer
+{
+
+constexpr auto MaxDepth = 200;
+
+static void writeVarint(std::string& buffer, std::uint64_t value)
+{
+	while (value >= 0x80u)
+	{
+		buffer.push_back(static_cast<char>((value & 0x7Fu) | 0x80u));
+		value >>= 7;
+	}
+	buffer.push_back(static_cast<char>(value));
+}
+
+static bool readVarint(char const*& cursor, char const* const end, std::uint64_t& value) noexcept
+{
+	value = 0u;
+	for (auto shift = 0u; shift < 64u; shift += 7u)
+	{
+		if (cursor == end)
+			return false;
+		auto const byte = static_cast<std::uint8_t>(*cursor++);
+		value |= static_cast<std::uint64_t>(byte & 0x7Fu) << shift;
+		if ((byte & 0x80u) == 0u)
+			return true;
+	}
+	return false;
+}
+
+template<typename T>
+static void writeRaw(std::string& buffer, T const value)
+{
+	buffer.append(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+
+template<typename T>
+static bool readRaw(char const*& cursor, char const* const end, T& value) noexcept
+{
+	if (static_cast<std::size_t>(end - cursor) < sizeof(value))
+		return false;
+	std::memcpy(&value, cursor, sizeof(value));
+	cursor += sizeof(value);
+	return true;
+}
+
+/* ************************************************************ */
+/* Writer                                                       */
+/* ************************************************************ */
+Writer::Writer(std::string& buffer, std::uint32_t const valuesCount)
+	: _buffer(buffer)
+{
+	_buffer.push_back(static_cast<char>(FormatVersion));
+	writeVarint(_buffer, valuesCount);
+}
+
+void Writer::writeNil()
+{
+	_buffer.push_back(static_cast<char>(Type::Nil));
+}
+
+void Writer::writeBoolean(bool const value)
+{
+	_buffer.push_back(static_cast<char>(value ? Type::True : Type::False));
+}
+
+void Writer::writeInteger(std::int64_t const value)
+{
+	_buffer.push_back(static_cast<char>(Type::Integer));
+	// Zigzag encoding, so small negative values are small too
+	writeVarint(_buffer, (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+}
+
+void Writer::writeNumber(double const value)
+{
+	_buffer.push_back(static_cast<char>(Type::Number));
+	writeRaw(_buffer, value);
+}
+
+void Writer::writeString(char const* const data, std::size_t const length)
+{
+	_buffer.push_back(static_cast<char>(Type::String));
+	writeVarint(_buffer, length);
+	_buffer.append(data, length);
+}
+
+void Writer::writeString(std::string const& value)
+{
+	writeString(value.data(), value.size());
+}
+
+std::uint64_t Writer::beginTable(std::uint64_t const arrayCount, std::uint32_t const hashCount)
+{
+	_tablePositions.push_back(_buffer.size());
+	_buffer.push_back(static_cast<char>(Type::Table));
+	writeVarint(_buffer, arrayCount);
+	writeRaw(_buffer, hashCount);
+	return _tablePositions.size() - 1u;
+}
+
+void Writer::patchHashCount(std::uint64_t const tableIndex, std::uint32_t const hashCount) noexcept
+{
+	// Skip the tag and the array count
+	auto position = _tablePositions[static_cast<std::size_t>(tableIndex)] + 1u;
+	while ((static_cast<std::uint8_t>(_buffer[position]) & 0x80u) != 0u)
+		++position;
+	std::memcpy(&_buffer[position + 1u], &hashCount, sizeof(hashCount));
+}
+
+void Writer::writeReference(std::uint64_t const tableIndex)
+{
+	_buffer[_tablePositions[static_cast<std::size_t>(tableIndex)]] = static_cast<char>(Type::SharedTable);
+	_buffer.push_back(static_cast<char>(Type::Reference));
+	writeVarint(_buffer, tableIndex);
+}
+
+/* ************************************************************ */
+/* Reader                                                       */
+/* ************************************************************ */
+Reader::Reader(char const* const data, std::size_t const size) noexcept
+	: _cursor(data)
+	, _end(data + size)
+{
+	auto valuesCount = std::uint64_t{ 0u };
+	_valid = _cursor != _end && static_cast<std::uint8_t>(*_cursor++) == FormatVersion && readVarint(_cursor, _end, valuesCount) && valuesCount <= UINT32_MAX;
+	_valuesCount = static_cast<std::uint32_t>(valuesCount);
+}
+
+bool Reader::next(Token& token) noexcept
+{
+	if (!_valid || _cursor == _end)
+		return false;
+
+	token.type = static_cast<Type>(*_cursor++);
+	switch (token.type)
+	{
+		case Type::Nil:
+		case Type::False:
+		case Type::True:
+			return true;
+		case Type::Integer:
+		{
+			auto value = std::uint64_t{ 0u };
+			_valid = readVarint(_cursor, _end, value);
+			token.integer = static_cast<std::int64_t>((value >> 1) ^ (~(value & 1u) + 1u));
+			return _valid;
+		}
+		case Type::Number:
+			_valid = readRaw(_cursor, _end, token.number);
+			return _valid;
+		case Type::String:
+		{
+			auto length = std::uint64_t{ 0u };
+			_valid = readVarint(_cursor, _end, length) && length <= static_cast<std::uint64_t>(_end - _cursor);
+			if (!_valid)
+				return false;
+			token.string = _cursor;
+			token.length = static_cast<std::size_t>(length);
+			_cursor += length;
+			return true;
+		}
+		case Type::SharedTable:
+			token.type = Type::Table;
+			token.shared = true;
+			// Each value takes at least one byte, reject counts the remaining data cannot hold
+			_valid = readVarint(_cursor, _end, token.arrayCount) && readRaw(_cursor, _end, token.hashCount) && token.arrayCount <= static_cast<std::uint64_t>(_end - _cursor) && token.hashCount <= static_cast<std::uint64_t>(_end - _cursor);
+			return _valid;
+		case Type::Table:
+			token.shared = false;
+			// Each value takes at least one byte, reject counts the remaining data cannot hold
+			_valid = readVarint(_cursor, _end, token.arrayCount) && readRaw(_cursor, _end, token.hashCount) && token.arrayCount <= static_cast<std::uint64_t>(_end - _cursor) && token.hashCount <= static_cast<std::uint64_t>(_end - _cursor);
+			return _valid;
+		case Type::Reference:
+			_valid = readVarint(_cursor, _end, token.reference);
+			return _valid;
+		default:
+			_valid = false;
+			return false;
+	}
+}
+
+/* ************************************************************ */
+/* LuaWriter                                                    */
+/* ************************************************************ */
+LuaWriter::LuaWriter(std::string& buffer, std::uint32_t const valuesCount)
+	: _writer(buffer, valuesCount)
+{
+}
+
+bool LuaWriter::write(lua_State* luaState, int const index, std::string& error)
+{
+	return writeValue(luaState, lua_absindex(luaState, index), error, 0);
+}
+
+bool LuaWriter::writeValue(lua_State* luaState, int const index, std::string& error, int const depth)
+{
+	switch (lua_type(luaState, index))
+	{
+		case LUA_TNIL:
+			_writer.writeNil();
+			return true;
+		case LUA_TBOOLEAN:
+			_writer.writeBoolean(lua_toboolean(luaState, index) != 0);
+			return true;
+		case LUA_TNUMBER:
+			if (lua_isinteger(luaState, index))
+				_writer.writeInteger(static_cast<std::int64_t>(lua_tointeger(luaState, index)));
+			else
+				_writer.writeNumber(static_cast<double>(lua_tonumber(luaState, index)));
+			return true;
+		case LUA_TSTRING:
+		{
+			auto length = std::size_t{ 0u };
+			auto const* const data = lua_tolstring(luaState, index, &length);
+			_writer.writeString(data, length);
+			return true;
+		}
+		case LUA_TUSERDATA:
+		{
+			auto const* const view = builtin::bufferView::test(luaState, index);
+			if (view == nullptr)
+				break;
+			_writer.writeString(view->data, view->size);
+			return true;
+		}
+		case LUA_TTABLE:
+		{
+			// Already written table (shared or cyclic), write a reference to it
+			auto* const entry = findTable(lua_topointer(luaState, index));
+			if (entry != nullptr && entry->table != nullptr)
+			{
+				_writer.writeReference(entry->index);
+				return true;
+			}
+
+			if (depth >= MaxDepth)
+			{
+				error = "table nesting too deep";
+				return false;
+			}
+			if (!lua_checkstack(luaState, 3))
+			{
+				error = "stack overflow";
+				return false;
+			}
+
+			auto const arrayCount = static_cast<lua_Integer>(lua_rawlen(luaState, index));
+			// The hash count is only known after enumeration, patch it afterwards
+			auto const tableIndex = _writer.beginTable(static_cast<std::uint64_t>(arrayCount), 0u);
+			insertTable(entry, lua_topointer(luaState, index), tableIndex);
+
+			for (auto i = lua_Integer{ 1 }; i <= arrayCount; ++i)
+			{
+				lua_rawgeti(luaState, index, i);
+				auto const success = writeValue(luaState, lua_gettop(luaState), error, depth + 1);
+				lua_pop(luaState, 1);
+				if (!success)
+					return false;
+			}
+
+			auto hashCount = std::uint32_t{ 0u };
+			lua_pushnil(luaState);
+			while (lua_next(luaState, index) != 0)
+			{
+				// Skip values already written in the array part
+				if (lua_isinteger(luaState, -2))
+				{
+					auto const key = lua_tointeger(luaState, -2);
+					if (key >= 1 && key <= arrayCount)
+					{
+						lua_pop(luaState, 1);
+						continue;
+					}
+				}
+				auto const top = lua_gettop(luaState);
+				if (!writeValue(luaState, top - 1, error, depth + 1) || !writeValue(luaState, top, error, depth + 1))
+				{
+					lua_pop(luaState, 2);
+					return false;
+				}
+				++hashCount;
+				lua_pop(luaState, 1);
+			}
+			_writer.patchHashCount(tableIndex, hashCount);
+			return true;
+		}
+		default:
+			break;
+	}
+
+	error = std::string("cannot serialize a ") + luaL_typename(luaState, index);
+	return false;
+}
+
+/** Returns the entry of 'table', or the empty entry where it should be inserted. */
+LuaWriter::TableEntry* LuaWriter::findTable(void const* const table) noexcept
+{
+	if (_tables.empty())
+		return nullptr;
+	auto const mask = _tables.size() - 1u;
+	auto const hash = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(table) >> 4) * UINT64_C(0x9E3779B97F4A7C15);
+	auto slot = static_cast<std::size_t>(hash ^ (hash >> 32)) & mask;
+	while (_tables[slot].table != nullptr && _tables[slot].table != table)
+		slot = (slot + 1u) & mask;
+	return &_tables[slot];
+}
+
+void LuaWriter::insertTable(TableEntry* entry, void const* const table, std::uint64_t const tableIndex)
+{
+	// Keep the load factor under 50%, so probe sequences stay short
+	if (entry == nullptr || (_tablesCount + 1u) * 2u > _tables.size())
+	{
+		auto previous = std::vector<TableEntry>(std::max(_tables.size() * 2u, std::size_t{ 64u }));
+		previous.swap(_tables);
+		for (auto const& e : previous)
+		{
+			if (e.table != nullptr)
+				*findTable(e.table) = e;
+		}
+		entry = findTable(table);
+	}
+	*entry = TableEntry{ table, tableIndex };
+	++_tablesCount;
+}
+
+/* ************************************************************ */
+/* readMessage                                                  */
+/* ************************************************************ */
+namespace
+{
+struct LuaReadContext
+{
+	Reader& reader;
+	int base{ 0 }; /**< Stack top before reading */
+	int refsIndex{ 0 }; /**< Stack index of the table of shared tables (0 until the first one is read) */
+	lua_Integer tablesCount{ 0 };
+};
+} // namespace
+
+static bool readValue(lua_State* luaState, LuaReadContext& context, int const depth) noexcept
+{
+	auto token = Token{};
+	if (depth >= MaxDepth || !lua_checkstack(luaState, 4) || !context.reader.next(token))
+		return false;
+
+	switch (token.type)
+	{
+		case Type::Nil:
+			lua_pushnil(luaState);
+			return true;
+		case Type::False:
+			lua_pushboolean(luaState, 0);
+			return true;
+		case Type::True:
+			lua_pushboolean(luaState, 1);
+			return true;
+		case Type::Integer:
+			lua_pushinteger(luaState, static_cast<lua_Integer>(token.integer));
+			return true;
+		case Type::Number:
+			lua_pushnumber(luaState, static_cast<lua_Number>(token.number));
+			return true;
+		case Type::String:
+			lua_pushlstring(luaState, token.string, token.length);
+			return true;
+		case Type::Table:
+		{
+			// Table is created with the exact sizes, so filling it never triggers a rehash
+			lua_createtable(luaState, token.arrayCount > INT_MAX ? 0 : static_cast<int>(token.arrayCount), token.hashCount > INT_MAX ? 0 : static_cast<int>(token.hashCount));
+			++context.tablesCount;
+			if (token.shared)
+			{
+				// First shared table of the message, create the table of shared tables below the values already pushed (it is anchored by the stack)
+				if (context.refsIndex == 0)
+				{
+					lua_newtable(luaState);
+					context.refsIndex = context.base + 1;
+					lua_insert(luaState, context.refsIndex);
+				}
+				// Register the table before reading its content, so cycles can reference it
+				lua_pushvalue(luaState, -1);
+				lua_rawseti(luaState, context.refsIndex, context.tablesCount);
+			}
+
+			for (auto i = std::uint64_t{ 1u }; i <= token.arrayCount; ++i)
+			{
+				if (!readValue(luaState, context, depth + 1))
+					return false;
+				lua_rawseti(luaState, -2, static_cast<lua_Integer>(i));
+			}
+			for (auto i = std::uint32_t{ 0u }; i < token.hashCount; ++i)
+			{
+				if (!readValue(luaState, context, depth + 1))
+					return false;
+				// nil and NaN keys would raise an error in lua_rawset
+				auto const invalidKey = lua_isnil(luaState, -1) || (lua_type(luaState, -1) == LUA_TNUMBER && lua_tonumber(luaState, -1) != lua_tonumber(luaState, -1));
+				if (invalidKey || !readValue(luaState, context, depth + 1))
+					return false;
+				lua_rawset(luaState, -3);
+			}
+			return true;
+		}
+		case Type::Reference:
+		{
+			if (context.refsIndex == 0 || token.reference >= static_cast<std::uint64_t>(context.tablesCount))
+				return false;
+			// Not a shared table
+			if (lua_rawgeti(luaState, context.refsIndex, static_cast<lua_Integer>(token.reference) + 1) != LUA_TTABLE)
+			{
+				lua_pop(luaState, 1);
+				return false;
+			}
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+int readMessage(lua_State* luaState, char const* const data, std::size_t const size) noexcept
+{
+	Reader reader{ data, size };
+	auto const valuesCount = reader.getValuesCount();
+	if (!reader.isValid() || valuesCount >= static_cast<std::uint32_t>(INT_MAX) || !lua_checkstack(luaState, static_cast<int>(valuesCount) + 1))
+		return -1;
+
+	auto context = LuaReadContext{ reader, lua_gettop(luaState), 0, 0 };
+	for (auto i = std::uint32_t{ 0u }; i < valuesCount; ++i)
+	{
+		if (!readValue(luaState, context, 0))
+		{
+			lua_settop(luaState, context.base);
+			return -1;
+		}
+	}
+
+	if (context.refsIndex != 0)
+		lua_remove(luaState, context.refsIndex);
+	return static_cast<int>(valuesCount);
+}
+
+} // namespace serializer
+} // namespace luaRunner
@@ -0,0 +1,74 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "luaRunner/serializer.hpp"
+#include <string>
+#include <cstddef>
+#include <vector>
+#include <lua.hpp>
+
+namespace luaRunner
+{
+namespace serializer
+{
+
+/**
+* Writes lua values as a message (see luaRunner/serializer.hpp).
+* Supported values are nil, booleans, numbers, strings (and views, written as strings) and tables of those, tables shared by several values of the message are only written once.
+*/
+class LuaWriter final
+{
+public:
+	/** Starts a message of 'valuesCount' values at the end of 'buffer'. */
+	LuaWriter(std::string& buffer, std::uint32_t const valuesCount);
+
+	/** Writes the value at stack 'index'. Returns false if the value cannot be serialized, 'error' is then set and the message is invalid. */
+	bool write(lua_State* luaState, int const index, std::string& error);
+
+	// Deleted compiler auto-generated methods
+	LuaWriter(LuaWriter&&) = delete;
+	LuaWriter(LuaWriter const&) = delete;
+	LuaWriter& operator=(LuaWriter const&) = delete;
+	LuaWriter& operator=(LuaWriter&&) = delete;
+
+private:
+	struct TableEntry
+	{
+		void const* table{ nullptr };
+		std::uint64_t index{ 0u };
+	};
+
+	// Private methods
+	bool writeValue(lua_State* luaState, int const index, std::string& error, int const depth);
+	TableEntry* findTable(void const* const table) noexcept;
+	void insertTable(TableEntry* entry, void const* const table, std::uint64_t const tableIndex);
+
+	// Private members
+	Writer _writer;
+	std::vector<TableEntry> _tables{}; /**< Open addressing hash table of the tables already written (and their index), much cheaper than a node based map for messages made of many small tables */
+	std::size_t _tablesCount{ 0u };
+};
+
+/** Pushes all the values of a message. Returns their count, or -1 (and pushes nothing) if the message is malformed. */
+int readMessage(lua_State* luaState, char const* const data, std::size_t const size) noexcept;
+
+} // namespace serializer
+} // namespace luaRunner
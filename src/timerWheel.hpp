@@ -0,0 +1,230 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+
+namespace luaRunner
+{
+namespace eventLoop
+{
+
+/**
+* Hierarchical timer wheel (4 levels of 256 slots), insertion and removal are O(1).
+* Timers are intrusive, the wheel never allocates nor owns them.
+* A timer is put in the lowest level able to hold its expiry, and moved down a level (cascaded) each time the level below wraps.
+*/
+class TimerWheel final
+{
+public:
+	using Tick = std::uint64_t;
+
+	struct Timer
+	{
+		Timer* prev{ nullptr };
+		Timer* next{ nullptr };
+		Tick expiry{ 0u };
+
+		bool isLinked() const noexcept
+		{
+			return prev != nullptr;
+		}
+	};
+
+	static constexpr Tick NoExpiry = std::numeric_limits<Tick>::max();
+
+	// Constructor
+	explicit TimerWheel(Tick const now) noexcept
+		: _nextTick(now)
+	{
+		for (auto& level : _slots)
+			for (auto& slot : level)
+				slot.prev = slot.next = &slot;
+	}
+
+	/** Adds a timer, its 'expiry' field must already be set. A timer already expired will fire during next 'advance' call. */
+	void add(Timer& timer) noexcept
+	{
+		link(slotFor(timer.expiry), timer);
+		++_count;
+	}
+
+	/** Removes a timer previously added. Does nothing if the timer is not linked. */
+	void remove(Timer& timer) noexcept
+	{
+		if (!timer.isLinked())
+			return;
+		unlink(timer);
+		--_count;
+	}
+
+	std::size_t size() const noexcept
+	{
+		return _count;
+	}
+
+	bool empty() const noexcept
+	{
+		return _count == 0u;
+	}
+
+	/** Processes all ticks up to 'now' (inclusive), calling 'onExpired(Timer&)' for each expired timer. The callback can add or remove timers. */
+	template<typename Callback>
+	void advance(Tick const now, Callback&& onExpired)
+	{
+		while (_nextTick <= now)
+		{
+			auto const index = static_cast<std::size_t>(_nextTick & SlotMask);
+
+			// Level 0 wrapped, cascade upper levels down
+			if (index == 0u)
+			{
+				for (auto level = 1u; level < Levels; ++level)
+				{
+					auto const levelIndex = static_cast<std::size_t>((_nextTick >> (level * SlotBits)) & SlotMask);
+					cascade(_slots[level][levelIndex]);
+					if (levelIndex != 0u)
+						break;
+				}
+			}
+
+			// Detach the expired slot first, so the callback can freely re-add timers
+			Timer expired;
+			expired.prev = expired.next = &expired;
+			splice(_slots[0][index], expired);
+			++_nextTick;
+
+			while (expired.next != &expired)
+			{
+				auto& timer = *expired.next;
+				unlink(timer);
+				--_count;
+				// Timers beyond the wheel range have been clamped, put them back if they are not due yet
+				if (timer.expiry >= _nextTick)
+				{
+					add(timer);
+					continue;
+				}
+				onExpired(timer);
+			}
+		}
+	}
+
+	/**
+	* Returns a tick at which 'advance' should be called next, NoExpiry if there is no timer.
+	* Only the lowest level is scanned, so when it is empty the returned tick is the next cascade point (never later than the actual expiry).
+	*/
+	Tick nextWakeupTick() const noexcept
+	{
+		if (_count == 0u)
+			return NoExpiry;
+
+		auto tick = _nextTick;
+		do
+		{
+			auto const& slot = _slots[0][static_cast<std::size_t>(tick & SlotMask)];
+			if (slot.next != &slot)
+				return tick;
+			++tick;
+		} while ((tick & SlotMask) != 0u);
+
+		return tick;
+	}
+
+	// Deleted compiler auto-generated methods
+	TimerWheel(TimerWheel&&) = delete;
+	TimerWheel(TimerWheel const&) = delete;
+	TimerWheel& operator=(TimerWheel const&) = delete;
+	TimerWheel& operator=(TimerWheel&&) = delete;
+
+private:
+	static constexpr unsigned int Levels = 4u;
+	static constexpr unsigned int SlotBits = 8u;
+	static constexpr std::size_t SlotsPerLevel = std::size_t(1u) << SlotBits;
+	static constexpr Tick SlotMask = SlotsPerLevel - 1u;
+	static constexpr Tick MaxDelta = (Tick(1u) << (Levels * SlotBits)) - 1u;
+
+	Timer& slotFor(Tick expiry) noexcept
+	{
+		// Already expired timers fire on next processed tick
+		if (expiry < _nextTick)
+			expiry = _nextTick;
+
+		auto const delta = expiry - _nextTick;
+		// Out of range timers are clamped to the last slot, they will be re-added when reached
+		if (delta > MaxDelta)
+			expiry = _nextTick + MaxDelta;
+
+		auto level = 0u;
+		while (level + 1u < Levels && (expiry - _nextTick) >= (Tick(1u) << ((level + 1u) * SlotBits)))
+			++level;
+		return _slots[level][static_cast<std::size_t>((expiry >> (level * SlotBits)) & SlotMask)];
+	}
+
+	void cascade(Timer& slot) noexcept
+	{
+		Timer pending;
+		pending.prev = pending.next = &pending;
+		splice(slot, pending);
+		while (pending.next != &pending)
+		{
+			auto& timer = *pending.next;
+			unlink(timer);
+			link(slotFor(timer.expiry), timer);
+		}
+	}
+
+	static void link(Timer& head, Timer& timer) noexcept
+	{
+		timer.prev = head.prev;
+		timer.next = &head;
+		head.prev->next = &timer;
+		head.prev = &timer;
+	}
+
+	static void unlink(Timer& timer) noexcept
+	{
+		timer.prev->next = timer.next;
+		timer.next->prev = timer.prev;
+		timer.prev = timer.next = nullptr;
+	}
+
+	/** Moves all timers from 'from' list to the (empty) 'to' list. */
+	static void splice(Timer& from, Timer& to) noexcept
+	{
+		if (from.next == &from)
+			return;
+		to.next = from.next;
+		to.prev = from.prev;
+		to.next->prev = &to;
+		to.prev->next = &to;
+		from.prev = from.next = &from;
+	}
+
+	// Private members
+	Tick _nextTick{ 0u };
+	std::size_t _count{ 0u };
+	Timer _slots[Levels][SlotsPerLevel];
+};
+
+} // namespace eventLoop
+} // namespace luaRunner
@@ -0,0 +1,383 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "luaRunner/value.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cassert>
+
+namespace luaRunner
+{
+namespace value
+{
+
+/* ************************************************************ */
+/* ValueBuilder                                                 */
+/* ************************************************************ */
+ValueBuilder::ValueBuilder(Values& values) noexcept
+	: _values(values)
+{
+}
+
+void ValueBuilder::beginValues(std::size_t const count)
+{
+	// Values are reserved before being added, so pointers to open tables stay valid
+	_values.reserve(_values.size() + count);
+}
+
+void ValueBuilder::endValues()
+{
+	assert(_openTables.empty() && "Unbalanced beginTable/endTable");
+}
+
+void ValueBuilder::visitNil()
+{
+	add();
+}
+
+void ValueBuilder::visitBoolean(bool const value)
+{
+	auto& v = add();
+	v.type = Value::Type::Boolean;
+	v.boolean = value;
+}
+
+void ValueBuilder::visitInteger(std::int64_t const value)
+{
+	auto& v = add();
+	v.type = Value::Type::Integer;
+	v.integer = value;
+}
+
+void ValueBuilder::visitNumber(double const value)
+{
+	auto& v = add();
+	v.type = Value::Type::Number;
+	v.number = value;
+}
+
+void ValueBuilder::visitString(char const* const data, std::size_t const length)
+{
+	auto& v = add();
+	v.type = Value::Type::String;
+	v.string.assign(data, length);
+}
+
+void ValueBuilder::beginTable(std::size_t const arrayCount, std::size_t const hashCount)
+{
+	auto& v = add();
+	v.type = Value::Type::Table;
+	v.array.reserve(arrayCount);
+	v.hash.reserve(hashCount);
+	_openTables.push_back(OpenTable{ &v, arrayCount, false });
+}
+
+void ValueBuilder::endTable()
+{
+	_openTables.pop_back();
+}
+
+void ValueBuilder::visitReference(std::size_t const tableIndex)
+{
+	auto& v = add();
+	v.type = Value::Type::Reference;
+	v.reference = tableIndex;
+}
+
+/** Returns the Value to fill for the next notified value. */
+Value& ValueBuilder::add()
+{
+	if (_openTables.empty())
+	{
+		_values.emplace_back();
+		return _values.back();
+	}
+
+	auto& openTable = _openTables.back();
+	auto& table = *openTable.table;
+	if (table.array.size() < openTable.arrayCount)
+	{
+		table.array.emplace_back();
+		return table.array.back();
+	}
+	if (!openTable.pendingKey)
+	{
+		openTable.pendingKey = true;
+		table.hash.emplace_back();
+		return table.hash.back().first;
+	}
+	openTable.pendingKey = false;
+	return table.hash.back().second;
+}
+
+/* ************************************************************ */
+/* JsonWriter                                                   */
+/* ************************************************************ */
+JsonWriter::JsonWriter(std::ostream& stream) noexcept
+	: _stream(stream)
+{
+}
+
+void JsonWriter::beginValues(std::size_t const /*count*/)
+{
+	_scopes.push_back(Scope{});
+	_stream << '[';
+}
+
+void JsonWriter::endValues()
+{
+	_scopes.pop_back();
+	_stream << ']';
+}
+
+void JsonWriter::visitNil()
+{
+	if (_ignoredDepth != 0u)
+		return;
+	prepare(); // nil is never a key
+	_stream << "null";
+}
+
+void JsonWriter::visitBoolean(bool const value)
+{
+	if (_ignoredDepth != 0u)
+		return;
+	if (prepare() == Role::Key)
+		_stream << (value ? "\"true\"" : "\"false\"");
+	else
+		_stream << (value ? "true" : "false");
+}
+
+void JsonWriter::visitInteger(std::int64_t const value)
+{
+	if (_ignoredDepth != 0u)
+		return;
+	if (prepare() == Role::Key)
+		_stream << '"' << value << '"';
+	else
+		_stream << value;
+}
+
+void JsonWriter::visitNumber(double const value)
+{
+	if (_ignoredDepth != 0u)
+		return;
+	auto const role = prepare();
+	// JSON has no representation for infinities and NaN
+	if (!std::isfinite(value))
+	{
+		_stream << (role == Role::Key ? "\"null\"" : "null");
+		return;
+	}
+	char number[32];
+	std::snprintf(number, sizeof(number), "%.17g", value);
+	if (role == Role::Key)
+		_stream << '"' << number << '"';
+	else
+		_stream << number;
+}
+
+void JsonWriter::visitString(char const* const data, std::size_t const length)
+{
+	if (_ignoredDepth != 0u)
+		return;
+	prepare();
+	writeEscaped(data, length);
+}
+
+void JsonWriter::beginTable(std::size_t const arrayCount, std::size_t const hashCount)
+{
+	if (_ignoredDepth != 0u)
+	{
+		++_ignoredDepth;
+		return;
+	}
+	if (prepare() == Role::Key)
+	{
+		_stream << "\"<table>\"";
+		_ignoredDepth = 1u;
+		return;
+	}
+
+	auto scope = Scope{};
+	scope.isObject = hashCount != 0u;
+	scope.arrayRemaining = scope.isObject ? arrayCount : 0u;
+	scope.expectingKey = scope.isObject && arrayCount == 0u;
+	_scopes.push_back(scope);
+	_stream << (scope.isObject ? '{' : '[');
+}
+
+void JsonWriter::endTable()
+{
+	if (_ignoredDepth != 0u)
+	{
+		--_ignoredDepth;
+		return;
+	}
+	_stream << (_scopes.back().isObject ? '}' : ']');
+	_scopes.pop_back();
+}
+
+void JsonWriter::visitReference(std::size_t const /*tableIndex*/)
+{
+	if (_ignoredDepth != 0u)
+		return;
+	if (prepare() == Role::Key)
+		_stream << "\"<table>\"";
+	else
+		_stream << "null";
+}
+
+JsonWriter::Role JsonWriter::prepare()
+{
+	auto& scope = _scopes.back();
+	auto const separate = [this, &scope]()
+	{
+		if (!scope.first)
+			_stream << ',';
+		scope.first = false;
+	};
+
+	if (!scope.isObject)
+	{
+		separate();
+		return Role::Value;
+	}
+	// Array part of an object, use the index as key
+	if (scope.arrayRemaining != 0u)
+	{
+		separate();
+		_stream << '"' << scope.nextIndex++ << "\":";
+		if (--scope.arrayRemaining == 0u)
+			scope.expectingKey = true;
+		return Role::Value;
+	}
+	if (scope.expectingKey)
+	{
+		separate();
+		scope.expectingKey = false;
+		return Role::Key;
+	}
+	_stream << ':';
+	scope.expectingKey = true;
+	return Role::Value;
+}
+
+void JsonWriter::writeEscaped(char const* const data, std::size_t const length)
+{
+	static char const HexDigits[] = "0123456789abcdef";
+
+	_stream << '"';
+	auto const* runStart = data;
+	auto const* const end = data + length;
+	for (auto const* c = data; c != end; ++c)
+	{
+		auto const uc = static_cast<unsigned char>(*c);
+		if (uc >= 0x20u && uc != '"' && uc != '\\')
+			continue;
+
+		// Flush the run of characters not needing escaping
+		_stream.write(runStart, c - runStart);
+		runStart = c + 1;
+		switch (uc)
+		{
+			case '"':
+				_stream << "\\\"";
+				break;
+			case '\\':
+				_stream << "\\\\";
+				break;
+			case '\n':
+				_stream << "\\n";
+				break;
+			case '\r':
+				_stream << "\\r";
+				break;
+			case '\t':
+				_stream << "\\t";
+				break;
+			default:
+				_stream << "\\u00" << HexDigits[uc >> 4] << HexDigits[uc & 0x0Fu];
+				break;
+		}
+	}
+	_stream.write(runStart, end - runStart);
+	_stream << '"';
+}
+
+/* ************************************************************ */
+/* BinaryWriter                                                 */
+/* ************************************************************ */
+BinaryWriter::BinaryWriter(std::string& buffer) noexcept
+	: _buffer(buffer)
+{
+}
+
+void BinaryWriter::beginValues(std::size_t const count)
+{
+	_writer = std::make_unique<serializer::Writer>(_buffer, static_cast<std::uint32_t>(count));
+}
+
+void BinaryWriter::endValues()
+{
+	_writer.reset();
+}
+
+void BinaryWriter::visitNil()
+{
+	_writer->writeNil();
+}
+
+void BinaryWriter::visitBoolean(bool const value)
+{
+	_writer->writeBoolean(value);
+}
+
+void BinaryWriter::visitInteger(std::int64_t const value)
+{
+	_writer->writeInteger(value);
+}
+
+void BinaryWriter::visitNumber(double const value)
+{
+	_writer->writeNumber(value);
+}
+
+void BinaryWriter::visitString(char const* const data, std::size_t const length)
+{
+	_writer->writeString(data, length);
+}
+
+void BinaryWriter::beginTable(std::size_t const arrayCount, std::size_t const hashCount)
+{
+	_writer->beginTable(arrayCount, static_cast<std::uint32_t>(hashCount));
+}
+
+void BinaryWriter::endTable()
+{
+}
+
+void BinaryWriter::visitReference(std::size_t const tableIndex)
+{
+	// Both formats number tables in the same order
+	_writer->writeReference(tableIndex);
+}
+
+} // namespace value
+} // namespace luaRunner
@@ -0,0 +1,76 @@
+-- Ahead-of-time compiled module: the output must be the same with the AotSample plugin (compiled module) and without it
+-- (plugins/aotSample/aotSample.lua interpreted)
+--   tests/run.sh <LuaRunner> <same LuaRunner> -p AotSample
+
+-- Without the plugin, require finds the module source
+local testsFolder = debug.getinfo(1, "S").source:sub(2):match("^(.*)[/\\]") or "."
+package.path = testsFolder .. "/../plugins/aotSample/?.lua;" .. package.path
+
+local stats = require("aotSample")
+
+local function format(value)
+	if math.type(value) == "float" then
+		if value ~= value then
+			return "nan (float)" -- the sign of a NaN is not specified
+		end
+		return string.format("%.17g (float)", value)
+	end
+	return tostring(value)
+end
+
+-- Error messages start with the chunk name, which is the module path given to luaRunner-aot for the compiled module
+local function message(text)
+	return (tostring(text):gsub("^.-([%w_]+%.lua:)", "%1"))
+end
+
+local function show(name, values)
+	local sum = table.pack(pcall(stats.sum, values))
+	local mean = table.pack(pcall(stats.mean, values))
+	local variance = table.pack(pcall(stats.variance, values))
+	print(name, "sum", sum[1], sum[1] and format(sum[2]) or message(sum[2]))
+	print(name, "mean", mean[1], mean[1] and format(mean[2]) or message(mean[2]))
+	print(name, "variance", variance[1], variance[1] and format(variance[2]) or message(variance[2]))
+end
+
+show("empty", {})
+show("one", { 42 })
+show("integers", { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 })
+show("floats", { 0.1, 0.2, 0.3, 1e-3, -2.5 })
+show("mixed", { 1, 2.5, -3, 4.25 })
+show("overflow", { math.maxinteger, 1 })
+show("strings", { "1", "2.5", 3 })
+show("invalid", { 1, {}, 3 })
+show("nan", { 1, 0 / 0 })
+
+local values = {}
+for i = 1, 1000 do
+	values[i] = (i * 7919) % 101 - 50
+end
+show("large", values)
+
+local function histogram(name, list, bucketSize)
+	local success, buckets = pcall(stats.histogram, list, bucketSize)
+	if not success then
+		print(name, "histogram", success, message(buckets))
+		return
+	end
+	local keys = {}
+	for key in pairs(buckets) do
+		keys[#keys + 1] = key
+	end
+	table.sort(keys)
+	local lines = {}
+	for _, key in ipairs(keys) do
+		lines[#lines + 1] = format(key) .. "=" .. buckets[key]
+	end
+	print(name, "histogram", table.concat(lines, " "))
+end
+histogram("integers", values, 10)
+histogram("floats", { 0.5, 1.5, 2.5, -0.5, 2.0 }, 1)
+histogram("float size", { 1, 2, 3, 4 }, 1.5)
+histogram("zero size", { 1, 2 }, 0)
+histogram("zero float size", { 1, 2 }, 0.0)
+
+-- Compiled functions go back to the interpreter for errors and metamethods
+local counted = setmetatable({}, { __len = function() return 3 end, __index = function(_, i) return (i <= 3) and i * 10 or nil end })
+show("metamethods", counted)
@@ -0,0 +1,137 @@
+-- Native code of hot functions: the output must be the same with and without --jit
+--   tests/run.sh <LuaRunner> <same LuaRunner> --jit
+
+-- Calls 'f' enough times for it to be compiled, with each argument list of 'cases', and prints the results of the last round
+local rounds = 200
+local function check(name, f, cases)
+	local results
+	for _ = 1, rounds do
+		results = {}
+		for c = 1, #cases do
+			results[c] = table.pack(pcall(f, table.unpack(cases[c], 1, cases[c].n or #cases[c])))
+		end
+	end
+	for c = 1, #results do
+		local r = results[c]
+		local values = {}
+		for v = 2, r.n do
+			local value = r[v]
+			if value ~= value then
+				value = "nan (float)" -- the sign of a NaN is not specified
+			elseif math.type(value) == "float" then
+				value = string.format("%.17g (float)", value)
+			elseif type(value) == "function" or type(value) == "table" then
+				value = type(value) -- addresses change between runs
+			end
+			values[#values + 1] = tostring(value)
+		end
+		print(name, c, r[1] and "ok" or "error", table.concat(values, " "))
+	end
+end
+
+local maxinteger, mininteger = math.maxinteger, math.mininteger
+local nan = 0 / 0
+
+-- Integer and float arithmetic
+check("add", function(a, b) return a + b, a - b, a * b end, {
+	{ 1, 2 }, { maxinteger, 1 }, { mininteger, -1 }, { 1.5, 2 }, { 3, 0.25 }, { 1e308, 1e308 }, { "10", 1 }, { nan, 1 } })
+check("div", function(a, b) return a / b, a // b, a % b end, {
+	{ 7, 2 }, { -7, 2 }, { 7, -2 }, { -7, -2 }, { 7.5, 2 }, { -7.5, 2 }, { 1, 0.0 }, { -1, 0.0 }, { 0, 0.0 },
+	{ 5.0, -0.0 }, { mininteger, -1 }, { 3, math.huge }, { -3, math.huge }, { 7, 0 } })
+check("pow", function(a, b) return a ^ b, -a, ~a end, { { 2, 10 }, { 2, 0.5 }, { -8, 1 / 3 }, { mininteger, 1 }, { 0, -1 } })
+check("bitwise", function(a, b) return a & b, a | b, a ~ b, a << b, a >> b end, {
+	{ 0xF0F0, 0x0FF0 }, { -1, 4 }, { 1, 63 }, { 1, 64 }, { 1, -1 }, { -1, 70 }, { 3.0, 1 }, { "12", 2 } })
+check("bitwise error", function(a, b) return a & b end, { { 1.5, 1 }, { 1, {} } })
+
+-- Comparisons and conditions
+check("compare", function(a, b)
+	return a < b, a <= b, a == b, a > b, a >= b, a ~= b
+end, { { 1, 2 }, { 2, 1 }, { 1, 1.0 }, { 1, 1.5 }, { nan, nan }, { nan, 1 }, { maxinteger, 2.0 ^ 63 },
+	{ mininteger, -2.0 ^ 63 }, { "a", "b" }, { "b", "a" }, { true, true } })
+check("compare error", function(a, b) return a < b end, { { 1, "1" }, { {}, {} } })
+check("conditions", function(a, b)
+	local x = a and b
+	local y = a or b
+	local z = not a
+	if a then
+		return x, y, z, "then"
+	end
+	return x, y, z, "else"
+end, { { nil, 1 }, { false, 2 }, { 0, 3 }, { "", nil }, { true, false } })
+
+-- Numeric for loops
+check("for", function(first, last, step)
+	local count, sum = 0, 0
+	for i = first, last, step do
+		count = count + 1
+		sum = sum + i
+	end
+	return count, sum
+end, { { 1, 100, 1 }, { 100, 1, -1 }, { 1, 0, 1 }, { 0, 1, 0.125 }, { 1.5, 10, 2 }, { 1, 3, 0 } })
+check("nested for", function(n)
+	local total = 0
+	for i = 1, n do
+		for j = i, n do
+			total = total + i * j
+		end
+	end
+	return total
+end, { { 0 }, { 1 }, { 30 } })
+
+-- Tables: array, paged and hash parts, string keys (inline caches), new keys and metamethods
+local array = {}
+for i = 1, 100 do
+	array[i] = i * i
+end
+local sparse = {}
+for i = 1, 3000, 7 do
+	sparse[i] = i
+end
+local record = { x = 1, y = 2.5, name = "record" }
+check("get", function(t, k) return t[k] end, {
+	{ array, 1 }, { array, 100 }, { array, 101 }, { array, 0 }, { array, -1 }, { array, 2.0 }, { array, 2.5 },
+	{ sparse, 1 }, { sparse, 8 }, { sparse, 9 }, { sparse, 2941 }, { sparse, 5000 },
+	{ record, "x" }, { record, "name" }, { record, "missing" }, { "string", "len" } })
+check("fields", function(t) return t.x, t.y, t.name end, { { record }, { { x = "other" } }, { setmetatable({}, { __index = record }) } })
+check("index error", function(t) return t.x end, { { nil }, { 1 } })
+check("set", function(k, v)
+	local t = { 1, 2, 3, x = 1 }
+	t[k] = v
+	t.x = t.x + 1
+	local n = 0
+	for _ in pairs(t) do
+		n = n + 1
+	end
+	return t[k], t.x, n, #t
+end, { { 1, "one" }, { 4, 4 }, { 10, 10 }, { "y", true }, { 2, nil }, { 1.0, "float key" } })
+local log = {}
+local guarded = setmetatable({}, { __newindex = function(t, k, v) log[#log + 1] = k; rawset(t, k, v) end })
+check("newindex", function(k) guarded[k] = k; local v = guarded[k]; guarded[k] = nil; return v end, { { "a" }, { 1 } })
+print("newindex", #log)
+
+-- Upvalues, closures and methods
+local counter = 0
+check("upvalues", function(n)
+	counter = counter + n
+	return counter
+end, { { 1 }, { -1 }, { 0.5 } })
+local object = { value = 10 }
+function object:add(n)
+	self.value = self.value + n
+	return self.value
+end
+check("self", function(o, n) return o:add(n) end, { { object, 1 }, { object, -1 } })
+print("self", object.value)
+
+-- Hooks disable the native code while they are set
+local hookCount = 0
+debug.sethook(function() hookCount = hookCount + 1 end, "", 1000)
+check("hooked", function(n)
+	local sum = 0
+	for i = 1, n do
+		sum = sum + i
+	end
+	return sum
+end, { { 1000 } })
+debug.sethook()
+print("hooked", hookCount > 0)
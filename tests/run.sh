@@ -0,0 +1,39 @@
+#!/bin/bash
+# Runs the test scripts with the specified LuaRunner executable and options, and compares their output with a reference run
+# (an executable built without the tested cmake option, or the same one without the tested LuaRunner options)
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 <LuaRunner executable> <Reference LuaRunner executable> [LuaRunner options (eg. --jit)]"
+	exit 1
+fi
+
+luaRunner="$1"
+reference="$2"
+shift 2
+options=("$@")
+
+# Get absolute folder for this script
+selfFolderPath="`cd "${BASH_SOURCE[0]%/*}"; pwd -P`/" # Command to get the absolute path
+
+# Runner messages and errors are written to this file ('-r' keeps the standard output for the script output and returned values)
+errorsFile="$(mktemp)"
+trap 'rm -f "${errorsFile}"' EXIT
+
+failed=0
+for script in "${selfFolderPath}"*.lua; do
+	name="$(basename "${script}" .lua)"
+	# helloWorld needs the Dummy plugin
+	if [ "${name}" = "helloWorld" ]; then
+		continue
+	fi
+	expected="$("${reference}" -r json "${script}" 2>"${errorsFile}")" || { echo "ERROR: ${name} failed with the reference executable"; cat "${errorsFile}"; failed=1; continue; }
+	output="$("${luaRunner}" -r json "${options[@]}" "${script}" 2>"${errorsFile}")" || { echo "ERROR: ${name} failed"; cat "${errorsFile}"; failed=1; continue; }
+	if [ "${output}" != "${expected}" ]; then
+		echo "ERROR: ${name} output differs from the reference"
+		diff <(echo "${expected}") <(echo "${output}")
+		failed=1
+		continue
+	fi
+	printf "%-20s ok\n" "${name}"
+done
+exit ${failed}
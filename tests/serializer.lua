@@ -0,0 +1,145 @@
+-- lrbi.serialize and lrbi.deserialize round trips
+--   LuaRunner tests/serializer.lua
+
+local lrbi = lrbi
+
+-- Compares two values, tables deeply ('seen' maps the tables of 'a' to the tables of 'b', to check sharing and cycles)
+local function same(a, b, seen)
+	if type(a) ~= type(b) then
+		return false
+	end
+	if type(a) == "number" then
+		if math.type(a) ~= math.type(b) then
+			return false
+		end
+		if a ~= a then -- NaN
+			return b ~= b
+		end
+		-- 0.0 and -0.0 are equal, but not their inverses
+		return a == b and (a ~= 0 or 1 / a == 1 / b)
+	end
+	if type(a) ~= "table" then
+		return a == b
+	end
+	seen = seen or {}
+	if seen[a] ~= nil then
+		return seen[a] == b
+	end
+	seen[a] = b
+	local count = 0
+	for k, v in pairs(a) do
+		-- Table keys are other tables once deserialized, look for the matching one
+		local other = b[k]
+		if type(k) == "table" then
+			other = nil
+			for k2, v2 in pairs(b) do
+				if type(k2) == "table" and (seen[k] == k2 or (seen[k] == nil and same(k, k2, seen))) then
+					other = v2
+					break
+				end
+			end
+		end
+		if not same(v, other, seen) then
+			return false
+		end
+		count = count + 1
+	end
+	for _ in pairs(b) do
+		count = count - 1
+	end
+	return count == 0
+end
+
+local function roundTrip(name, ...)
+	local data = lrbi.serialize(...)
+	assert(type(data) == "string", name)
+	local count = select("#", ...)
+	local values = table.pack(lrbi.deserialize(data))
+	assert(values.n == count, name .. ": " .. values.n .. " values instead of " .. count)
+	for i = 1, count do
+		assert(same(select(i, ...), values[i]), name .. ": value " .. i .. " differs")
+	end
+	print(name .. ": " .. count .. " value(s)")
+	return table.unpack(values, 1, values.n)
+end
+
+-- Every value type
+roundTrip("nothing")
+roundTrip("nil", nil)
+roundTrip("booleans", true, false)
+roundTrip("integers", 0, 1, -1, 255, 65536, -65537, math.maxinteger, math.mininteger, 1 << 48, -(1 << 47))
+roundTrip("floats", 0.0, -0.0, 0.5, -2.75, 1e300, 5e-324, math.pi, math.huge, -math.huge, 0 / 0)
+roundTrip("strings", "", "a", "hello world", string.rep("long string ", 1000))
+roundTrip("nils in the middle", 1, nil, nil, "end", nil)
+
+-- Strings are byte arrays, including NULs
+local bytes = {}
+for i = 0, 255 do
+	bytes[#bytes + 1] = string.char(i)
+end
+local allBytes = table.concat(bytes)
+local nul, zero, binary = roundTrip("strings with NULs", "a\0b", "\0", allBytes)
+assert(#nul == 3 and nul:byte(2) == 0 and zero == "\0" and binary == allBytes)
+
+-- Integers and floats stay apart, even with the same value
+local i, f = roundTrip("integer and float", 3, 3.0)
+assert(math.type(i) == "integer" and math.type(f) == "float")
+local keys = roundTrip("integral float keys", { [1] = "a", [2.0] = "b", [2.5] = "c" })
+assert(keys[2] == "b" and keys[2.5] == "c")
+assert(math.type(roundTrip("2^53", 2.0 ^ 53)) == "float")
+
+-- Tables: arrays, holes, mixed keys and nesting
+roundTrip("empty table", {})
+roundTrip("array", { 1, 2, 3, "four", 5.5, true })
+roundTrip("array with holes", { 1, nil, 3, nil, nil, 6, [100] = 100 })
+roundTrip("record", { name = "record", count = 3, ratio = 0.25, enabled = false })
+roundTrip("mixed keys", { 10, 20, x = "x", [true] = "true", [-1] = "negative", [0] = "zero", [1.5] = "float" })
+roundTrip("nested", { a = { b = { c = { d = { "deep" } } } }, list = { { 1 }, { 2, { 3 } } } })
+roundTrip("table key", { [{ "key" }] = "value" })
+
+-- Shared tables are written once and stay shared
+local shared = { "shared" }
+local result = roundTrip("shared tables", { first = shared, second = shared, list = { shared, shared } })
+assert(result.first == result.second and result.list[1] == result.first and result.list[2] == result.first)
+local a, b = roundTrip("shared between values", shared, shared)
+assert(a == b)
+
+-- Cycles are supported
+local cycle = { name = "cycle" }
+cycle.self = cycle
+cycle.child = { parent = cycle }
+result = roundTrip("cycles", cycle)
+assert(result.self == result and result.child.parent == result)
+
+-- Views are written as strings
+local scriptPath = debug.getinfo(1, "S").source:sub(2)
+local view = lrbi.mmap(scriptPath)
+local file = assert(io.open(scriptPath, "rb"))
+local content = file:read("a")
+file:close()
+assert(lrbi.deserialize(lrbi.serialize(view)) == content)
+print("view: " .. #content .. " bytes")
+
+-- Rejected values
+local function rejected(name, ...)
+	local success, message = pcall(lrbi.serialize, ...)
+	assert(not success, name .. " should not be serialized")
+	print(name .. ": " .. message:gsub("^.-lrbi%.", "lrbi."))
+end
+rejected("function", print)
+rejected("lua function", function() end)
+rejected("nested function", { 1, { callback = function() end } })
+rejected("function key", { [print] = true })
+rejected("coroutine", coroutine.create(function() end))
+rejected("userdata", io.stdout)
+local deep = {}
+for _ = 1, 300 do
+	deep = { deep }
+end
+rejected("deep nesting", deep)
+
+-- Malformed data
+local data = lrbi.serialize({ 1, 2, 3 }, "text")
+assert(not pcall(lrbi.deserialize, data:sub(1, #data - 2)))
+assert(not pcall(lrbi.deserialize, "\255\255\255\255"))
+print("malformed data rejected")
@@ -0,0 +1,105 @@
+-- Fused opcode pairs (MOVE+MOVE, GETTABLE+GETTABLE, MUL+ADD, MUL+MUL): the output must not depend on LUARUNNER_LUA_SUPERINSTRUCTIONS
+--   tests/run.sh <LuaRunner built with the option> <LuaRunner built without it>
+
+-- MOVE+MOVE
+local function swap(a, b)
+	local x, y = b, a
+	return x, y
+end
+local function rotate(a, b, c)
+	a, b, c = b, c, a
+	return a, b, c
+end
+print("move", swap(1, "two"))
+print("move", rotate(1, 2.5, "three"))
+print("move", rotate(nil, false, nil))
+
+-- GETTABLE+GETTABLE, on tables and through __index metamethods (including lua functions and errors in either instruction)
+local grid = {}
+for row = 1, 4 do
+	grid[row] = {}
+	for column = 1, 4 do
+		grid[row][column] = row * 10 + column
+	end
+end
+local function cell(g, row, column)
+	local r = g[row]
+	local value = r[column]
+	return value
+end
+local function diagonal(g, n)
+	local sum = 0
+	for k = 1, n do
+		sum = sum + g[k][k]
+	end
+	return sum
+end
+print("gettable", cell(grid, 2, 3), diagonal(grid, 4))
+local proxy = setmetatable({}, { __index = function(_, row)
+	return setmetatable({}, { __index = function(_, column)
+		return row .. "x" .. column
+	end })
+end })
+print("gettable", cell(proxy, "a", "b"), proxy.left.right)
+local strings = { name = "value" }
+print("gettable", type(strings.name.len), ("abc").upper ~= nil)
+print("gettable", pcall(cell, grid, 5, 1))
+print("gettable", pcall(cell, { [1] = 1 }, 1, 1))
+print("gettable", pcall(function() return grid[1][2][3] end))
+
+-- MUL+ADD and MUL+MUL, with integers (wrapping), floats, string coercions and metamethods
+local function muladd(a, b, c)
+	return a * b + c
+end
+local function mulmul(a, b, c)
+	return a * b * c
+end
+local function polynomial(x)
+	return 3 * x * x + 2 * x + 1
+end
+print("muladd", muladd(6, 7, 8), muladd(0.5, 3, 1), muladd(2, 3, 0.5), muladd("2", "3", "4"))
+print("muladd", muladd(math.maxinteger, 2, 1), muladd(math.mininteger, -1, 0), muladd(1e308, 10, 1))
+print("mulmul", mulmul(2, 3, 4), mulmul(2, 3, 4.0), mulmul(-0.0, 1, 1), mulmul(1 << 40, 1 << 30, 2))
+print("polynomial", polynomial(2), polynomial(0.5), polynomial(-3), polynomial("10"))
+local vector = {}
+vector.__index = vector
+local function new(x, y)
+	return setmetatable({ x = x, y = y }, vector)
+end
+vector.__mul = function(a, b)
+	if type(a) == "number" then
+		return new(a * b.x, a * b.y)
+	end
+	return new(a.x * b, a.y * b)
+end
+vector.__add = function(a, b)
+	return new(a.x + b.x, a.y + b.y)
+end
+vector.__tostring = function(v)
+	return "(" .. v.x .. ", " .. v.y .. ")"
+end
+print("metamethods", tostring(muladd(new(1, 2), 3, new(10, 20))), tostring(mulmul(2, new(1, 2), 3)))
+print("errors", pcall(muladd, 1, 2, {}))
+print("errors", pcall(muladd, {}, 2, 3))
+print("errors", pcall(mulmul, 1, 2, "x"))
+
+-- Hooks see every instruction of the pairs
+local lines = {}
+local count = 0
+debug.sethook(function(event, line)
+	if event == "line" then
+		lines[#lines + 1] = line
+	else
+		count = count + 1
+	end
+end, "l", 1)
+local a, b = swap(1, 2)
+local m = muladd(a, b, polynomial(a))
+local g = grid[a][b]
+debug.sethook()
+print("hooks", #lines, count, m, g)
+print("hooks", table.concat(lines, " "))
+
+-- Dumped and reloaded functions
+local reloaded = load(string.dump(polynomial))
+print("dump", reloaded(7), reloaded(1.5))
@@ -0,0 +1,188 @@
+-- Table parts (array, paged and hash parts): the output must not depend on LUARUNNER_LUA_SWISS_TABLES
+--   tests/run.sh <LuaRunner built with the option> <LuaRunner built without it>
+-- Traversal orders differ between the hash part layouts, so traversals are sorted or summed before being printed
+
+local lrbi = lrbi
+
+-- Sorted description of the content of 't'
+local function describe(t)
+	local keys = {}
+	for k in pairs(t) do
+		keys[#keys + 1] = k
+	end
+	table.sort(keys, function(a, b)
+		if type(a) ~= type(b) then
+			return type(a) < type(b)
+		end
+		if type(a) == "number" or type(a) == "string" then
+			return a < b
+		end
+		return tostring(a) < tostring(b)
+	end)
+	local items = {}
+	for _, k in ipairs(keys) do
+		local key = (math.type(k) == "float") and string.format("%.17g", k) or (type(k) == "boolean" and tostring(k) or k)
+		items[#items + 1] = tostring(key) .. "=" .. tostring(t[k])
+	end
+	return #keys .. " keys: " .. table.concat(items, " ")
+end
+
+-- Key types, including integral floats (normalized to integers) and keys of the same hash bucket
+local mixed = { 1, 2, 3 }
+mixed.name = "mixed"
+mixed[string.rep("long key ", 10)] = "long"
+mixed[0] = "zero"
+mixed[-1] = "negative"
+mixed[2.0 ^ 53] = "big float"
+mixed[1.5] = "float"
+mixed[4.0] = "integral float"
+mixed[true] = "true"
+mixed[false] = "false"
+mixed[math.maxinteger] = "maxinteger"
+mixed[math.mininteger] = "mininteger"
+mixed[math.huge] = "huge"
+mixed[-math.huge] = "-huge"
+print("mixed", describe(mixed))
+print("mixed", mixed[4], mixed[4.0], math.type(next({ [3.0] = true })), #mixed)
+print("nan key", pcall(function() mixed[0 / 0] = 1 end))
+print("nil key", pcall(function() mixed[nil] = 1 end))
+print("nan lookup", mixed[0 / 0], rawget(mixed, 0 / 0))
+
+local collisions = {}
+for i = 0, 63 do
+	collisions[i * 1024] = i
+	collisions[i * 1024 + 0.5] = -i
+end
+local sum = 0
+for k, v in pairs(collisions) do
+	sum = sum + k * v
+end
+print("collisions", describe(collisions):sub(1, 60), sum)
+
+-- Table and function keys are compared by identity
+local objects = {}
+local keys = {}
+for i = 1, 100 do
+	keys[i] = (i % 2 == 0) and {} or function() return i end
+	objects[keys[i]] = i
+end
+local found = 0
+for i = 1, 100 do
+	if objects[keys[i]] == i then
+		found = found + 1
+	end
+end
+print("objects", found, objects[{}], objects[print])
+
+-- Inserting and removing keys: growth, removed entries and rehashes
+local churn = {}
+local live = 0
+for round = 1, 20 do
+	for i = 1, 500 do
+		local key = "key" .. ((round * 7919 + i * 104729) % 2000)
+		if churn[key] == nil then
+			live = live + 1
+		end
+		churn[key] = round
+	end
+	for i = 1, 300 do
+		local key = "key" .. ((round * 31 + i * 7) % 2000)
+		if churn[key] ~= nil then
+			live = live - 1
+		end
+		churn[key] = nil
+	end
+end
+local count, total = 0, 0
+for k, v in pairs(churn) do
+	count = count + 1
+	total = total + v + #k
+end
+print("churn", live, count, total)
+
+-- Removing keys while traversing
+local removing = {}
+for i = 1, 1000 do
+	removing["k" .. i] = i
+	removing[i * 3] = i
+end
+local visited = 0
+for k in pairs(removing) do
+	visited = visited + 1
+	removing[k] = nil
+end
+print("removing", visited, next(removing))
+
+-- Integer keys: sequences, keys with gaps and borders of proper sequences
+local sequence = {}
+for i = 1, 1000 do
+	sequence[#sequence + 1] = i
+end
+print("sequence", #sequence, sequence[1000], sequence[1001])
+table.remove(sequence, 1)
+table.insert(sequence, 1, "first")
+print("sequence", #sequence, sequence[1], sequence[2], sequence[1000])
+local gaps = {}
+for i = 1, 10000, 3 do
+	gaps[i] = i
+end
+local gapsSum = 0
+for k, v in pairs(gaps) do
+	gapsSum = gapsSum + k + v
+end
+print("gaps", gapsSum, gaps[1], gaps[2], gaps[9997], gaps[10000])
+for i = 1, 10000, 3 do
+	gaps[i + 1] = -i
+end
+gapsSum = 0
+for k, v in pairs(gaps) do
+	gapsSum = gapsSum + k + v
+end
+print("gaps", gapsSum, gaps[2], gaps[9998])
+local downwards = {}
+for i = 2000, 1, -1 do
+	downwards[i] = i
+end
+print("downwards", #downwards, downwards[1], downwards[2000])
+
+-- Presized and cleared tables
+local presized = lrbi.table_new(100, 100)
+for i = 1, 100 do
+	presized[i] = i
+	presized["k" .. i] = i
+end
+print("presized", describe(presized):sub(1, 40), #presized)
+lrbi.table_clear(presized)
+print("cleared", next(presized), #presized)
+for i = 1, 50 do
+	presized["k" .. i] = -i
+end
+print("refilled", describe(presized):sub(1, 40))
+
+-- Weak tables
+local weakKeys = setmetatable({}, { __mode = "k" })
+local weakValues = setmetatable({}, { __mode = "v" })
+local kept = {}
+for i = 1, 100 do
+	local object = {}
+	if i % 10 == 0 then
+		kept[#kept + 1] = object
+	end
+	weakKeys[object] = i
+	weakValues[i] = object
+	weakValues["s" .. i] = object
+end
+collectgarbage()
+collectgarbage()
+local weakKeysCount, weakValuesCount = 0, 0
+for _ in pairs(weakKeys) do
+	weakKeysCount = weakKeysCount + 1
+end
+for _ in pairs(weakValues) do
+	weakValuesCount = weakValuesCount + 1
+end
+print("weak", weakKeysCount, weakValuesCount, #kept)
+
+-- next errors
+print("next", pcall(next, {}, "missing"))
+print("next", pcall(next, { a = 1 }, "b"))
@@ -0,0 +1,109 @@
+-- Value representation: the output must not depend on LUARUNNER_LUA_NAN_BOXING (integers beyond 48 bits boxed, NaNs canonicalized)
+--   tests/run.sh <LuaRunner built with the option> <LuaRunner built without it>
+
+local function format(value)
+	if math.type(value) == "float" then
+		if value ~= value then
+			return "nan (float)" -- the sign of a NaN is not specified
+		end
+		return string.format("%.17g (float)", value)
+	end
+	return tostring(value)
+end
+
+local function show(name, ...)
+	local values = table.pack(...)
+	for i = 1, values.n do
+		values[i] = format(values[i])
+	end
+	print(name, table.concat(values, " "))
+end
+
+-- Integers around the 48 bits boundary
+local limits = { 0, 1, -1, (1 << 47) - 1, 1 << 47, -(1 << 47), -(1 << 47) - 1, (1 << 48) - 1, 1 << 48, -(1 << 48),
+	1 << 52, 1 << 53, (1 << 53) + 1, 1 << 62, math.maxinteger, math.mininteger }
+for _, value in ipairs(limits) do
+	show("integer", value, math.type(value), value + 1, value - 1, value * 2, -value, value // 3, value % 7, value >> 1, ~value,
+		value == value + 0.0, value < value + 1)
+end
+
+-- Arithmetic crossing the boundary both ways, and loops over it
+local x = (1 << 47) - 5
+local crossings = {}
+for i = 1, 10 do
+	x = x + 1
+	crossings[#crossings + 1] = x
+end
+for i = 1, 10 do
+	x = x - 1
+	crossings[#crossings + 1] = x
+end
+show("crossing", table.unpack(crossings))
+local loopSum, loopCount = 0, 0
+for i = (1 << 47) - 3, (1 << 47) + 3 do
+	loopSum = loopSum + i
+	loopCount = loopCount + 1
+end
+show("loop", loopSum, loopCount)
+for i = -(1 << 47) + 2, -(1 << 47) - 2, -1 do
+	loopSum = loopSum - i
+end
+show("loop", loopSum)
+
+-- Boxed integers as table keys and values, and garbage collected
+local keyed = {}
+for i = 1, 100 do
+	keyed[(1 << 50) + i] = (1 << 49) * i
+	keyed[i] = -(1 << 60) + i
+end
+collectgarbage()
+local keySum, valueSum, keyCount = 0, 0, 0
+for k, v in pairs(keyed) do
+	keySum = keySum + k
+	valueSum = valueSum + v
+	keyCount = keyCount + 1
+end
+show("keys", keyCount, keySum, valueSum, keyed[(1 << 50) + 50], keyed[(1 << 50) + 50.0], keyed[(1 << 50) + 101])
+local boxed = {}
+for i = 1, 10000 do
+	boxed[i % 100 + 1] = (1 << 55) + i
+	if i % 1000 == 0 then
+		collectgarbage("step")
+	end
+end
+show("boxed", boxed[1], boxed[100], #boxed)
+
+-- Floats: special values, NaN payloads (values that look like boxed values) and signed zeros
+local floats = { 0.0, -0.0, 1.5, -1.5, 1 / 0, -1 / 0, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308, 2.0 ^ 63, -2.0 ^ 63 }
+for _, value in ipairs(floats) do
+	show("float", value, math.type(value), 1 / value, value == value, math.tointeger(value))
+end
+local payloads = {
+	"\0\0\0\0\0\0\248\127", "\1\0\0\0\0\0\248\127", "\255\255\255\255\255\255\255\127", "\1\0\0\0\0\0\240\127",
+	"\0\0\0\0\0\0\248\255", "\255\255\255\255\255\255\255\255", "\0\0\0\0\0\0\252\255", "\0\0\0\0\0\0\254\255",
+	"\0\0\0\0\0\0\240\127", "\0\0\0\0\0\0\240\255" }
+for i, bytes in ipairs(payloads) do
+	local value = string.unpack("<d", bytes)
+	local t = { value }
+	show("payload " .. i, value, math.type(value), type(value), value == value, t[1] == t[1], math.type(t[1]), value + 1)
+end
+local nan = 0 / 0
+show("nan", nan ~= nan, math.type(nan), math.type(-nan), math.huge - math.huge ~= 0, math.max(nan, 1), math.min(1, 2, nan))
+
+-- Integer and float values stay apart
+show("kinds", 3 == 3.0, math.type(3), math.type(3.0), 1 << 53 == 2.0 ^ 53, (1 << 53) + 1 == 2.0 ^ 53 + 1,
+	math.maxinteger + 0.0 == 2.0 ^ 63, math.maxinteger < 2.0 ^ 63, math.mininteger == -2.0 ^ 63)
+show("conversions", math.tointeger(2.0 ^ 52), math.tointeger(2.0 ^ 63), math.floor(2.0 ^ 60), 7 // 2.0, ("0x7fffffffffffffff" + 0),
+	tonumber("281474976710656"), tonumber("1e15"), string.format("%d %x", 1 << 50, -(1 << 50)))
+show("strings", string.pack("<j", 1 << 50):byte(1, -1))
+show("unpack", string.unpack("<j", string.pack("<j", -(1 << 50) - 1)))
+
+-- Other value types
+local co = coroutine.create(function(a)
+	local b = coroutine.yield(a + (1 << 48))
+	return b * 2
+end)
+show("types", type(nil), type(true), type(false), type(""), type({}), type(print), type(co), type(io.stdout))
+show("coroutine", select(2, coroutine.resume(co, 1)), select(2, coroutine.resume(co, (1 << 50) + 0.5)))
+show("booleans", true == true, false == nil, not nil, not 0, (1 << 48) and "truthy")
+show("select", select("#", nil, nil), select(2, "a", 1 << 60, 3.5))
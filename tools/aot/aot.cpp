@@ -0,0 +1,564 @@
+/*
+* Copyright 2017, Christophe Calmejane
+
+* This file is part of LuaRunner.
+
+* LuaRunner is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* LuaRunner is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with LuaRunner.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+* @file aot.cpp
+* @author Christophe Calmejane
+* @brief Ahead-of-time compiler of lua scripts into LuaRunner plugins.
+*
+* Writes the C source of a plugin registering the script as a 'package.preload' module. The plugin embeds the
+* bytecode of the script (so constants, debug information and error messages are unchanged) and one C function per
+* prototype, attached to the loaded prototypes (see luaA_attach). Each instruction is translated into the code of its
+* interpreter handler, with resolved operands and direct jumps instead of the opcode dispatch (see laotgen.h).
+*/
+
+#include <lua.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+// Lua internals, to read the compiled prototypes
+extern "C"
+{
+#include <lstate.h>
+#include <lobject.h>
+#include <lopcodes.h>
+}
+
+void printHelp()
+{
+	std::cout << "luaRunner-aot usage:" << "\n";
+	std::cout << "  luaRunner-aot [Options] <lua script to compile> <C file to generate>" << "\n";
+	std::cout << "Options:" << "\n";
+	std::cout << "  -h -> Display this help and exit" << "\n";
+	std::cout << "  -n <Module name> -> Name of the module to require (file name of the script without extension by default)." << "\n";
+	std::cout << "The generated file is the source of a LuaRunner plugin (see lr_add_aot_plugin cmake function). Once the plugin is loaded, require(<Module name>) runs the compiled script." << "\n";
+}
+
+class Generator
+{
+public:
+	Generator(std::ostream& out) noexcept
+		: _out(out)
+	{
+	}
+
+	/** Writes the C functions of 'proto' and its children (depth-first order), returns the number of written functions. */
+	int writeFunctions(Proto const* const proto) noexcept
+	{
+		_protos.clear();
+		collectProtos(proto);
+		for (auto index = 0u; index < _protos.size(); ++index)
+			writeFunction(index, _protos[index]);
+		return static_cast<int>(_protos.size());
+	}
+
+	/** Writes the tables of functions and code sizes expected by luaA_attach. */
+	void writeTables() noexcept
+	{
+		_out << "static const luaA_Function aot_functions[] = {\n";
+		for (auto index = 0u; index < _protos.size(); ++index)
+			_out << "  aot_f" << index << ",\n";
+		_out << "};\n\n";
+		_out << "static const int aot_sizes[] = {\n";
+		for (auto const* const proto : _protos)
+			_out << "  " << proto->sizecode << ",\n";
+		_out << "};\n\n";
+	}
+
+private:
+	void collectProtos(Proto const* const proto) noexcept
+	{
+		_protos.push_back(proto);
+		for (auto i = 0; i < proto->sizep; ++i)
+			collectProtos(proto->p[i]);
+	}
+
+	static std::string label(int const pc) noexcept
+	{
+		return "aot_L" + std::to_string(pc);
+	}
+
+	static std::string reg(int const r) noexcept
+	{
+		return "base+" + std::to_string(r);
+	}
+
+	/** Constant or register operand, for table accesses and stores. */
+	static std::string rk(int const x) noexcept
+	{
+		if (ISK(x))
+			return "k+" + std::to_string(INDEXK(x));
+		return reg(x);
+	}
+
+	/** Raw access function to use for the key of operand 'x' (see laotgen.h). */
+	std::string getter(Proto const* const proto, int const x) const noexcept
+	{
+		if (ISK(x))
+		{
+			auto const* const key = &proto->k[INDEXK(x)];
+			if (ttisshrstring(key))
+				return "aot_getstr";
+			if (ttisinteger(key))
+				return "aot_getint";
+		}
+		return "aot_get";
+	}
+
+	/** True if the number constant 'index' of the current function can be written as a C literal. */
+	bool isNumberLiteral(Proto const* const proto, int const index) const noexcept
+	{
+		auto const* const value = &proto->k[index];
+#if defined(LUA_USE_NANBOXING)
+		// Boxed integers are objects, not literals
+		if (ttisinteger(value) && !nbfitsint(ivalue(value)))
+			return false;
+#endif
+		return ttisinteger(value) || (ttisfloat(value) && std::isfinite(fltvalue(value)));
+	}
+
+	/** Arithmetic and comparison operand: number constants are C literals the compiler can fold. */
+	std::string numberOperand(Proto const* const proto, int const x) noexcept
+	{
+		if (ISK(x) && isNumberLiteral(proto, INDEXK(x)))
+		{
+			_usedLiterals[INDEXK(x)] = true;
+			return "&aot_k" + std::to_string(_functionIndex) + "_" + std::to_string(INDEXK(x));
+		}
+		return rk(x);
+	}
+
+	void writeLiterals(Proto const* const proto) noexcept
+	{
+		for (auto index = 0; index < proto->sizek; ++index)
+		{
+			if (!_usedLiterals[index])
+				continue;
+			auto const* const value = &proto->k[index];
+			_out << "static const TValue aot_k" << _functionIndex << "_" << index << " = ";
+			char buffer[64];
+			if (ttisinteger(value))
+			{
+				if (ivalue(value) == LUA_MININTEGER)
+					_out << "aot_intk(LUA_MININTEGER);\n";
+				else
+					_out << "aot_intk(" << ivalue(value) << "LL);\n";
+			}
+			else
+			{
+				std::snprintf(buffer, sizeof(buffer), "%a", fltvalue(value));
+				_out << "aot_fltk(" << buffer << ");\n";
+			}
+		}
+	}
+
+	void writeFunction(unsigned int const index, Proto const* const proto) noexcept
+	{
+		std::ostringstream body;
+		_functionIndex = index;
+		_usedLiterals.assign(proto->sizek, false);
+
+		for (auto pc = 0; pc < proto->sizecode; ++pc)
+		{
+			auto const i = proto->code[pc];
+			auto const op = GET_BASEOPCODE(i);
+			if (op == OP_EXTRAARG)
+				continue;
+			body << " " << label(pc) << ":";
+			// TFORLOOP runs right after TFORCALL, without being fetched
+			if (!(op == OP_TFORLOOP && pc > 0 && GET_BASEOPCODE(proto->code[pc - 1]) == OP_TFORCALL))
+				body << " aot_fetch(" << pc << ");";
+			body << "  /* " << luaP_opnames[op] << " */\n  ";
+			writeInstruction(body, proto, pc);
+			body << "\n";
+		}
+
+		auto const& source = getstr(proto->source);
+		_out << "/* " << (source[0] == '@' || source[0] == '=' ? source + 1 : "?") << ":" << proto->linedefined << " */\n";
+		writeLiterals(proto);
+		_out << "static int aot_f" << index << " (lua_State *L, CallInfo *ci) {\n";
+		_out << "  aot_prologue;\n";
+		_out << "  switch (ci->u.l.savedpc - code) {\n";
+		for (auto pc = 0; pc < proto->sizecode; ++pc)
+		{
+			if (GET_BASEOPCODE(proto->code[pc]) != OP_EXTRAARG)
+				_out << "    aot_entry(" << pc << ")\n";
+		}
+		_out << "    default: return 0;\n";
+		_out << "  }\n";
+		_out << body.str();
+		_out << "}\n\n";
+	}
+
+	void writeJump(std::ostream& out, int const jumpArg, int const target) const noexcept
+	{
+		if (jumpArg != 0)
+			out << "aot_close(" << jumpArg << "); ";
+		out << "goto " << label(target) << ";";
+	}
+
+	/** Comparison followed by its jump instruction. */
+	void writeComparison(std::ostream& out, Proto const* const proto, int const pc, char const* const compare) noexcept
+	{
+		auto const i = proto->code[pc];
+		auto const jump = proto->code[pc + 1];
+		out << "{ int res_; " << compare << "(" << pc << ", " << numberOperand(proto, GETARG_B(i)) << ", " << numberOperand(proto, GETARG_C(i)) << ", res_); ";
+		out << "aot_cmp(res_, " << GETARG_A(i) << ", " << GETARG_A(jump) << ", " << label(pc + 2 + GETARG_sBx(jump)) << ", " << label(pc + 2) << "); }";
+	}
+
+	void writeArith(std::ostream& out, Proto const* const proto, int const pc, char const* const macro, char const* const args) noexcept
+	{
+		auto const i = proto->code[pc];
+		out << macro << "(" << pc << ", " << reg(GETARG_A(i)) << ", " << numberOperand(proto, GETARG_B(i)) << ", " << numberOperand(proto, GETARG_C(i)) << ", " << args << ");";
+	}
+
+	void writeInstruction(std::ostream& out, Proto const* const proto, int const pc) noexcept
+	{
+		auto const i = proto->code[pc];
+		auto const a = GETARG_A(i);
+		auto const b = GETARG_B(i);
+		auto const c = GETARG_C(i);
+		switch (GET_BASEOPCODE(i))
+		{
+			case OP_MOVE:
+				out << "setobjs2s(L, " << reg(a) << ", " << reg(b) << ");";
+				break;
+			case OP_LOADK:
+				out << "setobj2s(L, " << reg(a) << ", k+" << GETARG_Bx(i) << ");";
+				break;
+			case OP_LOADKX:
+				out << "setobj2s(L, " << reg(a) << ", k+" << GETARG_Ax(proto->code[pc + 1]) << "); goto " << label(pc + 2) << ";";
+				break;
+			case OP_LOADBOOL:
+				out << "setbvalue(" << reg(a) << ", " << b << ");";
+				if (c != 0)
+					out << " goto " << label(pc + 2) << ";";
+				break;
+			case OP_LOADNIL:
+				for (auto r = a; r <= a + b; ++r)
+					out << "setnilvalue(" << reg(r) << "); ";
+				break;
+			case OP_GETUPVAL:
+				out << "setobj2s(L, " << reg(a) << ", cl->upvals[" << b << "]->v);";
+				break;
+			case OP_GETTABUP:
+				out << "aot_gettable(" << pc << ", cl->upvals[" << b << "]->v, " << rk(c) << ", " << reg(a) << ", " << getter(proto, c) << ");";
+				break;
+			case OP_GETTABLE:
+				out << "aot_gettable(" << pc << ", " << reg(b) << ", " << rk(c) << ", " << reg(a) << ", " << getter(proto, c) << ");";
+				break;
+			case OP_SETTABUP:
+				out << "aot_settable(" << pc << ", cl->upvals[" << a << "]->v, " << rk(b) << ", " << rk(c) << ", " << getter(proto, b) << ");";
+				break;
+			case OP_SETUPVAL:
+				out << "{ UpVal *uv_ = cl->upvals[" << b << "]; setobj(L, uv_->v, " << reg(a) << "); luaC_upvalbarrier(L, uv_); }";
+				break;
+			case OP_SETTABLE:
+				out << "aot_settable(" << pc << ", " << reg(a) << ", " << rk(b) << ", " << rk(c) << ", " << getter(proto, b) << ");";
+				break;
+			case OP_NEWTABLE:
+				out << "{ Table *t_; aot_savepc(" << pc << "); t_ = luaH_new(L); sethvalue(L, " << reg(a) << ", t_); ";
+				if (b != 0 || c != 0)
+					out << "luaH_resize(L, t_, " << luaO_fb2int(b) << ", " << luaO_fb2int(c) << "); ";
+				out << "aot_checkGC(" << reg(a + 1) << "); }";
+				break;
+			case OP_SELF:
+				out << "{ StkId rb_ = " << reg(b) << "; setobjs2s(L, " << reg(a + 1) << ", rb_); aot_gettable(" << pc << ", rb_, " << rk(c) << ", " << reg(a) << ", " << getter(proto, c) << "); }";
+				break;
+			case OP_ADD:
+				writeArith(out, proto, pc, "aot_arith", "+, luai_numadd, TM_ADD");
+				break;
+			case OP_SUB:
+				writeArith(out, proto, pc, "aot_arith", "-, luai_numsub, TM_SUB");
+				break;
+			case OP_MUL:
+				writeArith(out, proto, pc, "aot_arith", "*, luai_nummul, TM_MUL");
+				break;
+			case OP_MOD:
+				writeArith(out, proto, pc, "aot_arithdiv", "aot_mod, aot_nummod, TM_MOD");
+				break;
+			case OP_POW:
+				writeArith(out, proto, pc, "aot_farith", "luai_numpow, TM_POW");
+				break;
+			case OP_DIV:
+				writeArith(out, proto, pc, "aot_farith", "luai_numdiv, TM_DIV");
+				break;
+			case OP_IDIV:
+				writeArith(out, proto, pc, "aot_arithdiv", "aot_div, luai_numidiv, TM_IDIV");
+				break;
+			case OP_BAND:
+				writeArith(out, proto, pc, "aot_bitwise", "intop(&, ib_, ic_), TM_BAND");
+				break;
+			case OP_BOR:
+				writeArith(out, proto, pc, "aot_bitwise", "intop(|, ib_, ic_), TM_BOR");
+				break;
+			case OP_BXOR:
+				writeArith(out, proto, pc, "aot_bitwise", "intop(^, ib_, ic_), TM_BXOR");
+				break;
+			case OP_SHL:
+				writeArith(out, proto, pc, "aot_bitwise", "luaV_shiftl(ib_, ic_), TM_SHL");
+				break;
+			case OP_SHR:
+				writeArith(out, proto, pc, "aot_bitwise", "luaV_shiftl(ib_, -ic_), TM_SHR");
+				break;
+			case OP_UNM:
+				out << "aot_unm(" << pc << ", " << reg(a) << ", " << reg(b) << ");";
+				break;
+			case OP_BNOT:
+				out << "aot_bnot(" << pc << ", " << reg(a) << ", " << reg(b) << ");";
+				break;
+			case OP_NOT:
+				out << "{ int res_ = l_isfalse(" << reg(b) << "); setbvalue(" << reg(a) << ", res_); }";
+				break;
+			case OP_LEN:
+				out << "aot_savepc(" << pc << "); aot_Protect(luaV_objlen(L, " << reg(a) << ", " << reg(b) << "));";
+				break;
+			case OP_CONCAT:
+				out << "aot_concat(" << pc << ", " << a << ", " << b << ", " << c << ");";
+				break;
+			case OP_JMP:
+				writeJump(out, a, pc + 1 + GETARG_sBx(i));
+				break;
+			case OP_EQ:
+				writeComparison(out, proto, pc, "aot_eq");
+				break;
+			case OP_LT:
+				writeComparison(out, proto, pc, "aot_lt");
+				break;
+			case OP_LE:
+				writeComparison(out, proto, pc, "aot_le");
+				break;
+			case OP_TEST:
+			{
+				auto const jump = proto->code[pc + 1];
+				out << "aot_cmp(!l_isfalse(" << reg(a) << "), " << c << ", " << GETARG_A(jump) << ", " << label(pc + 2 + GETARG_sBx(jump)) << ", " << label(pc + 2) << ");";
+				break;
+			}
+			case OP_TESTSET:
+			{
+				auto const jump = proto->code[pc + 1];
+				out << "if (!l_isfalse(" << reg(b) << ") != " << c << ") goto " << label(pc + 2) << "; ";
+				out << "setobjs2s(L, " << reg(a) << ", " << reg(b) << "); ";
+				writeJump(out, GETARG_A(jump), pc + 2 + GETARG_sBx(jump));
+				break;
+			}
+			case OP_CALL:
+				out << "aot_call(" << pc << ", " << reg(a) << ", " << b << ", " << c << ");";
+				break;
+			case OP_TAILCALL:
+			case OP_RETURN:
+				// Frame changes are left to the interpreter
+				out << "aot_exit(" << pc << ");";
+				break;
+			case OP_FORLOOP:
+				out << "aot_forloop(" << reg(a) << ", " << label(pc + 1 + GETARG_sBx(i)) << ");";
+				break;
+			case OP_FORPREP:
+				out << "aot_savepc(" << pc << "); luaV_forprep(L, " << reg(a) << "); goto " << label(pc + 1 + GETARG_sBx(i)) << ";";
+				break;
+			case OP_TFORCALL:
+				out << "aot_tforcall(" << pc << ", " << a << ", " << c << ");";
+				break;
+			case OP_TFORLOOP:
+				out << "if (!ttisnil(" << reg(a + 1) << ")) { setobjs2s(L, " << reg(a) << ", " << reg(a + 1) << "); goto " << label(pc + 1 + GETARG_sBx(i)) << "; }";
+				break;
+			case OP_SETLIST:
+				if (c == 0)
+					out << "aot_setlist(" << pc + 1 << ", " << reg(a) << ", " << b << ", " << GETARG_Ax(proto->code[pc + 1]) << "); goto " << label(pc + 2) << ";";
+				else
+					out << "aot_setlist(" << pc << ", " << reg(a) << ", " << b << ", " << c << ");";
+				break;
+			case OP_CLOSURE:
+				out << "aot_savepc(" << pc << "); luaV_closure(L, cl->p->p[" << GETARG_Bx(i) << "], cl->upvals, base, " << reg(a) << "); aot_checkGC(" << reg(a + 1) << ");";
+				break;
+			case OP_VARARG:
+				out << "aot_vararg(" << pc << ", " << a << ", " << b << ");";
+				break;
+			default:
+				// Not a base opcode, cannot happen
+				out << "aot_exit(" << pc << ");";
+				break;
+		}
+	}
+
+	// Private members
+	std::ostream& _out;
+	std::vector<Proto const*> _protos{};
+	unsigned int _functionIndex{ 0u };
+	std::vector<bool> _usedLiterals{};
+};
+
+static int writeChunk(lua_State* /*luaState*/, void const* p, size_t size, void* userData)
+{
+	auto& chunk = *static_cast<std::string*>(userData);
+	chunk.append(static_cast<char const*>(p), size);
+	return 0;
+}
+
+static std::string moduleNameFromPath(std::string const& path) noexcept
+{
+	auto name = path;
+	auto const slashPos = name.find_last_of("/\\");
+	if (slashPos != name.npos)
+		name = name.substr(slashPos + 1);
+	auto const dotPos = name.find_last_of('.');
+	if (dotPos != name.npos && dotPos != 0)
+		name = name.substr(0, dotPos);
+	return name;
+}
+
+/** Quoted C string literal of 'str'. */
+static std::string quoted(std::string const& str) noexcept
+{
+	std::string result{ "\"" };
+	for (auto const c : str)
+	{
+		if (c == '"' || c == '\\')
+			result += '\\';
+		result += c;
+	}
+	return result + "\"";
+}
+
+int main(int argc, char const* argv[])
+{
+	std::string moduleName{};
+	std::vector<std::string> files{};
+
+	// Parse arguments
+	decltype(argc) argPos{ 1 };
+	while (argPos < argc)
+	{
+		auto const arg = std::string(argv[argPos]);
+
+		if (arg == "-h")
+		{
+			printHelp();
+			return 0;
+		}
+		else if (arg == "-n")
+		{
+			// This option requires an additional argument
+			++argPos;
+			if (argPos >= argc)
+			{
+				std::cout << "Missing parameter for '-n' option." << "\n\n";
+				printHelp();
+				return 255;
+			}
+			moduleName = argv[argPos];
+		}
+		else if (arg.length() > 1 && arg[0] == '-')
+		{
+			std::cout << "Unknown option: " << arg << "\n\n";
+			printHelp();
+			return 255;
+		}
+		else
+		{
+			files.push_back(arg);
+		}
+		++argPos;
+	}
+
+	if (files.size() != 2)
+	{
+		printHelp();
+		return 255;
+	}
+	auto const& scriptPath = files[0];
+	auto const& outputPath = files[1];
+	if (moduleName.empty())
+		moduleName = moduleNameFromPath(scriptPath);
+
+	// Compile the script
+	auto* const luaState = luaL_newstate();
+	if (luaL_loadfile(luaState, scriptPath.c_str()) != LUA_OK)
+	{
+		std::cerr << "Failed to compile script: " << lua_tostring(luaState, -1) << "\n";
+		lua_close(luaState);
+		return 1;
+	}
+	std::string chunk{};
+	lua_dump(luaState, &writeChunk, &chunk, 0);
+	auto const* const closure = static_cast<LClosure const*>(lua_topointer(luaState, -1));
+
+	// Generate the plugin
+	std::ostringstream out;
+	out << "/* Generated by luaRunner-aot from " << scriptPath << ", do not edit */\n\n";
+	out << "#include <stdbool.h>\n\n";
+	out << "#include \"laotgen.h\"\n\n";
+	out << "#if defined(_WIN32)\n";
+	out << "#define AOT_EXPORT __declspec(dllexport)\n";
+	out << "#else\n";
+	out << "#define AOT_EXPORT __attribute__((visibility(\"default\")))\n";
+	out << "#endif\n\n";
+
+	Generator generator{ out };
+	auto const count = generator.writeFunctions(closure->p);
+	generator.writeTables();
+
+	out << "static const unsigned char aot_chunk[] = {";
+	for (auto i = 0u; i < chunk.size(); ++i)
+	{
+		if (i % 16 == 0)
+			out << "\n ";
+		out << " " << static_cast<unsigned int>(static_cast<unsigned char>(chunk[i])) << ",";
+	}
+	out << "\n};\n\n";
+
+	out << "/* loader of the module, called by 'require' */\n";
+	out << "static int aot_loader (lua_State *L) {\n";
+	out << "  if (luaL_loadbufferx(L, (const char *)aot_chunk, sizeof(aot_chunk), " << quoted("=" + moduleName) << ", \"b\") != LUA_OK)\n";
+	out << "    return lua_error(L);\n";
+	out << "  if (!luaA_attach(L, -1, aot_functions, aot_sizes, " << count << "))\n";
+	out << "    return luaL_error(L, \"compiled code of module '%s' does not match its bytecode\", " << quoted(moduleName) << ");\n";
+	out << "  lua_insert(L, 1);\n";
+	out << "  lua_call(L, lua_gettop(L) - 1, 1);\n";
+	out << "  return 1;\n";
+	out << "}\n\n";
+
+	out << "AOT_EXPORT bool InitPlugin (lua_State *L) {\n";
+	out << "  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);\n";
+	out << "  lua_pushcfunction(L, aot_loader);\n";
+	out << "  lua_setfield(L, -2, " << quoted(moduleName) << ");\n";
+	out << "  lua_pop(L, 1);\n";
+	out << "  return true;\n";
+	out << "}\n\n";
+	out << "AOT_EXPORT void UninitPlugin (lua_State *L) {\n";
+	out << "  UNUSED(L);\n";
+	out << "}\n";
+
+	lua_close(luaState);
+
+	std::ofstream file(outputPath, std::ios::binary);
+	file << out.str();
+	if (!file)
+	{
+		std::cerr << "Failed to write " << outputPath << "\n";
+		return 1;
+	}
+	return 0;
+}